@@ -54,6 +54,11 @@ public:
 
         struct VSync {
             uint32_t count;
+            // number of vsync events this connection didn't receive since
+            // the previous one it got (see setVsyncCoalescing())
+            uint32_t missed;
+            // predicted timestamp of the next hardware vsync, 0 if unknown
+            nsecs_t nextTimestamp __attribute__((aligned(8)));
         };
 
         struct Hotplug {
@@ -126,6 +131,15 @@ public:
      */
     status_t requestNextVsync();
 
+    /*
+     * setVsyncCoalescing() controls what happens when the client falls
+     * behind. When enabled, SurfaceFlinger doesn't queue a new Event::VSync
+     * while a previous event is still unread; the next delivered event is
+     * the latest one and VSync::missed tells how many were skipped. Disabled
+     * by default.
+     */
+    status_t setVsyncCoalescing(bool enabled);
+
 private:
     sp<IDisplayEventConnection> mEventConnection;
     sp<BitTube> mDataChannel;
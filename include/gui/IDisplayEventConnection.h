@@ -54,6 +54,12 @@ public:
      * if the vsync rate is > 0.
      */
     virtual void requestNextVsync() = 0;    // asynchronous
+
+    /*
+     * setVsyncCoalescing() enables or disables coalescing of the vsync
+     * events the client hasn't read yet into a single latest event.
+     */
+    virtual void setVsyncCoalescing(bool enabled) = 0;
 };
 
 // ----------------------------------------------------------------------------
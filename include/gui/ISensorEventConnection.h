@@ -29,6 +29,7 @@ namespace android {
 // ----------------------------------------------------------------------------
 
 class BitTube;
+class SensorEventRing;
 
 class ISensorEventConnection : public IInterface
 {
@@ -36,6 +37,9 @@ public:
     DECLARE_META_INTERFACE(SensorEventConnection);
 
     virtual sp<BitTube> getSensorChannel() const = 0;
+    // Returns the shared-memory event ring of this connection, or NULL if the
+    // connection was not created with SensorEventQueue::MODE_FLAG_SHARED_RING.
+    virtual sp<SensorEventRing> getSensorRing() const = 0;
     virtual status_t enableDisable(int handle, bool enabled, nsecs_t samplingPeriodNs,
                                    nsecs_t maxBatchReportLatencyNs, int reservedFlags) = 0;
     virtual status_t setEventRate(int handle, nsecs_t ns) = 0;
@@ -43,6 +43,7 @@ namespace android {
 
 class ISensorEventConnection;
 class Sensor;
+class SensorEventRing;
 class Looper;
 
 // ----------------------------------------------------------------------------
@@ -53,6 +54,12 @@ public:
 
     enum { MAX_RECEIVE_BUFFER_EVENT_COUNT = 256 };
 
+    // Or'ed into the mode passed to SensorManager::createEventQueue() to ask
+    // SensorService to deliver events through a shared-memory SensorEventRing
+    // instead of the BitTube. The queue silently falls back to the BitTube if
+    // the service can't provide a ring.
+    enum { MODE_FLAG_SHARED_RING = 0x100 };
+
     /**
      * Typical sensor delay (sample period) in microseconds.
      */
@@ -93,10 +100,16 @@ public:
     void sendAck(const ASensorEvent* events, int count);
 
     status_t injectSensorEvent(const ASensorEvent& event);
+
+    // Number of events SensorService dropped because this queue was not
+    // drained fast enough and its ring stayed full. Always 0 when the queue
+    // uses the BitTube.
+    uint32_t getOverflowCount() const;
 private:
     sp<Looper> getLooper() const;
     sp<ISensorEventConnection> mSensorEventConnection;
     sp<BitTube> mSensorChannel;
+    sp<SensorEventRing> mSensorRing;
     mutable Mutex mLock;
     mutable sp<Looper> mLooper;
     ASensorEvent* mRecBuffer;
@@ -0,0 +1,120 @@
+/*
+ * Copyright (C) 2016 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef ANDROID_GUI_SENSOR_EVENT_RING_H
+#define ANDROID_GUI_SENSOR_EVENT_RING_H
+
+#include <atomic>
+
+#include <stdint.h>
+#include <sys/types.h>
+
+#include <utils/Errors.h>
+#include <utils/RefBase.h>
+
+struct ASensorEvent;
+
+namespace android {
+// ----------------------------------------------------------------------------
+class Parcel;
+
+/*
+ * SensorEventRing is a single-producer / single-consumer ring of ASensorEvent
+ * living in an ashmem region shared between SensorService and a client.
+ *
+ * The service writes events in place and signals the data eventfd; the client
+ * polls that eventfd (see getFd()) and reads events straight out of the shared
+ * region, avoiding the socket copies done by BitTube. A write never overwrites
+ * unread events: when the ring is full it fails with WOULD_BLOCK and the
+ * consumer signals the space eventfd once it has drained the ring so the
+ * producer can retry. Events the producer gives up on are accounted in the
+ * overflow counter with addOverflow().
+ */
+class SensorEventRing : public RefBase
+{
+public:
+    // creates a ring holding at least minCapacity events (rounded up to a
+    // power of two)
+    explicit SensorEventRing(size_t minCapacity);
+
+    // maps a ring received from the producer side
+    explicit SensorEventRing(const Parcel& data);
+
+    virtual ~SensorEventRing();
+
+    // check state after construction
+    status_t initCheck() const;
+
+    // eventfd signaled by the producer whenever new events are available
+    int getFd() const;
+
+    // eventfd signaled by the consumer when it freed space for a blocked
+    // producer
+    int getSpaceFd() const;
+
+    size_t getCapacity() const;
+
+    // producer side: writes all events or none. Returns the number of events
+    // written or WOULD_BLOCK if they do not fit.
+    ssize_t write(ASensorEvent const* events, size_t count);
+
+    // consumer side: reads up to count events. Returns the number of events
+    // read, 0 if the ring is empty.
+    ssize_t read(ASensorEvent* events, size_t count);
+
+    // producer side: drains the space eventfd after a wake-up
+    void clearSpaceSignal() const;
+
+    // number of events the consumer has not read yet
+    size_t getPendingCount() const;
+
+    // producer side: accounts count events dropped because the ring stayed
+    // full
+    void addOverflow(size_t count);
+
+    // number of events dropped by the producer, see addOverflow()
+    uint32_t getOverflowCount() const;
+
+    // parcels this ring for the consumer
+    status_t writeToParcel(Parcel* reply) const;
+
+private:
+    struct Header {
+        std::atomic<uint32_t> writeCount;
+        std::atomic<uint32_t> readCount;
+        std::atomic<uint32_t> overflowCount;
+        std::atomic<uint32_t> producerWaiting;
+        uint32_t capacity;
+        uint32_t reserved[11];
+    };
+
+    static size_t getRegionSize(size_t capacity);
+    void unmap();
+
+    int mAshmemFd;
+    int mDataFd;
+    int mSpaceFd;
+    Header* mHeader;
+    ASensorEvent* mEvents;
+    size_t mCapacity;
+    size_t mMapSize;
+    status_t mStatus;
+};
+
+// ----------------------------------------------------------------------------
+}; // namespace android
+
+#endif // ANDROID_GUI_SENSOR_EVENT_RING_H
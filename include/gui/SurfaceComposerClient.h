@@ -244,6 +244,10 @@ public:
             uint32_t minLayerZ, uint32_t maxLayerZ,
             bool useIdentityTransform, uint32_t rotation);
 
+    // The screenshot is rendered in the default buffer format of the
+    // CpuConsumer when it is RGBX_8888 or RGB_565 and the GPU output can be
+    // locked by the CPU, e.g.:
+    //   getCpuConsumer()->setDefaultBufferFormat(HAL_PIXEL_FORMAT_RGB_565);
     sp<CpuConsumer> getCpuConsumer() const;
 
     // release memory occupied by the screenshot
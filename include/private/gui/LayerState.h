@@ -21,6 +21,7 @@
 #include <sys/types.h>
 
 #include <utils/Errors.h>
+#include <utils/Vector.h>
 
 #include <ui/Region.h>
 #include <ui/Rect.h>
@@ -78,6 +79,16 @@ struct layer_state_t {
     status_t    write(Parcel& output) const;
     status_t    read(const Parcel& input);
 
+    // Only the fields flagged in what are written, and read back. The other
+    // fields are left untouched by readChanges().
+    status_t    writeChanges(Parcel& output) const;
+    status_t    readChanges(const Parcel& input);
+
+    // Whether other makes the same changes, so that both can be sent once.
+    // Changes specific to a layer (transparent region, deferred
+    // transaction) never compare equal.
+    bool        hasSameChanges(const layer_state_t& other) const;
+
             struct matrix22_t {
                 float   dsdx;
                 float   dtdx;
@@ -116,6 +127,14 @@ struct ComposerState {
     layer_state_t state;
     status_t    write(Parcel& output) const;
     status_t    read(const Parcel& input);
+
+    // Writes a transaction, sending the layers that get the same changes from
+    // the same client as a single entry. readList() appends the states it
+    // reads to outState.
+    static status_t writeList(Parcel& output,
+            const Vector<ComposerState>& state);
+    static status_t readList(const Parcel& input,
+            Vector<ComposerState>* outState);
 };
 
 struct DisplayState {
@@ -82,6 +82,11 @@ public:
     static sp<Fence> merge(const String8& name, const sp<Fence>& f1,
             const sp<Fence>& f2);
 
+    // get returns the fence file descriptor, which remains owned by the
+    // Fence: it can be polled, but must not be closed. -1 is returned for an
+    // invalid Fence.
+    int get() const { return mFenceFd; }
+
     // Return a duplicate of the fence file descriptor. The caller is
     // responsible for closing the returned file descriptor. On error, -1 will
     // be returned and errno will indicate the problem.
@@ -38,12 +38,14 @@ public:
 
                         Region();
                         Region(const Region& rhs);
+                        Region(Region&& rhs);
     explicit            Region(const Rect& rhs);
                         ~Region();
 
     static  Region      createTJunctionFreeRegion(const Region& r);
 
         Region& operator = (const Region& rhs);
+        Region& operator = (Region&& rhs);
 
     inline  bool        isEmpty() const     { return getBounds().isEmpty(); }
     inline  bool        isRect() const      { return mStorage.size() == 1; }
@@ -116,6 +118,10 @@ public:
     // returns true if the regions share the same underlying storage
     bool isTriviallyEqual(const Region& region) const;
 
+    // process-wide number of times a Region had to get a new storage buffer,
+    // for measuring allocation churn (e.g. per composited frame)
+    static uint32_t getStorageAllocationCount();
+
 
     /* various ways to access the rectangle list */
 
@@ -161,6 +167,8 @@ private:
 
     static void boolean_operation(int op, Region& dst,
             const Region& lhs, const Region& rhs);
+    static bool fast_boolean_operation(int op, Region& dst,
+            const Region& lhs, const Rect& rhs);
     static void boolean_operation(int op, Region& dst,
             const Region& lhs, const Rect& rhs);
 
@@ -174,6 +182,8 @@ private:
     // with an extra Rect as the last element which is set to the
     // bounds of the region. However, if the region is
     // a simple Rect then mStorage contains only that rect.
+    // The storage is copy-on-write: copies share it until one of them is
+    // modified, and all empty regions share a single buffer.
     Vector<Rect> mStorage;
 };
 
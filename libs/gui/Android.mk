@@ -67,6 +67,7 @@ LOCAL_SRC_FILES := \
 	OccupancyTracker.cpp \
 	Sensor.cpp \
 	SensorEventQueue.cpp \
+	SensorEventRing.cpp \
 	SensorManager.cpp \
 	StreamSplitter.cpp \
 	Surface.cpp \
@@ -76,6 +76,13 @@ status_t DisplayEventReceiver::requestNextVsync() {
     return NO_INIT;
 }
 
+status_t DisplayEventReceiver::setVsyncCoalescing(bool enabled) {
+    if (mEventConnection != NULL) {
+        mEventConnection->setVsyncCoalescing(enabled);
+        return NO_ERROR;
+    }
+    return NO_INIT;
+}
 
 ssize_t DisplayEventReceiver::getEvents(DisplayEventReceiver::Event* events,
         size_t count) {
@@ -33,7 +33,8 @@ namespace android {
 enum {
     GET_DATA_CHANNEL = IBinder::FIRST_CALL_TRANSACTION,
     SET_VSYNC_RATE,
-    REQUEST_NEXT_VSYNC
+    REQUEST_NEXT_VSYNC,
+    SET_VSYNC_COALESCING,
 };
 
 class BpDisplayEventConnection : public BpInterface<IDisplayEventConnection>
@@ -66,6 +67,13 @@ public:
         data.writeInterfaceToken(IDisplayEventConnection::getInterfaceDescriptor());
         remote()->transact(REQUEST_NEXT_VSYNC, data, &reply, IBinder::FLAG_ONEWAY);
     }
+
+    virtual void setVsyncCoalescing(bool enabled) {
+        Parcel data, reply;
+        data.writeInterfaceToken(IDisplayEventConnection::getInterfaceDescriptor());
+        data.writeInt32(enabled);
+        remote()->transact(SET_VSYNC_COALESCING, data, &reply);
+    }
 };
 
 // Out-of-line virtual method definition to trigger vtable emission in this
@@ -96,6 +104,11 @@ status_t BnDisplayEventConnection::onTransact(
             requestNextVsync();
             return NO_ERROR;
         }
+        case SET_VSYNC_COALESCING: {
+            CHECK_INTERFACE(IDisplayEventConnection, data, reply);
+            setVsyncCoalescing(data.readInt32() != 0);
+            return NO_ERROR;
+        }
     }
     return BBinder::onTransact(code, data, reply, flags);
 }
@@ -26,6 +26,7 @@
 
 #include <gui/ISensorEventConnection.h>
 #include <gui/BitTube.h>
+#include <gui/SensorEventRing.h>
 
 namespace android {
 // ----------------------------------------------------------------------------
@@ -34,7 +35,8 @@ enum {
     GET_SENSOR_CHANNEL = IBinder::FIRST_CALL_TRANSACTION,
     ENABLE_DISABLE,
     SET_EVENT_RATE,
-    FLUSH_SENSOR
+    FLUSH_SENSOR,
+    GET_SENSOR_RING,
 };
 
 class BpSensorEventConnection : public BpInterface<ISensorEventConnection>
@@ -55,6 +57,23 @@ public:
         return new BitTube(reply);
     }
 
+    virtual sp<SensorEventRing> getSensorRing() const
+    {
+        Parcel data, reply;
+        data.writeInterfaceToken(ISensorEventConnection::getInterfaceDescriptor());
+        status_t result = remote()->transact(GET_SENSOR_RING, data, &reply);
+        if (result != NO_ERROR || reply.readInt32() == 0) {
+            // Either the service doesn't know about shared rings or this
+            // connection doesn't have one; stay on the BitTube.
+            return NULL;
+        }
+        sp<SensorEventRing> ring(new SensorEventRing(reply));
+        if (ring->initCheck() != NO_ERROR) {
+            return NULL;
+        }
+        return ring;
+    }
+
     virtual status_t enableDisable(int handle, bool enabled, nsecs_t samplingPeriodNs,
                                    nsecs_t maxBatchReportLatencyNs, int reservedFlags)
     {
@@ -105,6 +124,15 @@ status_t BnSensorEventConnection::onTransact(
             channel->writeToParcel(reply);
             return NO_ERROR;
         }
+        case GET_SENSOR_RING: {
+            CHECK_INTERFACE(ISensorEventConnection, data, reply);
+            sp<SensorEventRing> ring(getSensorRing());
+            reply->writeInt32(ring != NULL);
+            if (ring != NULL) {
+                ring->writeToParcel(reply);
+            }
+            return NO_ERROR;
+        }
         case ENABLE_DISABLE: {
             CHECK_INTERFACE(ISensorEventConnection, data, reply);
             int handle = data.readInt32();
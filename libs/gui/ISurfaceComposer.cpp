@@ -80,10 +80,7 @@ public:
         Parcel data, reply;
         data.writeInterfaceToken(ISurfaceComposer::getInterfaceDescriptor());
 
-        data.writeUint32(static_cast<uint32_t>(state.size()));
-        for (const auto& s : state) {
-            s.write(data);
-        }
+        ComposerState::writeList(data, state);
 
         data.writeUint32(static_cast<uint32_t>(displays.size()));
         for (const auto& d : displays) {
@@ -414,21 +411,12 @@ status_t BnSurfaceComposer::onTransact(
         case SET_TRANSACTION_STATE: {
             CHECK_INTERFACE(ISurfaceComposer, data, reply);
 
-            size_t count = data.readUint32();
-            if (count > data.dataSize()) {
-                return BAD_VALUE;
-            }
-            ComposerState s;
             Vector<ComposerState> state;
-            state.setCapacity(count);
-            for (size_t i = 0; i < count; i++) {
-                if (s.read(data) == BAD_VALUE) {
-                    return BAD_VALUE;
-                }
-                state.add(s);
+            if (ComposerState::readList(data, &state) != NO_ERROR) {
+                return BAD_VALUE;
             }
 
-            count = data.readUint32();
+            size_t count = data.readUint32();
             if (count > data.dataSize()) {
                 return BAD_VALUE;
             }
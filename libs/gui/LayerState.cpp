@@ -14,6 +14,10 @@
  * limitations under the License.
  */
 
+#include <vector>
+
+#include <string.h>
+
 #include <utils/Errors.h>
 #include <binder/Parcel.h>
 #include <gui/ISurfaceComposerClient.h>
@@ -25,63 +29,215 @@ namespace android {
 status_t layer_state_t::write(Parcel& output) const
 {
     output.writeStrongBinder(surface);
-    output.writeUint32(what);
-    output.writeFloat(x);
-    output.writeFloat(y);
-    output.writeUint32(z);
-    output.writeUint32(w);
-    output.writeUint32(h);
-    output.writeUint32(layerStack);
-    output.writeFloat(blur);
-    output.writeStrongBinder(blurMaskSurface);
-    output.writeUint32(blurMaskSampling);
-    output.writeFloat(blurMaskAlphaThreshold);
-    output.writeFloat(alpha);
-    output.writeUint32(flags);
-    output.writeUint32(mask);
-    *reinterpret_cast<layer_state_t::matrix22_t *>(
-            output.writeInplace(sizeof(layer_state_t::matrix22_t))) = matrix;
-    output.write(crop);
-    output.write(finalCrop);
-    output.writeStrongBinder(handle);
-    output.writeUint64(frameNumber);
-    output.writeInt32(overrideScalingMode);
-    output.write(transparentRegion);
-    return NO_ERROR;
+    return writeChanges(output);
 }
 
 status_t layer_state_t::read(const Parcel& input)
 {
     surface = input.readStrongBinder();
+    return readChanges(input);
+}
+
+status_t layer_state_t::writeChanges(Parcel& output) const
+{
+    output.writeUint32(what);
+    if (what & ePositionChanged) {
+        output.writeFloat(x);
+        output.writeFloat(y);
+    }
+    if (what & eLayerChanged) {
+        output.writeUint32(z);
+    }
+    if (what & eSizeChanged) {
+        output.writeUint32(w);
+        output.writeUint32(h);
+    }
+    if (what & eLayerStackChanged) {
+        output.writeUint32(layerStack);
+    }
+    if (what & eBlurChanged) {
+        output.writeFloat(blur);
+    }
+    if (what & eBlurMaskSurfaceChanged) {
+        output.writeStrongBinder(blurMaskSurface);
+    }
+    if (what & eBlurMaskSamplingChanged) {
+        output.writeUint32(blurMaskSampling);
+    }
+    if (what & eBlurMaskAlphaThresholdChanged) {
+        output.writeFloat(blurMaskAlphaThreshold);
+    }
+    if (what & eAlphaChanged) {
+        output.writeFloat(alpha);
+    }
+    if (what & eFlagsChanged) {
+        output.writeUint32(static_cast<uint32_t>(flags) |
+                static_cast<uint32_t>(mask) << 8);
+    }
+    if (what & eMatrixChanged) {
+        *reinterpret_cast<layer_state_t::matrix22_t *>(
+                output.writeInplace(sizeof(layer_state_t::matrix22_t))) = matrix;
+    }
+    if (what & eCropChanged) {
+        output.write(crop);
+    }
+    if (what & eFinalCropChanged) {
+        output.write(finalCrop);
+    }
+    if (what & eDeferTransaction) {
+        output.writeStrongBinder(handle);
+        output.writeUint64(frameNumber);
+    }
+    if (what & eOverrideScalingModeChanged) {
+        output.writeInt32(overrideScalingMode);
+    }
+    if (what & eColorChanged) {
+        output.writeUint32(color);
+    }
+    if (what & eTransparentRegionChanged) {
+        output.write(transparentRegion);
+    }
+    return NO_ERROR;
+}
+
+status_t layer_state_t::readChanges(const Parcel& input)
+{
     what = input.readUint32();
-    x = input.readFloat();
-    y = input.readFloat();
-    z = input.readUint32();
-    w = input.readUint32();
-    h = input.readUint32();
-    layerStack = input.readUint32();
-    blur = input.readFloat();
-    blurMaskSurface = input.readStrongBinder();
-    blurMaskSampling = input.readUint32();
-    blurMaskAlphaThreshold = input.readFloat();
-    alpha = input.readFloat();
-    flags = static_cast<uint8_t>(input.readUint32());
-    mask = static_cast<uint8_t>(input.readUint32());
-    const void* matrix_data = input.readInplace(sizeof(layer_state_t::matrix22_t));
-    if (matrix_data) {
-        matrix = *reinterpret_cast<layer_state_t::matrix22_t const *>(matrix_data);
-    } else {
-        return BAD_VALUE;
+    if (what & ePositionChanged) {
+        x = input.readFloat();
+        y = input.readFloat();
+    }
+    if (what & eLayerChanged) {
+        z = input.readUint32();
+    }
+    if (what & eSizeChanged) {
+        w = input.readUint32();
+        h = input.readUint32();
+    }
+    if (what & eLayerStackChanged) {
+        layerStack = input.readUint32();
+    }
+    if (what & eBlurChanged) {
+        blur = input.readFloat();
+    }
+    // don't hold on to the binders of a previous state
+    blurMaskSurface.clear();
+    if (what & eBlurMaskSurfaceChanged) {
+        blurMaskSurface = input.readStrongBinder();
+    }
+    if (what & eBlurMaskSamplingChanged) {
+        blurMaskSampling = input.readUint32();
+    }
+    if (what & eBlurMaskAlphaThresholdChanged) {
+        blurMaskAlphaThreshold = input.readFloat();
+    }
+    if (what & eAlphaChanged) {
+        alpha = input.readFloat();
+    }
+    if (what & eFlagsChanged) {
+        const uint32_t flagsAndMask = input.readUint32();
+        flags = static_cast<uint8_t>(flagsAndMask);
+        mask = static_cast<uint8_t>(flagsAndMask >> 8);
+    }
+    if (what & eMatrixChanged) {
+        const void* matrix_data = input.readInplace(sizeof(layer_state_t::matrix22_t));
+        if (matrix_data) {
+            matrix = *reinterpret_cast<layer_state_t::matrix22_t const *>(matrix_data);
+        } else {
+            return BAD_VALUE;
+        }
+    }
+    if (what & eCropChanged) {
+        input.read(crop);
+    }
+    if (what & eFinalCropChanged) {
+        input.read(finalCrop);
+    }
+    handle.clear();
+    if (what & eDeferTransaction) {
+        handle = input.readStrongBinder();
+        frameNumber = input.readUint64();
+    }
+    if (what & eOverrideScalingModeChanged) {
+        overrideScalingMode = input.readInt32();
+    }
+    if (what & eColorChanged) {
+        color = input.readUint32();
+    }
+    if (what & eTransparentRegionChanged) {
+        if (input.read(transparentRegion) != NO_ERROR) {
+            return BAD_VALUE;
+        }
     }
-    input.read(crop);
-    input.read(finalCrop);
-    handle = input.readStrongBinder();
-    frameNumber = input.readUint64();
-    overrideScalingMode = input.readInt32();
-    input.read(transparentRegion);
     return NO_ERROR;
 }
 
+// Bitwise comparison: we only want to merge identical updates.
+static bool sameFloat(float lhs, float rhs) {
+    return memcmp(&lhs, &rhs, sizeof(float)) == 0;
+}
+
+bool layer_state_t::hasSameChanges(const layer_state_t& other) const
+{
+    if (what != other.what ||
+            (what & (eTransparentRegionChanged | eDeferTransaction))) {
+        return false;
+    }
+    if ((what & ePositionChanged) &&
+            !(sameFloat(x, other.x) && sameFloat(y, other.y))) {
+        return false;
+    }
+    if ((what & eLayerChanged) && z != other.z) {
+        return false;
+    }
+    if ((what & eSizeChanged) && (w != other.w || h != other.h)) {
+        return false;
+    }
+    if ((what & eLayerStackChanged) && layerStack != other.layerStack) {
+        return false;
+    }
+    if ((what & eBlurChanged) && !sameFloat(blur, other.blur)) {
+        return false;
+    }
+    if ((what & eBlurMaskSurfaceChanged) &&
+            blurMaskSurface != other.blurMaskSurface) {
+        return false;
+    }
+    if ((what & eBlurMaskSamplingChanged) &&
+            blurMaskSampling != other.blurMaskSampling) {
+        return false;
+    }
+    if ((what & eBlurMaskAlphaThresholdChanged) &&
+            !sameFloat(blurMaskAlphaThreshold, other.blurMaskAlphaThreshold)) {
+        return false;
+    }
+    if ((what & eAlphaChanged) && !sameFloat(alpha, other.alpha)) {
+        return false;
+    }
+    if ((what & eFlagsChanged) &&
+            (flags != other.flags || mask != other.mask)) {
+        return false;
+    }
+    if ((what & eMatrixChanged) &&
+            memcmp(&matrix, &other.matrix, sizeof(matrix22_t)) != 0) {
+        return false;
+    }
+    if ((what & eCropChanged) && crop != other.crop) {
+        return false;
+    }
+    if ((what & eFinalCropChanged) && finalCrop != other.finalCrop) {
+        return false;
+    }
+    if ((what & eOverrideScalingModeChanged) &&
+            overrideScalingMode != other.overrideScalingMode) {
+        return false;
+    }
+    if ((what & eColorChanged) && color != other.color) {
+        return false;
+    }
+    return true;
+}
+
 status_t ComposerState::write(Parcel& output) const {
     output.writeStrongBinder(IInterface::asBinder(client));
     return state.write(output);
@@ -92,6 +248,78 @@ status_t ComposerState::read(const Parcel& input) {
     return state.read(input);
 }
 
+status_t ComposerState::writeList(Parcel& output,
+        const Vector<ComposerState>& state) {
+    // Animations typically apply the same change (alpha, position...) to
+    // many layers in a transaction: each state goes to the first group
+    // making the same changes from the same client.
+    const size_t count = state.size();
+    std::vector<size_t> groupOf(count);
+    std::vector<size_t> groups;
+    for (size_t i = 0; i < count; i++) {
+        groupOf[i] = i;
+        for (size_t first : groups) {
+            if (state[first].client == state[i].client &&
+                    state[first].state.hasSameChanges(state[i].state)) {
+                groupOf[i] = first;
+                break;
+            }
+        }
+        if (groupOf[i] == i) {
+            groups.push_back(i);
+        }
+    }
+
+    output.writeUint32(static_cast<uint32_t>(groups.size()));
+    for (size_t first : groups) {
+        output.writeStrongBinder(IInterface::asBinder(state[first].client));
+        uint32_t surfaceCount = 0;
+        for (size_t i = first; i < count; i++) {
+            surfaceCount += groupOf[i] == first ? 1 : 0;
+        }
+        output.writeUint32(surfaceCount);
+        for (size_t i = first; i < count; i++) {
+            if (groupOf[i] == first) {
+                output.writeStrongBinder(state[i].state.surface);
+            }
+        }
+        status_t err = state[first].state.writeChanges(output);
+        if (err != NO_ERROR) {
+            return err;
+        }
+    }
+    return NO_ERROR;
+}
+
+status_t ComposerState::readList(const Parcel& input,
+        Vector<ComposerState>* outState) {
+    size_t groupCount = input.readUint32();
+    if (groupCount > input.dataSize()) {
+        return BAD_VALUE;
+    }
+    ComposerState s;
+    Vector<sp<IBinder> > surfaces;
+    for (size_t i = 0; i < groupCount; i++) {
+        s.client = interface_cast<ISurfaceComposerClient>(input.readStrongBinder());
+        size_t surfaceCount = input.readUint32();
+        if (surfaceCount > input.dataSize()) {
+            return BAD_VALUE;
+        }
+        surfaces.clear();
+        surfaces.setCapacity(surfaceCount);
+        for (size_t j = 0; j < surfaceCount; j++) {
+            surfaces.add(input.readStrongBinder());
+        }
+        if (s.state.readChanges(input) != NO_ERROR) {
+            return BAD_VALUE;
+        }
+        for (size_t j = 0; j < surfaceCount; j++) {
+            s.state.surface = surfaces[j];
+            outState->add(s);
+        }
+    }
+    return NO_ERROR;
+}
 
 DisplayState::DisplayState() :
     what(0),
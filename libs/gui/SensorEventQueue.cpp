@@ -29,6 +29,7 @@
 #include <gui/Sensor.h>
 #include <gui/BitTube.h>
 #include <gui/SensorEventQueue.h>
+#include <gui/SensorEventRing.h>
 #include <gui/ISensorEventConnection.h>
 
 #include <android/sensor.h>
@@ -52,10 +53,16 @@ SensorEventQueue::~SensorEventQueue() {
 void SensorEventQueue::onFirstRef()
 {
     mSensorChannel = mSensorEventConnection->getSensorChannel();
+    mSensorRing = mSensorEventConnection->getSensorRing();
 }
 
 int SensorEventQueue::getFd() const
 {
+    // Events arrive through the ring when we have one; the BitTube is then
+    // only used for acks and injection.
+    if (mSensorRing != NULL) {
+        return mSensorRing->getFd();
+    }
     return mSensorChannel->getFd();
 }
 
@@ -66,6 +73,10 @@ ssize_t SensorEventQueue::write(const sp<BitTube>& tube,
 }
 
 ssize_t SensorEventQueue::read(ASensorEvent* events, size_t numEvents) {
+    if (mSensorRing != NULL) {
+        // Read straight out of the shared region, no intermediate buffer.
+        return mSensorRing->read(events, numEvents);
+    }
     if (mAvailable == 0) {
         ssize_t err = BitTube::recvObjects(mSensorChannel,
                 mRecBuffer, MAX_RECEIVE_BUFFER_EVENT_COUNT);
@@ -172,6 +183,10 @@ status_t SensorEventQueue::injectSensorEvent(const ASensorEvent& event) {
     } while (true);
 }
 
+uint32_t SensorEventQueue::getOverflowCount() const {
+    return mSensorRing != NULL ? mSensorRing->getOverflowCount() : 0;
+}
+
 void SensorEventQueue::sendAck(const ASensorEvent* events, int count) {
     for (int i = 0; i < count; ++i) {
         if (events[i].flags & WAKE_UP_SENSOR_EVENT_NEEDS_ACK) {
@@ -0,0 +1,309 @@
+/*
+ * Copyright (C) 2016 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#define LOG_TAG "Sensors"
+
+#include <algorithm>
+#include <new>
+
+#include <errno.h>
+#include <stdint.h>
+#include <string.h>
+#include <sys/eventfd.h>
+#include <sys/mman.h>
+#include <sys/types.h>
+#include <unistd.h>
+
+#include <cutils/ashmem.h>
+#include <cutils/log.h>
+
+#include <utils/Errors.h>
+
+#include <binder/Parcel.h>
+
+#include <gui/SensorEventRing.h>
+
+#include <android/sensor.h>
+
+namespace android {
+// ----------------------------------------------------------------------------
+
+// Upper bound on the ring size accepted from a parcel, so a corrupted parcel
+// can't make us map an absurd region.
+static const size_t MAX_RING_CAPACITY = 64 * 1024;
+
+static size_t roundUpToPowerOfTwo(size_t value) {
+    size_t result = 1;
+    while (result < value) {
+        result <<= 1;
+    }
+    return result;
+}
+
+static void signalEventFd(int fd) {
+    uint64_t one = 1;
+    ssize_t size;
+    do {
+        size = ::write(fd, &one, sizeof(one));
+    } while (size < 0 && errno == EINTR);
+}
+
+static void drainEventFd(int fd) {
+    uint64_t value;
+    ssize_t size;
+    do {
+        size = ::read(fd, &value, sizeof(value));
+    } while (size < 0 && errno == EINTR);
+}
+
+SensorEventRing::SensorEventRing(size_t minCapacity)
+    : mAshmemFd(-1), mDataFd(-1), mSpaceFd(-1), mHeader(NULL), mEvents(NULL),
+      mCapacity(roundUpToPowerOfTwo(std::max(minCapacity, size_t(1)))),
+      mMapSize(getRegionSize(mCapacity)), mStatus(NO_INIT)
+{
+    mAshmemFd = ashmem_create_region("SensorEventRing", mMapSize);
+    if (mAshmemFd < 0) {
+        mStatus = -errno;
+        ALOGE("SensorEventRing: ashmem_create_region failed (%s)", strerror(errno));
+        return;
+    }
+    mDataFd = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+    mSpaceFd = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+    if (mDataFd < 0 || mSpaceFd < 0) {
+        mStatus = -errno;
+        ALOGE("SensorEventRing: eventfd creation failed (%s)", strerror(errno));
+        return;
+    }
+    void* addr = mmap(NULL, mMapSize, PROT_READ | PROT_WRITE, MAP_SHARED, mAshmemFd, 0);
+    if (addr == MAP_FAILED) {
+        mStatus = -errno;
+        ALOGE("SensorEventRing: mmap failed (%s)", strerror(errno));
+        return;
+    }
+    mHeader = new (addr) Header();
+    mHeader->writeCount.store(0);
+    mHeader->readCount.store(0);
+    mHeader->overflowCount.store(0);
+    mHeader->producerWaiting.store(0);
+    mHeader->capacity = static_cast<uint32_t>(mCapacity);
+    mEvents = reinterpret_cast<ASensorEvent*>(mHeader + 1);
+    mStatus = NO_ERROR;
+}
+
+SensorEventRing::SensorEventRing(const Parcel& data)
+    : mAshmemFd(-1), mDataFd(-1), mSpaceFd(-1), mHeader(NULL), mEvents(NULL),
+      mCapacity(0), mMapSize(0), mStatus(NO_INIT)
+{
+    mAshmemFd = dup(data.readFileDescriptor());
+    mDataFd = dup(data.readFileDescriptor());
+    mSpaceFd = dup(data.readFileDescriptor());
+    mCapacity = data.readUint32();
+    if (mAshmemFd < 0 || mDataFd < 0 || mSpaceFd < 0) {
+        mStatus = -errno;
+        ALOGE("SensorEventRing(Parcel): can't dup filedescriptor (%s)", strerror(errno));
+        return;
+    }
+    if (mCapacity == 0 || mCapacity > MAX_RING_CAPACITY ||
+            (mCapacity & (mCapacity - 1)) != 0) {
+        mStatus = BAD_VALUE;
+        ALOGE("SensorEventRing(Parcel): invalid capacity %zu", mCapacity);
+        return;
+    }
+    mMapSize = getRegionSize(mCapacity);
+    int regionSize = ashmem_get_size_region(mAshmemFd);
+    if (regionSize < 0 || static_cast<size_t>(regionSize) < mMapSize) {
+        mStatus = BAD_VALUE;
+        ALOGE("SensorEventRing(Parcel): region too small (%d < %zu)", regionSize, mMapSize);
+        return;
+    }
+    void* addr = mmap(NULL, mMapSize, PROT_READ | PROT_WRITE, MAP_SHARED, mAshmemFd, 0);
+    if (addr == MAP_FAILED) {
+        mStatus = -errno;
+        ALOGE("SensorEventRing(Parcel): mmap failed (%s)", strerror(errno));
+        return;
+    }
+    mHeader = reinterpret_cast<Header*>(addr);
+    mEvents = reinterpret_cast<ASensorEvent*>(mHeader + 1);
+    mStatus = NO_ERROR;
+}
+
+SensorEventRing::~SensorEventRing()
+{
+    unmap();
+    if (mAshmemFd >= 0)
+        close(mAshmemFd);
+    if (mDataFd >= 0)
+        close(mDataFd);
+    if (mSpaceFd >= 0)
+        close(mSpaceFd);
+}
+
+void SensorEventRing::unmap() {
+    if (mHeader != NULL) {
+        munmap(mHeader, mMapSize);
+        mHeader = NULL;
+        mEvents = NULL;
+    }
+}
+
+size_t SensorEventRing::getRegionSize(size_t capacity) {
+    return sizeof(Header) + capacity * sizeof(ASensorEvent);
+}
+
+status_t SensorEventRing::initCheck() const
+{
+    return mStatus;
+}
+
+int SensorEventRing::getFd() const
+{
+    return mDataFd;
+}
+
+int SensorEventRing::getSpaceFd() const
+{
+    return mSpaceFd;
+}
+
+size_t SensorEventRing::getCapacity() const
+{
+    return mCapacity;
+}
+
+ssize_t SensorEventRing::write(ASensorEvent const* events, size_t count)
+{
+    if (mStatus != NO_ERROR) {
+        return mStatus;
+    }
+    if (count > mCapacity) {
+        return BAD_VALUE;
+    }
+
+    const uint32_t writeCount = mHeader->writeCount.load(std::memory_order_relaxed);
+    uint32_t readCount = mHeader->readCount.load(std::memory_order_acquire);
+    if (mCapacity - (writeCount - readCount) < count) {
+        // Tell the consumer we are waiting for space, then look again in case
+        // it drained the ring before it could see the flag.
+        mHeader->producerWaiting.store(1);
+        readCount = mHeader->readCount.load();
+        if (mCapacity - (writeCount - readCount) < count) {
+            return WOULD_BLOCK;
+        }
+        mHeader->producerWaiting.store(0, std::memory_order_relaxed);
+    }
+
+    const size_t mask = mCapacity - 1;
+    const size_t first = writeCount & mask;
+    const size_t head = std::min(count, mCapacity - first);
+    memcpy(mEvents + first, events, head * sizeof(ASensorEvent));
+    if (head < count) {
+        memcpy(mEvents, events + head, (count - head) * sizeof(ASensorEvent));
+    }
+    mHeader->writeCount.store(writeCount + static_cast<uint32_t>(count),
+            std::memory_order_release);
+
+    signalEventFd(mDataFd);
+    return static_cast<ssize_t>(count);
+}
+
+ssize_t SensorEventRing::read(ASensorEvent* events, size_t count)
+{
+    if (mStatus != NO_ERROR) {
+        return mStatus;
+    }
+
+    const uint32_t readCount = mHeader->readCount.load(std::memory_order_relaxed);
+    uint32_t writeCount = mHeader->writeCount.load(std::memory_order_acquire);
+    size_t available = writeCount - readCount;
+    if (available == 0) {
+        // The ring is empty: clear the data signal, then re-check so an event
+        // written in between does not get lost with it.
+        drainEventFd(mDataFd);
+        writeCount = mHeader->writeCount.load(std::memory_order_acquire);
+        available = writeCount - readCount;
+        if (available == 0) {
+            return 0;
+        }
+        signalEventFd(mDataFd);
+    }
+
+    const size_t n = std::min(count, std::min(available, mCapacity));
+    const size_t mask = mCapacity - 1;
+    const size_t first = readCount & mask;
+    const size_t head = std::min(n, mCapacity - first);
+    memcpy(events, mEvents + first, head * sizeof(ASensorEvent));
+    if (head < n) {
+        memcpy(events + head, mEvents, (n - head) * sizeof(ASensorEvent));
+    }
+    mHeader->readCount.store(readCount + static_cast<uint32_t>(n));
+
+    if (mHeader->producerWaiting.exchange(0) != 0) {
+        signalEventFd(mSpaceFd);
+    }
+    return static_cast<ssize_t>(n);
+}
+
+void SensorEventRing::clearSpaceSignal() const
+{
+    drainEventFd(mSpaceFd);
+}
+
+size_t SensorEventRing::getPendingCount() const
+{
+    if (mStatus != NO_ERROR) {
+        return 0;
+    }
+    return mHeader->writeCount.load(std::memory_order_relaxed) -
+            mHeader->readCount.load(std::memory_order_relaxed);
+}
+
+void SensorEventRing::addOverflow(size_t count)
+{
+    if (mStatus != NO_ERROR) {
+        return;
+    }
+    mHeader->overflowCount.fetch_add(static_cast<uint32_t>(count),
+            std::memory_order_relaxed);
+}
+
+uint32_t SensorEventRing::getOverflowCount() const
+{
+    if (mStatus != NO_ERROR) {
+        return 0;
+    }
+    return mHeader->overflowCount.load(std::memory_order_relaxed);
+}
+
+status_t SensorEventRing::writeToParcel(Parcel* reply) const
+{
+    if (mStatus != NO_ERROR)
+        return mStatus;
+
+    status_t result = reply->writeDupFileDescriptor(mAshmemFd);
+    if (result == NO_ERROR) {
+        result = reply->writeDupFileDescriptor(mDataFd);
+    }
+    if (result == NO_ERROR) {
+        result = reply->writeDupFileDescriptor(mSpaceFd);
+    }
+    if (result == NO_ERROR) {
+        result = reply->writeUint32(static_cast<uint32_t>(mCapacity));
+    }
+    return result;
+}
+
+// ----------------------------------------------------------------------------
+}; // namespace android
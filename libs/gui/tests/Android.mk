@@ -15,7 +15,9 @@ LOCAL_SRC_FILES := \
     FillBuffer.cpp \
     GLTest.cpp \
     IGraphicBufferProducer_test.cpp \
+    LayerState_test.cpp \
     MultiTextureConsumer_test.cpp \
+    SensorEventRing_test.cpp \
     SRGB_test.cpp \
     StreamSplitter_test.cpp \
     SurfaceTextureClient_test.cpp \
@@ -0,0 +1,138 @@
+/*
+ * Copyright 2016 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#define LOG_TAG "LayerState_test"
+//#define LOG_NDEBUG 0
+
+#include <binder/Binder.h>
+#include <binder/Parcel.h>
+#include <private/gui/LayerState.h>
+
+#include <gtest/gtest.h>
+
+namespace android {
+
+static ComposerState makeAlphaState(const sp<IBinder>& surface, float alpha) {
+    ComposerState s;
+    s.state.surface = surface;
+    s.state.what = layer_state_t::eAlphaChanged;
+    s.state.alpha = alpha;
+    return s;
+}
+
+TEST(LayerStateTest, RoundTripsChangedFields) {
+    layer_state_t state;
+    state.surface = new BBinder();
+    state.what = layer_state_t::ePositionChanged |
+            layer_state_t::eLayerChanged |
+            layer_state_t::eFlagsChanged |
+            layer_state_t::eMatrixChanged |
+            layer_state_t::eCropChanged |
+            layer_state_t::eTransparentRegionChanged;
+    state.x = 12.5f;
+    state.y = -3.0f;
+    state.z = 21000;
+    state.flags = layer_state_t::eLayerHidden;
+    state.mask = layer_state_t::eLayerHidden | layer_state_t::eLayerOpaque;
+    state.matrix.dsdx = 0.5f;
+    state.matrix.dtdy = 2.0f;
+    state.crop = Rect(1, 2, 30, 40);
+    state.transparentRegion = Region(Rect(0, 0, 8, 8));
+
+    Parcel parcel;
+    ASSERT_EQ(NO_ERROR, state.write(parcel));
+    parcel.setDataPosition(0);
+
+    layer_state_t result;
+    ASSERT_EQ(NO_ERROR, result.read(parcel));
+    EXPECT_EQ(state.surface, result.surface);
+    EXPECT_EQ(state.what, result.what);
+    EXPECT_EQ(state.x, result.x);
+    EXPECT_EQ(state.y, result.y);
+    EXPECT_EQ(state.z, result.z);
+    EXPECT_EQ(state.flags, result.flags);
+    EXPECT_EQ(state.mask, result.mask);
+    EXPECT_EQ(state.matrix.dsdx, result.matrix.dsdx);
+    EXPECT_EQ(state.matrix.dtdy, result.matrix.dtdy);
+    EXPECT_EQ(state.crop, result.crop);
+    EXPECT_EQ(state.transparentRegion.getBounds(),
+            result.transparentRegion.getBounds());
+    EXPECT_EQ(parcel.dataSize(), parcel.dataPosition());
+}
+
+TEST(LayerStateTest, OnlyWritesChangedFields) {
+    layer_state_t alphaOnly;
+    alphaOnly.what = layer_state_t::eAlphaChanged;
+    layer_state_t everything;
+    everything.what = layer_state_t::eAlphaChanged |
+            layer_state_t::eSizeChanged | layer_state_t::eFinalCropChanged;
+
+    Parcel small, large;
+    alphaOnly.writeChanges(small);
+    everything.writeChanges(large);
+    EXPECT_LT(small.dataSize(), large.dataSize());
+}
+
+TEST(LayerStateTest, BatchesIdenticalChanges) {
+    Vector<ComposerState> state;
+    for (int i = 0; i < 8; i++) {
+        state.add(makeAlphaState(new BBinder(), 0.25f));
+    }
+    state.add(makeAlphaState(new BBinder(), 0.75f));
+
+    Parcel batched;
+    ASSERT_EQ(NO_ERROR, ComposerState::writeList(batched, state));
+    Parcel separate;
+    for (size_t i = 0; i < state.size(); i++) {
+        state[i].write(separate);
+    }
+    EXPECT_LT(batched.dataSize(), separate.dataSize());
+
+    batched.setDataPosition(0);
+    Vector<ComposerState> result;
+    ASSERT_EQ(NO_ERROR, ComposerState::readList(batched, &result));
+    ASSERT_EQ(state.size(), result.size());
+    for (size_t i = 0; i < state.size(); i++) {
+        // every surface must come back exactly once with its own alpha
+        size_t matches = 0;
+        for (size_t j = 0; j < result.size(); j++) {
+            if (result[j].state.surface == state[i].state.surface) {
+                EXPECT_EQ(state[i].state.what, result[j].state.what);
+                EXPECT_EQ(state[i].state.alpha, result[j].state.alpha);
+                matches++;
+            }
+        }
+        EXPECT_EQ(1U, matches);
+    }
+}
+
+TEST(LayerStateTest, DoesNotBatchLayerSpecificChanges) {
+    layer_state_t a;
+    a.what = layer_state_t::eTransparentRegionChanged;
+    layer_state_t b;
+    b.what = layer_state_t::eTransparentRegionChanged;
+    EXPECT_FALSE(a.hasSameChanges(b));
+
+    a.what = b.what = layer_state_t::ePositionChanged;
+    a.x = b.x = 1.0f;
+    a.y = 2.0f;
+    b.y = 3.0f;
+    EXPECT_FALSE(a.hasSameChanges(b));
+    b.y = 2.0f;
+    EXPECT_TRUE(a.hasSameChanges(b));
+}
+
+} // namespace android
@@ -0,0 +1,115 @@
+/*
+ * Copyright 2016 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#define LOG_TAG "SensorEventRing_test"
+//#define LOG_NDEBUG 0
+
+#include <poll.h>
+#include <string.h>
+
+#include <binder/Parcel.h>
+#include <gui/SensorEventRing.h>
+
+#include <android/sensor.h>
+
+#include <gtest/gtest.h>
+
+namespace android {
+
+static ASensorEvent makeEvent(int64_t timestamp) {
+    ASensorEvent event;
+    memset(&event, 0, sizeof(event));
+    event.version = sizeof(event);
+    event.type = ASENSOR_TYPE_ACCELEROMETER;
+    event.timestamp = timestamp;
+    return event;
+}
+
+static bool isReadable(int fd) {
+    struct pollfd pfd = { fd, POLLIN, 0 };
+    return poll(&pfd, 1, 0) == 1 && (pfd.revents & POLLIN);
+}
+
+class SensorEventRingTest : public ::testing::Test {
+protected:
+    virtual void SetUp() {
+        mProducer = new SensorEventRing(4);
+        ASSERT_EQ(NO_ERROR, mProducer->initCheck());
+        Parcel parcel;
+        ASSERT_EQ(NO_ERROR, mProducer->writeToParcel(&parcel));
+        parcel.setDataPosition(0);
+        mConsumer = new SensorEventRing(parcel);
+        ASSERT_EQ(NO_ERROR, mConsumer->initCheck());
+    }
+
+    sp<SensorEventRing> mProducer;
+    sp<SensorEventRing> mConsumer;
+};
+
+TEST_F(SensorEventRingTest, EventsCrossTheRegion) {
+    ASensorEvent in[3] = { makeEvent(1), makeEvent(2), makeEvent(3) };
+    ASSERT_EQ(3, mProducer->write(in, 3));
+    EXPECT_TRUE(isReadable(mConsumer->getFd()));
+
+    ASensorEvent out[4];
+    ASSERT_EQ(2, mConsumer->read(out, 2));
+    EXPECT_EQ(1, out[0].timestamp);
+    EXPECT_EQ(2, out[1].timestamp);
+    // Still signaled, one event is left.
+    EXPECT_TRUE(isReadable(mConsumer->getFd()));
+    ASSERT_EQ(1, mConsumer->read(out, 4));
+    EXPECT_EQ(3, out[0].timestamp);
+
+    // Empty ring clears the signal.
+    ASSERT_EQ(0, mConsumer->read(out, 4));
+    EXPECT_FALSE(isReadable(mConsumer->getFd()));
+}
+
+TEST_F(SensorEventRingTest, WrapsAround) {
+    ASensorEvent out[4];
+    for (int64_t i = 0; i < 10; i++) {
+        ASensorEvent in[3] = { makeEvent(3 * i), makeEvent(3 * i + 1), makeEvent(3 * i + 2) };
+        ASSERT_EQ(3, mProducer->write(in, 3));
+        ASSERT_EQ(3, mConsumer->read(out, 4));
+        for (int j = 0; j < 3; j++) {
+            EXPECT_EQ(3 * i + j, out[j].timestamp);
+        }
+    }
+}
+
+TEST_F(SensorEventRingTest, FullRingBlocksAndSignalsSpace) {
+    ASensorEvent in[4] = { makeEvent(1), makeEvent(2), makeEvent(3), makeEvent(4) };
+    ASSERT_EQ(3, mProducer->write(in, 3));
+    EXPECT_EQ(WOULD_BLOCK, mProducer->write(in, 2));
+    // the producer keeps the events to retry, nothing is dropped yet
+    EXPECT_EQ(0u, mConsumer->getOverflowCount());
+    EXPECT_FALSE(isReadable(mProducer->getSpaceFd()));
+
+    ASensorEvent out[4];
+    ASSERT_EQ(3, mConsumer->read(out, 4));
+    EXPECT_TRUE(isReadable(mProducer->getSpaceFd()));
+    mProducer->clearSpaceSignal();
+    EXPECT_FALSE(isReadable(mProducer->getSpaceFd()));
+    EXPECT_EQ(4, mProducer->write(in, 4));
+}
+
+TEST_F(SensorEventRingTest, DroppedEventsAreAccounted) {
+    mProducer->addOverflow(2);
+    mProducer->addOverflow(3);
+    EXPECT_EQ(5u, mConsumer->getOverflowCount());
+}
+
+} // namespace android
@@ -16,6 +16,9 @@
 
 #define LOG_TAG "Region"
 
+#include <algorithm>
+#include <atomic>
+
 #include <inttypes.h>
 #include <limits.h>
 
@@ -55,10 +58,34 @@ enum {
 
 const Region Region::INVALID_REGION(Rect::INVALID_RECT);
 
+static std::atomic<uint32_t> sStorageAllocations(0);
+
+// Storage of the empty region. Vector<> is copy-on-write, so default
+// constructed and cleared regions share it instead of allocating their own.
+static const Vector<Rect>& emptyStorage() {
+    static const Vector<Rect>* const storage = [] {
+        Vector<Rect>* v = new Vector<Rect>();
+        v->add(Rect(0,0));
+        return v;
+    }();
+    return *storage;
+}
+
+static inline void noteStorage(const Rect* before, const Rect* after) {
+    if (before != after) {
+        sStorageAllocations.fetch_add(1, std::memory_order_relaxed);
+    }
+}
+
+uint32_t Region::getStorageAllocationCount() {
+    return sStorageAllocations.load(std::memory_order_relaxed);
+}
+
 // ----------------------------------------------------------------------------
 
-Region::Region() {
-    mStorage.add(Rect(0,0));
+Region::Region()
+    : mStorage(emptyStorage())
+{
 }
 
 Region::Region(const Region& rhs)
@@ -69,8 +96,17 @@ Region::Region(const Region& rhs)
 #endif
 }
 
+Region::Region(Region&& rhs)
+    : mStorage(rhs.mStorage)
+{
+    // Vector has no move, take a reference on rhs' storage and hand it the
+    // shared empty one; neither allocates.
+    rhs.mStorage = emptyStorage();
+}
+
 Region::Region(const Rect& rhs) {
     mStorage.add(rhs);
+    noteStorage(NULL, mStorage.array());
 }
 
 Region::~Region()
@@ -217,12 +253,20 @@ Region& Region::operator = (const Region& rhs)
     return *this;
 }
 
+Region& Region::operator = (Region&& rhs)
+{
+    if (this != &rhs) {
+        mStorage = rhs.mStorage;
+        rhs.mStorage = emptyStorage();
+    }
+    return *this;
+}
+
 Region& Region::makeBoundsSelf()
 {
     if (mStorage.size() >= 2) {
         const Rect bounds(getBounds());
-        mStorage.clear();
-        mStorage.add(bounds);
+        set(bounds);
     }
     return *this;
 }
@@ -245,26 +289,30 @@ bool Region::contains(int x, int y) const {
 
 void Region::clear()
 {
-    mStorage.clear();
-    mStorage.add(Rect(0,0));
+    mStorage = emptyStorage();
 }
 
 void Region::set(const Rect& r)
 {
-    mStorage.clear();
-    mStorage.add(r);
+    const Rect* before = mStorage.array();
+    if (mStorage.size() == 1) {
+        // overwrite in place, this only copies if the storage is shared
+        mStorage.editItemAt(0) = r;
+    } else {
+        mStorage.clear();
+        mStorage.add(r);
+    }
+    noteStorage(before, mStorage.array());
 }
 
 void Region::set(int32_t w, int32_t h)
 {
-    mStorage.clear();
-    mStorage.add(Rect(w, h));
+    set(Rect(w, h));
 }
 
 void Region::set(uint32_t w, uint32_t h)
 {
-    mStorage.clear();
-    mStorage.add(Rect(w, h));
+    set(Rect(w, h));
 }
 
 bool Region::isTriviallyEqual(const Region& region) const {
@@ -277,7 +325,9 @@ void Region::addRectUnchecked(int l, int t, int r, int b)
 {
     Rect rect(l,t,r,b);
     size_t where = mStorage.size() - 1;
+    const Rect* before = mStorage.array();
     mStorage.insertAt(rect, where, 1);
+    noteStorage(before, mStorage.array());
 }
 
 // ----------------------------------------------------------------------------
@@ -419,13 +469,15 @@ class Region::rasterizer : public region_operator<Rect>::region_rasterizer
 {
     Rect bounds;
     Vector<Rect>& storage;
+    Rect const* const previousStorage;
     Rect* head;
     Rect* tail;
     Vector<Rect> span;
     Rect* cur;
 public:
     rasterizer(Region& reg)
-        : bounds(INT_MAX, 0, INT_MIN, 0), storage(reg.mStorage), head(), tail(), cur() {
+        : bounds(INT_MAX, 0, INT_MIN, 0), storage(reg.mStorage),
+          previousStorage(reg.mStorage.array()), head(), tail(), cur() {
         storage.clear();
     }
 
@@ -458,6 +510,7 @@ Region::rasterizer::~rasterizer()
         bounds.right = 0;
     }
     storage.add(bounds);
+    noteStorage(previousStorage, storage.array());
 }
 
 void Region::rasterizer::operator()(const Rect& rect)
@@ -582,6 +635,114 @@ bool Region::validate(const Region& reg, const char* name, bool silent)
     return result;
 }
 
+static inline bool rectContains(const Rect& outer, const Rect& inner) {
+    return outer.left <= inner.left && outer.top <= inner.top &&
+            outer.right >= inner.right && outer.bottom >= inner.bottom;
+}
+
+// Handles the cases that don't need the spanner: empty operands, disjoint
+// bounds, rhs covering lhs and operations between two rects whose result is
+// a single rect. These are the bulk of what SurfaceFlinger does when computing
+// visible regions. Returns false if the operation must go through the
+// spanner. dst must not alias lhs.
+bool Region::fast_boolean_operation(int op, Region& dst,
+        const Region& lhs, const Rect& rhs)
+{
+    const Rect l(lhs.getBounds());
+    if (!l.isValid() || !rhs.isValid()) {
+        return false;
+    }
+
+    const bool lhsEmpty = l.isEmpty();
+    const bool rhsEmpty = rhs.isEmpty();
+    if (lhsEmpty || rhsEmpty) {
+        if (op == op_and || (lhsEmpty && (op == op_nand || rhsEmpty))) {
+            dst.clear();
+        } else if (lhsEmpty) {
+            dst.set(rhs);
+        } else {
+            dst = lhs;
+        }
+        return true;
+    }
+
+    Rect overlap;
+    const bool intersects = l.intersect(rhs, &overlap);
+    if (!intersects) {
+        if (op == op_and) {
+            dst.clear();
+            return true;
+        } else if (op == op_nand) {
+            dst = lhs;
+            return true;
+        }
+    }
+
+    if (rectContains(rhs, l)) {
+        if (op == op_and) {
+            dst = lhs;
+            return true;
+        } else if (op == op_or) {
+            dst.set(rhs);
+            return true;
+        } else if (op == op_nand) {
+            dst.clear();
+            return true;
+        }
+    }
+
+    if (!lhs.isRect()) {
+        return false;
+    }
+
+    // both operands are non-empty rects from here on
+    switch (op) {
+        case op_and:
+            dst.set(overlap);
+            return true;
+        case op_or:
+            if (rectContains(l, rhs)) {
+                dst = lhs;
+                return true;
+            }
+            if (l.top == rhs.top && l.bottom == rhs.bottom &&
+                    l.left <= rhs.right && rhs.left <= l.right) {
+                dst.set(Rect(std::min(l.left, rhs.left), l.top,
+                        std::max(l.right, rhs.right), l.bottom));
+                return true;
+            }
+            if (l.left == rhs.left && l.right == rhs.right &&
+                    l.top <= rhs.bottom && rhs.top <= l.bottom) {
+                dst.set(Rect(l.left, std::min(l.top, rhs.top),
+                        l.right, std::max(l.bottom, rhs.bottom)));
+                return true;
+            }
+            return false;
+        case op_nand:
+            // rhs intersects l without covering it, so at most one of these
+            // leaves a single rect behind
+            if (rhs.left <= l.left && rhs.right >= l.right) {
+                if (rhs.top <= l.top) {
+                    dst.set(Rect(l.left, rhs.bottom, l.right, l.bottom));
+                    return true;
+                } else if (rhs.bottom >= l.bottom) {
+                    dst.set(Rect(l.left, l.top, l.right, rhs.top));
+                    return true;
+                }
+            } else if (rhs.top <= l.top && rhs.bottom >= l.bottom) {
+                if (rhs.left <= l.left) {
+                    dst.set(Rect(rhs.right, l.top, l.right, l.bottom));
+                    return true;
+                } else if (rhs.right >= l.right) {
+                    dst.set(Rect(l.left, l.top, rhs.left, l.bottom));
+                    return true;
+                }
+            }
+            return false;
+    }
+    return false;
+}
+
 void Region::boolean_operation(int op, Region& dst,
         const Region& lhs,
         const Region& rhs, int dx, int dy)
@@ -592,6 +753,36 @@ void Region::boolean_operation(int op, Region& dst,
     validate(dst, "boolean_operation (before): dst");
 #endif
 
+#if !(VALIDATE_WITH_CORECG || VALIDATE_REGIONS)
+    if (rhs.isRect()) {
+        Rect r(rhs.getBounds());
+        if (r.isValid()) {
+            r.offsetBy(dx, dy);
+            if (fast_boolean_operation(op, dst, lhs, r)) {
+                return;
+            }
+        }
+    } else if (lhs.isRect() && !dx && !dy && (op == op_and || op == op_or)) {
+        // these two are commutative
+        if (fast_boolean_operation(op, dst, rhs, lhs.getBounds())) {
+            return;
+        }
+    } else {
+        Rect rhsBounds(rhs.getBounds());
+        rhsBounds.offsetBy(dx, dy);
+        Rect overlap;
+        if (!lhs.getBounds().intersect(rhsBounds, &overlap)) {
+            if (op == op_and) {
+                dst.clear();
+                return;
+            } else if (op == op_nand) {
+                dst = lhs;
+                return;
+            }
+        }
+    }
+#endif
+
     size_t lhs_count;
     Rect const * const lhs_rects = lhs.getArray(&lhs_count);
 
@@ -707,6 +898,12 @@ void Region::boolean_operation(int op, Region& dst,
 #if VALIDATE_WITH_CORECG || VALIDATE_REGIONS
     boolean_operation(op, dst, lhs, Region(rhs), dx, dy);
 #else
+    Rect r(rhs);
+    r.offsetBy(dx, dy);
+    if (rhs.isValid() && fast_boolean_operation(op, dst, lhs, r)) {
+        return;
+    }
+
     size_t lhs_count;
     Rect const * const lhs_rects = lhs.getArray(&lhs_count);
 
@@ -740,7 +937,9 @@ void Region::translate(Region& reg, int dx, int dy)
         validate(reg, "translate (before)");
 #endif
         size_t count = reg.mStorage.size();
+        const Rect* before = reg.mStorage.array();
         Rect* rects = reg.mStorage.editArray();
+        noteStorage(before, rects);
         while (count) {
             rects->offsetBy(dx, dy);
             rects++;
@@ -821,6 +1020,7 @@ status_t Region::unflatten(void const* buffer, size_t size) {
         return BAD_VALUE;
     }
     mStorage = result.mStorage;
+    noteStorage(NULL, mStorage.array());
     return NO_ERROR;
 }
 
@@ -34,3 +34,10 @@ LOCAL_ADDITIONAL_DEPENDENCIES := $(LOCAL_PATH)/Android.mk
 LOCAL_SRC_FILES := mat_test.cpp
 LOCAL_MODULE := mat_test
 include $(BUILD_NATIVE_TEST)
+
+include $(CLEAR_VARS)
+LOCAL_ADDITIONAL_DEPENDENCIES := $(LOCAL_PATH)/Android.mk
+LOCAL_SHARED_LIBRARIES := libui
+LOCAL_SRC_FILES := Region_benchmark.cpp
+LOCAL_MODULE := Region_benchmark
+include $(BUILD_NATIVE_BENCHMARK)
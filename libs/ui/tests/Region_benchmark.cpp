@@ -0,0 +1,183 @@
+/*
+ * Copyright (C) 2016 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include <stddef.h>
+
+#include <benchmark/benchmark.h>
+
+#include <ui/Rect.h>
+#include <ui/Region.h>
+
+namespace android {
+
+// ---------------------------------------------------------------------------
+// Region operations as SurfaceFlinger::computeVisibleRegions() runs them, over
+// the layer stacks of a few typical 1080x1920 screens, top-most layer last.
+
+struct StackLayer {
+    Rect bounds;
+    bool opaque;
+};
+
+struct LayerStack {
+    const StackLayer* layers;
+    size_t count;
+};
+
+static const Rect kScreen(1080, 1920);
+
+static const StackLayer kHomeLayers[] = {
+    { Rect(0, 0, 1080, 1920), true },       // wallpaper
+    { Rect(0, 0, 1080, 1920), false },      // launcher
+    { Rect(0, 0, 1080, 72), false },        // status bar
+    { Rect(0, 1776, 1080, 1920), false },   // navigation bar
+};
+
+static const StackLayer kAppLayers[] = {
+    { Rect(0, 0, 1080, 1920), true },       // app
+    { Rect(0, 1056, 1080, 1776), true },    // input method
+    { Rect(0, 0, 1080, 72), false },        // status bar
+    { Rect(0, 1776, 1080, 1920), false },   // navigation bar
+};
+
+static const StackLayer kDialogLayers[] = {
+    { Rect(0, 0, 1080, 1920), true },       // app
+    { Rect(0, 0, 1080, 1920), false },      // dim layer
+    { Rect(60, 640, 1020, 1280), true },    // dialog
+    { Rect(340, 1560, 740, 1660), false },  // toast
+    { Rect(0, 0, 1080, 72), false },        // status bar
+    { Rect(0, 1776, 1080, 1920), false },   // navigation bar
+};
+
+static const StackLayer kMultiWindowLayers[] = {
+    { Rect(0, 0, 1080, 1920), true },       // wallpaper
+    { Rect(0, 72, 1080, 912), true },       // top app
+    { Rect(0, 936, 1080, 1776), true },     // bottom app
+    { Rect(0, 912, 1080, 936), true },      // divider
+    { Rect(680, 1240, 1040, 1440), true },  // picture-in-picture
+    { Rect(0, 0, 1080, 72), false },        // status bar
+    { Rect(0, 1776, 1080, 1920), false },   // navigation bar
+};
+
+#define LAYER_STACK(layers) { layers, sizeof(layers) / sizeof(layers[0]) }
+
+static const LayerStack kLayerStacks[] = {
+    LAYER_STACK(kHomeLayers),
+    LAYER_STACK(kAppLayers),
+    LAYER_STACK(kDialogLayers),
+    LAYER_STACK(kMultiWindowLayers),
+};
+
+static void computeVisibleRegions(const LayerStack& stack) {
+    Region aboveOpaqueLayers;
+    Region aboveCoveredLayers;
+    Region dirty;
+    for (size_t i = stack.count; i-- > 0;) {
+        const StackLayer& layer(stack.layers[i]);
+        Region visibleRegion(layer.bounds);
+        visibleRegion.andSelf(kScreen);
+        const Region coveredRegion(aboveCoveredLayers.intersect(layer.bounds));
+        aboveCoveredLayers.orSelf(layer.bounds);
+        visibleRegion.subtractSelf(aboveOpaqueLayers);
+        const Region visibleNonTransparentRegion(
+                visibleRegion.subtract(Region()));
+        dirty.orSelf(visibleRegion);
+        if (layer.opaque) {
+            aboveOpaqueLayers.orSelf(visibleRegion);
+        }
+        benchmark::DoNotOptimize(coveredRegion.getBounds());
+        benchmark::DoNotOptimize(visibleNonTransparentRegion.getBounds());
+    }
+    dirty.andSelf(kScreen);
+    benchmark::DoNotOptimize(dirty.getBounds());
+}
+
+static void BM_ComputeVisibleRegions(benchmark::State& state) {
+    const LayerStack& stack(kLayerStacks[state.range(0)]);
+    while (state.KeepRunning()) {
+        computeVisibleRegions(stack);
+    }
+}
+BENCHMARK(BM_ComputeVisibleRegions)->DenseRange(0, 3);
+
+// ---------------------------------------------------------------------------
+// Single operations, on rects and on a region made of many rects
+
+static Region makeStaircase(int steps) {
+    Region region;
+    for (int i = 0; i < steps; i++) {
+        region.orSelf(Rect(i * 40, i * 40, i * 40 + 200, i * 40 + 200));
+    }
+    return region;
+}
+
+static void BM_RectAndRect(benchmark::State& state) {
+    const Region lhs(Rect(0, 0, 1080, 1920));
+    while (state.KeepRunning()) {
+        benchmark::DoNotOptimize(
+                lhs.intersect(Rect(60, 640, 1020, 1280)).getBounds());
+    }
+}
+BENCHMARK(BM_RectAndRect);
+
+static void BM_RectOrRect(benchmark::State& state) {
+    const Region lhs(Rect(0, 0, 1080, 912));
+    while (state.KeepRunning()) {
+        benchmark::DoNotOptimize(
+                lhs.merge(Rect(0, 912, 1080, 1920)).getBounds());
+    }
+}
+BENCHMARK(BM_RectOrRect);
+
+static void BM_RectSubtractRect(benchmark::State& state) {
+    const Region lhs(Rect(0, 0, 1080, 1920));
+    while (state.KeepRunning()) {
+        benchmark::DoNotOptimize(
+                lhs.subtract(Rect(0, 1776, 1080, 1920)).getBounds());
+    }
+}
+BENCHMARK(BM_RectSubtractRect);
+
+static void BM_RectSubtractRectSplit(benchmark::State& state) {
+    const Region lhs(Rect(0, 0, 1080, 1920));
+    while (state.KeepRunning()) {
+        benchmark::DoNotOptimize(
+                lhs.subtract(Rect(60, 640, 1020, 1280)).getBounds());
+    }
+}
+BENCHMARK(BM_RectSubtractRectSplit);
+
+static void BM_RegionOrRect(benchmark::State& state) {
+    const Region lhs(makeStaircase(state.range(0)));
+    while (state.KeepRunning()) {
+        benchmark::DoNotOptimize(
+                lhs.merge(Rect(100, 100, 300, 300)).getBounds());
+    }
+}
+BENCHMARK(BM_RegionOrRect)->Arg(4)->Arg(16)->Arg(64);
+
+static void BM_RegionAndDisjointRegion(benchmark::State& state) {
+    const Region lhs(makeStaircase(state.range(0)));
+    const Region rhs(makeStaircase(state.range(0)).translate(4000, 0));
+    while (state.KeepRunning()) {
+        benchmark::DoNotOptimize(lhs.intersect(rhs).getBounds());
+    }
+}
+BENCHMARK(BM_RegionAndDisjointRegion)->Arg(4)->Arg(16)->Arg(64);
+
+}; // namespace android
+
+BENCHMARK_MAIN();
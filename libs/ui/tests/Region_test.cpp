@@ -17,6 +17,7 @@
 #define LOG_TAG "RegionTest"
 
 #include <stdlib.h>
+#include <utility>
 #include <ui/Region.h>
 #include <ui/Rect.h>
 #include <gtest/gtest.h>
@@ -152,5 +153,106 @@ TEST_F(RegionTest, Random_TJunction) {
     }
 }
 
+static Rect randomRect(int max) {
+    int l = random() % max;
+    int t = random() % max;
+    int r = l + random() % (max - l + 1);
+    int b = t + random() % (max - t + 1);
+    return Rect(l, t, r, b);
+}
+
+static bool rectContains(const Rect& r, int x, int y) {
+    return x >= r.left && x < r.right && y >= r.top && y < r.bottom;
+}
+
+TEST_F(RegionTest, Random_RectOperations) {
+    // Rect/rect operations mostly take the fast path in boolean_operation,
+    // check them pixel by pixel and make sure single-rect results stay
+    // canonical.
+    srandom(54321);
+
+    for (int iter = 0; iter < ITER_MAX; iter++) {
+        const Rect a(randomRect(X_MAX));
+        const Rect b(randomRect(X_MAX));
+        const Region ra(a);
+
+        const Region results[] = {
+            ra.merge(b), ra.intersect(b), ra.subtract(b), ra.mergeExclusive(b),
+            ra.merge(Region(b)), ra.intersect(Region(b)), ra.subtract(Region(b)),
+        };
+
+        for (int x = -1; x <= X_MAX; x++) {
+            for (int y = -1; y <= X_MAX; y++) {
+                const bool inA = rectContains(a, x, y) && !a.isEmpty();
+                const bool inB = rectContains(b, x, y) && !b.isEmpty();
+                EXPECT_EQ(inA || inB, results[0].contains(x, y));
+                EXPECT_EQ(inA && inB, results[1].contains(x, y));
+                EXPECT_EQ(inA && !inB, results[2].contains(x, y));
+                EXPECT_EQ(inA != inB, results[3].contains(x, y));
+                EXPECT_EQ(inA || inB, results[4].contains(x, y));
+                EXPECT_EQ(inA && inB, results[5].contains(x, y));
+                EXPECT_EQ(inA && !inB, results[6].contains(x, y));
+            }
+        }
+
+        for (const Region& result : results) {
+            if (result.isEmpty()) {
+                EXPECT_EQ(Rect(0, 0), result.getBounds());
+            }
+            size_t count;
+            result.getArray(&count);
+            if (result.isRect()) {
+                EXPECT_EQ(1U, count);
+            }
+        }
+    }
+}
+
+TEST_F(RegionTest, DisjointBounds) {
+    Region r;
+    r.orSelf(Rect(0, 0, 10, 10));
+    r.orSelf(Rect(20, 20, 30, 30));
+
+    Region other;
+    other.orSelf(Rect(100, 100, 110, 110));
+    other.orSelf(Rect(120, 120, 130, 130));
+
+    EXPECT_TRUE(r.intersect(other).isEmpty());
+    EXPECT_TRUE(r.subtract(other).isTriviallyEqual(r));
+    EXPECT_TRUE((r.subtract(other) ^ r).isEmpty());
+    EXPECT_TRUE((r.intersect(other, -100, -100) ^ r).isEmpty());
+}
+
+TEST_F(RegionTest, SharedStorage) {
+    const uint32_t start = Region::getStorageAllocationCount();
+    Region empty1;
+    Region empty2;
+    EXPECT_TRUE(empty1.isTriviallyEqual(empty2));
+    empty2.clear();
+    EXPECT_TRUE(empty1.isTriviallyEqual(empty2));
+    EXPECT_EQ(start, Region::getStorageAllocationCount());
+
+    Region r;
+    r.orSelf(Rect(0, 0, 10, 10));
+    r.orSelf(Rect(20, 20, 30, 30));
+    const Region copy(r);
+    EXPECT_TRUE(copy.isTriviallyEqual(r));
+
+    Region moved(std::move(r));
+    EXPECT_TRUE(moved.isTriviallyEqual(copy));
+    EXPECT_TRUE(r.isEmpty());
+    EXPECT_TRUE(r.isTriviallyEqual(empty1));
+
+    r = std::move(moved);
+    EXPECT_TRUE(r.isTriviallyEqual(copy));
+    EXPECT_TRUE(moved.isEmpty());
+
+    // writing to a shared region must not affect the other owners
+    r.set(Rect(5, 5));
+    EXPECT_FALSE(r.isTriviallyEqual(copy));
+    EXPECT_EQ(Rect(0, 0, 30, 30), copy.getBounds());
+    EXPECT_TRUE(empty1.isEmpty());
+}
+
 }; // namespace android
 
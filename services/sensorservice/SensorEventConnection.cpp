@@ -27,11 +27,23 @@ namespace android {
 
 SensorService::SensorEventConnection::SensorEventConnection(
         const sp<SensorService>& service, uid_t uid, String8 packageName, bool isDataInjectionMode,
-        const String16& opPackageName)
+        const String16& opPackageName, bool useSharedRing)
     : mService(service), mUid(uid), mWakeLockRefCount(0), mHasLooperCallbacks(false),
-      mDead(false), mDataInjectionMode(isDataInjectionMode), mEventCache(NULL),
-      mCacheSize(0), mMaxCacheSize(0), mPackageName(packageName), mOpPackageName(opPackageName) {
+      mHasRingLooperCallbacks(false), mDead(false), mDataInjectionMode(isDataInjectionMode),
+      mEventCache(NULL), mCacheSize(0), mMaxCacheSize(0), mPackageName(packageName),
+      mOpPackageName(opPackageName) {
     mChannel = new BitTube(mService->mSocketBufferSize);
+    if (useSharedRing) {
+        // Give the ring the same capacity the socket buffer would have had.
+        sp<SensorEventRing> ring(new SensorEventRing(
+                mService->mSocketBufferSize / sizeof(sensors_event_t)));
+        if (ring->initCheck() == NO_ERROR) {
+            mRing = ring;
+        } else {
+            ALOGE("%s: can't create shared ring, falling back to BitTube",
+                  mPackageName.string());
+        }
+    }
 #if DEBUG_CONNECTIONS
     mEventsReceived = mEventsSentFromCache = mEventsSent = 0;
     mTotalAcksNeeded = mTotalAcksReceived = 0;
@@ -66,6 +78,10 @@ void SensorService::SensorEventConnection::dump(String8& result) {
     result.appendFormat("\t %s | WakeLockRefCount %d | uid %d | cache size %d | "
             "max cache size %d\n", mPackageName.string(), mWakeLockRefCount, mUid, mCacheSize,
             mMaxCacheSize);
+    if (mRing != NULL) {
+        result.appendFormat("\t shared ring | capacity %zu | pending %zu | overflow %u\n",
+                mRing->getCapacity(), mRing->getPendingCount(), mRing->getOverflowCount());
+    }
     for (size_t i = 0; i < mSensorInfo.size(); ++i) {
         const FlushInfo& flushInfo = mSensorInfo.valueAt(i);
         result.appendFormat("\t %s 0x%08x | status: %s | pending flush events %d \n",
@@ -158,10 +174,28 @@ void SensorService::SensorEventConnection::updateLooperRegistrationLocked(
         ALOGD_IF(DEBUG_CONNECTIONS, "%p removeFd fd=%d", this,
                  mChannel->getSendFd());
         looper->removeFd(mChannel->getSendFd()); mHasLooperCallbacks = false; }
+    if (mHasRingLooperCallbacks) {
+        looper->removeFd(mRing->getSpaceFd()); mHasRingLooperCallbacks = false; }
     return; }
 
+    // With a shared ring, cached events are flushed when the client signals the space eventfd
+    // instead of when the socket becomes writable.
+    if (mRing != NULL) {
+        if (mCacheSize > 0 && !mHasRingLooperCallbacks) {
+            int ret = looper->addFd(mRing->getSpaceFd(), 0, ALOOPER_EVENT_INPUT, this, NULL);
+            if (ret == 1) {
+                mHasRingLooperCallbacks = true;
+            } else {
+                ALOGE("Looper::addFd failed ret=%d fd=%d", ret, mRing->getSpaceFd());
+            }
+        } else if (mCacheSize == 0 && mHasRingLooperCallbacks) {
+            looper->removeFd(mRing->getSpaceFd());
+            mHasRingLooperCallbacks = false;
+        }
+    }
+
     int looper_flags = 0;
-    if (mCacheSize > 0) looper_flags |= ALOOPER_EVENT_OUTPUT;
+    if (mCacheSize > 0 && mRing == NULL) looper_flags |= ALOOPER_EVENT_OUTPUT;
     if (mDataInjectionMode) looper_flags |= ALOOPER_EVENT_INPUT;
     for (size_t i = 0; i < mSensorInfo.size(); ++i) {
         const int handle = mSensorInfo.keyAt(i);
@@ -303,6 +337,9 @@ status_t SensorService::SensorEventConnection::sendEvents(
             }
             int numEventsDropped = count - remaningCacheSize;
             countFlushCompleteEventsLocked(mEventCache, numEventsDropped);
+            if (mRing != NULL) {
+                mRing->addOverflow(numEventsDropped);
+            }
             // Drop the first "numEventsDropped" in the cache.
             memmove(mEventCache, &mEventCache[numEventsDropped],
                     (mCacheSize - numEventsDropped) * sizeof(sensors_event_t));
@@ -323,9 +360,7 @@ status_t SensorService::SensorEventConnection::sendEvents(
 #endif
     }
 
-    // NOTE: ASensorEvent and sensors_event_t are the same type.
-    ssize_t size = SensorEventQueue::write(mChannel,
-                                    reinterpret_cast<ASensorEvent const*>(scratch), count);
+    ssize_t size = writeEventsLocked(scratch, count);
     if (size < 0) {
         // Write error, copy events to local cache.
         if (index_wake_up_event >= 0) {
@@ -400,7 +435,8 @@ void SensorService::SensorEventConnection::sendPendingFlushEventsLocked() {
                ++mWakeLockRefCount;
                flushCompleteEvent.flags |= WAKE_UP_SENSOR_EVENT_NEEDS_ACK;
             }
-            ssize_t size = SensorEventQueue::write(mChannel, &flushCompleteEvent, 1);
+            ssize_t size = writeEventsLocked(
+                    reinterpret_cast<sensors_event_t const*>(&flushCompleteEvent), 1);
             if (size < 0) {
                 if (wakeUpSensor) --mWakeLockRefCount;
                 return;
@@ -433,9 +469,7 @@ void SensorService::SensorEventConnection::writeToSocketFromCache() {
 #endif
         }
 
-        ssize_t size = SensorEventQueue::write(mChannel,
-                          reinterpret_cast<ASensorEvent const*>(mEventCache + numEventsSent),
-                          numEventsToWrite);
+        ssize_t size = writeEventsLocked(mEventCache + numEventsSent, numEventsToWrite);
         if (size < 0) {
             if (index_wake_up_event >= 0) {
                 // If there was a wake_up sensor_event, reset the flag.
@@ -468,6 +502,15 @@ void SensorService::SensorEventConnection::writeToSocketFromCache() {
     updateLooperRegistrationLocked(mService->getLooper());
 }
 
+ssize_t SensorService::SensorEventConnection::writeEventsLocked(sensors_event_t const* events,
+                                                                size_t count) {
+    // NOTE: ASensorEvent and sensors_event_t are the same type.
+    if (mRing != NULL) {
+        return mRing->write(reinterpret_cast<ASensorEvent const*>(events), count);
+    }
+    return SensorEventQueue::write(mChannel, reinterpret_cast<ASensorEvent const*>(events), count);
+}
+
 void SensorService::SensorEventConnection::countFlushCompleteEventsLocked(
                 sensors_event_t const* scratch, const int numEventsDropped) {
     ALOGD_IF(DEBUG_CONNECTIONS, "dropping %d events ", numEventsDropped);
@@ -499,6 +542,11 @@ sp<BitTube> SensorService::SensorEventConnection::getSensorChannel() const
     return mChannel;
 }
 
+sp<SensorEventRing> SensorService::SensorEventConnection::getSensorRing() const
+{
+    return mRing;
+}
+
 status_t SensorService::SensorEventConnection::enableDisable(
         int handle, bool enabled, nsecs_t samplingPeriodNs, nsecs_t maxBatchReportLatencyNs,
         int reservedFlags)
@@ -546,6 +594,13 @@ int SensorService::SensorEventConnection::handleEvent(int fd, int events, void*
         return 1;
     }
 
+    if (mRing != NULL && fd == mRing->getSpaceFd()) {
+        // The client drained the shared ring, send what is left in mEventCache.
+        mRing->clearSpaceSignal();
+        mService->sendEventsFromCache(this);
+        return 1;
+    }
+
     if (events & ALOOPER_EVENT_INPUT) {
         unsigned char buf[sizeof(sensors_event_t)];
         ssize_t numBytesRead = ::recv(fd, buf, sizeof(buf), MSG_DONTWAIT);
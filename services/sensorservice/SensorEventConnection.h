@@ -33,6 +33,7 @@
 
 #include <gui/Sensor.h>
 #include <gui/BitTube.h>
+#include <gui/SensorEventRing.h>
 #include <gui/ISensorServer.h>
 #include <gui/ISensorEventConnection.h>
 
@@ -49,7 +50,8 @@ class SensorService::SensorEventConnection:
 
 public:
     SensorEventConnection(const sp<SensorService>& service, uid_t uid, String8 packageName,
-                          bool isDataInjectionMode, const String16& opPackageName);
+                          bool isDataInjectionMode, const String16& opPackageName,
+                          bool useSharedRing = false);
 
     status_t sendEvents(sensors_event_t const* buffer, size_t count, sensors_event_t* scratch,
                         wp<const SensorEventConnection> const * mapFlushEventsToConnections = NULL);
@@ -70,6 +72,7 @@ private:
     virtual ~SensorEventConnection();
     virtual void onFirstRef();
     virtual sp<BitTube> getSensorChannel() const;
+    virtual sp<SensorEventRing> getSensorRing() const;
     virtual status_t enableDisable(int handle, bool enabled, nsecs_t samplingPeriodNs,
                                    nsecs_t maxBatchReportLatencyNs, int reservedFlags);
     virtual status_t setEventRate(int handle, nsecs_t samplingPeriodNs);
@@ -93,6 +96,10 @@ private:
     // Writes events from mEventCache to the socket.
     void writeToSocketFromCache();
 
+    // Writes events to the client through the shared ring if this connection has one, through the
+    // BitTube otherwise. Like BitTube writes, either all the events are written or none.
+    ssize_t writeEventsLocked(sensors_event_t const* events, size_t count);
+
     // Compute the approximate cache size from the FIFO sizes of various sensors registered for this
     // connection. Wake up and non-wake up sensors have separate FIFOs but FIFO may be shared
     // amongst wake-up sensors and non-wake up sensors.
@@ -122,6 +129,9 @@ private:
 
     sp<SensorService> const mService;
     sp<BitTube> mChannel;
+    // Shared-memory ring events are delivered through when the client asked for one. mChannel is
+    // still used for wake-up acks and data injection.
+    sp<SensorEventRing> mRing;
     uid_t mUid;
     mutable Mutex mConnectionLock;
     // Number of events from wake up sensors which are still pending and haven't been delivered to
@@ -133,6 +143,9 @@ private:
     // connection has wake-up sensors associated with it or when write has failed on this connection
     // and we're storing some events in the cache.
     bool mHasLooperCallbacks;
+    // Set when the space eventfd of mRing has been added to the Looper, which happens while events
+    // are waiting in the cache for the client to drain the ring.
+    bool mHasRingLooperCallbacks;
     // If there are any errors associated with the Looper this flag is set to true and
     // mWakeLockRefCount is reset to zero. needsWakeLock method will always return false, if this
     // flag is set.
@@ -906,6 +906,8 @@ Vector<Sensor> SensorService::getDynamicSensorList(const String16& opPackageName
 
 sp<ISensorEventConnection> SensorService::createSensorEventConnection(const String8& packageName,
         int requestedMode, const String16& opPackageName) {
+    const bool useSharedRing = (requestedMode & SensorEventQueue::MODE_FLAG_SHARED_RING) != 0;
+    requestedMode &= ~SensorEventQueue::MODE_FLAG_SHARED_RING;
     // Only 2 modes supported for a SensorEventConnection ... NORMAL and DATA_INJECTION.
     if (requestedMode != NORMAL && requestedMode != DATA_INJECTION) {
         return NULL;
@@ -921,7 +923,8 @@ sp<ISensorEventConnection> SensorService::createSensorEventConnection(const Stri
 
     uid_t uid = IPCThreadState::self()->getCallingUid();
     sp<SensorEventConnection> result(new SensorEventConnection(this, uid, packageName,
-            requestedMode == DATA_INJECTION, opPackageName));
+            requestedMode == DATA_INJECTION, opPackageName,
+            useSharedRing && requestedMode == NORMAL));
     if (requestedMode == DATA_INJECTION) {
         if (mActiveConnections.indexOf(result) < 0) {
             mActiveConnections.add(result);
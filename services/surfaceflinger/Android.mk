@@ -1,4 +1,10 @@
 LOCAL_PATH := $(call my-dir)
+
+# SELinux policy of /data/misc/surfaceflinger, where ProgramCache saves the
+# program binaries. It is part of every build with surfaceflinger: this file
+# is included before system/sepolicy/Android.mk reads BOARD_SEPOLICY_DIRS.
+BOARD_SEPOLICY_DIRS += $(LOCAL_PATH)/sepolicy
+
 include $(CLEAR_VARS)
 
 LOCAL_CLANG := true
@@ -8,9 +14,13 @@ LOCAL_SRC_FILES := \
     Client.cpp \
     DisplayDevice.cpp \
     DispSync.cpp \
+    DispSyncModel.cpp \
+    DispSyncScheduler.cpp \
     EventControlThread.cpp \
     EventThread.cpp \
+    FenceTimeline.cpp \
     FenceTracker.cpp \
+    FrameHistogram.cpp \
     FrameTracker.cpp \
     GpuService.cpp \
     Layer.cpp \
@@ -25,6 +35,7 @@ LOCAL_SRC_FILES := \
     DisplayHardware/HWC2On1Adapter.cpp \
     DisplayHardware/PowerHAL.cpp \
     DisplayHardware/VirtualDisplaySurface.cpp \
+    Effects/ColorPipeline.cpp \
     Effects/Daltonizer.cpp \
     EventLog/EventLogTags.logtags \
     EventLog/EventLog.cpp \
@@ -55,6 +66,7 @@ LOCAL_CFLAGS += -DGL_GLEXT_PROTOTYPES -DEGL_EGLEXT_PROTOTYPES
 ifeq ($(TARGET_USES_HWC2),true)
     LOCAL_CFLAGS += -DUSE_HWC2
     LOCAL_SRC_FILES += \
+        PlanePredictor.cpp \
         SurfaceFlinger.cpp \
         DisplayHardware/HWComposer.cpp
 else
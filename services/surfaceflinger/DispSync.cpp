@@ -24,6 +24,7 @@
 
 #include <cutils/iosched_policy.h>
 #include <cutils/log.h>
+#include <cutils/properties.h>
 
 #include <ui/Fence.h>
 
@@ -33,6 +34,7 @@
 #include <utils/Vector.h>
 
 #include "DispSync.h"
+#include "DispSyncScheduler.h"
 #include "EventLog/EventLog.h"
 
 #include <algorithm>
@@ -56,6 +58,10 @@ static const bool kEnableZeroPhaseTracer = false;
 // present time and the nearest software-predicted vsync.
 static const nsecs_t kErrorThreshold = 160000000000;    // 400 usec squared
 
+// With the robust estimator the model is only considered locked once its
+// confidence reaches this value, see DispSyncModel::getConfidence().
+static const float kMinLockedConfidence = 0.5f;
+
 // This is the offset from the present fence timestamps to the corresponding
 // vsync event.
 static const int64_t kPresentTimeOffset = PRESENT_TIME_OFFSET_FROM_VSYNC_NS;
@@ -65,26 +71,21 @@ static const int64_t kPresentTimeOffset = PRESENT_TIME_OFFSET_FROM_VSYNC_NS;
 class DispSyncThread: public Thread {
 public:
 
-    DispSyncThread(const char* name):
+    DispSyncThread(const char* name, const DispSync::Clock& clock):
             mName(name),
+            mClock(clock),
             mStop(false),
-            mPeriod(0),
-            mPhase(0),
-            mReferenceTime(0),
-            mWakeupLatency(0),
-            mFrameNumber(0) {}
+            mScheduler(name),
+            mFrameNumber(0),
+            mNextEventTime(INT64_MAX) {}
 
     virtual ~DispSyncThread() {}
 
     void updateModel(nsecs_t period, nsecs_t phase, nsecs_t referenceTime) {
         if (kTraceDetailedInfo) ATRACE_CALL();
         Mutex::Autolock lock(mMutex);
-        mPeriod = period;
-        mPhase = phase;
-        mReferenceTime = referenceTime;
-        ALOGV("[%s] updateModel: mPeriod = %" PRId64 ", mPhase = %" PRId64
-                " mReferenceTime = %" PRId64, mName, ns2us(mPeriod),
-                ns2us(mPhase), ns2us(mReferenceTime));
+        mScheduler.updateModel(period, phase, referenceTime);
+        mNextEventTime = INT64_MAX;
         mCond.signal();
     }
 
@@ -97,10 +98,10 @@ public:
 
     virtual bool threadLoop() {
         status_t err;
-        nsecs_t now = systemTime(SYSTEM_TIME_MONOTONIC);
+        nsecs_t now = mClock.now();
 
         while (true) {
-            Vector<CallbackInvocation> callbackInvocations;
+            Vector<DispSyncScheduler::CallbackInvocation> callbackInvocations;
 
             nsecs_t targetTime = 0;
 
@@ -117,7 +118,7 @@ public:
                     return false;
                 }
 
-                if (mPeriod == 0) {
+                if (!mScheduler.hasModel()) {
                     err = mCond.wait(mMutex);
                     if (err != NO_ERROR) {
                         ALOGE("error waiting for new events: %s (%d)",
@@ -127,7 +128,7 @@ public:
                     continue;
                 }
 
-                targetTime = computeNextEventTimeLocked(now);
+                targetTime = mScheduler.computeNextEventTime(now);
 
                 bool isWakeup = false;
 
@@ -152,22 +153,13 @@ public:
                     }
                 }
 
-                now = systemTime(SYSTEM_TIME_MONOTONIC);
-
-                // Don't correct by more than 1.5 ms
-                static const nsecs_t kMaxWakeupLatency = us2ns(1500);
+                now = mClock.now();
 
                 if (isWakeup) {
-                    mWakeupLatency = ((mWakeupLatency * 63) +
-                            (now - targetTime)) / 64;
-                    mWakeupLatency = min(mWakeupLatency, kMaxWakeupLatency);
-                    if (kTraceDetailedInfo) {
-                        ATRACE_INT64("DispSync:WakeupLat", now - targetTime);
-                        ATRACE_INT64("DispSync:AvgWakeupLat", mWakeupLatency);
-                    }
+                    mScheduler.onWakeup(targetTime, now);
                 }
 
-                callbackInvocations = gatherCallbackInvocationsLocked(now);
+                callbackInvocations = mScheduler.gatherCallbackInvocations(now);
             }
 
             if (callbackInvocations.size() > 0) {
@@ -183,162 +175,69 @@ public:
         if (kTraceDetailedInfo) ATRACE_CALL();
         Mutex::Autolock lock(mMutex);
 
-        for (size_t i = 0; i < mEventListeners.size(); i++) {
-            if (mEventListeners[i].mCallback == callback) {
-                return BAD_VALUE;
-            }
+        status_t err = mScheduler.addEventListener(name, phase, callback,
+                mClock.now());
+        if (err == NO_ERROR) {
+            mNextEventTime = INT64_MAX;
+            mCond.signal();
         }
-
-        EventListener listener;
-        listener.mName = name;
-        listener.mPhase = phase;
-        listener.mCallback = callback;
-
-        // We want to allow the firstmost future event to fire without
-        // allowing any past events to fire
-        listener.mLastEventTime = systemTime() - mPeriod / 2 + mPhase -
-                mWakeupLatency;
-
-        mEventListeners.push(listener);
-
-        mCond.signal();
-
-        return NO_ERROR;
+        return err;
     }
 
     status_t removeEventListener(const sp<DispSync::Callback>& callback) {
         if (kTraceDetailedInfo) ATRACE_CALL();
         Mutex::Autolock lock(mMutex);
 
-        for (size_t i = 0; i < mEventListeners.size(); i++) {
-            if (mEventListeners[i].mCallback == callback) {
-                mEventListeners.removeAt(i);
-                mCond.signal();
-                return NO_ERROR;
-            }
+        status_t err = mScheduler.removeEventListener(callback);
+        if (err == NO_ERROR) {
+            mNextEventTime = INT64_MAX;
+            mCond.signal();
         }
-
-        return BAD_VALUE;
+        return err;
     }
 
-    // This method is only here to handle the kIgnorePresentFences case.
-    bool hasAnyEventListeners() {
-        if (kTraceDetailedInfo) ATRACE_CALL();
-        Mutex::Autolock lock(mMutex);
-        return !mEventListeners.empty();
-    }
-
-private:
-
-    struct EventListener {
-        const char* mName;
-        nsecs_t mPhase;
-        nsecs_t mLastEventTime;
-        sp<DispSync::Callback> mCallback;
-    };
+    // One iteration of threadLoop() at the current time of the clock, for
+    // when the thread isn't run. Reaching the time returned by the previous
+    // call is a wakeup; any change of the model or of the listeners since
+    // then is a signal, as it would have interrupted the wait.
+    nsecs_t dispatchEvents() {
+        Vector<DispSyncScheduler::CallbackInvocation> callbackInvocations;
+        nsecs_t nextEventTime = INT64_MAX;
 
-    struct CallbackInvocation {
-        sp<DispSync::Callback> mCallback;
-        nsecs_t mEventTime;
-    };
+        { // Scope for lock
+            Mutex::Autolock lock(mMutex);
 
-    nsecs_t computeNextEventTimeLocked(nsecs_t now) {
-        if (kTraceDetailedInfo) ATRACE_CALL();
-        ALOGV("[%s] computeNextEventTimeLocked", mName);
-        nsecs_t nextEventTime = INT64_MAX;
-        for (size_t i = 0; i < mEventListeners.size(); i++) {
-            nsecs_t t = computeListenerNextEventTimeLocked(mEventListeners[i],
-                    now);
+            if (!mScheduler.hasModel()) {
+                return INT64_MAX;
+            }
 
-            if (t < nextEventTime) {
-                nextEventTime = t;
+            nsecs_t now = mClock.now();
+            if (mNextEventTime != INT64_MAX && now >= mNextEventTime) {
+                mScheduler.onWakeup(mNextEventTime, now);
             }
+
+            callbackInvocations = mScheduler.gatherCallbackInvocations(now);
+            mNextEventTime = mScheduler.computeNextEventTime(now);
+            nextEventTime = mNextEventTime;
         }
 
-        ALOGV("[%s] nextEventTime = %" PRId64, mName, ns2us(nextEventTime));
+        if (callbackInvocations.size() > 0) {
+            fireCallbackInvocations(callbackInvocations);
+        }
         return nextEventTime;
     }
 
-    Vector<CallbackInvocation> gatherCallbackInvocationsLocked(nsecs_t now) {
+    // This method is only here to handle the kIgnorePresentFences case.
+    bool hasAnyEventListeners() {
         if (kTraceDetailedInfo) ATRACE_CALL();
-        ALOGV("[%s] gatherCallbackInvocationsLocked @ %" PRId64, mName,
-                ns2us(now));
-
-        Vector<CallbackInvocation> callbackInvocations;
-        nsecs_t onePeriodAgo = now - mPeriod;
-
-        for (size_t i = 0; i < mEventListeners.size(); i++) {
-            nsecs_t t = computeListenerNextEventTimeLocked(mEventListeners[i],
-                    onePeriodAgo);
-
-            if (t < now) {
-                CallbackInvocation ci;
-                ci.mCallback = mEventListeners[i].mCallback;
-                ci.mEventTime = t;
-                ALOGV("[%s] [%s] Preparing to fire", mName,
-                        mEventListeners[i].mName);
-                callbackInvocations.push(ci);
-                mEventListeners.editItemAt(i).mLastEventTime = t;
-            }
-        }
-
-        return callbackInvocations;
+        Mutex::Autolock lock(mMutex);
+        return mScheduler.hasAnyEventListeners();
     }
 
-    nsecs_t computeListenerNextEventTimeLocked(const EventListener& listener,
-            nsecs_t baseTime) {
-        if (kTraceDetailedInfo) ATRACE_CALL();
-        ALOGV("[%s] [%s] computeListenerNextEventTimeLocked(%" PRId64 ")",
-                mName, listener.mName, ns2us(baseTime));
-
-        nsecs_t lastEventTime = listener.mLastEventTime + mWakeupLatency;
-        ALOGV("[%s] lastEventTime: %" PRId64, mName, ns2us(lastEventTime));
-        if (baseTime < lastEventTime) {
-            baseTime = lastEventTime;
-            ALOGV("[%s] Clamping baseTime to lastEventTime -> %" PRId64, mName,
-                    ns2us(baseTime));
-        }
-
-        baseTime -= mReferenceTime;
-        ALOGV("[%s] Relative baseTime = %" PRId64, mName, ns2us(baseTime));
-        nsecs_t phase = mPhase + listener.mPhase;
-        ALOGV("[%s] Phase = %" PRId64, mName, ns2us(phase));
-        baseTime -= phase;
-        ALOGV("[%s] baseTime - phase = %" PRId64, mName, ns2us(baseTime));
-
-        // If our previous time is before the reference (because the reference
-        // has since been updated), the division by mPeriod will truncate
-        // towards zero instead of computing the floor. Since in all cases
-        // before the reference we want the next time to be effectively now, we
-        // set baseTime to -mPeriod so that numPeriods will be -1.
-        // When we add 1 and the phase, we will be at the correct event time for
-        // this period.
-        if (baseTime < 0) {
-            ALOGV("[%s] Correcting negative baseTime", mName);
-            baseTime = -mPeriod;
-        }
-
-        nsecs_t numPeriods = baseTime / mPeriod;
-        ALOGV("[%s] numPeriods = %" PRId64, mName, numPeriods);
-        nsecs_t t = (numPeriods + 1) * mPeriod + phase;
-        ALOGV("[%s] t = %" PRId64, mName, ns2us(t));
-        t += mReferenceTime;
-        ALOGV("[%s] Absolute t = %" PRId64, mName, ns2us(t));
-
-        // Check that it's been slightly more than half a period since the last
-        // event so that we don't accidentally fall into double-rate vsyncs
-        if (t - listener.mLastEventTime < (3 * mPeriod / 5)) {
-            t += mPeriod;
-            ALOGV("[%s] Modifying t -> %" PRId64, mName, ns2us(t));
-        }
-
-        t -= mWakeupLatency;
-        ALOGV("[%s] Corrected for wakeup latency -> %" PRId64, mName, ns2us(t));
-
-        return t;
-    }
+private:
 
-    void fireCallbackInvocations(const Vector<CallbackInvocation>& callbacks) {
+    void fireCallbackInvocations(
+            const Vector<DispSyncScheduler::CallbackInvocation>& callbacks) {
         if (kTraceDetailedInfo) ATRACE_CALL();
         for (size_t i = 0; i < callbacks.size(); i++) {
             callbacks[i].mCallback->onDispSyncEvent(callbacks[i].mEventTime);
@@ -347,16 +246,17 @@ private:
 
     const char* const mName;
 
+    const DispSync::Clock& mClock;
+
     bool mStop;
 
-    nsecs_t mPeriod;
-    nsecs_t mPhase;
-    nsecs_t mReferenceTime;
-    nsecs_t mWakeupLatency;
+    // Computes the event times, see DispSyncScheduler
+    DispSyncScheduler mScheduler;
 
     int64_t mFrameNumber;
 
-    Vector<EventListener> mEventListeners;
+    // When dispatchEvents() must be called next, see dispatchEvents()
+    nsecs_t mNextEventTime;
 
     Mutex mMutex;
     Condition mCond;
@@ -378,10 +278,33 @@ private:
     bool mParity;
 };
 
+class MonotonicClock : public DispSync::Clock {
+public:
+    virtual nsecs_t now() const {
+        return systemTime(SYSTEM_TIME_MONOTONIC);
+    }
+
+    virtual nsecs_t getSignalTime(const sp<Fence>& fence) const {
+        return fence->getSignalTime();
+    }
+};
+
+static MonotonicClock sMonotonicClock;
+
+static DispSyncModel::Estimator getModelEstimator() {
+    char value[PROPERTY_VALUE_MAX];
+    property_get("debug.sf.dispsync_robust", value, "1");
+    return atoi(value) ? DispSyncModel::ESTIMATOR_ROBUST :
+            DispSyncModel::ESTIMATOR_AVERAGE;
+}
+
 DispSync::DispSync(const char* name) :
         mName(name),
+        mModel(getModelEstimator()),
         mRefreshSkipCount(0),
-        mThread(new DispSyncThread(name)) {
+        mClock(&sMonotonicClock),
+        mThreaded(true),
+        mThread(new DispSyncThread(name, *mClock)) {
 
     mThread->run("DispSync", PRIORITY_URGENT_DISPLAY + PRIORITY_MORE_FAVORABLE);
     // set DispSync to SCHED_FIFO to minimize jitter
@@ -393,6 +316,20 @@ DispSync::DispSync(const char* name) :
 
     android_set_rt_ioprio(mThread->getTid(), 1);
 
+    init();
+}
+
+DispSync::DispSync(const char* name, Clock* clock) :
+        mName(name),
+        mModel(getModelEstimator()),
+        mRefreshSkipCount(0),
+        mClock(clock),
+        mThreaded(false),
+        mThread(new DispSyncThread(name, *mClock)) {
+    init();
+}
+
+void DispSync::init() {
     reset();
     beginResync();
 
@@ -416,8 +353,7 @@ void DispSync::reset() {
     mPhase = 0;
     mReferenceTime = 0;
     mModelUpdated = false;
-    mNumResyncSamples = 0;
-    mFirstResyncSample = 0;
+    mModel.clearSamples();
     mNumResyncSamplesSincePresent = 0;
 #ifdef HH_VSYNC_ISSUE
     mNumPresentWithoutResyncSamples = 0;
@@ -436,7 +372,7 @@ bool DispSync::addPresentFence(const sp<Fence>& fence) {
     for (size_t i = 0; i < NUM_PRESENT_SAMPLES; i++) {
         const sp<Fence>& f(mPresentFences[i]);
         if (f != NULL) {
-            nsecs_t t = f->getSignalTime();
+            nsecs_t t = mClock->getSignalTime(f);
             if (t < INT64_MAX) {
                 mPresentFences[i].clear();
                 mPresentTimes[i] = t + kPresentTimeOffset;
@@ -450,7 +386,7 @@ bool DispSync::addPresentFence(const sp<Fence>& fence) {
     // This is a workaround for b/25845510.
     // If we have no resync samples after many presents, something is wrong with
     // HW vsync. Tell SF to disable HW vsync now and re-enable it next time.
-    if (mNumResyncSamples == 0 &&
+    if (mModel.getSampleCount() == 0 &&
         mNumPresentWithoutResyncSamples++ > MAX_PRESENT_WITHOUT_RESYNC_SAMPLES) {
         mNumPresentWithoutResyncSamples = 0;
         return false;
@@ -464,7 +400,7 @@ void DispSync::beginResync() {
     Mutex::Autolock lock(mMutex);
     ALOGV("[%s] beginResync", mName);
     mModelUpdated = false;
-    mNumResyncSamples = 0;
+    mModel.clearSamples();
 #ifdef HH_VSYNC_ISSUE
     mNumPresentWithoutResyncSamples = 0;
 #endif
@@ -475,9 +411,7 @@ bool DispSync::addResyncSample(nsecs_t timestamp) {
 
     ALOGV("[%s] addResyncSample(%" PRId64 ")", mName, ns2us(timestamp));
 
-    size_t idx = (mFirstResyncSample + mNumResyncSamples) % MAX_RESYNC_SAMPLES;
-    mResyncSamples[idx] = timestamp;
-    if (mNumResyncSamples == 0) {
+    if (mModel.getSampleCount() == 0) {
         mPhase = 0;
         mReferenceTime = timestamp;
         ALOGV("[%s] First resync sample: mPeriod = %" PRId64 ", mPhase = 0, "
@@ -486,14 +420,10 @@ bool DispSync::addResyncSample(nsecs_t timestamp) {
         mThread->updateModel(mPeriod, mPhase, mReferenceTime);
     }
 
-    if (mNumResyncSamples < MAX_RESYNC_SAMPLES) {
-        mNumResyncSamples++;
-    } else {
-        mFirstResyncSample = (mFirstResyncSample + 1) % MAX_RESYNC_SAMPLES;
+    if (mModel.addSample(timestamp)) {
+        updateModelLocked();
     }
 
-    updateModelLocked();
-
     if (mNumResyncSamplesSincePresent++ > MAX_RESYNC_SAMPLES_WITHOUT_PRESENT) {
         resetErrorLocked();
     }
@@ -510,6 +440,10 @@ bool DispSync::addResyncSample(nsecs_t timestamp) {
     // Check against kErrorThreshold / 2 to add some hysteresis before having to
     // resync again
     bool modelLocked = mModelUpdated && mError < (kErrorThreshold / 2);
+    if (mModel.getEstimator() == DispSyncModel::ESTIMATOR_ROBUST) {
+        modelLocked = modelLocked &&
+                mModel.getConfidence() >= kMinLockedConfidence;
+    }
     ALOGV("[%s] addResyncSample returning %s", mName,
             modelLocked ? "locked" : "unlocked");
     return !modelLocked;
@@ -538,6 +472,7 @@ status_t DispSync::removeEventListener(const sp<Callback>& callback) {
 
 void DispSync::setPeriod(nsecs_t period) {
     Mutex::Autolock lock(mMutex);
+    mModel.setPeriod(period);
     mPeriod = period;
     mPhase = 0;
     mReferenceTime = 0;
@@ -551,54 +486,20 @@ nsecs_t DispSync::getPeriod() {
 }
 
 void DispSync::updateModelLocked() {
-    ALOGV("[%s] updateModelLocked %zu", mName, mNumResyncSamples);
-    if (mNumResyncSamples >= MIN_RESYNC_SAMPLES_FOR_UPDATE) {
-        ALOGV("[%s] Computing...", mName);
-        nsecs_t durationSum = 0;
-        nsecs_t minDuration = INT64_MAX;
-        nsecs_t maxDuration = 0;
-        for (size_t i = 1; i < mNumResyncSamples; i++) {
-            size_t idx = (mFirstResyncSample + i) % MAX_RESYNC_SAMPLES;
-            size_t prev = (idx + MAX_RESYNC_SAMPLES - 1) % MAX_RESYNC_SAMPLES;
-            nsecs_t duration = mResyncSamples[idx] - mResyncSamples[prev];
-            durationSum += duration;
-            minDuration = min(minDuration, duration);
-            maxDuration = max(maxDuration, duration);
-        }
-
-        // Exclude the min and max from the average
-        durationSum -= minDuration + maxDuration;
-        mPeriod = durationSum / (mNumResyncSamples - 3);
-
-        ALOGV("[%s] mPeriod = %" PRId64, mName, ns2us(mPeriod));
-
-        double sampleAvgX = 0;
-        double sampleAvgY = 0;
-        double scale = 2.0 * M_PI / double(mPeriod);
-        // Intentionally skip the first sample
-        for (size_t i = 1; i < mNumResyncSamples; i++) {
-            size_t idx = (mFirstResyncSample + i) % MAX_RESYNC_SAMPLES;
-            nsecs_t sample = mResyncSamples[idx] - mReferenceTime;
-            double samplePhase = double(sample % mPeriod) * scale;
-            sampleAvgX += cos(samplePhase);
-            sampleAvgY += sin(samplePhase);
-        }
-
-        sampleAvgX /= double(mNumResyncSamples - 1);
-        sampleAvgY /= double(mNumResyncSamples - 1);
-
-        mPhase = nsecs_t(atan2(sampleAvgY, sampleAvgX) / scale);
+    ALOGV("[%s] updateModelLocked %zu", mName, mModel.getSampleCount());
+    if (mModel.isValid()) {
+        mPeriod = mModel.getPeriod();
+        mPhase = mModel.getPhase();
+        mReferenceTime = mModel.getReferenceTime();
 
-        ALOGV("[%s] mPhase = %" PRId64, mName, ns2us(mPhase));
-
-        if (mPhase < -(mPeriod / 2)) {
-            mPhase += mPeriod;
-            ALOGV("[%s] Adjusting mPhase -> %" PRId64, mName, ns2us(mPhase));
-        }
+        ALOGV("[%s] mPeriod = %" PRId64 ", mPhase = %" PRId64, mName,
+                ns2us(mPeriod), ns2us(mPhase));
 
         if (kTraceDetailedInfo) {
             ATRACE_INT64("DispSync:Period", mPeriod);
             ATRACE_INT64("DispSync:Phase", mPhase + mPeriod / 2);
+            ATRACE_INT("DispSync:Confidence",
+                    int32_t(mModel.getConfidence() * 100));
         }
 
         // Artificially inflate the period if requested.
@@ -620,6 +521,7 @@ void DispSync::updateErrorLocked() {
 
     int numErrSamples = 0;
     nsecs_t sqErrSum = 0;
+    nsecs_t maxSqErr = 0;
 
     for (size_t i = 0; i < NUM_PRESENT_SAMPLES; i++) {
         nsecs_t sample = mPresentTimes[i] - mReferenceTime;
@@ -629,10 +531,19 @@ void DispSync::updateErrorLocked() {
                 sampleErr -= period;
             }
             sqErrSum += sampleErr * sampleErr;
+            maxSqErr = max(maxSqErr, sampleErr * sampleErr);
             numErrSamples++;
         }
     }
 
+    // A single late fence timestamp shouldn't force a resync: the robust
+    // estimator leaves the worst sample out.
+    if (mModel.getEstimator() == DispSyncModel::ESTIMATOR_ROBUST &&
+            numErrSamples > 2) {
+        sqErrSum -= maxSqErr;
+        numErrSamples--;
+    }
+
     if (numErrSamples > 0) {
         mError = sqErrSum / numErrSamples;
     } else {
@@ -653,13 +564,24 @@ void DispSync::resetErrorLocked() {
     }
 }
 
+float DispSync::getModelConfidence() const {
+    Mutex::Autolock lock(mMutex);
+    return mModel.getConfidence();
+}
+
 nsecs_t DispSync::computeNextRefresh(int periodOffset) const {
     Mutex::Autolock lock(mMutex);
-    nsecs_t now = systemTime(SYSTEM_TIME_MONOTONIC);
+    nsecs_t now = mClock->now();
     nsecs_t phase = mReferenceTime + mPhase;
     return (((now - phase) / mPeriod) + periodOffset + 1) * mPeriod + phase;
 }
 
+nsecs_t DispSync::dispatchEvents() {
+    LOG_ALWAYS_FATAL_IF(mThreaded,
+            "[%s] dispatchEvents() with a callback thread", mName);
+    return mThread->dispatchEvents();
+}
+
 void DispSync::dump(String8& result) const {
     Mutex::Autolock lock(mMutex);
     result.appendFormat("present fences are %s\n",
@@ -671,14 +593,18 @@ void DispSync::dump(String8& result) const {
             mError, sqrt(mError));
     result.appendFormat("mNumResyncSamplesSincePresent: %d (limit %d)\n",
             mNumResyncSamplesSincePresent, MAX_RESYNC_SAMPLES_WITHOUT_PRESENT);
+    result.appendFormat("model: %s estimator, confidence %.2f, "
+            "%zu outliers, %u rate changes\n",
+            DispSyncModel::getEstimatorName(mModel.getEstimator()),
+            mModel.getConfidence(), mModel.getOutlierCount(),
+            mModel.getRateChangeCount());
     result.appendFormat("mNumResyncSamples: %zd (max %d)\n",
-            mNumResyncSamples, MAX_RESYNC_SAMPLES);
+            mModel.getSampleCount(), DispSyncModel::MAX_SAMPLES);
 
     result.appendFormat("mResyncSamples:\n");
     nsecs_t previous = -1;
-    for (size_t i = 0; i < mNumResyncSamples; i++) {
-        size_t idx = (mFirstResyncSample + i) % MAX_RESYNC_SAMPLES;
-        nsecs_t sampleTime = mResyncSamples[idx];
+    for (size_t i = 0; i < mModel.getSampleCount(); i++) {
+        nsecs_t sampleTime = mModel.getSample(i);
         if (i == 0) {
             result.appendFormat("  %" PRId64 "\n", sampleTime);
         } else {
@@ -690,7 +616,7 @@ void DispSync::dump(String8& result) const {
 
     result.appendFormat("mPresentFences / mPresentTimes [%d]:\n",
             NUM_PRESENT_SAMPLES);
-    nsecs_t now = systemTime(SYSTEM_TIME_MONOTONIC);
+    nsecs_t now = mClock->now();
     previous = 0;
     for (size_t i = 0; i < NUM_PRESENT_SAMPLES; i++) {
         size_t idx = (i + mPresentSampleOffset) % NUM_PRESENT_SAMPLES;
@@ -23,6 +23,8 @@
 #include <utils/Timers.h>
 #include <utils/RefBase.h>
 
+#include "DispSyncModel.h"
+
 namespace android {
 
 // Ignore present (retire) fences if the device doesn't have support for the
@@ -61,7 +63,23 @@ public:
         virtual void onDispSyncEvent(nsecs_t when) = 0;
     };
 
+    // Clock gives DispSync the current time and the signal time of the
+    // present fences. The default one reads the monotonic clock and the
+    // fences themselves; tests substitute a simulated one.
+    class Clock {
+    public:
+        virtual ~Clock() {}
+        virtual nsecs_t now() const = 0;
+        virtual nsecs_t getSignalTime(const sp<Fence>& fence) const = 0;
+    };
+
     DispSync(const char* name);
+
+    // This constructor runs DispSync on the given clock, which must outlive
+    // it, and doesn't start the callback thread: the callbacks are called
+    // from dispatchEvents() instead. It is meant for tests.
+    DispSync(const char* name, Clock* clock);
+
     ~DispSync();
 
     // reset clears the resync samples and error value.
@@ -119,6 +137,10 @@ public:
     // DispSync object.
     status_t removeEventListener(const sp<Callback>& callback);
 
+    // getModelConfidence returns the confidence in the vsync event model,
+    // between 0 (no model) and 1, see DispSyncModel::getConfidence().
+    float getModelConfidence() const;
+
     // computeNextRefresh computes when the next refresh is expected to begin.
     // The periodOffset value can be used to move forward or backward; an
     // offset of zero is the next refresh, -1 is the previous refresh, 1 is
@@ -128,14 +150,19 @@ public:
     // dump appends human-readable debug info to the result string.
     void dump(String8& result) const;
 
+    // dispatchEvents calls the callbacks that are due at the current time of
+    // the clock, as the callback thread would when it wakes up, and returns
+    // when the next ones are due, INT64_MAX if none is. Only for a DispSync
+    // constructed without a callback thread.
+    nsecs_t dispatchEvents();
+
 private:
+    void init();
 
     void updateModelLocked();
     void updateErrorLocked();
     void resetErrorLocked();
 
-    enum { MAX_RESYNC_SAMPLES = 32 };
-    enum { MIN_RESYNC_SAMPLES_FOR_UPDATE = 6 };
     enum { NUM_PRESENT_SAMPLES = 8 };
     enum { MAX_RESYNC_SAMPLES_WITHOUT_PRESENT = 4 };
 #ifdef HH_VSYNC_ISSUE
@@ -164,12 +191,9 @@ private:
     // Whether we have updated the vsync event model since the last resync.
     bool mModelUpdated;
 
-    // These member variables are the state used during the resynchronization
-    // process to store information about the hardware vsync event times used
-    // to compute the model.
-    nsecs_t mResyncSamples[MAX_RESYNC_SAMPLES];
-    size_t mFirstResyncSample;
-    size_t mNumResyncSamples;
+    // mModel holds the hardware vsync event times gathered during the
+    // resynchronization process, and computes mPeriod and mPhase from them.
+    DispSyncModel mModel;
     int mNumResyncSamplesSincePresent;
 #ifdef HH_VSYNC_ISSUE
     int mNumPresentWithoutResyncSamples;
@@ -183,6 +207,13 @@ private:
 
     int mRefreshSkipCount;
 
+    // mClock is where the current time and the present times are read.
+    Clock* const mClock;
+
+    // Whether mThread runs; when it doesn't, dispatchEvents() calls the
+    // callbacks.
+    const bool mThreaded;
+
     // mThread is the thread from which all the callbacks are called.
     sp<DispSyncThread> mThread;
 
@@ -0,0 +1,343 @@
+/*
+ * Copyright (C) 2016 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+// This is needed for stdint.h to define INT64_MAX in C++
+#define __STDC_LIMIT_MACROS
+
+#include <math.h>
+#include <stdlib.h>
+
+#include "DispSyncModel.h"
+
+#include <algorithm>
+
+using std::max;
+using std::min;
+
+namespace android {
+
+// Samples within this distance of the model are considered to fit it, see
+// getConfidence(). It matches the 400 usec of DispSync's kErrorThreshold.
+static const nsecs_t kFitThreshold = 400000;
+
+// The robust estimator rejects the samples further from its first fit than
+// kOutlierDeviations times the standard deviation of the residuals, as
+// estimated from their median absolute deviation, but never those within
+// kMinOutlierThreshold.
+static const double kOutlierDeviations = 3.0;
+static const nsecs_t kMinOutlierThreshold = 200000;   // 200 usec
+
+// Fewest samples the robust estimator fits a line through.
+static const size_t kMinInliers = 3;
+
+// A refresh rate change is detected when RATE_CHANGE_INTERVALS consecutive
+// intervals differ from the modeled period by more than this percentage,
+// and from each other by less.
+static const nsecs_t kRateChangePercent = 10;
+
+// Least-squares fit of y = slope * x + intercept over the points in use.
+static bool fitLine(const double* x, const double* y, const bool* use,
+        size_t count, double* outSlope, double* outIntercept) {
+    double n = 0;
+    double meanX = 0;
+    double meanY = 0;
+    for (size_t i = 0; i < count; i++) {
+        if (use[i]) {
+            n += 1;
+            meanX += x[i];
+            meanY += y[i];
+        }
+    }
+    if (n < 2) {
+        return false;
+    }
+    meanX /= n;
+    meanY /= n;
+
+    double sxx = 0;
+    double sxy = 0;
+    for (size_t i = 0; i < count; i++) {
+        if (use[i]) {
+            sxx += (x[i] - meanX) * (x[i] - meanX);
+            sxy += (x[i] - meanX) * (y[i] - meanY);
+        }
+    }
+    if (sxx <= 0) {
+        return false;
+    }
+    *outSlope = sxy / sxx;
+    *outIntercept = meanY - *outSlope * meanX;
+    return true;
+}
+
+DispSyncModel::DispSyncModel(Estimator estimator) :
+        mEstimator(estimator),
+        mPeriod(0),
+        mPhase(0),
+        mReferenceTime(0),
+        mValid(false),
+        mFirstSample(0),
+        mNumSamples(0),
+        mConfidence(0),
+        mOutlierCount(0),
+        mRateChangeCount(0) {
+}
+
+const char* DispSyncModel::getEstimatorName(Estimator estimator) {
+    switch (estimator) {
+        case ESTIMATOR_AVERAGE:
+            return "average";
+        case ESTIMATOR_ROBUST:
+            return "robust";
+    }
+    return "unknown";
+}
+
+void DispSyncModel::clearSamples() {
+    mFirstSample = 0;
+    mNumSamples = 0;
+    mPhase = 0;
+    mValid = false;
+    mConfidence = 0;
+    mOutlierCount = 0;
+}
+
+void DispSyncModel::setPeriod(nsecs_t period) {
+    mPeriod = period;
+    mPhase = 0;
+    mReferenceTime = 0;
+}
+
+nsecs_t DispSyncModel::getSample(size_t index) const {
+    return mSamples[(mFirstSample + index) % MAX_SAMPLES];
+}
+
+bool DispSyncModel::addSample(nsecs_t timestamp) {
+    if (mNumSamples == 0) {
+        mPhase = 0;
+        mReferenceTime = timestamp;
+    }
+
+    size_t idx = (mFirstSample + mNumSamples) % MAX_SAMPLES;
+    mSamples[idx] = timestamp;
+    if (mNumSamples < MAX_SAMPLES) {
+        mNumSamples++;
+    } else {
+        mFirstSample = (mFirstSample + 1) % MAX_SAMPLES;
+    }
+
+    if (mEstimator == ESTIMATOR_ROBUST) {
+        // After a rate change, fit the new rate without waiting for a full
+        // set of samples
+        if (!detectRateChange() && mNumSamples < MIN_SAMPLES_FOR_UPDATE) {
+            return false;
+        }
+        fitRobust();
+    } else {
+        if (mNumSamples < MIN_SAMPLES_FOR_UPDATE) {
+            return false;
+        }
+        fitAverage();
+    }
+
+    if (mValid) {
+        updateConfidence();
+    }
+    return mValid;
+}
+
+void DispSyncModel::fitAverage() {
+    nsecs_t durationSum = 0;
+    nsecs_t minDuration = INT64_MAX;
+    nsecs_t maxDuration = 0;
+    for (size_t i = 1; i < mNumSamples; i++) {
+        nsecs_t duration = getSample(i) - getSample(i - 1);
+        durationSum += duration;
+        minDuration = min(minDuration, duration);
+        maxDuration = max(maxDuration, duration);
+    }
+
+    // Exclude the min and max from the average
+    durationSum -= minDuration + maxDuration;
+    mPeriod = durationSum / nsecs_t(mNumSamples - 3);
+
+    double sampleAvgX = 0;
+    double sampleAvgY = 0;
+    double scale = 2.0 * M_PI / double(mPeriod);
+    // Intentionally skip the first sample
+    for (size_t i = 1; i < mNumSamples; i++) {
+        nsecs_t sample = getSample(i) - mReferenceTime;
+        double samplePhase = double(sample % mPeriod) * scale;
+        sampleAvgX += cos(samplePhase);
+        sampleAvgY += sin(samplePhase);
+    }
+
+    sampleAvgX /= double(mNumSamples - 1);
+    sampleAvgY /= double(mNumSamples - 1);
+
+    mPhase = nsecs_t(atan2(sampleAvgY, sampleAvgX) / scale);
+    if (mPhase < -(mPeriod / 2)) {
+        mPhase += mPeriod;
+    }
+
+    mOutlierCount = 0;
+    mValid = true;
+}
+
+void DispSyncModel::fitRobust() {
+    const size_t count = mNumSamples;
+
+    // Period hint: median of the intervals between the samples. Once there
+    // is a model each interval is divided by the number of vsync events it
+    // spans, so that a missing sample doesn't read as a long period.
+    nsecs_t intervals[MAX_SAMPLES];
+    for (size_t i = 1; i < count; i++) {
+        nsecs_t interval = getSample(i) - getSample(i - 1);
+        if (mValid && mPeriod > 0) {
+            interval /= max(nsecs_t(1), (interval + mPeriod / 2) / mPeriod);
+        }
+        intervals[i - 1] = interval;
+    }
+    nsecs_t* median = intervals + (count - 1) / 2;
+    std::nth_element(intervals, median, intervals + count - 1);
+    const nsecs_t hint = *median;
+    if (hint <= 0) {
+        return;
+    }
+
+    // Place the samples on the vsync grid and fit a line through them: its
+    // slope is the period.
+    const nsecs_t origin = getSample(0);
+    double x[MAX_SAMPLES];
+    double y[MAX_SAMPLES];
+    bool inlier[MAX_SAMPLES];
+    for (size_t i = 0; i < count; i++) {
+        y[i] = double(getSample(i) - origin);
+        x[i] = floor(y[i] / double(hint) + 0.5);
+        inlier[i] = true;
+    }
+    double slope;
+    double intercept;
+    if (!fitLine(x, y, inlier, count, &slope, &intercept)) {
+        return;
+    }
+
+    // Reject the samples too far from the line, and fit again without them
+    double deviations[MAX_SAMPLES];
+    double sortedDeviations[MAX_SAMPLES];
+    for (size_t i = 0; i < count; i++) {
+        deviations[i] = fabs(y[i] - (slope * x[i] + intercept));
+        sortedDeviations[i] = deviations[i];
+    }
+    double* medianDeviation = sortedDeviations + count / 2;
+    std::nth_element(sortedDeviations, medianDeviation,
+            sortedDeviations + count);
+    // 1.4826 scales the median absolute deviation to a standard deviation
+    const double threshold = max(double(kMinOutlierThreshold),
+            kOutlierDeviations * 1.4826 * *medianDeviation);
+    size_t inliers = 0;
+    for (size_t i = 0; i < count; i++) {
+        inlier[i] = deviations[i] <= threshold;
+        inliers += inlier[i] ? 1 : 0;
+    }
+    mOutlierCount = 0;
+    if (inliers < count && inliers >= kMinInliers &&
+            fitLine(x, y, inlier, count, &slope, &intercept)) {
+        mOutlierCount = count - inliers;
+    }
+
+    const nsecs_t period = nsecs_t(slope + 0.5);
+    if (period <= 0) {
+        return;
+    }
+    mPeriod = period;
+    setPhase(origin + nsecs_t(intercept));
+    mValid = true;
+}
+
+bool DispSyncModel::detectRateChange() {
+    if (!mValid || mPeriod <= 0 || mNumSamples < RATE_CHANGE_INTERVALS + 1) {
+        return false;
+    }
+
+    nsecs_t sum = 0;
+    nsecs_t minInterval = INT64_MAX;
+    nsecs_t maxInterval = 0;
+    for (size_t i = mNumSamples - RATE_CHANGE_INTERVALS; i < mNumSamples; i++) {
+        nsecs_t interval = getSample(i) - getSample(i - 1);
+        if (llabs(interval - mPeriod) * 100 < mPeriod * kRateChangePercent) {
+            return false;
+        }
+        sum += interval;
+        minInterval = min(minInterval, interval);
+        maxInterval = max(maxInterval, interval);
+    }
+    if ((maxInterval - minInterval) * 100 > minInterval * kRateChangePercent) {
+        return false;
+    }
+
+    // Only keep the samples taken at the new rate
+    size_t drop = mNumSamples - (RATE_CHANGE_INTERVALS + 1);
+    mFirstSample = (mFirstSample + drop) % MAX_SAMPLES;
+    mNumSamples -= drop;
+    mPeriod = sum / RATE_CHANGE_INTERVALS;
+    mValid = false;
+    mRateChangeCount++;
+    return true;
+}
+
+void DispSyncModel::setPhase(nsecs_t firstVsync) {
+    mPhase = (firstVsync - mReferenceTime) % mPeriod;
+    if (mPhase > mPeriod / 2) {
+        mPhase -= mPeriod;
+    } else if (mPhase < -(mPeriod / 2)) {
+        mPhase += mPeriod;
+    }
+}
+
+nsecs_t DispSyncModel::getError(nsecs_t timestamp) const {
+    if (mPeriod <= 0) {
+        return 0;
+    }
+    nsecs_t error = (timestamp - mReferenceTime - mPhase) % mPeriod;
+    if (error > mPeriod / 2) {
+        error -= mPeriod;
+    } else if (error < -(mPeriod / 2)) {
+        error += mPeriod;
+    }
+    return error;
+}
+
+void DispSyncModel::updateConfidence() {
+    size_t fits = 0;
+    double sqErrSum = 0;
+    for (size_t i = 0; i < mNumSamples; i++) {
+        nsecs_t error = getError(getSample(i));
+        if (llabs(error) <= kFitThreshold) {
+            fits++;
+            sqErrSum += double(error) * double(error);
+        }
+    }
+    if (fits == 0) {
+        mConfidence = 0;
+        return;
+    }
+    double rms = sqrt(sqErrSum / fits);
+    mConfidence = float(double(fits) / mNumSamples *
+            max(0.0, 1.0 - rms / kFitThreshold));
+}
+
+} // namespace android
@@ -0,0 +1,121 @@
+/*
+ * Copyright (C) 2016 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef ANDROID_DISPSYNC_MODEL_H
+#define ANDROID_DISPSYNC_MODEL_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include <utils/Timers.h>
+
+namespace android {
+
+// DispSyncModel fits the period and phase of the hardware vsync events to
+// the consecutive hardware vsync timestamps given to addSample(). It is the
+// model computed by DispSync, without the thread and fences around it, so
+// that recorded traces can be replayed through it offline (see
+// tests/dispsync).
+//
+// Not thread safe, DispSync protects it with its own mutex.
+class DispSyncModel {
+public:
+    enum Estimator {
+        // Average of the intervals between the samples, without the shortest
+        // and the longest, and circular mean of their phases.
+        ESTIMATOR_AVERAGE,
+        // Least-squares fit of the samples placed on the vsync grid. Samples
+        // too far from the fit are rejected and the fit is computed again
+        // without them; a run of intervals that agree with each other but
+        // not with the model is taken as a refresh rate change, and drops
+        // the samples taken at the previous rate.
+        ESTIMATOR_ROBUST,
+    };
+
+    explicit DispSyncModel(Estimator estimator);
+
+    Estimator getEstimator() const { return mEstimator; }
+    static const char* getEstimatorName(Estimator estimator);
+
+    // clearSamples drops the samples and invalidates the model, the period
+    // is kept as a hint for the next fit.
+    void clearSamples();
+
+    // setPeriod primes the period before any sample was fitted.
+    void setPeriod(nsecs_t period);
+
+    // addSample adds a hardware vsync timestamp and returns true if the
+    // model was updated. The first sample after clearSamples() becomes the
+    // reference time.
+    bool addSample(nsecs_t timestamp);
+
+    // Whether the model was fitted since the last clearSamples().
+    bool isValid() const { return mValid; }
+
+    nsecs_t getPeriod() const { return mPeriod; }
+    // Offset of the modeled vsync events from the reference time, between
+    // -period/2 and period/2.
+    nsecs_t getPhase() const { return mPhase; }
+    nsecs_t getReferenceTime() const { return mReferenceTime; }
+
+    // Signed distance from timestamp to the nearest modeled vsync event.
+    nsecs_t getError(nsecs_t timestamp) const;
+
+    // Confidence in the model between 0 (no model) and 1: the fraction of
+    // the samples within kFitThreshold of the model, scaled down as the rms
+    // error of these samples grows towards the threshold.
+    float getConfidence() const { return mConfidence; }
+
+    // Samples left out of the last fit.
+    size_t getOutlierCount() const { return mOutlierCount; }
+    // Refresh rate changes detected since the model was created.
+    uint32_t getRateChangeCount() const { return mRateChangeCount; }
+
+    // The samples of the model, oldest first.
+    size_t getSampleCount() const { return mNumSamples; }
+    nsecs_t getSample(size_t index) const;
+
+    enum { MAX_SAMPLES = 32 };
+    enum { MIN_SAMPLES_FOR_UPDATE = 6 };
+
+private:
+    enum { RATE_CHANGE_INTERVALS = 3 };
+
+    void fitAverage();
+    void fitRobust();
+    bool detectRateChange();
+    void setPhase(nsecs_t firstVsync);
+    void updateConfidence();
+
+    const Estimator mEstimator;
+
+    nsecs_t mPeriod;
+    nsecs_t mPhase;
+    nsecs_t mReferenceTime;
+    bool mValid;
+
+    nsecs_t mSamples[MAX_SAMPLES];
+    size_t mFirstSample;
+    size_t mNumSamples;
+
+    float mConfidence;
+    size_t mOutlierCount;
+    uint32_t mRateChangeCount;
+};
+
+}
+
+#endif // ANDROID_DISPSYNC_MODEL_H
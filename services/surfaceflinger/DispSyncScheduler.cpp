@@ -0,0 +1,199 @@
+/*
+ * Copyright (C) 2016 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#define ATRACE_TAG ATRACE_TAG_GRAPHICS
+#define LOG_TAG "DispSyncThread"
+//#define LOG_NDEBUG 0
+
+// This is needed for stdint.h to define INT64_MAX in C++
+#define __STDC_LIMIT_MACROS
+
+#include <inttypes.h>
+
+#include <cutils/log.h>
+
+#include <utils/Trace.h>
+
+#include "DispSyncScheduler.h"
+
+#include <algorithm>
+
+using std::min;
+
+namespace android {
+
+// Setting this to true enables verbose tracing that can be used to debug
+// vsync event model or phase issues, see DispSync.cpp.
+static const bool kTraceDetailedInfo = false;
+
+DispSyncScheduler::DispSyncScheduler(const char* name) :
+        mName(name),
+        mPeriod(0),
+        mPhase(0),
+        mReferenceTime(0),
+        mWakeupLatency(0) {
+}
+
+void DispSyncScheduler::updateModel(nsecs_t period, nsecs_t phase,
+        nsecs_t referenceTime) {
+    mPeriod = period;
+    mPhase = phase;
+    mReferenceTime = referenceTime;
+    ALOGV("[%s] updateModel: mPeriod = %" PRId64 ", mPhase = %" PRId64
+            " mReferenceTime = %" PRId64, mName, ns2us(mPeriod),
+            ns2us(mPhase), ns2us(mReferenceTime));
+}
+
+status_t DispSyncScheduler::addEventListener(const char* name, nsecs_t phase,
+        const sp<DispSync::Callback>& callback, nsecs_t now) {
+    for (size_t i = 0; i < mEventListeners.size(); i++) {
+        if (mEventListeners[i].mCallback == callback) {
+            return BAD_VALUE;
+        }
+    }
+
+    EventListener listener;
+    listener.mName = name;
+    listener.mPhase = phase;
+    listener.mCallback = callback;
+
+    // We want to allow the firstmost future event to fire without
+    // allowing any past events to fire
+    listener.mLastEventTime = now - mPeriod / 2 + mPhase - mWakeupLatency;
+
+    mEventListeners.push(listener);
+    return NO_ERROR;
+}
+
+status_t DispSyncScheduler::removeEventListener(
+        const sp<DispSync::Callback>& callback) {
+    for (size_t i = 0; i < mEventListeners.size(); i++) {
+        if (mEventListeners[i].mCallback == callback) {
+            mEventListeners.removeAt(i);
+            return NO_ERROR;
+        }
+    }
+    return BAD_VALUE;
+}
+
+nsecs_t DispSyncScheduler::computeNextEventTime(nsecs_t now) {
+    if (kTraceDetailedInfo) ATRACE_CALL();
+    ALOGV("[%s] computeNextEventTime", mName);
+    nsecs_t nextEventTime = INT64_MAX;
+    for (size_t i = 0; i < mEventListeners.size(); i++) {
+        nsecs_t t = computeListenerNextEventTime(mEventListeners[i], now);
+
+        if (t < nextEventTime) {
+            nextEventTime = t;
+        }
+    }
+
+    ALOGV("[%s] nextEventTime = %" PRId64, mName, ns2us(nextEventTime));
+    return nextEventTime;
+}
+
+void DispSyncScheduler::onWakeup(nsecs_t targetTime, nsecs_t now) {
+    // Don't correct by more than 1.5 ms
+    static const nsecs_t kMaxWakeupLatency = us2ns(1500);
+
+    mWakeupLatency = ((mWakeupLatency * 63) + (now - targetTime)) / 64;
+    mWakeupLatency = min(mWakeupLatency, kMaxWakeupLatency);
+    if (kTraceDetailedInfo) {
+        ATRACE_INT64("DispSync:WakeupLat", now - targetTime);
+        ATRACE_INT64("DispSync:AvgWakeupLat", mWakeupLatency);
+    }
+}
+
+Vector<DispSyncScheduler::CallbackInvocation>
+DispSyncScheduler::gatherCallbackInvocations(nsecs_t now) {
+    if (kTraceDetailedInfo) ATRACE_CALL();
+    ALOGV("[%s] gatherCallbackInvocations @ %" PRId64, mName, ns2us(now));
+
+    Vector<CallbackInvocation> callbackInvocations;
+    nsecs_t onePeriodAgo = now - mPeriod;
+
+    for (size_t i = 0; i < mEventListeners.size(); i++) {
+        nsecs_t t = computeListenerNextEventTime(mEventListeners[i],
+                onePeriodAgo);
+
+        if (t < now) {
+            CallbackInvocation ci;
+            ci.mCallback = mEventListeners[i].mCallback;
+            ci.mEventTime = t;
+            ALOGV("[%s] [%s] Preparing to fire", mName,
+                    mEventListeners[i].mName);
+            callbackInvocations.push(ci);
+            mEventListeners.editItemAt(i).mLastEventTime = t;
+        }
+    }
+
+    return callbackInvocations;
+}
+
+nsecs_t DispSyncScheduler::computeListenerNextEventTime(
+        const EventListener& listener, nsecs_t baseTime) {
+    if (kTraceDetailedInfo) ATRACE_CALL();
+    ALOGV("[%s] [%s] computeListenerNextEventTime(%" PRId64 ")",
+            mName, listener.mName, ns2us(baseTime));
+
+    nsecs_t lastEventTime = listener.mLastEventTime + mWakeupLatency;
+    ALOGV("[%s] lastEventTime: %" PRId64, mName, ns2us(lastEventTime));
+    if (baseTime < lastEventTime) {
+        baseTime = lastEventTime;
+        ALOGV("[%s] Clamping baseTime to lastEventTime -> %" PRId64, mName,
+                ns2us(baseTime));
+    }
+
+    baseTime -= mReferenceTime;
+    ALOGV("[%s] Relative baseTime = %" PRId64, mName, ns2us(baseTime));
+    nsecs_t phase = mPhase + listener.mPhase;
+    ALOGV("[%s] Phase = %" PRId64, mName, ns2us(phase));
+    baseTime -= phase;
+    ALOGV("[%s] baseTime - phase = %" PRId64, mName, ns2us(baseTime));
+
+    // If our previous time is before the reference (because the reference
+    // has since been updated), the division by mPeriod will truncate
+    // towards zero instead of computing the floor. Since in all cases
+    // before the reference we want the next time to be effectively now, we
+    // set baseTime to -mPeriod so that numPeriods will be -1.
+    // When we add 1 and the phase, we will be at the correct event time for
+    // this period.
+    if (baseTime < 0) {
+        ALOGV("[%s] Correcting negative baseTime", mName);
+        baseTime = -mPeriod;
+    }
+
+    nsecs_t numPeriods = baseTime / mPeriod;
+    ALOGV("[%s] numPeriods = %" PRId64, mName, numPeriods);
+    nsecs_t t = (numPeriods + 1) * mPeriod + phase;
+    ALOGV("[%s] t = %" PRId64, mName, ns2us(t));
+    t += mReferenceTime;
+    ALOGV("[%s] Absolute t = %" PRId64, mName, ns2us(t));
+
+    // Check that it's been slightly more than half a period since the last
+    // event so that we don't accidentally fall into double-rate vsyncs
+    if (t - listener.mLastEventTime < (3 * mPeriod / 5)) {
+        t += mPeriod;
+        ALOGV("[%s] Modifying t -> %" PRId64, mName, ns2us(t));
+    }
+
+    t -= mWakeupLatency;
+    ALOGV("[%s] Corrected for wakeup latency -> %" PRId64, mName, ns2us(t));
+
+    return t;
+}
+
+} // namespace android
@@ -0,0 +1,93 @@
+/*
+ * Copyright (C) 2016 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef ANDROID_DISPSYNC_SCHEDULER_H
+#define ANDROID_DISPSYNC_SCHEDULER_H
+
+#include <stdint.h>
+
+#include <utils/Errors.h>
+#include <utils/Timers.h>
+#include <utils/Vector.h>
+
+#include "DispSync.h"
+
+namespace android {
+
+// DispSyncScheduler computes when the DispSync event listeners must be
+// called from the vsync event model. It is the scheduling done by the
+// DispSync thread, without the thread: the current time is always given by
+// the caller, so that it can be driven by a simulated clock (see
+// tests/dispsync).
+//
+// Not thread safe, the DispSync thread protects it with its own mutex.
+class DispSyncScheduler {
+public:
+    struct CallbackInvocation {
+        sp<DispSync::Callback> mCallback;
+        nsecs_t mEventTime;
+    };
+
+    explicit DispSyncScheduler(const char* name);
+
+    void updateModel(nsecs_t period, nsecs_t phase, nsecs_t referenceTime);
+
+    // Whether a model was set, no event is scheduled before.
+    bool hasModel() const { return mPeriod != 0; }
+
+    status_t addEventListener(const char* name, nsecs_t phase,
+            const sp<DispSync::Callback>& callback, nsecs_t now);
+    status_t removeEventListener(const sp<DispSync::Callback>& callback);
+    bool hasAnyEventListeners() const { return !mEventListeners.empty(); }
+
+    // computeNextEventTime returns when the next listener must be called,
+    // INT64_MAX if there is none.
+    nsecs_t computeNextEventTime(nsecs_t now);
+
+    // onWakeup records how late a wakeup targeted at targetTime happened, to
+    // schedule the next ones that much earlier.
+    void onWakeup(nsecs_t targetTime, nsecs_t now);
+
+    // gatherCallbackInvocations returns the listeners to call at time now,
+    // and marks them as called.
+    Vector<CallbackInvocation> gatherCallbackInvocations(nsecs_t now);
+
+    nsecs_t getWakeupLatency() const { return mWakeupLatency; }
+
+private:
+    struct EventListener {
+        const char* mName;
+        nsecs_t mPhase;
+        nsecs_t mLastEventTime;
+        sp<DispSync::Callback> mCallback;
+    };
+
+    nsecs_t computeListenerNextEventTime(const EventListener& listener,
+            nsecs_t baseTime);
+
+    const char* const mName;
+
+    nsecs_t mPeriod;
+    nsecs_t mPhase;
+    nsecs_t mReferenceTime;
+    nsecs_t mWakeupLatency;
+
+    Vector<EventListener> mEventListeners;
+};
+
+}
+
+#endif // ANDROID_DISPSYNC_SCHEDULER_H
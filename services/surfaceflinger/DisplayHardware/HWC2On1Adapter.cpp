@@ -86,6 +86,7 @@ void HWC2On1Adapter::DisplayContentsDeleter::operator()(
         for (size_t l = 0; l < contents->numHwLayers; ++l) {
             auto& layer = contents->hwLayers[l];
             std::free(const_cast<hwc_rect_t*>(layer.visibleRegionScreen.rects));
+            std::free(const_cast<hwc_rect_t*>(layer.surfaceDamage.rects));
         }
     }
     std::free(contents);
@@ -142,7 +143,8 @@ HWC2On1Adapter::HWC2On1Adapter(hwc_composer_device_1_t* hwc1Device)
     mPendingVsyncs(),
     mPendingHotplugs(),
     mDisplays(),
-    mHwc1DisplayMap()
+    mHwc1DisplayMap(),
+    mTranslationStats()
 {
     common.close = closeHook;
     getCapabilities = getCapabilitiesHook;
@@ -428,6 +430,29 @@ void HWC2On1Adapter::dump(uint32_t* outSize, char* outBuffer)
         const auto& display = element.second;
         output << display->dump();
     }
+
+    const auto& stats = mTranslationStats;
+    if (stats.frames > 0) {
+        using std::chrono::microseconds;
+        using std::chrono::duration_cast;
+        output << "Translation (us): prepare last " <<
+                duration_cast<microseconds>(stats.lastPrepareTime).count() <<
+                " avg " << duration_cast<microseconds>(
+                stats.totalPrepareTime / stats.frames).count() <<
+                " max " <<
+                duration_cast<microseconds>(stats.maxPrepareTime).count() <<
+                ", set last " <<
+                duration_cast<microseconds>(stats.lastSetTime).count() <<
+                " avg " << duration_cast<microseconds>(
+                stats.totalSetTime / stats.frames).count() <<
+                " max " <<
+                duration_cast<microseconds>(stats.maxSetTime).count() << '\n';
+        output << "  " << stats.frames << " frames, " <<
+                stats.layersTranslated << " layers translated, " <<
+                stats.layersSkipped << " clean layers skipped\n";
+        output << "  Contents: " << stats.contentsReused << " reused, " <<
+                stats.contentsAllocated << " allocated\n";
+    }
     output << '\n';
 
     // Release the lock before calling into HWC1, and since we no longer require
@@ -590,6 +615,7 @@ Error HWC2On1Adapter::Display::acceptChanges()
 
     mChanges->clearTypeChanges();
 
+    mHwc1SpareContents = std::move(mHwc1RequestedContents);
     mHwc1RequestedContents = std::move(mHwc1ReceivedContents);
 
     return Error::None;
@@ -1288,7 +1314,11 @@ bool HWC2On1Adapter::Display::prepare()
     for (auto& layer : mLayers) {
         auto& hwc1Layer = mHwc1RequestedContents->hwLayers[layer->getHwc1Id()];
         hwc1Layer.releaseFenceFd = -1;
-        layer->applyState(hwc1Layer, applyAllState);
+        if (layer->applyState(hwc1Layer, applyAllState)) {
+            ++mDevice.mTranslationStats.layersTranslated;
+        } else {
+            ++mDevice.mTranslationStats.layersSkipped;
+        }
     }
 
     mHwc1RequestedContents->outbuf = mOutputBuffer.getBuffer();
@@ -1299,36 +1329,69 @@ bool HWC2On1Adapter::Display::prepare()
     return true;
 }
 
-static void cloneHWCRegion(hwc_region_t& region)
+// Deep copies source into destination to avoid double-frees, reusing the rects
+// destination previously owned (passed in as previous) when the size matches
+static void copyHWCRegion(const hwc_region_t& source,
+        const hwc_region_t& previous, hwc_region_t& destination)
 {
-    auto size = sizeof(hwc_rect_t) * region.numRects;
-    auto newRects = static_cast<hwc_rect_t*>(std::malloc(size));
-    std::copy_n(region.rects, region.numRects, newRects);
-    region.rects = newRects;
+    auto rects = const_cast<hwc_rect_t*>(previous.rects);
+    if (source.numRects == 0) {
+        std::free(rects);
+        rects = nullptr;
+    } else if (rects == nullptr || previous.numRects != source.numRects) {
+        std::free(rects);
+        rects = static_cast<hwc_rect_t*>(
+                std::malloc(sizeof(hwc_rect_t) * source.numRects));
+    }
+    std::copy_n(source.rects, source.numRects, rects);
+    destination.rects = rects;
+    destination.numRects = source.numRects;
 }
 
 HWC2On1Adapter::Display::HWC1Contents
-        HWC2On1Adapter::Display::cloneRequestedContents() const
+        HWC2On1Adapter::Display::cloneRequestedContents()
 {
     std::unique_lock<std::recursive_mutex> lock(mStateMutex);
 
-    size_t size = sizeof(hwc_display_contents_1_t) +
-            sizeof(hwc_layer_1_t) * (mHwc1RequestedContents->numHwLayers);
-    auto contents = static_cast<hwc_display_contents_1_t*>(std::malloc(size));
-    std::memcpy(contents, mHwc1RequestedContents.get(), size);
-    for (size_t layerId = 0; layerId < contents->numHwLayers; ++layerId) {
+    const auto& requested = *mHwc1RequestedContents;
+    auto numLayers = requested.numHwLayers;
+
+    HWC1Contents contents;
+    if (mHwc1SpareContents && mHwc1SpareContents->numHwLayers == numLayers) {
+        contents = std::move(mHwc1SpareContents);
+        ++mDevice.mTranslationStats.contentsReused;
+    } else {
+        mHwc1SpareContents.reset();
+        size_t size = sizeof(hwc_display_contents_1_t) +
+                sizeof(hwc_layer_1_t) * numLayers;
+        contents.reset(
+                static_cast<hwc_display_contents_1_t*>(std::calloc(size, 1)));
+        ++mDevice.mTranslationStats.contentsAllocated;
+    }
+
+    std::memcpy(contents.get(), &requested, sizeof(hwc_display_contents_1_t));
+    for (size_t layerId = 0; layerId < numLayers; ++layerId) {
         auto& layer = contents->hwLayers[layerId];
-        // Deep copy the regions to avoid double-frees
-        cloneHWCRegion(layer.visibleRegionScreen);
-        cloneHWCRegion(layer.surfaceDamage);
+        auto previousVisibleRegion = layer.visibleRegionScreen;
+        auto previousSurfaceDamage = layer.surfaceDamage;
+        const auto& requestedLayer = requested.hwLayers[layerId];
+        layer = requestedLayer;
+        copyHWCRegion(requestedLayer.visibleRegionScreen,
+                previousVisibleRegion, layer.visibleRegionScreen);
+        copyHWCRegion(requestedLayer.surfaceDamage, previousSurfaceDamage,
+                layer.surfaceDamage);
     }
-    return HWC1Contents(contents);
+    return contents;
 }
 
 void HWC2On1Adapter::Display::setReceivedContents(HWC1Contents contents)
 {
     std::unique_lock<std::recursive_mutex> lock(mStateMutex);
 
+    // Contents received but never accepted can be reused on the next frame
+    if (mHwc1ReceivedContents) {
+        mHwc1SpareContents = std::move(mHwc1ReceivedContents);
+    }
     mHwc1ReceivedContents = std::move(contents);
 
     mChanges.reset(new Changes);
@@ -1955,13 +2018,18 @@ void HWC2On1Adapter::Display::prepareFramebufferTarget()
     }
     hwc1Target.displayFrame = {0, 0, width, height};
     hwc1Target.planeAlpha = 255;
-    hwc1Target.visibleRegionScreen.numRects = 1;
-    auto rects = static_cast<hwc_rect_t*>(std::malloc(sizeof(hwc_rect_t)));
+    auto& hwc1VisibleRegion = hwc1Target.visibleRegionScreen;
+    auto rects = const_cast<hwc_rect_t*>(hwc1VisibleRegion.rects);
+    if (rects == nullptr || hwc1VisibleRegion.numRects != 1) {
+        std::free(rects);
+        rects = static_cast<hwc_rect_t*>(std::malloc(sizeof(hwc_rect_t)));
+    }
     rects[0].left = 0;
     rects[0].top = 0;
     rects[0].right = width;
     rects[0].bottom = height;
-    hwc1Target.visibleRegionScreen.rects = rects;
+    hwc1VisibleRegion.rects = rects;
+    hwc1VisibleRegion.numRects = 1;
 
     // We will set this to the correct value in set
     hwc1Target.acquireFenceFd = -1;
@@ -2111,19 +2179,29 @@ const sp<Fence>& HWC2On1Adapter::Layer::getReleaseFence() const
     return mReleaseFence.get();
 }
 
-void HWC2On1Adapter::Layer::applyState(hwc_layer_1_t& hwc1Layer,
+bool HWC2On1Adapter::Layer::applyState(hwc_layer_1_t& hwc1Layer,
         bool applyAllState)
 {
-    applyCommonState(hwc1Layer, applyAllState);
+    // The HWC1 layer still holds the state latched on an earlier frame, so
+    // only the buffer needs to be updated for clean layers
+    bool translate = applyAllState || isDirty();
+    if (translate) {
+        applyCommonState(hwc1Layer, applyAllState);
+    }
     auto compositionType = mCompositionType.getPendingValue();
     if (compositionType == Composition::SolidColor) {
-        applySolidColorState(hwc1Layer, applyAllState);
+        if (translate) {
+            applySolidColorState(hwc1Layer, applyAllState);
+        }
     } else if (compositionType == Composition::Sideband) {
-        applySidebandState(hwc1Layer, applyAllState);
+        if (translate) {
+            applySidebandState(hwc1Layer, applyAllState);
+        }
     } else {
         applyBufferState(hwc1Layer);
     }
     applyCompositionType(hwc1Layer, applyAllState);
+    return translate;
 }
 
 // Layer dump helpers
@@ -2245,13 +2323,15 @@ void HWC2On1Adapter::Layer::applyCommonState(hwc_layer_1_t& hwc1Layer,
     if (applyAllState || mVisibleRegion.isDirty()) {
         auto& hwc1VisibleRegion = hwc1Layer.visibleRegionScreen;
 
-        std::free(const_cast<hwc_rect_t*>(hwc1VisibleRegion.rects));
-
-        auto pending = mVisibleRegion.getPendingValue();
-        hwc_rect_t* newRects = static_cast<hwc_rect_t*>(
-                std::malloc(sizeof(hwc_rect_t) * pending.size()));
-        std::copy(pending.begin(), pending.end(), newRects);
-        hwc1VisibleRegion.rects = const_cast<const hwc_rect_t*>(newRects);
+        const auto& pending = mVisibleRegion.getPendingValue();
+        auto rects = const_cast<hwc_rect_t*>(hwc1VisibleRegion.rects);
+        if (rects == nullptr || hwc1VisibleRegion.numRects != pending.size()) {
+            std::free(rects);
+            rects = static_cast<hwc_rect_t*>(
+                    std::malloc(sizeof(hwc_rect_t) * pending.size()));
+        }
+        std::copy(pending.begin(), pending.end(), rects);
+        hwc1VisibleRegion.rects = const_cast<const hwc_rect_t*>(rects);
         hwc1VisibleRegion.numRects = pending.size();
         mVisibleRegion.latch();
     }
@@ -2412,6 +2492,8 @@ bool HWC2On1Adapter::prepareAllDisplays()
 
     std::unique_lock<std::recursive_timed_mutex> lock(mStateMutex);
 
+    auto translationStart = std::chrono::steady_clock::now();
+
     for (const auto& displayPair : mDisplays) {
         auto& display = displayPair.second;
         if (!display->prepare()) {
@@ -2471,6 +2553,9 @@ bool HWC2On1Adapter::prepareAllDisplays()
         }
     }
 
+    std::chrono::nanoseconds translationTime =
+            std::chrono::steady_clock::now() - translationStart;
+
     ALOGV("Calling HWC1 prepare");
     {
         ATRACE_NAME("HWC1 prepare");
@@ -2478,6 +2563,8 @@ bool HWC2On1Adapter::prepareAllDisplays()
                 mHwc1Contents.data());
     }
 
+    translationStart = std::chrono::steady_clock::now();
+
     for (size_t c = 0; c < mHwc1Contents.size(); ++c) {
         auto& contents = mHwc1Contents[c];
         if (!contents) {
@@ -2500,6 +2587,13 @@ bool HWC2On1Adapter::prepareAllDisplays()
         display->setReceivedContents(std::move(requestedContents[hwc1Id]));
     }
 
+    translationTime += std::chrono::steady_clock::now() - translationStart;
+    auto& stats = mTranslationStats;
+    ++stats.frames;
+    stats.lastPrepareTime = translationTime;
+    stats.totalPrepareTime += translationTime;
+    stats.maxPrepareTime = std::max(stats.maxPrepareTime, translationTime);
+
     return true;
 }
 
@@ -2509,6 +2603,8 @@ Error HWC2On1Adapter::setAllDisplays()
 
     std::unique_lock<std::recursive_timed_mutex> lock(mStateMutex);
 
+    auto translationStart = std::chrono::steady_clock::now();
+
     // Make sure we're ready to validate
     for (size_t hwc1Id = 0; hwc1Id < mHwc1Contents.size(); ++hwc1Id) {
         if (mHwc1Contents[hwc1Id] == nullptr) {
@@ -2525,6 +2621,9 @@ Error HWC2On1Adapter::setAllDisplays()
         }
     }
 
+    std::chrono::nanoseconds translationTime =
+            std::chrono::steady_clock::now() - translationStart;
+
     ALOGV("Calling HWC1 set");
     {
         ATRACE_NAME("HWC1 set");
@@ -2532,6 +2631,8 @@ Error HWC2On1Adapter::setAllDisplays()
                 mHwc1Contents.data());
     }
 
+    translationStart = std::chrono::steady_clock::now();
+
     // Add retire and release fences
     for (size_t hwc1Id = 0; hwc1Id < mHwc1Contents.size(); ++hwc1Id) {
         if (mHwc1Contents[hwc1Id] == nullptr) {
@@ -2547,6 +2648,12 @@ Error HWC2On1Adapter::setAllDisplays()
         display->addReleaseFences(*mHwc1Contents[hwc1Id]);
     }
 
+    translationTime += std::chrono::steady_clock::now() - translationStart;
+    auto& stats = mTranslationStats;
+    stats.lastSetTime = translationTime;
+    stats.totalSetTime += translationTime;
+    stats.maxSetTime = std::max(stats.maxSetTime, translationTime);
+
     return Error::None;
 }
 
@@ -26,6 +26,7 @@
 #include <ui/Fence.h>
 
 #include <atomic>
+#include <chrono>
 #include <map>
 #include <mutex>
 #include <queue>
@@ -231,7 +232,7 @@ private:
             void populateConfigs(uint32_t width, uint32_t height);
 
             bool prepare();
-            HWC1Contents cloneRequestedContents() const;
+            HWC1Contents cloneRequestedContents();
             void setReceivedContents(HWC1Contents contents);
             bool hasChanges() const;
             HWC2::Error set(hwc_display_contents_1& hwcContents);
@@ -369,6 +370,11 @@ private:
             bool mZIsDirty;
             HWC1Contents mHwc1RequestedContents;
             HWC1Contents mHwc1ReceivedContents;
+
+            // Contents from an earlier frame which are no longer in use. Their
+            // allocation is reused by cloneRequestedContents when the number
+            // of layers matches.
+            HWC1Contents mHwc1SpareContents;
             DeferredFence mRetireFence;
 
             // Will only be non-null after the layer has been validated but
@@ -536,7 +542,9 @@ private:
             void setHwc1Id(size_t id) { mHwc1Id = id; }
             size_t getHwc1Id() const { return mHwc1Id; }
 
-            void applyState(struct hwc_layer_1& hwc1Layer, bool applyAllState);
+            // Returns whether the geometry of the layer had to be translated,
+            // which is only the case for dirty layers unless applyAllState
+            bool applyState(struct hwc_layer_1& hwc1Layer, bool applyAllState);
 
             std::string dump() const;
 
@@ -684,6 +692,36 @@ private:
 
     std::map<hwc2_display_t, std::shared_ptr<Display>> mDisplays;
     std::unordered_map<int, hwc2_display_t> mHwc1DisplayMap;
+
+    // Cost of the HWC2 to HWC1 translation, excluding the time spent in the
+    // HWC1 device itself. Protected by mStateMutex.
+    struct TranslationStats {
+        TranslationStats()
+          : frames(0),
+            lastPrepareTime(0),
+            totalPrepareTime(0),
+            maxPrepareTime(0),
+            lastSetTime(0),
+            totalSetTime(0),
+            maxSetTime(0),
+            layersTranslated(0),
+            layersSkipped(0),
+            contentsAllocated(0),
+            contentsReused(0) {}
+
+        uint64_t frames;
+        std::chrono::nanoseconds lastPrepareTime;
+        std::chrono::nanoseconds totalPrepareTime;
+        std::chrono::nanoseconds maxPrepareTime;
+        std::chrono::nanoseconds lastSetTime;
+        std::chrono::nanoseconds totalSetTime;
+        std::chrono::nanoseconds maxSetTime;
+        uint64_t layersTranslated;
+        uint64_t layersSkipped;
+        uint64_t contentsAllocated;
+        uint64_t contentsReused;
+    };
+    TranslationStats mTranslationStats;
 };
 
 } // namespace android
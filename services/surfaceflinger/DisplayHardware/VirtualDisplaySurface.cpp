@@ -18,8 +18,14 @@
 #include "VirtualDisplaySurface.h"
 #include "HWComposer.h"
 
+#include <inttypes.h>
+#include <stdlib.h>
+
+#include <cutils/properties.h>
+
 #include <gui/BufferItem.h>
 #include <gui/IProducerListener.h>
+#include <ui/PixelFormat.h>
 
 // ---------------------------------------------------------------------------
 namespace android {
@@ -38,6 +44,21 @@ static const bool sForceHwcCopy = false;
 #define VDS_LOGV(msg, ...) ALOGV("[%s] " msg, \
         mDisplayName.string(), ##__VA_ARGS__)
 
+// Formats GLES renders to and HWC can write, that a sink asking for one of
+// them can take without a conversion.
+static bool isGlesRenderableFormat(int format) {
+    switch (format) {
+        case HAL_PIXEL_FORMAT_RGBA_8888:
+        case HAL_PIXEL_FORMAT_RGBX_8888:
+        case HAL_PIXEL_FORMAT_RGB_888:
+        case HAL_PIXEL_FORMAT_RGB_565:
+        case HAL_PIXEL_FORMAT_BGRA_8888:
+            return true;
+        default:
+            return false;
+    }
+}
+
 static const char* dbgCompositionTypeStr(DisplaySurface::CompositionType type) {
     switch (type) {
         case DisplaySurface::COMPOSITION_UNKNOWN: return "UNKNOWN";
@@ -59,6 +80,8 @@ VirtualDisplaySurface::VirtualDisplaySurface(HWComposer& hwc, int32_t dispId,
     mDisplayName(name),
     mSource{},
     mDefaultOutputFormat(HAL_PIXEL_FORMAT_IMPLEMENTATION_DEFINED),
+    mForceHwcCopy(false),
+    mKeepGlesOutputFormat(false),
     mOutputFormat(HAL_PIXEL_FORMAT_IMPLEMENTATION_DEFINED),
     mOutputUsage(GRALLOC_USAGE_HW_COMPOSER),
     mProducerSlotSource(0),
@@ -71,6 +94,14 @@ VirtualDisplaySurface::VirtualDisplaySurface(HWComposer& hwc, int32_t dispId,
     mOutputFence(Fence::NO_FENCE),
     mFbProducerSlot(BufferQueue::INVALID_BUFFER_SLOT),
     mOutputProducerSlot(BufferQueue::INVALID_BUFFER_SLOT),
+    mHwcCopyForced(false),
+    mHwcFrames(0),
+    mGlesFrames(0),
+    mScratchFrames(0),
+    mForcedCopyFrames(0),
+    mOutputBytes(0),
+    mScratchBytes(0),
+    mOutputReallocations(0),
     mDbgState(DBG_STATE_IDLE),
     mDbgLastCompositionType(COMPOSITION_UNKNOWN),
     mMustRecompose(false)
@@ -92,14 +123,41 @@ VirtualDisplaySurface::VirtualDisplaySurface(HWComposer& hwc, int32_t dispId,
     // on usage bits.
     int sinkUsage;
     sink->query(NATIVE_WINDOW_CONSUMER_USAGE_BITS, &sinkUsage);
+    int sinkFormat;
+    sink->query(NATIVE_WINDOW_FORMAT, &sinkFormat);
     if (sinkUsage & (GRALLOC_USAGE_SW_READ_MASK | GRALLOC_USAGE_SW_WRITE_MASK)) {
-        int sinkFormat;
-        sink->query(NATIVE_WINDOW_FORMAT, &sinkFormat);
         mDefaultOutputFormat = sinkFormat;
     } else {
         mDefaultOutputFormat = HAL_PIXEL_FORMAT_IMPLEMENTATION_DEFINED;
     }
+
+    // Unless disabled, GLES renders straight into the sink buffers whenever
+    // the sink can take its output as is. Video encoders only benefit from
+    // having HWC copy (and convert) GLES-only frames when they leave the
+    // format to gralloc, which may pick YUV for them; an encoder that asked
+    // for an RGB format takes the GLES output directly, and gets that format
+    // from HWC too. NATIVE_WINDOW_FORMAT reports the BufferQueue default,
+    // RGBA_8888, for a sink that never set a format, so that one only counts
+    // as asked for when a CPU consumer reads it. Only CPU consumers and
+    // encoders need the output in a format of their choosing: for the others,
+    // e.g. a SurfaceTexture, the buffer GLES asked for is kept when HWC
+    // composes, saving a dequeue and often a reallocation each time the
+    // composition type changes.
+    char value[PROPERTY_VALUE_MAX];
+    property_get("debug.sf.vds_direct_output", value, "1");
+    const bool directOutput = atoi(value) != 0;
+    const bool sinkIsEncoder = (sinkUsage & GRALLOC_USAGE_HW_VIDEO_ENCODER) != 0;
+    const bool sinkIsCpu = (sinkUsage &
+            (GRALLOC_USAGE_SW_READ_MASK | GRALLOC_USAGE_SW_WRITE_MASK)) != 0;
+    const bool sinkAskedForRgb = isGlesRenderableFormat(sinkFormat) &&
+            (sinkFormat != HAL_PIXEL_FORMAT_RGBA_8888 || sinkIsCpu);
+    const bool sinkTakesGlesOutput = !sinkIsEncoder || sinkAskedForRgb;
+    if (directOutput && sinkIsEncoder && sinkTakesGlesOutput) {
+        mDefaultOutputFormat = sinkFormat;
+    }
     mOutputFormat = mDefaultOutputFormat;
+    mForceHwcCopy = sForceHwcCopy && (!directOutput || !sinkTakesGlesOutput);
+    mKeepGlesOutputFormat = directOutput && !sinkIsEncoder && !sinkIsCpu;
 
     ConsumerBase::mName = String8::format("VDS: %s", mDisplayName.string());
     mConsumer->setConsumerName(ConsumerBase::mName);
@@ -136,7 +194,7 @@ status_t VirtualDisplaySurface::prepareFrame(CompositionType compositionType) {
     mDbgState = DBG_STATE_PREPARED;
 
     mCompositionType = compositionType;
-    if (sForceHwcCopy && mCompositionType == COMPOSITION_GLES) {
+    if (mForceHwcCopy && mCompositionType == COMPOSITION_GLES) {
         // Some hardware can do RGB->YUV conversion more efficiently in hardware
         // controlled by HWC than in hardware controlled by the video encoder.
         // Forcing GLES-composed frames to go through an extra copy by the HWC
@@ -146,6 +204,7 @@ status_t VirtualDisplaySurface::prepareFrame(CompositionType compositionType) {
         // On the other hand, when the consumer prefers RGB or can consume RGB
         // inexpensively, this forces an unnecessary copy.
         mCompositionType = COMPOSITION_MIXED;
+        mHwcCopyForced = true;
     }
 
     if (mCompositionType != mDbgLastCompositionType) {
@@ -154,7 +213,7 @@ status_t VirtualDisplaySurface::prepareFrame(CompositionType compositionType) {
         mDbgLastCompositionType = mCompositionType;
     }
 
-    if (mCompositionType != COMPOSITION_GLES &&
+    if (mCompositionType != COMPOSITION_GLES && !mKeepGlesOutputFormat &&
             (mOutputFormat != mDefaultOutputFormat ||
              mOutputUsage != GRALLOC_USAGE_HW_COMPOSER)) {
         // We must have just switched from GLES-only to MIXED or HWC
@@ -169,6 +228,7 @@ status_t VirtualDisplaySurface::prepareFrame(CompositionType compositionType) {
         // dequeueBuffer().
         mOutputFormat = mDefaultOutputFormat;
         setOutputUsage(GRALLOC_USAGE_HW_COMPOSER);
+        mOutputReallocations++;
         refreshOutputBuffer();
     }
 
@@ -282,6 +342,7 @@ void VirtualDisplaySurface::onFrameCommitted() {
                     &qbo);
             if (result == NO_ERROR) {
                 updateQueueBufferOutput(qbo);
+                updateFrameStats();
             }
         } else {
             // If the surface hadn't actually been updated, then we only went
@@ -299,7 +360,19 @@ void VirtualDisplaySurface::onFrameCommitted() {
     resetPerFrameState();
 }
 
-void VirtualDisplaySurface::dumpAsString(String8& /* result */) const {
+void VirtualDisplaySurface::dumpAsString(String8& result) const {
+    const uint64_t frames = mHwcFrames + mGlesFrames + mScratchFrames;
+    result.appendFormat("   VDS: %" PRIu64 " frames: %" PRIu64 " HWC, %" PRIu64
+            " GLES, %" PRIu64 " through scratch (%" PRIu64 " forced HWC "
+            "copies), %" PRIu64 " output reallocations\n",
+            frames, mHwcFrames, mGlesFrames, mScratchFrames,
+            mForcedCopyFrames, mOutputReallocations);
+    result.appendFormat("        force HWC copy %s, keep GLES format %s, "
+            "output %.2f MB/frame, scratch %.2f MB/frame\n",
+            mForceHwcCopy ? "on" : "off",
+            mKeepGlesOutputFormat ? "on" : "off",
+            frames ? double(mOutputBytes) / frames / (1024 * 1024) : 0.0,
+            frames ? double(mScratchBytes) / frames / (1024 * 1024) : 0.0);
 }
 
 void VirtualDisplaySurface::resizeBuffers(const uint32_t w, const uint32_t h) {
@@ -436,6 +509,7 @@ status_t VirtualDisplaySurface::dequeueBuffer(int* pslot, sp<Fence>* fence,
                     buf->getPixelFormat(), buf->getUsage());
             mOutputFormat = format;
             setOutputUsage(usage);
+            mOutputReallocations++;
             result = refreshOutputBuffer();
             if (result < 0)
                 return result;
@@ -631,8 +705,45 @@ void VirtualDisplaySurface::updateQueueBufferOutput(
     mQueueBufferOutput.inflate(w, h, 0, numPendingBuffers, nextFrameNumber);
 }
 
+// Estimated memory traffic of writing or reading the whole buffer once
+static uint64_t getBufferBytes(const sp<GraphicBuffer>& buffer) {
+    if (buffer == NULL) {
+        return 0;
+    }
+    uint64_t pixels = uint64_t(buffer->getStride()) * buffer->getHeight();
+    uint32_t bpp = bytesPerPixel(buffer->getPixelFormat());
+    // YUV and implementation defined formats: assume 12 bits per pixel
+    return bpp ? pixels * bpp : pixels * 3 / 2;
+}
+
+void VirtualDisplaySurface::updateFrameStats() {
+    mOutputBytes += getBufferBytes(mProducerBuffers[mOutputProducerSlot]);
+    switch (mCompositionType) {
+        case COMPOSITION_HWC:
+            mHwcFrames++;
+            break;
+        case COMPOSITION_GLES:
+            mGlesFrames++;
+            break;
+        case COMPOSITION_MIXED:
+            mScratchFrames++;
+            if (mHwcCopyForced) {
+                mForcedCopyFrames++;
+            }
+            // GLES writes the scratch buffer, then HWC reads it back
+            if (mFbProducerSlot >= 0) {
+                mScratchBytes +=
+                        2 * getBufferBytes(mProducerBuffers[mFbProducerSlot]);
+            }
+            break;
+        default:
+            break;
+    }
+}
+
 void VirtualDisplaySurface::resetPerFrameState() {
     mCompositionType = COMPOSITION_UNKNOWN;
+    mHwcCopyForced = false;
     mFbFence = Fence::NO_FENCE;
     mOutputFence = Fence::NO_FENCE;
     mOutputProducerSlot = -1;
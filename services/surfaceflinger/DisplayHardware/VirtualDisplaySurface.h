@@ -67,6 +67,11 @@ class IProducerListener;
  * buffer for HWC, and a separate buffer is dequeued from the sink and used as
  * the HWC output buffer. When HWC composition is complete, the scratch buffer
  * is released and the output buffer is queued to the sink.
+ *
+ * Builds with FORCE_HWC_COPY_FOR_VIRTUAL_DISPLAYS turn GLES-only frames into
+ * MIXED ones, so that HWC can convert the output for video encoders. The
+ * other sinks keep getting GLES-only frames rendered straight into their
+ * buffers, unless debug.sf.vds_direct_output is 0.
  */
 class VirtualDisplaySurface : public DisplaySurface,
                               public BnGraphicBufferProducer,
@@ -143,6 +148,7 @@ private:
     void updateQueueBufferOutput(const QueueBufferOutput& qbo);
     void resetPerFrameState();
     status_t refreshOutputBuffer();
+    void updateFrameStats();
 
     // Both the sink and scratch buffer pools have their own set of slots
     // ("source slots", or "sslot"). We have to merge these into the single
@@ -162,6 +168,13 @@ private:
     sp<IGraphicBufferProducer> mSource[2]; // indexed by SOURCE_*
     uint32_t mDefaultOutputFormat;
 
+    // Whether GLES-only frames go through a scratch buffer and an HWC copy,
+    // see prepareFrame(). Only done for the sinks that benefit from it.
+    bool mForceHwcCopy;
+    // Whether the output buffer GLES asked for is kept on MIXED and HWC
+    // frames, rather than dequeueing a new one in the default format.
+    bool mKeepGlesOutputFormat;
+
     //
     // Inter-frame state
     //
@@ -212,6 +225,27 @@ private:
     int mFbProducerSlot;
     int mOutputProducerSlot;
 
+    // Whether this frame was GLES-only, but made MIXED by mForceHwcCopy.
+    bool mHwcCopyForced;
+
+    //
+    // Statistics for dumpAsString()
+    //
+
+    // Frames by the way their output was produced: written by HWC, rendered
+    // by GLES straight into the sink buffer, or rendered by GLES into a
+    // scratch buffer that HWC then reads back.
+    uint64_t mHwcFrames;
+    uint64_t mGlesFrames;
+    uint64_t mScratchFrames;
+    uint64_t mForcedCopyFrames;
+    // Bytes written to the sink buffers, and the extra bytes written to and
+    // read back from the scratch buffers.
+    uint64_t mOutputBytes;
+    uint64_t mScratchBytes;
+    // Sink buffers dequeued again for a different format or usage
+    uint64_t mOutputReallocations;
+
     // Debug only -- track the sequence of events in each frame so we can make
     // sure they happen in the order we expect. This class implicitly models
     // a state machine; this enum/variable makes it explicit.
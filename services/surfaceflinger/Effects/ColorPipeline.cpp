@@ -0,0 +1,80 @@
+/*
+ * Copyright 2016 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include "ColorPipeline.h"
+
+namespace android {
+
+ColorPipeline::ColorPipeline() :
+        mSaturation(1.0f),
+        mIsIdentity(true) {
+}
+
+void ColorPipeline::setDaltonizer(ColorBlindnessType type,
+        ColorBlindnessMode mode) {
+    mDaltonizer.setType(type);
+    mDaltonizer.setMode(mode);
+    update();
+}
+
+void ColorPipeline::setColorMatrix(const mat4& matrix) {
+    mColorMatrix = matrix;
+    update();
+}
+
+void ColorPipeline::setSecondaryColorMatrix(const mat4& matrix) {
+    mSecondaryColorMatrix = matrix;
+    update();
+}
+
+void ColorPipeline::setSaturation(float saturation) {
+    mSaturation = saturation;
+    update();
+}
+
+void ColorPipeline::update() {
+    // mixes each color with its luminance (Rec. 709 coefficients)
+    mat4 saturationMatrix;
+    if (mSaturation != 1.0f) {
+        const vec3 luminance(0.2126f, 0.7152f, 0.0722f);
+        const float s = mSaturation;
+        for (size_t i = 0; i < 3; i++) {
+            for (size_t j = 0; j < 3; j++) {
+                saturationMatrix[i][j] = luminance[i] * (1.0f - s) +
+                        (i == j ? s : 0.0f);
+            }
+        }
+    }
+
+    mColorTransform = mColorMatrix * mSecondaryColorMatrix *
+            saturationMatrix * mDaltonizer();
+    mIsIdentity = mColorTransform == mat4();
+}
+
+void ColorPipeline::dump(String8& result) const {
+    if (mIsIdentity) {
+        result.append("Color transform: identity\n");
+        return;
+    }
+    result.appendFormat("Color transform: saturation %.2f\n", mSaturation);
+    for (size_t j = 0; j < 4; j++) {
+        result.appendFormat("    [%7.4f %7.4f %7.4f %7.4f]\n",
+                mColorTransform[0][j], mColorTransform[1][j],
+                mColorTransform[2][j], mColorTransform[3][j]);
+    }
+}
+
+} /* namespace android */
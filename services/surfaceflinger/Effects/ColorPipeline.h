@@ -0,0 +1,68 @@
+/*
+ * Copyright 2016 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef SF_EFFECTS_COLORPIPELINE_H_
+#define SF_EFFECTS_COLORPIPELINE_H_
+
+#include <ui/mat4.h>
+#include <utils/String8.h>
+
+#include "Daltonizer.h"
+
+namespace android {
+
+/*
+ * ColorPipeline fuses all the global color effects into the single color
+ * transform of the displays:
+ *
+ *   user matrix * secondary matrix * saturation * daltonizer
+ *
+ * The fused transform is only recomputed when one of them changes, and when
+ * it ends up being the identity, e.g. with a neutral user matrix, there is no
+ * color transform to apply at all.
+ */
+class ColorPipeline {
+public:
+    ColorPipeline();
+
+    void setDaltonizer(ColorBlindnessType type, ColorBlindnessMode mode);
+
+    // Set by the accessibility and display settings services
+    void setColorMatrix(const mat4& matrix);
+    void setSecondaryColorMatrix(const mat4& matrix);
+
+    // 0 is grayscale, 1 leaves the colors unchanged and above 1 boosts them
+    void setSaturation(float saturation);
+
+    const mat4& getColorTransform() const { return mColorTransform; }
+    bool isIdentity() const { return mIsIdentity; }
+
+    void dump(String8& result) const;
+
+private:
+    void update();
+
+    Daltonizer mDaltonizer;
+    mat4 mColorMatrix;
+    mat4 mSecondaryColorMatrix;
+    float mSaturation;
+
+    mat4 mColorTransform;
+    bool mIsIdentity;
+};
+
+} /* namespace android */
+#endif /* SF_EFFECTS_COLORPIPELINE_H_ */
@@ -17,8 +17,11 @@
 #define ATRACE_TAG ATRACE_TAG_GRAPHICS
 
 #include <stdint.h>
+#include <sys/ioctl.h>
 #include <sys/types.h>
 
+#include <linux/sockios.h>
+
 #include <cutils/compiler.h>
 #include <cutils/iosched_policy.h>
 
@@ -58,6 +61,8 @@ EventThread::EventThread(const sp<VSyncSource>& src, SurfaceFlinger& flinger)
         mVSyncEvent[i].header.id = 0;
         mVSyncEvent[i].header.timestamp = 0;
         mVSyncEvent[i].vsync.count =  0;
+        mVSyncEvent[i].vsync.missed = 0;
+        mVSyncEvent[i].vsync.nextTimestamp = 0;
     }
     struct sigevent se;
     se.sigev_notify = SIGEV_THREAD;
@@ -138,6 +143,12 @@ void EventThread::requestNextVsync(
     }
 }
 
+void EventThread::setVsyncCoalescing(bool enabled,
+        const sp<EventThread::Connection>& connection) {
+    Mutex::Autolock _l(mLock);
+    connection->coalesce = enabled;
+}
+
 void EventThread::onScreenReleased() {
     Mutex::Autolock _l(mLock);
     if (!mUseSoftwareVSync) {
@@ -157,11 +168,14 @@ void EventThread::onScreenAcquired() {
 }
 
 void EventThread::onVSyncEvent(nsecs_t timestamp) {
+    // query the model before taking mLock, DispSync has its own lock
+    const nsecs_t nextTimestamp = mVSyncSource->computeNextRefresh();
     Mutex::Autolock _l(mLock);
     mVSyncEvent[0].header.type = DisplayEventReceiver::DISPLAY_EVENT_VSYNC;
     mVSyncEvent[0].header.id = 0;
     mVSyncEvent[0].header.timestamp = timestamp;
     mVSyncEvent[0].vsync.count++;
+    mVSyncEvent[0].vsync.nextTimestamp = nextTimestamp;
     mCondition.broadcast();
 }
 
@@ -258,13 +272,20 @@ Vector< sp<EventThread::Connection> > EventThread::waitForEvent(
                     if (timestamp) {
                         // we consume the event only if it's time
                         // (ie: we received a vsync event)
-                        if (connection->count == 0) {
+                        const bool due = connection->count <= 1 ||
+                                (vsyncCount % connection->count) == 0;
+                        if (due && connection->coalesce &&
+                                connection->hasUnreadEvents()) {
+                            // The client is behind, don't queue yet another
+                            // stale vsync. A one-shot request stays pending
+                            // until the client catches up.
+                            connection->missed++;
+                        } else if (connection->count == 0) {
                             // fired this time around
                             connection->count = -1;
                             signalConnections.add(connection);
                             added = true;
-                        } else if (connection->count == 1 ||
-                                (vsyncCount % connection->count) == 0) {
+                        } else if (due) {
                             // continuous event, and time to report it
                             signalConnections.add(connection);
                             added = true;
@@ -328,6 +349,7 @@ Vector< sp<EventThread::Connection> > EventThread::waitForEvent(
                     mVSyncEvent[0].header.id = DisplayDevice::DISPLAY_PRIMARY;
                     mVSyncEvent[0].header.timestamp = systemTime(SYSTEM_TIME_MONOTONIC);
                     mVSyncEvent[0].vsync.count++;
+                    mVSyncEvent[0].vsync.nextTimestamp = 0;
                 }
             } else {
                 // Nobody is interested in vsync, so we just want to sleep.
@@ -378,8 +400,10 @@ void EventThread::dump(String8& result) const {
     for (size_t i=0 ; i<mDisplayEventConnections.size() ; i++) {
         sp<Connection> connection =
                 mDisplayEventConnections.itemAt(i).promote();
-        result.appendFormat("    %p: count=%d\n",
-                connection.get(), connection!=NULL ? connection->count : 0);
+        result.appendFormat("    %p: count=%d coalesce=%d missed=%u\n",
+                connection.get(), connection!=NULL ? connection->count : 0,
+                connection!=NULL ? connection->coalesce : 0,
+                connection!=NULL ? connection->missed : 0);
     }
 }
 
@@ -387,7 +411,8 @@ void EventThread::dump(String8& result) const {
 
 EventThread::Connection::Connection(
         const sp<EventThread>& eventThread)
-    : count(-1), mEventThread(eventThread), mChannel(new BitTube())
+    : count(-1), coalesce(false), missed(0),
+      mEventThread(eventThread), mChannel(new BitTube())
 {
 }
 
@@ -413,10 +438,35 @@ void EventThread::Connection::requestNextVsync() {
     mEventThread->requestNextVsync(this);
 }
 
+void EventThread::Connection::setVsyncCoalescing(bool enabled) {
+    mEventThread->setVsyncCoalescing(enabled, this);
+}
+
+bool EventThread::Connection::hasUnreadEvents() const {
+    // For AF_UNIX sockets SIOCOUTQ reports the bytes the peer hasn't read yet.
+    int pending = 0;
+    if (ioctl(mChannel->getSendFd(), SIOCOUTQ, &pending) < 0) {
+        return false;
+    }
+    return pending > 0;
+}
+
 status_t EventThread::Connection::postEvent(
         const DisplayEventReceiver::Event& event) {
-    ssize_t size = DisplayEventReceiver::sendEvents(mChannel, &event, 1);
-    return size < 0 ? status_t(size) : status_t(NO_ERROR);
+    if (event.header.type != DisplayEventReceiver::DISPLAY_EVENT_VSYNC) {
+        ssize_t size = DisplayEventReceiver::sendEvents(mChannel, &event, 1);
+        return size < 0 ? status_t(size) : status_t(NO_ERROR);
+    }
+
+    DisplayEventReceiver::Event vsync(event);
+    vsync.vsync.missed = missed;
+    ssize_t size = DisplayEventReceiver::sendEvents(mChannel, &vsync, 1);
+    if (size < 0) {
+        missed++;
+        return status_t(size);
+    }
+    missed = 0;
+    return NO_ERROR;
 }
 
 // ---------------------------------------------------------------------------
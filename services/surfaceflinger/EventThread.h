@@ -52,6 +52,8 @@ public:
     virtual void setVSyncEnabled(bool enable) = 0;
     virtual void setCallback(const sp<Callback>& callback) = 0;
     virtual void setPhaseOffset(nsecs_t phaseOffset) = 0;
+    // Predicted time of the next hardware vsync, 0 if unknown.
+    virtual nsecs_t computeNextRefresh() const = 0;
 };
 
 class EventThread : public Thread, private VSyncSource::Callback {
@@ -65,12 +67,25 @@ class EventThread : public Thread, private VSyncSource::Callback {
         // count ==-1 : one-shot event that fired this round / disabled
         int32_t count;
 
+        // When set, a vsync is not posted while the previous event is still
+        // unread; the client gets the latest one with the number it missed.
+        // Like count, protected by EventThread::mLock.
+        bool coalesce;
+
+        // vsync events withheld (or dropped) since the last one that was
+        // posted to this connection. Only written by the EventThread.
+        uint32_t missed;
+
+        // Whether the client hasn't read all the events posted to it yet
+        bool hasUnreadEvents() const;
+
     private:
         virtual ~Connection();
         virtual void onFirstRef();
         virtual sp<BitTube> getDataChannel() const;
         virtual void setVsyncRate(uint32_t count);
         virtual void requestNextVsync();    // asynchronous
+        virtual void setVsyncCoalescing(bool enabled);
         sp<EventThread> const mEventThread;
         sp<BitTube> const mChannel;
     };
@@ -84,6 +99,7 @@ public:
 
     void setVsyncRate(uint32_t count, const sp<Connection>& connection);
     void requestNextVsync(const sp<Connection>& connection);
+    void setVsyncCoalescing(bool enabled, const sp<Connection>& connection);
 
     // called before the screen is turned off from main thread
     void onScreenReleased();
@@ -0,0 +1,125 @@
+/*
+ * Copyright 2016 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#define ATRACE_TAG ATRACE_TAG_GRAPHICS
+
+// This is needed for stdint.h to define INT64_MAX in C++
+#define __STDC_LIMIT_MACROS
+
+#include <errno.h>
+#include <inttypes.h>
+#include <string.h>
+
+#include <cutils/log.h>
+#include <utils/Trace.h>
+
+#include "FenceTimeline.h"
+
+namespace android {
+
+const sp<FenceTime> FenceTime::NO_FENCE = new FenceTime(Fence::NO_FENCE);
+
+FenceTime::FenceTime(const sp<Fence>& fence) :
+        mValid(fence->isValid()),
+        mFence(fence->isValid() ? fence : Fence::NO_FENCE),
+        mSignalTime(fence->isValid() ? INT64_MAX : -1) {
+}
+
+FenceTimeline::FenceTimeline() :
+        mUpdates(0),
+        mSignaled(0),
+        mDropped(0) {
+}
+
+sp<FenceTime> FenceTimeline::track(const sp<Fence>& fence) {
+    if (fence == NULL || !fence->isValid()) {
+        return FenceTime::NO_FENCE;
+    }
+
+    Mutex::Autolock lock(mMutex);
+    // The same fence is often tracked twice, e.g. the acquire fence of a
+    // buffer by both FrameTracker and FenceTracker
+    for (const auto& fenceTime : mPending) {
+        if (fenceTime->mFence == fence) {
+            return fenceTime;
+        }
+    }
+    sp<FenceTime> fenceTime = new FenceTime(fence);
+    mPending.push_back(fenceTime);
+    return fenceTime;
+}
+
+void FenceTimeline::updateSignalTimes() {
+    ATRACE_CALL();
+    Mutex::Autolock lock(mMutex);
+    mUpdates++;
+
+    // Forget the fences nobody else holds, their signal time is of no use
+    size_t count = 0;
+    for (size_t i = 0; i < mPending.size(); i++) {
+        if (mPending[i]->getStrongCount() == 1) {
+            mDropped++;
+            continue;
+        }
+        mPending[count++] = mPending[i];
+    }
+    mPending.resize(count);
+    if (count == 0) {
+        return;
+    }
+
+    mPollFds.resize(count);
+    for (size_t i = 0; i < count; i++) {
+        mPollFds[i].fd = mPending[i]->mFence->get();
+        mPollFds[i].events = POLLIN;
+        mPollFds[i].revents = 0;
+    }
+    int ready = poll(mPollFds.data(), nfds_t(count), 0);
+    if (ready < 0) {
+        ALOGE("updateSignalTimes: poll failed: %s (%d)", strerror(errno),
+                errno);
+        return;
+    }
+    if (ready == 0) {
+        return;
+    }
+
+    size_t pending = 0;
+    for (size_t i = 0; i < count; i++) {
+        const sp<FenceTime>& fenceTime = mPending[i];
+        if (mPollFds[i].revents != 0) {
+            // Signaled, or in error in which case -1 is recorded
+            nsecs_t signalTime = fenceTime->mFence->getSignalTime();
+            if (signalTime != INT64_MAX) {
+                fenceTime->mSignalTime.store(signalTime);
+                fenceTime->mFence = Fence::NO_FENCE;
+                mSignaled++;
+                continue;
+            }
+        }
+        mPending[pending++] = fenceTime;
+    }
+    mPending.resize(pending);
+}
+
+void FenceTimeline::dump(String8& result) const {
+    Mutex::Autolock lock(mMutex);
+    result.appendFormat("Fence timeline: %zu pending, %" PRIu64 " updates, %"
+            PRIu64 " signaled, %" PRIu64 " dropped unsignaled\n",
+            mPending.size(), mUpdates, mSignaled, mDropped);
+}
+
+} // namespace android
@@ -0,0 +1,99 @@
+/*
+ * Copyright 2016 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef ANDROID_FENCETIMELINE_H
+#define ANDROID_FENCETIMELINE_H
+
+#include <poll.h>
+#include <stdint.h>
+
+#include <atomic>
+#include <vector>
+
+#include <ui/Fence.h>
+#include <utils/Mutex.h>
+#include <utils/RefBase.h>
+#include <utils/String8.h>
+#include <utils/Timers.h>
+
+namespace android {
+
+// FenceTime is the signal time of a fence, as last seen by the FenceTimeline
+// that tracks it. Reading it never queries the fence.
+class FenceTime : public LightRefBase<FenceTime> {
+public:
+    static const sp<FenceTime> NO_FENCE;
+
+    // isValid returns whether the tracked fence was valid, see
+    // Fence::isValid().
+    bool isValid() const { return mValid; }
+
+    // getSignalTime returns the time at which the fence signaled, INT64_MAX
+    // if it hadn't when the FenceTimeline last polled it, or -1 if the fence
+    // is invalid or in error. See Fence::getSignalTime().
+    nsecs_t getSignalTime() const { return mSignalTime.load(); }
+
+private:
+    friend class FenceTimeline;
+    friend class LightRefBase<FenceTime>;
+
+    explicit FenceTime(const sp<Fence>& fence);
+    ~FenceTime() {}
+
+    const bool mValid;
+
+    // mFence is the fence until it signals, protected by the FenceTimeline
+    // lock.
+    sp<Fence> mFence;
+
+    std::atomic<nsecs_t> mSignalTime;
+};
+
+// FenceTimeline polls the fences that the frame trackers of SurfaceFlinger
+// wait for. Instead of every tracker querying the signal time of each of its
+// pending fences every frame, the timeline polls all of them with a single
+// poll() call, and only queries the signal time of the ones that are
+// signaled. Fences nobody but the timeline references anymore are dropped.
+class FenceTimeline {
+public:
+    FenceTimeline();
+
+    // track returns the FenceTime of the fence, creating it the first time.
+    // Invalid fences all map to FenceTime::NO_FENCE.
+    sp<FenceTime> track(const sp<Fence>& fence);
+
+    // updateSignalTimes polls the pending fences, and records the signal
+    // time of those that signaled. SurfaceFlinger calls it once per frame in
+    // postComposition(), and when frame stats are requested. The frame
+    // timestamps reported by FenceTracker are as of the last frame.
+    void updateSignalTimes();
+
+    void dump(String8& result) const;
+
+private:
+    mutable Mutex mMutex;
+    std::vector<sp<FenceTime>> mPending;
+    std::vector<struct pollfd> mPollFds;
+
+    // Statistics for dump()
+    uint64_t mUpdates;
+    uint64_t mSignaled;
+    uint64_t mDropped;
+};
+
+}
+
+#endif // ANDROID_FENCETIMELINE_H
@@ -23,34 +23,48 @@
 
 namespace android {
 
-FenceTracker::FenceTracker() :
+FenceTracker::FenceTracker(FenceTimeline& timeline) :
+        mTimeline(timeline),
         mFrameCounter(0),
-        mOffset(0),
         mFrames(),
+        mLayerFrames(),
         mMutex() {
 }
 
+static inline bool isValidTimestamp(nsecs_t time) {
+    return time > 0 && time < INT64_MAX;
+}
+
+// The signal time of the fence as last polled, 0 if it hadn't signaled
+static inline nsecs_t signalTime(const sp<FenceTime>& fence) {
+    nsecs_t time = fence->getSignalTime();
+    return isValidTimestamp(time) ? time : 0;
+}
+
 void FenceTracker::dump(String8* outString) {
     Mutex::Autolock lock(mMutex);
-    checkFencesForCompletion();
+
+    mTimeline.dump(*outString);
 
     for (size_t i = 0; i < MAX_FRAME_HISTORY; i++) {
-        int index = (mOffset + i) % MAX_FRAME_HISTORY;
+        int index = (mFrameCounter + i) % MAX_FRAME_HISTORY;
         const FrameRecord& frame = mFrames[index];
 
         outString->appendFormat("Frame %" PRIu64 "\n", frame.frameId);
         outString->appendFormat("- Refresh start\t%" PRId64 "\n",
                 frame.refreshStartTime);
 
-        if (frame.glesCompositionDoneTime) {
+        const nsecs_t glesCompositionDoneTime =
+                signalTime(frame.glesCompositionDoneFence);
+        if (glesCompositionDoneTime) {
             outString->appendFormat("- GLES done\t%" PRId64 "\n",
-                    frame.glesCompositionDoneTime);
-        } else if (frame.glesCompositionDoneFence != Fence::NO_FENCE) {
+                    glesCompositionDoneTime);
+        } else if (frame.glesCompositionDoneFence != FenceTime::NO_FENCE) {
             outString->append("- GLES done\tNot signaled\n");
         }
-        if (frame.retireTime) {
-            outString->appendFormat("- Retire\t%" PRId64 "\n",
-                    frame.retireTime);
+        const nsecs_t retireTime = signalTime(frame.retireFence);
+        if (retireTime) {
+            outString->appendFormat("- Retire\t%" PRId64 "\n", retireTime);
         } else {
             outString->append("- Retire\tNot signaled\n");
         }
@@ -62,15 +76,17 @@ void FenceTracker::dump(String8* outString) {
                     layer.isGlesComposition ? "GLES" : "HWC");
             outString->appendFormat("---- Posted\t%" PRId64 "\n",
                     layer.postedTime);
-            if (layer.acquireTime) {
+            const nsecs_t acquireTime = signalTime(layer.acquireFence);
+            if (acquireTime) {
                 outString->appendFormat("---- Acquire\t%" PRId64 "\n",
-                        layer.acquireTime);
+                        acquireTime);
             } else {
                 outString->append("---- Acquire\tNot signaled\n");
             }
-            if (layer.releaseTime) {
+            const nsecs_t releaseTime = signalTime(layer.releaseFence);
+            if (releaseTime) {
                 outString->appendFormat("---- Release\t%" PRId64 "\n",
-                        layer.releaseTime);
+                        releaseTime);
             } else {
                 outString->append("---- Release\tNot signaled\n");
             }
@@ -78,54 +94,25 @@ void FenceTracker::dump(String8* outString) {
     }
 }
 
-static inline bool isValidTimestamp(nsecs_t time) {
-    return time > 0 && time < INT64_MAX;
-}
-
-void FenceTracker::checkFencesForCompletion() {
-    ATRACE_CALL();
-    for (auto& frame : mFrames) {
-        if (frame.retireFence != Fence::NO_FENCE) {
-            nsecs_t time = frame.retireFence->getSignalTime();
-            if (isValidTimestamp(time)) {
-                frame.retireTime = time;
-                frame.retireFence = Fence::NO_FENCE;
-            }
-        }
-        if (frame.glesCompositionDoneFence != Fence::NO_FENCE) {
-            nsecs_t time = frame.glesCompositionDoneFence->getSignalTime();
-            if (isValidTimestamp(time)) {
-                frame.glesCompositionDoneTime = time;
-                frame.glesCompositionDoneFence = Fence::NO_FENCE;
-            }
-        }
-        for (auto& kv : frame.layers) {
-            LayerRecord& layer = kv.second;
-            if (layer.acquireFence != Fence::NO_FENCE) {
-                nsecs_t time = layer.acquireFence->getSignalTime();
-                if (isValidTimestamp(time)) {
-                    layer.acquireTime = time;
-                    layer.acquireFence = Fence::NO_FENCE;
-                }
-            }
-            if (layer.releaseFence != Fence::NO_FENCE) {
-                nsecs_t time = layer.releaseFence->getSignalTime();
-                if (isValidTimestamp(time)) {
-                    layer.releaseTime = time;
-                    layer.releaseFence = Fence::NO_FENCE;
-                }
-            }
-        }
-    }
-}
-
-void FenceTracker::addFrame(nsecs_t refreshStartTime, sp<Fence> retireFence,
-        const Vector<sp<Layer>>& layers, sp<Fence> glDoneFence) {
+void FenceTracker::addFrame(nsecs_t refreshStartTime,
+        const sp<FenceTime>& retireFence, const Vector<sp<Layer>>& layers,
+        const sp<FenceTime>& glDoneFence) {
     ATRACE_CALL();
     Mutex::Autolock lock(mMutex);
-    FrameRecord& frame = mFrames[mOffset];
-    FrameRecord& prevFrame = mFrames[(mOffset + MAX_FRAME_HISTORY - 1) %
+    const size_t index = mFrameCounter % MAX_FRAME_HISTORY;
+    FrameRecord& frame = mFrames[index];
+    FrameRecord& prevFrame = mFrames[(index + MAX_FRAME_HISTORY - 1) %
                                      MAX_FRAME_HISTORY];
+
+    // Forget the layers that were last composed in the frame dropped from
+    // the history
+    for (const auto& kv : frame.layers) {
+        auto layerFrames = mLayerFrames.find(kv.first);
+        if (layerFrames != mLayerFrames.end() &&
+                layerFrames->second.lastFrameId == frame.frameId) {
+            mLayerFrames.erase(layerFrames);
+        }
+    }
     frame.layers.clear();
 
     bool wasGlesCompositionDone = false;
@@ -135,24 +122,26 @@ void FenceTracker::addFrame(nsecs_t refreshStartTime, sp<Fence> retireFence,
         uint64_t frameNumber;
         bool glesComposition;
         nsecs_t postedTime;
-        sp<Fence> acquireFence;
-        sp<Fence> prevReleaseFence;
+        sp<Fence> fence;
+        sp<Fence> releaseFence;
         int32_t layerId = layers[i]->getSequence();
 
         layers[i]->getFenceData(&name, &frameNumber, &glesComposition,
-                &postedTime, &acquireFence, &prevReleaseFence);
+                &postedTime, &fence, &releaseFence);
+        sp<FenceTime> acquireFence = mTimeline.track(fence);
+        sp<FenceTime> prevReleaseFence = mTimeline.track(releaseFence);
 #ifdef USE_HWC2
         if (glesComposition) {
             frame.layers.emplace(std::piecewise_construct,
                     std::forward_as_tuple(layerId),
                     std::forward_as_tuple(name, frameNumber, glesComposition,
-                    postedTime, 0, 0, acquireFence, prevReleaseFence));
+                    postedTime, acquireFence, prevReleaseFence));
             wasGlesCompositionDone = true;
         } else {
             frame.layers.emplace(std::piecewise_construct,
                     std::forward_as_tuple(layerId),
                     std::forward_as_tuple(name, frameNumber, glesComposition,
-                    postedTime, 0, 0, acquireFence, Fence::NO_FENCE));
+                    postedTime, acquireFence, FenceTime::NO_FENCE));
             auto prevLayer = prevFrame.layers.find(layerId);
             if (prevLayer != prevFrame.layers.end()) {
                 prevLayer->second.releaseFence = prevReleaseFence;
@@ -162,8 +151,8 @@ void FenceTracker::addFrame(nsecs_t refreshStartTime, sp<Fence> retireFence,
         frame.layers.emplace(std::piecewise_construct,
                 std::forward_as_tuple(layerId),
                 std::forward_as_tuple(name, frameNumber, glesComposition,
-                postedTime, 0, 0, acquireFence,
-                glesComposition ? Fence::NO_FENCE : prevReleaseFence));
+                postedTime, acquireFence,
+                glesComposition ? FenceTime::NO_FENCE : prevReleaseFence));
         if (glesComposition) {
             wasGlesCompositionDone = true;
         }
@@ -171,48 +160,68 @@ void FenceTracker::addFrame(nsecs_t refreshStartTime, sp<Fence> retireFence,
         frame.layers.emplace(std::piecewise_construct,
                 std::forward_as_tuple(layerId),
                 std::forward_as_tuple(name, frameNumber, glesComposition,
-                postedTime, 0, 0, acquireFence, prevReleaseFence));
+                postedTime, acquireFence, prevReleaseFence));
+
+        LayerFrames& layerFrames = mLayerFrames[layerId];
+        BufferFrames& buffer =
+                layerFrames.buffers[frameNumber % MAX_FRAME_HISTORY];
+        if (buffer.frameNumber != frameNumber) {
+            buffer.frameNumber = frameNumber;
+            buffer.firstFrameId = mFrameCounter;
+        }
+        buffer.lastFrameId = mFrameCounter;
+        layerFrames.lastFrameId = mFrameCounter;
     }
 
     frame.frameId = mFrameCounter;
     frame.refreshStartTime = refreshStartTime;
-    frame.retireTime = 0;
-    frame.glesCompositionDoneTime = 0;
     prevFrame.retireFence = retireFence;
-    frame.retireFence = Fence::NO_FENCE;
+    frame.retireFence = FenceTime::NO_FENCE;
     frame.glesCompositionDoneFence = wasGlesCompositionDone ? glDoneFence :
-            Fence::NO_FENCE;
+            FenceTime::NO_FENCE;
 
-    mOffset = (mOffset + 1) % MAX_FRAME_HISTORY;
     mFrameCounter++;
 }
 
 bool FenceTracker::getFrameTimestamps(const Layer& layer,
         uint64_t frameNumber, FrameTimestamps* outTimestamps) {
     Mutex::Autolock lock(mMutex);
-    checkFencesForCompletion();
     int32_t layerId = layer.getSequence();
 
-    size_t i = 0;
-    for (; i < MAX_FRAME_HISTORY; i++) {
-       if (mFrames[i].layers.count(layerId) &&
-               mFrames[i].layers[layerId].frameNumber == frameNumber) {
-           break;
-       }
+    auto layerFrames = mLayerFrames.find(layerId);
+    if (layerFrames == mLayerFrames.end()) {
+        return false;
     }
-    if (i == MAX_FRAME_HISTORY) {
+    const BufferFrames& buffer =
+            layerFrames->second.buffers[frameNumber % MAX_FRAME_HISTORY];
+    if (buffer.frameNumber != frameNumber ||
+            !isInHistory(buffer.lastFrameId)) {
+        return false;
+    }
+
+    // The buffer is timed by the first frame it was composed in, and
+    // released after the last one
+    const uint64_t frameId = isInHistory(buffer.firstFrameId) ?
+            buffer.firstFrameId : buffer.lastFrameId;
+    const FrameRecord& frameRecord = mFrames[frameId % MAX_FRAME_HISTORY];
+    const FrameRecord& lastFrameRecord =
+            mFrames[buffer.lastFrameId % MAX_FRAME_HISTORY];
+    auto layerRecord = frameRecord.layers.find(layerId);
+    auto lastLayerRecord = lastFrameRecord.layers.find(layerId);
+    if (layerRecord == frameRecord.layers.end() ||
+            lastLayerRecord == lastFrameRecord.layers.end()) {
         return false;
     }
 
-    const FrameRecord& frameRecord = mFrames[i];
-    const LayerRecord& layerRecord = mFrames[i].layers[layerId];
     outTimestamps->frameNumber = frameNumber;
-    outTimestamps->postedTime = layerRecord.postedTime;
-    outTimestamps->acquireTime = layerRecord.acquireTime;
+    outTimestamps->postedTime = layerRecord->second.postedTime;
+    outTimestamps->acquireTime = signalTime(layerRecord->second.acquireFence);
     outTimestamps->refreshStartTime = frameRecord.refreshStartTime;
-    outTimestamps->glCompositionDoneTime = frameRecord.glesCompositionDoneTime;
-    outTimestamps->displayRetireTime = frameRecord.retireTime;
-    outTimestamps->releaseTime = layerRecord.releaseTime;
+    outTimestamps->glCompositionDoneTime =
+            signalTime(frameRecord.glesCompositionDoneFence);
+    outTimestamps->displayRetireTime = signalTime(frameRecord.retireFence);
+    outTimestamps->releaseTime =
+            signalTime(lastLayerRecord->second.releaseFence);
     return true;
 }
 
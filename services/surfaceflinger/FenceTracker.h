@@ -26,48 +26,50 @@
 
 #include <unordered_map>
 
+#include "FenceTimeline.h"
+
 namespace android {
 
 class Layer;
 struct FrameTimestamps;
 /*
  * Keeps a circular buffer of fence/timestamp data for the last N frames in
- * SurfaceFlinger. Gets timestamps for fences after they have signaled.
+ * SurfaceFlinger. The signal times of the fences are read from their
+ * FenceTime, as polled by the FenceTimeline once per frame.
  */
 class FenceTracker {
 public:
-     FenceTracker();
+     explicit FenceTracker(FenceTimeline& timeline);
      void dump(String8* outString);
-     void addFrame(nsecs_t refreshStartTime, sp<Fence> retireFence,
-             const Vector<sp<Layer>>& layers, sp<Fence> glDoneFence);
+     void addFrame(nsecs_t refreshStartTime,
+             const sp<FenceTime>& retireFence,
+             const Vector<sp<Layer>>& layers,
+             const sp<FenceTime>& glDoneFence);
      bool getFrameTimestamps(const Layer& layer, uint64_t frameNumber,
              FrameTimestamps* outTimestamps);
 
 protected:
-     static constexpr size_t MAX_FRAME_HISTORY = 8;
+     static constexpr size_t MAX_FRAME_HISTORY = 64;
 
      struct LayerRecord {
          String8 name; // layer name
          uint64_t frameNumber; // frame number for this layer
          bool isGlesComposition; // was GLES composition used for this layer?
          nsecs_t postedTime; // time when buffer was queued
-         nsecs_t acquireTime; // timestamp from the acquire fence
-         nsecs_t releaseTime; // timestamp from the release fence
-         sp<Fence> acquireFence; // acquire fence
-         sp<Fence> releaseFence; // release fence
+         sp<FenceTime> acquireFence; // acquire fence
+         sp<FenceTime> releaseFence; // release fence
 
          LayerRecord(const String8& name, uint64_t frameNumber,
                  bool isGlesComposition, nsecs_t postedTime,
-                 nsecs_t acquireTime, nsecs_t releaseTime,
-                 sp<Fence> acquireFence, sp<Fence> releaseFence) :
+                 const sp<FenceTime>& acquireFence,
+                 const sp<FenceTime>& releaseFence) :
                  name(name), frameNumber(frameNumber),
                  isGlesComposition(isGlesComposition), postedTime(postedTime),
-                 acquireTime(acquireTime), releaseTime(releaseTime),
                  acquireFence(acquireFence), releaseFence(releaseFence) {};
          LayerRecord() : name("uninitialized"), frameNumber(0),
-                 isGlesComposition(false), postedTime(0), acquireTime(0),
-                 releaseTime(0), acquireFence(Fence::NO_FENCE),
-                 releaseFence(Fence::NO_FENCE) {};
+                 isGlesComposition(false), postedTime(0),
+                 acquireFence(FenceTime::NO_FENCE),
+                 releaseFence(FenceTime::NO_FENCE) {};
      };
 
      struct FrameRecord {
@@ -77,27 +79,44 @@ protected:
          std::unordered_map<int32_t, LayerRecord> layers;
          // timestamp for when SurfaceFlinger::handleMessageRefresh() was called
          nsecs_t refreshStartTime;
-         // timestamp from the retire fence
-         nsecs_t retireTime;
-         // timestamp from the GLES composition completion fence
-         nsecs_t glesCompositionDoneTime;
          // primary display retire fence for this frame
-         sp<Fence> retireFence;
+         sp<FenceTime> retireFence;
          // if GLES composition was done, the fence for its completion
-         sp<Fence> glesCompositionDoneFence;
+         sp<FenceTime> glesCompositionDoneFence;
 
          FrameRecord() : frameId(0), layers(), refreshStartTime(0),
-                 retireTime(0), glesCompositionDoneTime(0),
-                 retireFence(Fence::NO_FENCE),
-                 glesCompositionDoneFence(Fence::NO_FENCE) {}
+                 retireFence(FenceTime::NO_FENCE),
+                 glesCompositionDoneFence(FenceTime::NO_FENCE) {}
+     };
+
+     // The frames in which the buffers of a layer were composed, indexed by
+     // the buffer frame number modulo MAX_FRAME_HISTORY, so that
+     // getFrameTimestamps() doesn't search the history. A buffer is usually
+     // composed in a run of frames, from the one it was latched in until the
+     // next one is latched.
+     struct BufferFrames {
+         uint64_t frameNumber;
+         uint64_t firstFrameId;
+         uint64_t lastFrameId;
+         BufferFrames() : frameNumber(UINT64_MAX), firstFrameId(0),
+                 lastFrameId(0) {}
+     };
+     struct LayerFrames {
+         BufferFrames buffers[MAX_FRAME_HISTORY];
+         // the last frame the layer was composed in
+         uint64_t lastFrameId;
+         LayerFrames() : lastFrameId(0) {}
      };
 
+     FenceTimeline& mTimeline;
      uint64_t mFrameCounter;
-     uint32_t mOffset;
      FrameRecord mFrames[MAX_FRAME_HISTORY];
+     std::unordered_map<int32_t, LayerFrames> mLayerFrames;
      Mutex mMutex;
 
-     void checkFencesForCompletion();
+     bool isInHistory(uint64_t frameId) const {
+         return mFrameCounter - frameId <= MAX_FRAME_HISTORY;
+     }
 };
 
 }
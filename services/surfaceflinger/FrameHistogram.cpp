@@ -0,0 +1,107 @@
+/*
+ * Copyright (C) 2016 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include <string.h>
+
+#include <utils/String8.h>
+
+#include "FrameHistogram.h"
+
+namespace android {
+
+// The buckets come in groups of BUCKETS_PER_GROUP, the width of the buckets
+// doubling from one group to the next.
+static const size_t BUCKETS_PER_GROUP = 16;
+static const size_t NUM_GROUPS = FrameHistogram::NUM_BUCKETS / BUCKETS_PER_GROUP;
+static const nsecs_t kFirstBucketWidth = 500000;    // 0.5 ms
+
+static nsecs_t getGroupStart(size_t group) {
+    return nsecs_t(BUCKETS_PER_GROUP) * kFirstBucketWidth *
+            ((nsecs_t(1) << group) - 1);
+}
+
+FrameHistogram::FrameHistogram() {
+    clear();
+}
+
+void FrameHistogram::add(nsecs_t duration) {
+    if (duration < 0) {
+        duration = 0;
+    }
+    mBuckets[getBucket(duration)]++;
+    mCount++;
+    mSum += duration;
+    if (duration > mMax) {
+        mMax = duration;
+    }
+}
+
+void FrameHistogram::clear() {
+    memset(mBuckets, 0, sizeof(mBuckets));
+    mCount = 0;
+    mSum = 0;
+    mMax = 0;
+}
+
+size_t FrameHistogram::getBucket(nsecs_t duration) {
+    for (size_t group = 0; group < NUM_GROUPS; group++) {
+        if (duration < getGroupStart(group + 1)) {
+            nsecs_t width = kFirstBucketWidth << group;
+            return group * BUCKETS_PER_GROUP +
+                    size_t((duration - getGroupStart(group)) / width);
+        }
+    }
+    // The last bucket is a catch-all
+    return NUM_BUCKETS - 1;
+}
+
+nsecs_t FrameHistogram::getBucketLimit(size_t bucket) {
+    size_t group = bucket / BUCKETS_PER_GROUP;
+    nsecs_t width = kFirstBucketWidth << group;
+    return getGroupStart(group) +
+            nsecs_t(bucket % BUCKETS_PER_GROUP + 1) * width;
+}
+
+nsecs_t FrameHistogram::getPercentile(uint32_t percentile) const {
+    if (mCount == 0) {
+        return 0;
+    }
+    uint64_t target = (mCount * percentile + 99) / 100;
+    uint64_t count = 0;
+    for (size_t i = 0; i < NUM_BUCKETS - 1; i++) {
+        count += mBuckets[i];
+        if (count >= target && count > 0) {
+            nsecs_t limit = getBucketLimit(i);
+            return limit < mMax ? limit : mMax;
+        }
+    }
+    return mMax;
+}
+
+void FrameHistogram::dump(const char* name, String8& result) const {
+    if (mCount == 0) {
+        result.appendFormat("    %-17s: no frames\n", name);
+        return;
+    }
+    result.appendFormat("    %-17s: mean %.2f ms, p50 %.2f ms, p90 %.2f ms, "
+            "p95 %.2f ms, p99 %.2f ms, max %.2f ms\n", name,
+            double(mSum) / double(mCount) / 1e6,
+            double(getPercentile(50)) / 1e6, double(getPercentile(90)) / 1e6,
+            double(getPercentile(95)) / 1e6, double(getPercentile(99)) / 1e6,
+            double(mMax) / 1e6);
+}
+
+} // namespace android
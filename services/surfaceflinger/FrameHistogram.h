@@ -0,0 +1,65 @@
+/*
+ * Copyright (C) 2016 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef ANDROID_FRAMEHISTOGRAM_H
+#define ANDROID_FRAMEHISTOGRAM_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include <utils/Timers.h>
+
+namespace android {
+
+class String8;
+
+// FrameHistogram accumulates durations into a fixed set of buckets, so that
+// it can run for the lifetime of a layer with a constant memory footprint
+// and a constant cost per sample. Percentiles are only as precise as the
+// buckets: 0.5 ms below 8 ms, doubling every 16 buckets up to 120 ms.
+//
+// It is *NOT* thread-safe, see FrameTracker.
+class FrameHistogram {
+public:
+    enum { NUM_BUCKETS = 64 };
+
+    FrameHistogram();
+
+    void add(nsecs_t duration);
+    void clear();
+
+    uint64_t getCount() const { return mCount; }
+
+    // getPercentile returns the upper bound of the bucket holding the given
+    // percentile of the samples, or the largest sample if it is lower.
+    nsecs_t getPercentile(uint32_t percentile) const;
+
+    // dump appends a one line summary of the histogram to result.
+    void dump(const char* name, String8& result) const;
+
+private:
+    static size_t getBucket(nsecs_t duration);
+    static nsecs_t getBucketLimit(size_t bucket);
+
+    uint32_t mBuckets[NUM_BUCKETS];
+    uint64_t mCount;
+    nsecs_t mSum;
+    nsecs_t mMax;
+};
+
+}
+
+#endif // ANDROID_FRAMEHISTOGRAM_H
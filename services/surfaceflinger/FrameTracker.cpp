@@ -21,11 +21,11 @@
 
 #include <cutils/log.h>
 
-#include <ui/Fence.h>
 #include <ui/FrameStats.h>
 
 #include <utils/String8.h>
 
+#include "FenceTimeline.h"
 #include "FrameTracker.h"
 #include "EventLog/EventLog.h"
 
@@ -36,6 +36,7 @@ FrameTracker::FrameTracker() :
         mNumFences(0),
         mDisplayPeriod(0) {
     resetFrameCountersLocked();
+    clearTimeStats();
 }
 
 void FrameTracker::setDesiredPresentTime(nsecs_t presentTime) {
@@ -48,18 +49,24 @@ void FrameTracker::setFrameReadyTime(nsecs_t readyTime) {
     mFrameRecords[mOffset].frameReadyTime = readyTime;
 }
 
-void FrameTracker::setFrameReadyFence(const sp<Fence>& readyFence) {
+void FrameTracker::setFrameReadyFence(const sp<FenceTime>& readyFence) {
     Mutex::Autolock lock(mMutex);
     mFrameRecords[mOffset].frameReadyFence = readyFence;
     mNumFences++;
 }
 
+void FrameTracker::setLatchTime(nsecs_t latchTime) {
+    Mutex::Autolock lock(mMutex);
+    mFrameRecords[mOffset].latchTime = latchTime;
+}
+
 void FrameTracker::setActualPresentTime(nsecs_t presentTime) {
     Mutex::Autolock lock(mMutex);
     mFrameRecords[mOffset].actualPresentTime = presentTime;
 }
 
-void FrameTracker::setActualPresentFence(const sp<Fence>& readyFence) {
+void FrameTracker::setActualPresentFence(
+        const sp<FenceTime>& readyFence) {
     Mutex::Autolock lock(mMutex);
     mFrameRecords[mOffset].actualPresentFence = readyFence;
     mNumFences++;
@@ -80,7 +87,9 @@ void FrameTracker::advanceFrame() {
     mOffset = (mOffset+1) % NUM_FRAME_RECORDS;
     mFrameRecords[mOffset].desiredPresentTime = INT64_MAX;
     mFrameRecords[mOffset].frameReadyTime = INT64_MAX;
+    mFrameRecords[mOffset].latchTime = 0;
     mFrameRecords[mOffset].actualPresentTime = INT64_MAX;
+    mFrameRecords[mOffset].statsUpdated = false;
 
     if (mFrameRecords[mOffset].frameReadyFence != NULL) {
         // We're clobbering an unsignaled fence, so we need to decrement the
@@ -106,7 +115,9 @@ void FrameTracker::clearStats() {
     for (size_t i = 0; i < NUM_FRAME_RECORDS; i++) {
         mFrameRecords[i].desiredPresentTime = 0;
         mFrameRecords[i].frameReadyTime = 0;
+        mFrameRecords[i].latchTime = 0;
         mFrameRecords[i].actualPresentTime = 0;
+        mFrameRecords[i].statsUpdated = false;
         mFrameRecords[i].frameReadyFence.clear();
         mFrameRecords[i].actualPresentFence.clear();
     }
@@ -156,7 +167,7 @@ void FrameTracker::processFencesLocked() const {
         size_t idx = (mOffset+NUM_FRAME_RECORDS-i) % NUM_FRAME_RECORDS;
         bool updated = false;
 
-        const sp<Fence>& rfence = records[idx].frameReadyFence;
+        const sp<FenceTime>& rfence = records[idx].frameReadyFence;
         if (rfence != NULL) {
             records[idx].frameReadyTime = rfence->getSignalTime();
             if (records[idx].frameReadyTime < INT64_MAX) {
@@ -166,7 +177,7 @@ void FrameTracker::processFencesLocked() const {
             }
         }
 
-        const sp<Fence>& pfence = records[idx].actualPresentFence;
+        const sp<FenceTime>& pfence = records[idx].actualPresentFence;
         if (pfence != NULL) {
             records[idx].actualPresentTime = pfence->getSignalTime();
             if (records[idx].actualPresentTime < INT64_MAX) {
@@ -184,11 +195,20 @@ void FrameTracker::processFencesLocked() const {
 
 void FrameTracker::updateStatsLocked(size_t newFrameIdx) const {
     int* numFrames = const_cast<int*>(mNumFrames);
+    FrameRecord* records = const_cast<FrameRecord*>(mFrameRecords);
 
-    if (mDisplayPeriod > 0 && isFrameValidLocked(newFrameIdx)) {
-        size_t prevFrameIdx = (newFrameIdx+NUM_FRAME_RECORDS-1) %
-                NUM_FRAME_RECORDS;
+    // A frame is updated again when its ready fence signals after its
+    // present fence, it must only be counted once.
+    if (!isFrameValidLocked(newFrameIdx) || records[newFrameIdx].statsUpdated) {
+        return;
+    }
+    records[newFrameIdx].statsUpdated = true;
+
+    size_t prevFrameIdx = (newFrameIdx+NUM_FRAME_RECORDS-1) %
+            NUM_FRAME_RECORDS;
+    updateTimeStatsLocked(newFrameIdx, prevFrameIdx);
 
+    if (mDisplayPeriod > 0) {
         if (isFrameValidLocked(prevFrameIdx)) {
             nsecs_t newPresentTime =
                     mFrameRecords[newFrameIdx].actualPresentTime;
@@ -213,6 +233,43 @@ void FrameTracker::updateStatsLocked(size_t newFrameIdx) const {
     }
 }
 
+void FrameTracker::updateTimeStatsLocked(size_t newFrameIdx,
+        size_t prevFrameIdx) const {
+    const FrameRecord& frame = mFrameRecords[newFrameIdx];
+    const nsecs_t presentTime = frame.actualPresentTime;
+    const bool hasDesiredPresentTime = frame.desiredPresentTime > 0 &&
+            frame.desiredPresentTime < INT64_MAX;
+
+    mPresentedFrames++;
+    if (frame.latchTime > 0 && frame.latchTime < INT64_MAX) {
+        mLatchToPresent.add(presentTime - frame.latchTime);
+    }
+    if (hasDesiredPresentTime) {
+        mQueueToPresent.add(presentTime - frame.desiredPresentTime);
+    }
+
+    if (!isFrameValidLocked(prevFrameIdx)) {
+        return;
+    }
+    const nsecs_t prevPresentTime = mFrameRecords[prevFrameIdx].actualPresentTime;
+    mFrameInterval.add(presentTime - prevPresentTime);
+
+    if (mDisplayPeriod <= 0 || !hasDesiredPresentTime) {
+        return;
+    }
+    if (frame.desiredPresentTime >= prevPresentTime) {
+        mLateFrames++;
+        return;
+    }
+    nsecs_t numPeriods = (presentTime - prevPresentTime + mDisplayPeriod/2) /
+            mDisplayPeriod;
+    nsecs_t missed = numPeriods > 1 ? numPeriods - 1 : 0;
+    if (missed >= NUM_MISSED_VSYNC_BUCKETS) {
+        missed = NUM_MISSED_VSYNC_BUCKETS - 1;
+    }
+    mMissedVsyncs[missed]++;
+}
+
 void FrameTracker::resetFrameCountersLocked() {
     for (int i = 0; i < NUM_FRAME_BUCKETS; i++) {
         mNumFrames[i] = 0;
@@ -248,4 +305,47 @@ void FrameTracker::dumpStats(String8& result) const {
     result.append("\n");
 }
 
+void FrameTracker::clearTimeStats() {
+    Mutex::Autolock lock(mMutex);
+    mLatchToPresent.clear();
+    mQueueToPresent.clear();
+    mFrameInterval.clear();
+    for (size_t i = 0; i < NUM_MISSED_VSYNC_BUCKETS; i++) {
+        mMissedVsyncs[i] = 0;
+    }
+    mLateFrames = 0;
+    mPresentedFrames = 0;
+    mTimeStatsStartTime = systemTime();
+}
+
+void FrameTracker::dumpTimeStats(const String8& name, String8& result) const {
+    Mutex::Autolock lock(mMutex);
+    processFencesLocked();
+
+    uint64_t queuedFrames = 0;
+    uint64_t missedFrames = 0;
+    for (size_t i = 0; i < NUM_MISSED_VSYNC_BUCKETS; i++) {
+        queuedFrames += mMissedVsyncs[i];
+        if (i > 0) {
+            missedFrames += mMissedVsyncs[i];
+        }
+    }
+
+    result.appendFormat("%s: %" PRIu64 " frames in %.1f s, %" PRIu64
+            " missed deadlines (%.2f%%), %" PRIu64 " queued late\n",
+            name.string(), mPresentedFrames,
+            double(systemTime() - mTimeStatsStartTime) / 1e9, missedFrames,
+            queuedFrames ? 100.0 * double(missedFrames) / double(queuedFrames) :
+            0.0, mLateFrames);
+    mLatchToPresent.dump("latch-to-present", result);
+    mQueueToPresent.dump("queue-to-present", result);
+    mFrameInterval.dump("frame interval", result);
+    result.append("    missed vsyncs    :");
+    for (size_t i = 0; i < NUM_MISSED_VSYNC_BUCKETS; i++) {
+        result.appendFormat(" %zu%s:%" PRIu64, i,
+                i == NUM_MISSED_VSYNC_BUCKETS - 1 ? "+" : "", mMissedVsyncs[i]);
+    }
+    result.append("\n");
+}
+
 } // namespace android
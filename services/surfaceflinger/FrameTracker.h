@@ -23,10 +23,12 @@
 #include <utils/Timers.h>
 #include <utils/RefBase.h>
 
+#include "FrameHistogram.h"
+
 namespace android {
 
 class String8;
-class Fence;
+class FenceTime;
 
 // FrameTracker tracks information about the most recently rendered frames. It
 // uses a circular buffer of frame records, and is *NOT* thread-safe -
@@ -35,7 +37,13 @@ class Fence;
 //
 // Some of the time values tracked may be set either as a specific timestamp
 // or a fence.  When a non-NULL fence is set for a given time value, the
-// signal time of that fence is used instead of the timestamp.
+// signal time of that fence is used instead of the timestamp. The fences
+// are polled by the FenceTimeline that tracks them, FrameTracker only reads
+// the signal times it recorded.
+//
+// Besides the frame records, it keeps long-horizon timing statistics of all
+// the frames seen since it was created or since clearTimeStats(), in fixed
+// size histograms (see FrameHistogram).
 class FrameTracker {
 
 public:
@@ -45,6 +53,10 @@ public:
 
     enum { NUM_FRAME_BUCKETS = 7 };
 
+    // NUM_MISSED_VSYNC_BUCKETS is the number of buckets of the missed vsync
+    // histogram, the last one counts all the frames that missed more.
+    enum { NUM_MISSED_VSYNC_BUCKETS = 8 };
+
     FrameTracker();
 
     // setDesiredPresentTime sets the time at which the current frame
@@ -60,7 +72,11 @@ public:
 
     // setFrameReadyFence sets the fence that is used to get the time at which
     // the current frame became ready to be presented to the user.
-    void setFrameReadyFence(const sp<Fence>& readyFence);
+    void setFrameReadyFence(const sp<FenceTime>& readyFence);
+
+    // setLatchTime sets the time at which SurfaceFlinger latched the current
+    // frame for composition.
+    void setLatchTime(nsecs_t latchTime);
 
     // setActualPresentTime sets the timestamp at which the current frame became
     // visible to the user.
@@ -68,7 +84,7 @@ public:
 
     // setActualPresentFence sets the fence that is used to get the time
     // at which the current frame became visible to the user.
-    void setActualPresentFence(const sp<Fence>& fence);
+    void setActualPresentFence(const sp<FenceTime>& fence);
 
     // setDisplayRefreshPeriod sets the display refresh period in nanoseconds.
     // This is used to compute frame presentation duration statistics relative
@@ -91,17 +107,29 @@ public:
     // dumpStats dump appends the current frame display time history to the result string.
     void dumpStats(String8& result) const;
 
+    // clearTimeStats clears the long-horizon timing statistics.
+    void clearTimeStats();
+
+    // dumpTimeStats appends the long-horizon timing statistics to the
+    // result string.
+    void dumpTimeStats(const String8& name, String8& result) const;
+
 private:
     struct FrameRecord {
         FrameRecord() :
             desiredPresentTime(0),
             frameReadyTime(0),
-            actualPresentTime(0) {}
+            latchTime(0),
+            actualPresentTime(0),
+            statsUpdated(false) {}
         nsecs_t desiredPresentTime;
         nsecs_t frameReadyTime;
+        nsecs_t latchTime;
         nsecs_t actualPresentTime;
-        sp<Fence> frameReadyFence;
-        sp<Fence> actualPresentFence;
+        // whether the frame was already counted in the statistics
+        bool statsUpdated;
+        sp<FenceTime> frameReadyFence;
+        sp<FenceTime> actualPresentFence;
     };
 
     // processFences iterates over all the frame records that have a fence set
@@ -114,9 +142,13 @@ private:
     void processFencesLocked() const;
 
     // updateStatsLocked updates the running statistics that are gathered
-    // about the frame times.
+    // about the frame times, once the frame has been presented.
     void updateStatsLocked(size_t newFrameIdx) const;
 
+    // updateTimeStatsLocked adds a presented frame to the long-horizon
+    // timing statistics.
+    void updateTimeStatsLocked(size_t newFrameIdx, size_t prevFrameIdx) const;
+
     // resetFrameCounteresLocked sets all elements of the mNumFrames array to
     // 0.
     void resetFrameCountersLocked();
@@ -151,6 +183,32 @@ private:
     // all frames with duration greater than 2^(NUM_FRAME_BUCKETS-1).
     int32_t mNumFrames[NUM_FRAME_BUCKETS];
 
+    // mLatchToPresent and mQueueToPresent are the distributions of the time
+    // from the latch and from the desired present time of the frames to their
+    // presentation. The desired present time is when the frame was queued,
+    // unless the producer gave it an explicit timestamp.
+    mutable FrameHistogram mLatchToPresent;
+    mutable FrameHistogram mQueueToPresent;
+
+    // mFrameInterval is the distribution of the time between the
+    // presentation of consecutive frames.
+    mutable FrameHistogram mFrameInterval;
+
+    // mMissedVsyncs counts the frames that were queued before the previous
+    // frame was presented by the number of vsync periods they missed: those
+    // were ready, so any period without a new frame is a missed deadline.
+    // mLateFrames counts the frames queued later, which can't miss one.
+    //
+    // Like mNumFrames, these are updated from the const processFencesLocked.
+    mutable uint64_t mMissedVsyncs[NUM_MISSED_VSYNC_BUCKETS];
+    mutable uint64_t mLateFrames;
+
+    // mPresentedFrames counts all the frames in the statistics.
+    mutable uint64_t mPresentedFrames;
+
+    // mTimeStatsStartTime is when the long-horizon statistics were cleared.
+    nsecs_t mTimeStatsStartTime;
+
     // mDisplayPeriod is the display refresh period of the display for which
     // this FrameTracker is gathering information.
     nsecs_t mDisplayPeriod;
@@ -49,12 +49,14 @@
 #include "DisplayDevice.h"
 #include "Layer.h"
 #include "MonitoredProducer.h"
+#include "PlanePredictor.h"
 #include "SurfaceFlinger.h"
 
 #include "DisplayHardware/HWComposer.h"
 
 #include "RenderEngine/RenderEngine.h"
 
+#include <functional>
 #include <mutex>
 
 #define DEBUG_RESIZE    0
@@ -89,6 +91,8 @@ Layer::Layer(SurfaceFlinger* flinger, const sp<Client>& client,
         mFiltering(false),
         mNeedsFiltering(false),
         mMesh(Mesh::TRIANGLE_FAN, 4, 2, 2),
+        mGeometryGeneration(0),
+        mContentGeneration(0),
 #ifndef USE_HWC2
         mIsGlesComposition(false),
 #endif
@@ -682,6 +686,23 @@ void Layer::setGeometry(
                 "%s (%d)", mName.string(), to_string(transform).c_str(),
                 to_string(error).c_str(), static_cast<int32_t>(error));
     }
+
+    uint64_t geometryHash = 0;
+    for (int32_t edge : {transformedFrame.left, transformedFrame.top,
+            transformedFrame.right, transformedFrame.bottom}) {
+        geometryHash = PlanePredictor::combineHash(geometryHash,
+                uint32_t(edge));
+    }
+    for (float edge : {sourceCrop.left, sourceCrop.top, sourceCrop.right,
+            sourceCrop.bottom, s.alpha}) {
+        geometryHash = PlanePredictor::combineHash(geometryHash,
+                std::hash<float>()(edge));
+    }
+    geometryHash = PlanePredictor::combineHash(geometryHash, isOpaque(s));
+    geometryHash = PlanePredictor::combineHash(geometryHash, orientation);
+    geometryHash = PlanePredictor::combineHash(geometryHash,
+            hwcInfo.forceClientComposition);
+    hwcInfo.geometryHash = geometryHash;
 #else
     if (orientation & Transform::ROT_INVALID) {
         // we can only handle simple transformation
@@ -1137,6 +1158,14 @@ HWC2::Composition Layer::getCompositionType(int32_t hwcId) const {
     return mHwcLayers.at(hwcId).compositionType;
 }
 
+uint64_t Layer::getHwcGeometryHash(int32_t hwcId) const {
+    if (mHwcLayers.count(hwcId) == 0) {
+        ALOGE("getHwcGeometryHash called with an invalid HWC layer");
+        return 0;
+    }
+    return mHwcLayers.at(hwcId).geometryHash;
+}
+
 void Layer::setClearClientTarget(int32_t hwcId, bool clear) {
     if (mHwcLayers.count(hwcId) == 0) {
         ALOGE("setClearClientTarget called without a valid HWC layer");
@@ -1224,6 +1253,9 @@ bool Layer::addSyncPoint(const std::shared_ptr<SyncPoint>& point) {
 }
 
 void Layer::setFiltering(bool filtering) {
+    if (mFiltering != filtering) {
+        mContentGeneration++;
+    }
     mFiltering = filtering;
 }
 
@@ -1387,20 +1419,111 @@ bool Layer::needsFiltering(const sp<const DisplayDevice>& hw) const {
     return mNeedsFiltering || hw->needsFiltering();
 }
 
+// Returns false if the regions may differ. Regions built differently can
+// have different (but equivalent) rect lists, this only costs a recompute.
+static bool regionsEqual(const Region& lhs, const Region& rhs) {
+    if (lhs.isTriviallyEqual(rhs)) {
+        return true;
+    }
+    size_t lhsCount, rhsCount;
+    const Rect* lhsRects = lhs.getArray(&lhsCount);
+    const Rect* rhsRects = rhs.getArray(&rhsCount);
+    if (lhsCount != rhsCount) {
+        return false;
+    }
+    for (size_t i = 0; i < lhsCount; i++) {
+        if (lhsRects[i] != rhsRects[i]) {
+            return false;
+        }
+    }
+    return true;
+}
+
+static bool transformsEqual(const Transform& lhs, const Transform& rhs) {
+    return lhs[0] == rhs[0] && lhs[1] == rhs[1] && lhs[2] == rhs[2];
+}
+
 void Layer::setVisibleRegion(const Region& visibleRegion) {
     // always called from main thread
+    if (!regionsEqual(this->visibleRegion, visibleRegion)) {
+        mGeometryGeneration++;
+        mContentGeneration++;
+    }
     this->visibleRegion = visibleRegion;
+    mVisibleRegionCache.valid = false;
 }
 
 void Layer::setCoveredRegion(const Region& coveredRegion) {
     // always called from main thread
     this->coveredRegion = coveredRegion;
+    mVisibleRegionCache.valid = false;
 }
 
 void Layer::setVisibleNonTransparentRegion(const Region&
         setVisibleNonTransparentRegion) {
     // always called from main thread
     this->visibleNonTransparentRegion = setVisibleNonTransparentRegion;
+    mVisibleRegionCache.valid = false;
+}
+
+bool Layer::reuseVisibleRegions(uint32_t layerStack,
+        Region& aboveOpaqueLayers, Region& aboveCoveredLayers,
+        Region& dirtyRegion) {
+    VisibleRegionCache& cache(mVisibleRegionCache);
+    if (!cache.valid || contentDirty || cache.layerStack != layerStack) {
+        return false;
+    }
+
+    // these are the inputs computeVisibleRegions() uses
+    const State& s(getDrawingState());
+    if (cache.visible != isVisible() || cache.opaque != isOpaque(s) ||
+#ifdef USE_HWC2
+            cache.opaqueAlpha != (s.alpha == 1.0f) ||
+#else
+            cache.opaqueAlpha != (s.alpha == 255) ||
+#endif
+            !transformsEqual(cache.transform, s.active.transform) ||
+            cache.bounds != computeBounds() ||
+            !regionsEqual(cache.transparentRegion, s.activeTransparentRegion)) {
+        return false;
+    }
+
+    if (!regionsEqual(cache.aboveOpaqueBefore, aboveOpaqueLayers) ||
+            !regionsEqual(cache.aboveCoveredBefore, aboveCoveredLayers)) {
+        return false;
+    }
+
+    aboveOpaqueLayers = cache.aboveOpaqueAfter;
+    aboveCoveredLayers = cache.aboveCoveredAfter;
+    dirtyRegion.orSelf(cache.unchangedDirty);
+    return true;
+}
+
+void Layer::cacheVisibleRegions(uint32_t layerStack,
+        const Region& aboveOpaqueBefore, const Region& aboveCoveredBefore,
+        const Region& aboveOpaqueAfter, const Region& aboveCoveredAfter) {
+    VisibleRegionCache& cache(mVisibleRegionCache);
+    const State& s(getDrawingState());
+    cache.layerStack = layerStack;
+    cache.visible = isVisible();
+    cache.opaque = isOpaque(s);
+#ifdef USE_HWC2
+    cache.opaqueAlpha = (s.alpha == 1.0f);
+#else
+    cache.opaqueAlpha = (s.alpha == 255);
+#endif
+    cache.transform = s.active.transform;
+    cache.bounds = computeBounds();
+    cache.transparentRegion = s.activeTransparentRegion;
+    cache.aboveOpaqueBefore = aboveOpaqueBefore;
+    cache.aboveCoveredBefore = aboveCoveredBefore;
+    cache.aboveOpaqueAfter = aboveOpaqueAfter;
+    cache.aboveCoveredAfter = aboveCoveredAfter;
+    // With the same geometry and the same layers above, computeVisibleRegions()
+    // finds the old and new regions equal, so the layer only dirties the part
+    // of its visible region which is covered (by translucent layers).
+    cache.unchangedDirty = visibleRegion.intersect(coveredRegion);
+    cache.valid = true;
 }
 
 // ----------------------------------------------------------------------------
@@ -1638,6 +1761,8 @@ uint32_t Layer::doTransaction(uint32_t flags) {
 
 void Layer::commitTransaction(const State& stateToCommit) {
     mDrawingState = stateToCommit;
+    mGeometryGeneration++;
+    mContentGeneration++;
 }
 
 uint32_t Layer::getTransactionFlags(uint32_t flags) {
@@ -1846,7 +1971,7 @@ bool Layer::onPreComposition() {
     return mQueuedFrames > 0 || mSidebandStreamChanged || mAutoRefresh;
 }
 
-bool Layer::onPostComposition() {
+bool Layer::onPostComposition(const sp<FenceTime>& presentFence) {
     bool frameLatencyNeeded = mFrameLatencyNeeded;
     if (mFrameLatencyNeeded) {
         nsecs_t desiredPresentTime = mSurfaceFlingerConsumer->getTimestamp();
@@ -1854,24 +1979,20 @@ bool Layer::onPostComposition() {
 
         sp<Fence> frameReadyFence = mSurfaceFlingerConsumer->getCurrentFence();
         if (frameReadyFence->isValid()) {
-            mFrameTracker.setFrameReadyFence(frameReadyFence);
+            mFrameTracker.setFrameReadyFence(
+                    mFlinger->mFenceTimeline.track(frameReadyFence));
         } else {
             // There was no fence for this frame, so assume that it was ready
             // to be presented at the desired present time.
             mFrameTracker.setFrameReadyTime(desiredPresentTime);
         }
 
-        const HWComposer& hwc = mFlinger->getHwComposer();
-#ifdef USE_HWC2
-        sp<Fence> presentFence = hwc.getRetireFence(HWC_DISPLAY_PRIMARY);
-#else
-        sp<Fence> presentFence = hwc.getDisplayFence(HWC_DISPLAY_PRIMARY);
-#endif
         if (presentFence->isValid()) {
             mFrameTracker.setActualPresentFence(presentFence);
         } else {
             // The HWC doesn't support present fences, so use the refresh
             // timestamp instead.
+            const HWComposer& hwc = mFlinger->getHwComposer();
             nsecs_t presentTime = hwc.getRefreshTimestamp(HWC_DISPLAY_PRIMARY);
             mFrameTracker.setActualPresentTime(presentTime);
         }
@@ -2187,6 +2308,7 @@ Region Layer::latchBuffer(bool& recomputeVisibleRegions)
 
         mRefreshPending = true;
         mFrameLatencyNeeded = true;
+        mFrameTracker.setLatchTime(systemTime());
         if (oldActiveBuffer == NULL) {
              // the first time we receive a buffer, we need to trigger a
              // geometry invalidation.
@@ -2221,6 +2343,7 @@ Region Layer::latchBuffer(bool& recomputeVisibleRegions)
         }
 
         mCurrentFrameNumber = mSurfaceFlingerConsumer->getFrameNumber();
+        mContentGeneration++;
 
         // Remove any sync points corresponding to the buffer which was just
         // latched
@@ -2404,9 +2527,18 @@ void Layer::logFrameStats() {
 }
 
 void Layer::getFrameStats(FrameStats* outStats) const {
+    mFlinger->mFenceTimeline.updateSignalTimes();
     mFrameTracker.getStats(outStats);
 }
 
+void Layer::dumpTimeStats(String8& result) const {
+    mFrameTracker.dumpTimeStats(mName, result);
+}
+
+void Layer::clearTimeStats() {
+    mFrameTracker.clearTimeStats();
+}
+
 void Layer::getFenceData(String8* outName, uint64_t* outFrameNumber,
         bool* outIsGlesComposition, nsecs_t* outPostedTime,
         sp<Fence>* outAcquireFence, sp<Fence>* outPrevReleaseFence) const {
@@ -2442,6 +2574,10 @@ bool Layer::getTransformToDisplayInverse() const {
     return mSurfaceFlingerConsumer->getTransformToDisplayInverse();
 }
 
+android_dataspace Layer::getDataSpace() const {
+    return mSurfaceFlingerConsumer->getCurrentDataSpace();
+}
+
 // ---------------------------------------------------------------------------
 
 Layer::LayerCleaner::LayerCleaner(const sp<SurfaceFlinger>& flinger,
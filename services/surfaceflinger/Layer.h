@@ -262,6 +262,10 @@ public:
             bool callIntoHwc = true);
     HWC2::Composition getCompositionType(int32_t hwcId) const;
 
+    // getHwcGeometryHash returns a hash of the geometry last set on the HWC
+    // layer by setGeometry(), see PlanePredictor
+    uint64_t getHwcGeometryHash(int32_t hwcId) const;
+
     void setClearClientTarget(int32_t hwcId, bool clear);
     bool getClearClientTarget(int32_t hwcId) const;
 
@@ -296,10 +300,11 @@ public:
     bool onPreComposition();
 
     /*
-     * called after composition.
+     * called after composition, with the present fence of the primary
+     * display.
      * returns true if the layer latched a new buffer this frame.
      */
-    bool onPostComposition();
+    bool onPostComposition(const sp<FenceTime>& presentFence);
 
 #ifdef USE_HWC2
     // If a buffer was replaced this frame, release the former buffer
@@ -340,6 +345,34 @@ public:
     void setVisibleNonTransparentRegion(const Region&
             visibleNonTransparentRegion);
 
+    /*
+     * reuseVisibleRegions - called by computeVisibleRegions() before it
+     * processes this layer. If the layer's geometry and the regions of the
+     * layers above it are the same as in the last pass, the regions set then
+     * are still valid: the above regions are advanced past this layer, its
+     * dirty contribution is added to dirtyRegion and true is returned.
+     */
+    bool reuseVisibleRegions(uint32_t layerStack, Region& aboveOpaqueLayers,
+            Region& aboveCoveredLayers, Region& dirtyRegion);
+
+    /*
+     * cacheVisibleRegions - called by computeVisibleRegions() after it set
+     * the regions of this layer, with the above regions as they were before
+     * and after this layer, so that the next pass can reuse them.
+     */
+    void cacheVisibleRegions(uint32_t layerStack,
+            const Region& aboveOpaqueBefore, const Region& aboveCoveredBefore,
+            const Region& aboveOpaqueAfter, const Region& aboveCoveredAfter);
+
+    /*
+     * getGeometryGeneration - changes whenever the drawing state or the
+     * visible region of this layer changes. getContentGeneration() also
+     * changes when a new buffer is latched: when it is unchanged, draw()
+     * produces the same pixels as before on a given display.
+     */
+    uint64_t getGeometryGeneration() const { return mGeometryGeneration; }
+    uint64_t getContentGeneration() const { return mContentGeneration; }
+
     /*
      * latchBuffer - called each time the screen is redrawn and returns whether
      * the visible regions need to be recomputed (this is a fairly heavy
@@ -431,6 +464,9 @@ public:
     // only for debugging
     inline const sp<GraphicBuffer>& getActiveBuffer() const { return mActiveBuffer; }
 
+    // frame number of the buffer latched last, changes with the content
+    uint64_t getCurrentFrameNumber() const { return mCurrentFrameNumber; }
+
     inline  const State&    getDrawingState() const { return mDrawingState; }
     inline  const State&    getCurrentState() const { return mCurrentState; }
     inline  State&          getCurrentState()       { return mCurrentState; }
@@ -446,6 +482,8 @@ public:
     void clearFrameStats();
     void logFrameStats();
     void getFrameStats(FrameStats* outStats) const;
+    void dumpTimeStats(String8& result) const;
+    void clearTimeStats();
 
     void getFenceData(String8* outName, uint64_t* outFrameNumber,
             bool* outIsGlesComposition, nsecs_t* outPostedTime,
@@ -460,6 +498,9 @@ public:
 
     bool getTransformToDisplayInverse() const;
 
+    // dataspace of the buffer latched last
+    android_dataspace getDataSpace() const;
+
 protected:
     // constant
     sp<SurfaceFlinger> mFlinger;
@@ -616,6 +657,32 @@ private:
     // The texture used to draw the layer in GLES composition mode
     mutable Texture mTexture;
 
+    // Inputs and results of the last visible region computation for this
+    // layer, see reuseVisibleRegions()
+    struct VisibleRegionCache {
+        VisibleRegionCache() : valid(false), layerStack(0), visible(false),
+                opaque(false), opaqueAlpha(false) {}
+        bool valid;
+        uint32_t layerStack;
+        bool visible;
+        bool opaque;
+        bool opaqueAlpha;
+        Transform transform;
+        Rect bounds;
+        Region transparentRegion;
+        Region aboveOpaqueBefore;
+        Region aboveCoveredBefore;
+        Region aboveOpaqueAfter;
+        Region aboveCoveredAfter;
+        // what the layer adds to the dirty region when nothing changed
+        Region unchangedDirty;
+    };
+    VisibleRegionCache mVisibleRegionCache;
+
+    // see getGeometryGeneration(), main thread only
+    uint64_t mGeometryGeneration;
+    uint64_t mContentGeneration;
+
 #ifdef USE_HWC2
     // HWC items, accessed from the main thread
     struct HWCInfo {
@@ -623,7 +690,8 @@ private:
           : layer(),
             forceClientComposition(false),
             compositionType(HWC2::Composition::Invalid),
-            clearClientTarget(false) {}
+            clearClientTarget(false),
+            geometryHash(0) {}
 
         std::shared_ptr<HWC2::Layer> layer;
         bool forceClientComposition;
@@ -631,6 +699,7 @@ private:
         bool clearClientTarget;
         Rect displayFrame;
         FloatRect sourceCrop;
+        uint64_t geometryHash;
     };
     std::unordered_map<int32_t, HWCInfo> mHwcLayers;
 #else
@@ -36,6 +36,7 @@
 #include "LayerBlur.h"
 #include "SurfaceFlinger.h"
 #include "DisplayDevice.h"
+#include "RenderEngine/Program.h"
 #include "RenderEngine/RenderEngine.h"
 
 namespace android {
@@ -91,25 +92,186 @@ static void setupMesh(Mesh& mesh, int width, int height, int viewportHeight) {
     texCoords[3] = vec2(1.0f, 1.0f);
 }
 
+// ---------------------------------------------------------------------------
+// Built-in dual filter blur: the capture is downsampled by half a few times,
+// then upsampled back, each pass sampling between texels so that the bilinear
+// filtering does part of the work. This is much cheaper than a gaussian of the
+// same radius, and the cost is mostly that of the first downsample.
+
+static const char* const sBlurVertexShader =
+    "attribute vec4 position;\n"
+    "attribute vec2 texCoords;\n"
+    "varying vec2 outTexCoords;\n"
+    "void main(void) {\n"
+    "    outTexCoords = texCoords;\n"
+    "    gl_Position = position;\n"
+    "}\n";
+
+static const char* const sBlurFragmentPrecision =
+    "#ifdef GL_FRAGMENT_PRECISION_HIGH\n"
+    "precision highp float;\n"
+    "#else\n"
+    "precision mediump float;\n"
+    "#endif\n"
+    "uniform sampler2D sampler;\n"
+    "uniform vec2 halfPixel;\n"
+    "varying vec2 outTexCoords;\n";
+
+static const char* const sBlurDownsampleShader =
+    "void main(void) {\n"
+    "    vec2 uv = outTexCoords;\n"
+    "    vec4 sum = texture2D(sampler, uv) * 4.0;\n"
+    "    sum += texture2D(sampler, uv - halfPixel);\n"
+    "    sum += texture2D(sampler, uv + halfPixel);\n"
+    "    sum += texture2D(sampler, uv + vec2(halfPixel.x, -halfPixel.y));\n"
+    "    sum += texture2D(sampler, uv - vec2(halfPixel.x, -halfPixel.y));\n"
+    "    gl_FragColor = sum / 8.0;\n"
+    "}\n";
+
+static const char* const sBlurUpsampleShader =
+    "void main(void) {\n"
+    "    vec2 uv = outTexCoords;\n"
+    "    vec4 sum = texture2D(sampler, uv + vec2(-halfPixel.x * 2.0, 0.0));\n"
+    "    sum += texture2D(sampler, uv + vec2(-halfPixel.x, halfPixel.y)) * 2.0;\n"
+    "    sum += texture2D(sampler, uv + vec2(0.0, halfPixel.y * 2.0));\n"
+    "    sum += texture2D(sampler, uv + vec2(halfPixel.x, halfPixel.y)) * 2.0;\n"
+    "    sum += texture2D(sampler, uv + vec2(halfPixel.x * 2.0, 0.0));\n"
+    "    sum += texture2D(sampler, uv + vec2(halfPixel.x, -halfPixel.y)) * 2.0;\n"
+    "    sum += texture2D(sampler, uv + vec2(0.0, -halfPixel.y * 2.0));\n"
+    "    sum += texture2D(sampler, uv + vec2(-halfPixel.x, -halfPixel.y)) * 2.0;\n"
+    "    gl_FragColor = sum / 12.0;\n"
+    "}\n";
+
+// Levels smaller than this add nothing but passes
+static const int kMinBlurLevelSize = 8;
+
+struct BlurProgram {
+    GLuint program;
+    GLint halfPixelLoc;
+};
+
+static GLuint buildBlurShader(GLenum type, const char* const* sources,
+        GLsizei count) {
+    GLuint shader = glCreateShader(type);
+    glShaderSource(shader, count, sources, 0);
+    glCompileShader(shader);
+    GLint status;
+    glGetShaderiv(shader, GL_COMPILE_STATUS, &status);
+    if (status != GL_TRUE) {
+        GLchar log[512];
+        glGetShaderInfoLog(shader, sizeof(log), 0, log);
+        ALOGE("Error while compiling blur shader:\n%s", log);
+        glDeleteShader(shader);
+        return 0;
+    }
+    return shader;
+}
+
+static bool buildBlurProgram(const char* fragment, BlurProgram* outProgram) {
+    GLuint vertexId = buildBlurShader(GL_VERTEX_SHADER, &sBlurVertexShader, 1);
+    const char* fragmentSources[] = { sBlurFragmentPrecision, fragment };
+    GLuint fragmentId = buildBlurShader(GL_FRAGMENT_SHADER, fragmentSources, 2);
+    if (vertexId == 0 || fragmentId == 0) {
+        glDeleteShader(vertexId);
+        glDeleteShader(fragmentId);
+        return false;
+    }
+
+    GLuint programId = glCreateProgram();
+    glAttachShader(programId, vertexId);
+    glAttachShader(programId, fragmentId);
+    glBindAttribLocation(programId, Program::position, "position");
+    glBindAttribLocation(programId, Program::texCoords, "texCoords");
+    glLinkProgram(programId);
+    glDeleteShader(vertexId);
+    glDeleteShader(fragmentId);
+
+    GLint status;
+    glGetProgramiv(programId, GL_LINK_STATUS, &status);
+    if (status != GL_TRUE) {
+        ALOGE("Error while linking blur shaders");
+        glDeleteProgram(programId);
+        return false;
+    }
+
+    glUseProgram(programId);
+    glUniform1i(glGetUniformLocation(programId, "sampler"), 0);
+    outProgram->program = programId;
+    outProgram->halfPixelLoc = glGetUniformLocation(programId, "halfPixel");
+    return true;
+}
+
+// The programs are built on first use and shared by all the LayerBlur, like
+// the ones of the ProgramCache they live as long as the GL context.
+static bool getBlurPrograms(BlurProgram* outDownsample, BlurProgram* outUpsample) {
+    static bool sInitialized = false;
+    static bool sValid = false;
+    static BlurProgram sDownsample;
+    static BlurProgram sUpsample;
+    if (!sInitialized) {
+        sInitialized = true;
+        sValid = buildBlurProgram(sBlurDownsampleShader, &sDownsample) &&
+                buildBlurProgram(sBlurUpsampleShader, &sUpsample);
+    }
+    *outDownsample = sDownsample;
+    *outUpsample = sUpsample;
+    return sValid;
+}
+
+static void drawBlurPass(const BlurProgram& program, const Texture& source,
+        GLuint fbo, int width, int height) {
+    static const GLfloat positions[] = { -1, -1,  1, -1,  1, 1,  -1, 1 };
+    static const GLfloat texCoords[] = {  0,  0,  1,  0,  1, 1,   0, 1 };
+
+    glBindFramebuffer(GL_FRAMEBUFFER, fbo);
+    glViewport(0, 0, width, height);
+    glUseProgram(program.program);
+    glUniform2f(program.halfPixelLoc, 0.5f / width, 0.5f / height);
+
+    glBindTexture(GL_TEXTURE_2D, source.getTextureName());
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_LINEAR);
+
+    glEnableVertexAttribArray(Program::texCoords);
+    glVertexAttribPointer(Program::texCoords, 2, GL_FLOAT, GL_FALSE, 0, texCoords);
+    glVertexAttribPointer(Program::position, 2, GL_FLOAT, GL_FALSE, 0, positions);
+    glDrawArrays(GL_TRIANGLE_FAN, 0, 4);
+    glDisableVertexAttribArray(Program::texCoords);
+}
+
+// ---------------------------------------------------------------------------
+
 LayerBlur::LayerBlur(SurfaceFlinger* flinger, const sp<Client>& client,
         const String8& name, uint32_t w, uint32_t h, uint32_t flags)
     : Layer(flinger, client, name, w, h, flags), mBlurMaskSampling(1),
-    mBlurMaskAlphaThreshold(0.0f) ,mLastFrameSequence(0)
+    mBlurMaskAlphaThreshold(0.0f) ,mLastFrameSequence(0),
+    mCaptureLayerStack(0), mCaptureOrientation(0), mCaptureBlurLevel(0),
+    mCaptureValid(false)
 {
-    GLuint texnames[3];
-    mFlinger->getRenderEngine().genTextures(3, texnames);
+    GLuint texnames[3 + MAX_BLUR_PASSES];
+    mFlinger->getRenderEngine().genTextures(3 + MAX_BLUR_PASSES, texnames);
     mTextureCapture.init(Texture::TEXTURE_2D, texnames[0]);
     mTextureBlur.init(Texture::TEXTURE_2D, texnames[1]);
     mTextureMasking.init(Texture::TEXTURE_2D, texnames[2]);
+    for (size_t i=0; i<MAX_BLUR_PASSES; ++i) {
+        mTextureChain[i].init(Texture::TEXTURE_2D, texnames[3 + i]);
+    }
 }
 
 LayerBlur::~LayerBlur() {
 
     releaseFbo(mFboCapture);
     releaseFbo(mFboMasking);
+    releaseFbo(mFboBlur);
     mFlinger->deleteTextureAsync(mTextureCapture.getTextureName());
     mFlinger->deleteTextureAsync(mTextureBlur.getTextureName());
     mFlinger->deleteTextureAsync(mTextureMasking.getTextureName());
+    for (size_t i=0; i<MAX_BLUR_PASSES; ++i) {
+        releaseFbo(mFboChain[i]);
+        mFlinger->deleteTextureAsync(mTextureChain[i].getTextureName());
+    }
 }
 
 void LayerBlur::onDraw(const sp<const DisplayDevice>& hw, const Region& /*clip*/,
@@ -124,6 +286,10 @@ void LayerBlur::onDraw(const sp<const DisplayDevice>& hw, const Region& /*clip*/
         return;
     }
 
+    // We read back and render to our own framebuffers with direct GL calls,
+    // everything batched so far must be drawn first.
+    RenderEngine::SuspendBatching suspendBatching(mFlinger->getRenderEngine());
+
     /////
     // NOTE:
     //
@@ -150,30 +316,34 @@ void LayerBlur::onDraw(const sp<const DisplayDevice>& hw, const Region& /*clip*/
 
     if (mLastFrameSequence != mFlinger->mActiveFrameSequence ||
             mTextureBlur.getWidth() == 0 || mTextureBlur.getHeight() == 0) {
-        // full drawing needed.
-
-
-        // capture
-        if (!captureScreen(hw, mFboCapture, mTextureCapture, hwWidth, hwHeight)) {
-            return;
-        }
-
-        // blur
-        size_t outTexWidth = mTextureBlur.getWidth();
-        size_t outTexHeight = mTextureBlur.getHeight();
-        if (mBlurImpl.blur(s.blur,
-                mTextureCapture.getTextureName(),
-                mTextureCapture.getWidth(),
-                mTextureCapture.getHeight(),
-                mTextureBlur.getTextureName(),
-                &outTexWidth,
-                &outTexHeight) != OK) {
-            return;
+        // full drawing needed, unless nothing changed below us since the
+        // last capture: the blurred image is still good then.
+        bool inputsChanged = updateCaptureInputs(hw, s.blur);
+        if (inputsChanged || !mCaptureValid) {
+            mCaptureValid = false;
+
+            // capture
+            if (!captureScreen(hw, mFboCapture, mTextureCapture, hwWidth, hwHeight)) {
+                return;
+            }
+
+            // blur
+            size_t outTexWidth = mTextureBlur.getWidth();
+            size_t outTexHeight = mTextureBlur.getHeight();
+            if (mBlurImpl.blur(s.blur,
+                    mTextureCapture.getTextureName(),
+                    mTextureCapture.getWidth(),
+                    mTextureCapture.getHeight(),
+                    mTextureBlur.getTextureName(),
+                    &outTexWidth,
+                    &outTexHeight) == OK) {
+                // mTextureBlur now has "Blurred image"
+                mTextureBlur.setDimensions(outTexWidth, outTexHeight);
+            } else if (!blurBuiltin(s.blur, mTextureCapture)) {
+                return;
+            }
+            mCaptureValid = true;
         }
-
-        // mTextureBlur now has "Blurred image"
-        mTextureBlur.setDimensions(outTexWidth, outTexHeight);
-
     } else {
         // We can just re-use mTextureBlur.
         // SurfaceFlinger or other LayerBlur object called my draw() multiple times
@@ -211,6 +381,49 @@ void LayerBlur::onDraw(const sp<const DisplayDevice>& hw, const Region& /*clip*/
 }
 
 
+/*
+ * Records what the layers captureScreen() draws look like, returns whether
+ * it differs from the last time.
+ */
+bool LayerBlur::updateCaptureInputs(const sp<const DisplayDevice>& hw, int level) {
+    const uint32_t z = getDrawingState().z;
+    const LayerVector& layers(mFlinger->mDrawingState.layersSortedByZ);
+    mNextCaptureInputs.clear();
+    for (size_t i=0; i<layers.size(); ++i) {
+        const sp<Layer>& layer(layers[i]);
+        const Layer::State& state(layer->getDrawingState());
+        if (state.layerStack != hw->getLayerStack() || state.z >= z ||
+                !layer->isVisible()) {
+            continue;
+        }
+        CaptureInput input;
+        input.layer = layer->getSequence();
+        input.sequence = state.sequence;
+        input.frameNumber = layer->getCurrentFrameNumber();
+        mNextCaptureInputs.push_back(input);
+    }
+
+    // The capture is drawn with the global color transform, e.g. night
+    // light or the accessibility color modes
+    const mat4& colorTransform(mFlinger->mColorPipeline.getColorTransform());
+    bool changed = mNextCaptureInputs != mCaptureInputs ||
+            mCaptureLayerStack != hw->getLayerStack() ||
+            mCaptureOrientation != hw->getOrientation() ||
+            mCaptureViewport != hw->getViewport() ||
+            mCaptureFrame != hw->getFrame() ||
+            mCaptureBlurLevel != level ||
+            mCaptureColorTransform != colorTransform;
+
+    mCaptureInputs.swap(mNextCaptureInputs);
+    mCaptureLayerStack = hw->getLayerStack();
+    mCaptureOrientation = hw->getOrientation();
+    mCaptureViewport = hw->getViewport();
+    mCaptureFrame = hw->getFrame();
+    mCaptureBlurLevel = level;
+    mCaptureColorTransform = colorTransform;
+    return changed;
+}
+
 bool LayerBlur::captureScreen(const sp<const DisplayDevice>& hw, FBO& fbo, Texture& texture, int width, int height) {
     ATRACE_CALL();
     ensureFbo(fbo, width, height, texture.getTextureName());
@@ -283,6 +496,73 @@ bool LayerBlur::drawMaskLayer(sp<Layer>& maskLayer, const sp<const DisplayDevice
     return true;
 }
 
+/*
+ * Blurs input into mTextureBlur with the built-in dual filter, the higher
+ * the level the more passes. The result is half the size of the input.
+ */
+bool LayerBlur::blurBuiltin(int level, const Texture& input) {
+    ATRACE_CALL();
+
+    BlurProgram downsample, upsample;
+    if (!getBlurPrograms(&downsample, &upsample)) {
+        return false;
+    }
+
+    int passes = 1 + level * (MAX_BLUR_PASSES - 1) / 255;
+    const int width = input.getWidth();
+    const int height = input.getHeight();
+    for (int i=0; i<passes; ++i) {
+        int levelWidth = width >> (i + 1);
+        int levelHeight = height >> (i + 1);
+        if (i > 0 && (levelWidth < kMinBlurLevelSize ||
+                levelHeight < kMinBlurLevelSize)) {
+            passes = i;
+            break;
+        }
+        ensureFbo(mFboChain[i], levelWidth, levelHeight,
+                mTextureChain[i].getTextureName());
+        if (mFboChain[i].fbo == 0) {
+            ALOGE("blurBuiltin(). mFboChain[%d].fbo == 0", i);
+            return false;
+        }
+        mTextureChain[i].setDimensions(levelWidth, levelHeight);
+    }
+    const int outWidth = mFboChain[0].width;
+    const int outHeight = mFboChain[0].height;
+    ensureFbo(mFboBlur, outWidth, outHeight, mTextureBlur.getTextureName());
+    if (mFboBlur.fbo == 0) {
+        ALOGE("blurBuiltin(). mFboBlur.fbo == 0");
+        return false;
+    }
+
+    GLint savedFramebuffer = 0;
+    glGetIntegerv(GL_FRAMEBUFFER_BINDING, &savedFramebuffer);
+    GLint savedViewport[4];
+    glGetIntegerv(GL_VIEWPORT, savedViewport);
+    GLboolean isBlendEnabled = glIsEnabled(GL_BLEND);
+    glDisable(GL_BLEND);
+
+    // down to the smallest level, and back up to the first one
+    for (int i=0; i<passes; ++i) {
+        drawBlurPass(downsample, i == 0 ? input : mTextureChain[i-1],
+                (GLuint)mFboChain[i].fbo, mFboChain[i].width, mFboChain[i].height);
+    }
+    for (int i=passes-1; i>0; --i) {
+        drawBlurPass(upsample, mTextureChain[i],
+                (GLuint)mFboChain[i-1].fbo, mFboChain[i-1].width, mFboChain[i-1].height);
+    }
+    drawBlurPass(upsample, mTextureChain[0], (GLuint)mFboBlur.fbo, outWidth, outHeight);
+
+    if (isBlendEnabled) {
+        glEnable(GL_BLEND);
+    }
+    glViewport(savedViewport[0], savedViewport[1], savedViewport[2], savedViewport[3]);
+    glBindFramebuffer(GL_FRAMEBUFFER, savedFramebuffer);
+
+    mTextureBlur.setDimensions(outWidth, outHeight);
+    return true;
+}
+
 /*
  * draw final texture into outer framebuffer
  */
@@ -24,6 +24,10 @@
 #include <stdint.h>
 #include <sys/types.h>
 
+#include <vector>
+
+#include <ui/mat4.h>
+
 #include "Layer.h"
 
 // ---------------------------------------------------------------------------
@@ -32,7 +36,8 @@ namespace android {
 
 /**
  * Blur layer object.
- * Actual blurring logics are capsulated in libuiblur.so
+ * Actual blurring logics are capsulated in libuiblur.so, devices without it
+ * use a built-in dual filter blur.
  */
 class LayerBlur : public Layer
 {
@@ -91,6 +96,27 @@ private:
     float mBlurMaskAlphaThreshold;
     uint32_t mLastFrameSequence;
 
+    // What the layers below looked like when they were last captured, the
+    // capture and its blur are reused until it changes.
+    struct CaptureInput {
+        int32_t layer;          // Layer::getSequence()
+        int32_t sequence;       // Layer::State::sequence
+        uint64_t frameNumber;
+        bool operator==(const CaptureInput& other) const {
+            return layer == other.layer && sequence == other.sequence &&
+                    frameNumber == other.frameNumber;
+        }
+    };
+    std::vector<CaptureInput> mCaptureInputs;
+    std::vector<CaptureInput> mNextCaptureInputs;
+    uint32_t mCaptureLayerStack;
+    int mCaptureOrientation;
+    Rect mCaptureViewport;
+    Rect mCaptureFrame;
+    int mCaptureBlurLevel;
+    mat4 mCaptureColorTransform;    // ColorPipeline::getColorTransform()
+    bool mCaptureValid;
+
     class FBO {
     public:
         FBO() : fbo(0), width(0), height(0) {}
@@ -108,10 +134,18 @@ private:
     Texture mTextureCapture;
 
     Texture mTextureBlur;
+    FBO mFboBlur;
+
+    // Intermediate levels of the built-in blur, level i is 1/2^(i+1) of the
+    // capture in each dimension.
+    enum { MAX_BLUR_PASSES = 6 };
+    FBO mFboChain[MAX_BLUR_PASSES];
+    Texture mTextureChain[MAX_BLUR_PASSES];
 
     FBO mFboMasking;
     Texture mTextureMasking;
 
+    bool updateCaptureInputs(const sp<const DisplayDevice>& hw, int level);
     bool captureScreen(const sp<const DisplayDevice>& hw,
             FBO& fbo, Texture& texture, int width, int height);
     void doDrawFinal(const sp<const DisplayDevice>& hw,
@@ -121,6 +155,7 @@ private:
         Texture* maskTexture);
     bool drawMaskLayer(sp<Layer>& maskLayer, const sp<const DisplayDevice>& hw,
         FBO& fbo, int width, int height, int sampling, Texture& texture);
+    bool blurBuiltin(int level, const Texture& input);
 
 };
 
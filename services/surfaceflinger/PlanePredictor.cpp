@@ -0,0 +1,189 @@
+/*
+ * Copyright 2016 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#define ATRACE_TAG ATRACE_TAG_GRAPHICS
+
+#include <inttypes.h>
+
+#include <utils/Trace.h>
+
+#include "PlanePredictor.h"
+
+namespace android {
+
+PlanePredictor::PlanePredictor() :
+        mEnabled(true),
+        mFrame(0),
+        mValidates(0),
+        mValidatesWithChanges(0),
+        mLayersRejected(0),
+        mPredictedFrames(0),
+        mLayersPredicted(0),
+        mPredictionHits(0),
+        mRechecks(0) {
+}
+
+void PlanePredictor::setEnabled(bool enabled) {
+    mEnabled = enabled;
+    if (!enabled) {
+        mDisplays.clear();
+    }
+}
+
+bool PlanePredictor::canMoveToClient(HWC2::Composition type) {
+    return type == HWC2::Composition::Device ||
+            type == HWC2::Composition::Cursor ||
+            type == HWC2::Composition::SolidColor;
+}
+
+bool PlanePredictor::predict(int32_t hwcId, uint64_t configuration,
+        std::vector<HWC2::Composition>* types) {
+    if (!mEnabled) {
+        return false;
+    }
+    ATRACE_CALL();
+    mFrame++;
+
+    DisplayState& display(mDisplays[hwcId]);
+    display.configuration = configuration;
+    display.requested = *types;
+    display.predicted = false;
+
+    auto it = display.predictions.find(configuration);
+    if (it == display.predictions.end() ||
+            it->second.rejected.size() != types->size()) {
+        display.sent = *types;
+        return false;
+    }
+    Prediction& prediction(it->second);
+    prediction.lastUse = mFrame;
+    if (++prediction.uses % RECHECK_INTERVAL == 0) {
+        // Let HWC see the configuration as SurfaceFlinger wants it, in case
+        // it can now take the layers it rejected
+        mRechecks++;
+        display.sent = *types;
+        return false;
+    }
+
+    for (size_t i = 0; i < types->size(); i++) {
+        if (prediction.rejected[i] && canMoveToClient((*types)[i])) {
+            (*types)[i] = HWC2::Composition::Client;
+            display.predicted = true;
+            mLayersPredicted++;
+        }
+    }
+    display.sent = *types;
+    if (display.predicted) {
+        mPredictedFrames++;
+    }
+    return display.predicted;
+}
+
+void PlanePredictor::onValidated(int32_t hwcId,
+        const std::vector<HWC2::Composition>& types) {
+    if (!mEnabled) {
+        return;
+    }
+    auto displayIt = mDisplays.find(hwcId);
+    const size_t count = types.size();
+    if (displayIt == mDisplays.end() ||
+            displayIt->second.requested.size() != count) {
+        return;
+    }
+    DisplayState& display(displayIt->second);
+    mValidates++;
+
+    std::vector<bool> rejected(count, false);
+    size_t numRejected = 0;
+    size_t numChanged = 0;
+    for (size_t i = 0; i < count; i++) {
+        if (types[i] == HWC2::Composition::Client &&
+                canMoveToClient(display.requested[i])) {
+            rejected[i] = true;
+            numRejected++;
+        }
+        if (types[i] != display.sent[i]) {
+            numChanged++;
+        }
+    }
+
+    if (numChanged > 0) {
+        mValidatesWithChanges++;
+        mLayersRejected += numChanged;
+    } else if (display.predicted) {
+        mPredictionHits++;
+    }
+
+    auto it = display.predictions.find(display.configuration);
+    if (numRejected == 0) {
+        // Either HWC took all the layers, or this was a recheck and HWC can
+        // now take the layers it rejected before
+        if (it != display.predictions.end()) {
+            display.predictions.erase(it);
+        }
+        return;
+    }
+
+    if (it == display.predictions.end()) {
+        if (display.predictions.size() >= MAX_PREDICTIONS) {
+            evictOldest(display);
+        }
+        it = display.predictions.emplace(display.configuration,
+                Prediction()).first;
+        it->second.lastUse = mFrame;
+    }
+    it->second.rejected.swap(rejected);
+}
+
+void PlanePredictor::evictOldest(DisplayState& display) {
+    auto oldest = display.predictions.begin();
+    for (auto it = display.predictions.begin();
+            it != display.predictions.end(); ++it) {
+        if (it->second.lastUse < oldest->second.lastUse) {
+            oldest = it;
+        }
+    }
+    if (oldest != display.predictions.end()) {
+        display.predictions.erase(oldest);
+    }
+}
+
+void PlanePredictor::clear(int32_t hwcId) {
+    auto it = mDisplays.find(hwcId);
+    if (it != mDisplays.end()) {
+        it->second.predictions.clear();
+    }
+}
+
+void PlanePredictor::removeDisplay(int32_t hwcId) {
+    mDisplays.erase(hwcId);
+}
+
+void PlanePredictor::dump(String8& result) const {
+    size_t configurations = 0;
+    for (const auto& display : mDisplays) {
+        configurations += display.second.predictions.size();
+    }
+    result.appendFormat("Plane prediction (%s): %" PRIu64 " validates, %"
+            PRIu64 " with composition changes (%" PRIu64 " layers), %" PRIu64
+            " predicted (%" PRIu64 " layers, %" PRIu64 " without changes), %"
+            PRIu64 " rechecks, %zu configurations\n",
+            mEnabled ? "on" : "off", mValidates, mValidatesWithChanges,
+            mLayersRejected, mPredictedFrames, mLayersPredicted,
+            mPredictionHits, mRechecks, configurations);
+}
+
+} // namespace android
@@ -0,0 +1,127 @@
+/*
+ * Copyright 2016 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef ANDROID_PLANEPREDICTOR_H
+#define ANDROID_PLANEPREDICTOR_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include <unordered_map>
+#include <vector>
+
+#include <utils/String8.h>
+
+#include "DisplayHardware/HWC2.h"
+
+namespace android {
+
+// PlanePredictor remembers which layers HWC moved to client composition when
+// it validated a given configuration of the visible layers of a display, and
+// requests client composition for those layers up front the next time the
+// display shows the same configuration. This spares HWC from rejecting the
+// same layers again, and SurfaceFlinger from learning about the client
+// composition only once validate returns.
+//
+// A configuration is identified by a hash SurfaceFlinger computes from the
+// geometry, composition type, buffer format and dataspace of the layers, in
+// Z order, see SurfaceFlinger::predictCompositionTypes(). As HWC never moves
+// a layer back to device composition, predictions are checked again against
+// HWC every RECHECK_INTERVAL uses.
+//
+// It only deals with composition types, not with the layers themselves, so
+// that it can be tested on its own (see tests/planepredictor).
+//
+// It is *NOT* thread-safe, SurfaceFlinger only uses it from the main thread.
+class PlanePredictor {
+public:
+    enum { RECHECK_INTERVAL = 120 };
+    enum { MAX_PREDICTIONS = 32 };
+
+    PlanePredictor();
+
+    void setEnabled(bool enabled);
+    bool isEnabled() const { return mEnabled; }
+
+    // predict is called once Layer::setPerFrameData() has set the composition
+    // types SurfaceFlinger wants for the visible layers of the display. It
+    // changes the ones HWC rejected before in this configuration to client
+    // composition, and returns whether it changed any.
+    bool predict(int32_t hwcId, uint64_t configuration,
+            std::vector<HWC2::Composition>* types);
+
+    // onValidated is called once HWC validated the display with the types
+    // predict() returned, and learns which layers HWC moved to client
+    // composition from the types HWC settled on.
+    void onValidated(int32_t hwcId,
+            const std::vector<HWC2::Composition>& types);
+
+    // clear forgets the predictions for a display, when something which HWC
+    // bases its decisions on and which isn't part of the configuration of the
+    // layers changed, e.g. the color transform.
+    void clear(int32_t hwcId);
+
+    // removeDisplay forgets a display altogether, once it is disconnected.
+    // Its hwc id can be reused by the next virtual display.
+    void removeDisplay(int32_t hwcId);
+
+    void dump(String8& result) const;
+
+    // combineHash mixes value into the hash seed
+    static uint64_t combineHash(uint64_t seed, uint64_t value) {
+        return seed ^ (value + 0x9e3779b97f4a7c15ULL + (seed << 6) +
+                (seed >> 2));
+    }
+
+private:
+    struct Prediction {
+        Prediction() : uses(0), lastUse(0) {}
+        // Indices of the layers HWC moved to client composition
+        std::vector<bool> rejected;
+        uint32_t uses;
+        uint64_t lastUse;
+    };
+
+    struct DisplayState {
+        DisplayState() : configuration(0), predicted(false) {}
+        // Configuration and composition types of the frame being validated
+        uint64_t configuration;
+        std::vector<HWC2::Composition> requested;
+        std::vector<HWC2::Composition> sent;
+        bool predicted;
+        std::unordered_map<uint64_t, Prediction> predictions;
+    };
+
+    static bool canMoveToClient(HWC2::Composition type);
+    void evictOldest(DisplayState& display);
+
+    bool mEnabled;
+    uint64_t mFrame;
+    std::unordered_map<int32_t, DisplayState> mDisplays;
+
+    // Statistics for dump()
+    uint64_t mValidates;
+    uint64_t mValidatesWithChanges;
+    uint64_t mLayersRejected;
+    uint64_t mPredictedFrames;
+    uint64_t mLayersPredicted;
+    uint64_t mPredictionHits;
+    uint64_t mRechecks;
+};
+
+}
+
+#endif // ANDROID_PLANEPREDICTOR_H
@@ -104,4 +104,38 @@ void Description::disableMasking() {
     mMaskTextureEnabled = false;
 }
 
+static bool sameMatrix(const mat4& lhs, const mat4& rhs) {
+    return memcmp(lhs.asArray(), rhs.asArray(), 16 * sizeof(float)) == 0;
+}
+
+static bool sameTexture(const Texture& lhs, const Texture& rhs) {
+    return lhs.getTextureName() == rhs.getTextureName() &&
+            lhs.getTextureTarget() == rhs.getTextureTarget() &&
+            lhs.getFiltering() == rhs.getFiltering() &&
+            sameMatrix(lhs.getMatrix(), rhs.getMatrix());
+}
+
+bool Description::isEquivalent(const Description& rhs) const {
+    if (mPlaneAlpha != rhs.mPlaneAlpha ||
+            mPremultipliedAlpha != rhs.mPremultipliedAlpha ||
+            mOpaque != rhs.mOpaque ||
+            mTextureEnabled != rhs.mTextureEnabled ||
+            mColorMatrixEnabled != rhs.mColorMatrixEnabled ||
+            mMaskTextureEnabled != rhs.mMaskTextureEnabled) {
+        return false;
+    }
+    if (mTextureEnabled && !sameTexture(mTexture, rhs.mTexture)) {
+        return false;
+    }
+    if (mColorMatrixEnabled && !sameMatrix(mColorMatrix, rhs.mColorMatrix)) {
+        return false;
+    }
+    if (mMaskTextureEnabled && (!sameTexture(mMaskTexture, rhs.mMaskTexture) ||
+            mMaskAlphaThreshold != rhs.mMaskAlphaThreshold)) {
+        return false;
+    }
+    return memcmp(mColor, rhs.mColor, sizeof(mColor)) == 0 &&
+            sameMatrix(mProjectionMatrix, rhs.mProjectionMatrix);
+}
+
 } /* namespace android */
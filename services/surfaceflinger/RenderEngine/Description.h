@@ -73,6 +73,10 @@ public:
     void setMasking(const Texture& maskTexture, float alphaThreshold);
     void disableMasking();
 
+    // true if drawing with either description uses the same program with
+    // the same uniforms
+    bool isEquivalent(const Description& rhs) const;
+
 private:
     bool mUniformsDirty;
 };
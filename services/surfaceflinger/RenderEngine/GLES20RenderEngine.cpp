@@ -44,7 +44,9 @@ namespace android {
 // ---------------------------------------------------------------------------
 
 GLES20RenderEngine::GLES20RenderEngine() :
-        mVpWidth(0), mVpHeight(0), mProjectionRotation(Transform::ROT_0) {
+        mVpWidth(0), mVpHeight(0), mProjectionRotation(Transform::ROT_0),
+        mBatching(false), mBinding(unsetBinding()), mBatchCount(0),
+        mLastFlushDraws(0), mLastFlushBatches(0), mLastFlushPrograms(0) {
 
     glGetIntegerv(GL_MAX_TEXTURE_SIZE, &mMaxTextureSize);
     glGetIntegerv(GL_MAX_VIEWPORT_DIMS, mMaxViewportDims);
@@ -83,6 +85,8 @@ void GLES20RenderEngine::setViewportAndProjection(
         size_t vpw, size_t vph, Rect sourceCrop, size_t hwh, bool yswap,
         Transform::orientation_flags rotation) {
 
+    flushBatches();
+
     size_t l = sourceCrop.left;
     size_t r = sourceCrop.right;
 
@@ -149,10 +153,9 @@ void GLES20RenderEngine::setupLayerBlending(
 
     if (alpha < 0xFF || !opaque) {
 #endif
-        glEnable(GL_BLEND);
-        glBlendFunc(premultipliedAlpha ? GL_ONE : GL_SRC_ALPHA, GL_ONE_MINUS_SRC_ALPHA);
+        setBlending(true, premultipliedAlpha ? GL_ONE : GL_SRC_ALPHA);
     } else {
-        glDisable(GL_BLEND);
+        setBlending(false, GL_ONE);
     }
 }
 
@@ -176,10 +179,9 @@ void GLES20RenderEngine::setupDimLayerBlending(int alpha) {
 #else
     if (alpha == 0xFF) {
 #endif
-        glDisable(GL_BLEND);
+        setBlending(false, GL_ONE);
     } else {
-        glEnable(GL_BLEND);
-        glBlendFunc(GL_ONE, GL_ONE_MINUS_SRC_ALPHA);
+        setBlending(true, GL_ONE);
     }
 }
 
@@ -209,30 +211,19 @@ void GLES20RenderEngine::setupDimLayerBlendingWithColor(uint32_t color, int alph
 #else
     if (alpha == 0xFF) {
 #endif
-        glDisable(GL_BLEND);
+        setBlending(false, GL_ONE);
     } else {
-        glEnable(GL_BLEND);
-        glBlendFunc(GL_ONE, GL_ONE_MINUS_SRC_ALPHA);
+        setBlending(true, GL_ONE);
     }
 }
 
 void GLES20RenderEngine::setupLayerTexturing(const Texture& texture) {
-    GLuint target = texture.getTextureTarget();
-    glBindTexture(target, texture.getTextureName());
-    GLenum filter = GL_NEAREST;
-    if (texture.getFiltering()) {
-        filter = GL_LINEAR;
-    }
-    glTexParameteri(target, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
-    glTexParameteri(target, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
-    glTexParameteri(target, GL_TEXTURE_MAG_FILTER, filter);
-    glTexParameteri(target, GL_TEXTURE_MIN_FILTER, filter);
-
+    setTexture(false, texture);
     mState.setTexture(texture);
 }
 
 void GLES20RenderEngine::setupLayerBlackedOut() {
-    glBindTexture(GL_TEXTURE_2D, mProtectedTexName);
+    setTexture(false, GL_TEXTURE_2D, mProtectedTexName, 0);
     Texture texture(Texture::TEXTURE_2D, mProtectedTexName);
     texture.setDimensions(1, 1); // FIXME: we should get that from somewhere
     mState.setTexture(texture);
@@ -249,13 +240,14 @@ void GLES20RenderEngine::disableTexturing() {
 }
 
 void GLES20RenderEngine::disableBlending() {
-    glDisable(GL_BLEND);
+    setBlending(false, GL_ONE);
 }
 
 
 void GLES20RenderEngine::bindImageAsFramebuffer(EGLImageKHR image,
         uint32_t* texName, uint32_t* fbName, uint32_t* status,
         bool useReadPixels, int reqWidth, int reqHeight) {
+    flushBatches();
     GLuint tname, name;
     if (!useReadPixels) {
         // turn our EGLImage into a texture
@@ -286,6 +278,7 @@ void GLES20RenderEngine::bindImageAsFramebuffer(EGLImageKHR image,
 
 void GLES20RenderEngine::unbindFramebuffer(uint32_t texName, uint32_t fbName,
         bool useReadPixels) {
+    flushBatches();
     glBindFramebuffer(GL_FRAMEBUFFER, 0);
     glDeleteFramebuffers(1, &fbName);
     if (!useReadPixels)
@@ -300,57 +293,352 @@ void GLES20RenderEngine::setupFillWithColor(float r, float g, float b, float a)
     mState.setOpaque(false);
     mState.setColor(r, g, b, a);
     mState.disableTexture();
-    glDisable(GL_BLEND);
+    setBlending(false, GL_ONE);
 }
 
 void GLES20RenderEngine::drawMesh(const Mesh& mesh) {
+    if (mBatching) {
+        batchDraw(mesh);
+        return;
+    }
+    drawVertices(mState, mesh.getPrimitive(), mesh.getVertexCount(),
+            mesh.getVertexSize(), mesh.getTexCoordsSize(),
+            mesh.getPositions());
+}
 
-    ProgramCache::getInstance().useProgram(mState);
+void GLES20RenderEngine::drawVertices(const Description& state,
+        GLenum primitive, GLsizei vertexCount, GLint vertexSize,
+        GLint texCoordsSize, const float* vertices, bool programInUse) {
 
-    if (mesh.getTexCoordsSize()) {
+    ProgramCache::getInstance().useProgram(state, programInUse);
+
+    const GLsizei stride = (vertexSize + texCoordsSize) * sizeof(float);
+    if (texCoordsSize) {
         glEnableVertexAttribArray(Program::texCoords);
         glVertexAttribPointer(Program::texCoords,
-                mesh.getTexCoordsSize(),
+                texCoordsSize,
                 GL_FLOAT, GL_FALSE,
-                mesh.getByteStride(),
-                mesh.getTexCoords());
+                stride,
+                vertices + vertexSize);
     }
 
     glVertexAttribPointer(Program::position,
-            mesh.getVertexSize(),
+            vertexSize,
             GL_FLOAT, GL_FALSE,
-            mesh.getByteStride(),
-            mesh.getPositions());
+            stride,
+            vertices);
 
-    glDrawArrays(mesh.getPrimitive(), 0, mesh.getVertexCount());
+    glDrawArrays(primitive, 0, vertexCount);
 
-    if (mesh.getTexCoordsSize()) {
+    if (texCoordsSize) {
         glDisableVertexAttribArray(Program::texCoords);
     }
 }
 
+void GLES20RenderEngine::setBlending(bool enabled, GLenum srcFactor) {
+    if (mBatching) {
+        mBinding.blend = enabled;
+        mBinding.blendSrc = enabled ? srcFactor : GL_ONE;
+        return;
+    }
+    if (enabled) {
+        glEnable(GL_BLEND);
+        glBlendFunc(srcFactor, GL_ONE_MINUS_SRC_ALPHA);
+    } else {
+        glDisable(GL_BLEND);
+    }
+}
+
+void GLES20RenderEngine::setTexture(bool mask, GLenum target, GLuint name,
+        GLenum filter) {
+    if (mBatching) {
+        if (mask) {
+            mBinding.maskTarget = target;
+            mBinding.maskName = name;
+            mBinding.maskFilter = filter;
+        } else {
+            mBinding.target = target;
+            mBinding.name = name;
+            mBinding.filter = filter;
+        }
+        return;
+    }
+    if (mask) {
+        glActiveTexture(GL_TEXTURE0 + 1);
+    }
+    glBindTexture(target, name);
+    if (filter) {
+        glTexParameteri(target, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
+        glTexParameteri(target, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
+        glTexParameteri(target, GL_TEXTURE_MAG_FILTER, filter);
+        glTexParameteri(target, GL_TEXTURE_MIN_FILTER, filter);
+    }
+    if (mask) {
+        glActiveTexture(GL_TEXTURE0);
+    }
+}
+
+void GLES20RenderEngine::setTexture(bool mask, const Texture& texture) {
+    setTexture(mask, texture.getTextureTarget(), texture.getTextureName(),
+            texture.getFiltering() ? GL_LINEAR : GL_NEAREST);
+}
+
+void GLES20RenderEngine::setBatching(bool enabled) {
+    if (!enabled) {
+        flushBatches();
+    } else if (!mBatching) {
+        mBinding = unsetBinding();
+    }
+    mBatching = enabled;
+}
+
+// How many draws flushBatches() reorders at once; scheduleDraws() is
+// quadratic in it
+static const size_t MAX_SCHEDULED_DRAWS = 128;
+
+bool GLES20RenderEngine::Binding::operator==(const Binding& rhs) const {
+    return blend == rhs.blend && blendSrc == rhs.blendSrc &&
+            target == rhs.target && name == rhs.name && filter == rhs.filter &&
+            maskTarget == rhs.maskTarget && maskName == rhs.maskName &&
+            maskFilter == rhs.maskFilter;
+}
+
+GLES20RenderEngine::Binding GLES20RenderEngine::unsetBinding() {
+    Binding binding;
+    binding.blend = false;
+    binding.blendSrc = NO_BINDING;
+    binding.target = 0;
+    binding.name = NO_BINDING;
+    binding.filter = 0;
+    binding.maskTarget = 0;
+    binding.maskName = NO_BINDING;
+    binding.maskFilter = 0;
+    return binding;
+}
+
+void GLES20RenderEngine::flushBatches() {
+    if (mDraws.empty() && mBinding == unsetBinding()) {
+        return;
+    }
+    ATRACE_CALL();
+
+    for (size_t first = 0; first < mDraws.size();
+            first += MAX_SCHEDULED_DRAWS) {
+        const size_t last = first + MAX_SCHEDULED_DRAWS < mDraws.size() ?
+                first + MAX_SCHEDULED_DRAWS : mDraws.size();
+        scheduleDraws(first, last);
+    }
+
+    // setBlending() and setTexture() must reach GL from here on
+    const bool batching = mBatching;
+    mBatching = false;
+    Binding current(unsetBinding());
+    size_t programs = 0;
+    for (size_t i = 0; i < mBatchCount; i++) {
+        const Batch& batch(mBatches[i]);
+        applyBinding(batch.binding, current, i == 0);
+        // batches using the same program were scheduled next to each other
+        const bool programInUse = i > 0 && mBatches[i - 1].key == batch.key;
+        drawVertices(batch.state, batch.primitive, batch.vertexCount,
+                batch.vertexSize, batch.texCoordsSize, batch.vertices.data(),
+                programInUse);
+        if (!programInUse) {
+            programs++;
+        }
+    }
+    // leave GL as the set-up since the last flush would have
+    applyBinding(mBinding, current, false);
+    mBatching = batching;
+
+    mLastFlushDraws = mDraws.size();
+    mLastFlushBatches = mBatchCount;
+    mLastFlushPrograms = programs;
+    mBatchCount = 0;
+    mDraws.clear();
+    mVertexData.clear();
+    mBinding = unsetBinding();
+}
+
+// Whether draw "later" has to stay after draw "earlier": they overlap, or
+// "earlier" relies on blending or a texture set up before the flush which
+// "later" changes. Bindings only go from unset to set during a flush.
+bool GLES20RenderEngine::mustFollow(const Draw& earlier, const Draw& later) {
+    if (!earlier.bounded || !later.bounded || (earlier.minX < later.maxX &&
+            later.minX < earlier.maxX && earlier.minY < later.maxY &&
+            later.minY < earlier.maxY)) {
+        return true;
+    }
+    const Binding& e(earlier.binding);
+    const Binding& l(later.binding);
+    return (e.blendSrc == NO_BINDING && l.blendSrc != NO_BINDING) ||
+            (earlier.key.isTexturing() && e.name == NO_BINDING &&
+                    l.name != NO_BINDING) ||
+            (earlier.key.isTextureMasking() && e.maskName == NO_BINDING &&
+                    l.maskName != NO_BINDING);
+}
+
+void GLES20RenderEngine::scheduleDraws(size_t first, size_t last) {
+    const size_t count = last - first;
+    mBlockers.assign(count, 0);
+    mScheduled.assign(count, false);
+    for (size_t i = 1; i < count; i++) {
+        for (size_t j = 0; j < i; j++) {
+            if (mustFollow(mDraws[first + j], mDraws[first + i])) {
+                mBlockers[i]++;
+            }
+        }
+    }
+
+    // Repeatedly pick, among the draws whose predecessors are all drawn,
+    // the first one that can join the last batch, else the first one using
+    // the same program and texture, else the same program, else the first.
+    for (size_t n = 0; n < count; n++) {
+        const Batch* batch = mBatchCount ? &mBatches[mBatchCount - 1] : NULL;
+        size_t best = count;
+        int bestRank = -1;
+        for (size_t i = 0; i < count && bestRank < 3; i++) {
+            if (mScheduled[i] || mBlockers[i]) {
+                continue;
+            }
+            const Draw& draw(mDraws[first + i]);
+            int rank = 0;
+            if (batch != NULL && batch->key == draw.key) {
+                rank = draw.binding.name == batch->binding.name ? 2 : 1;
+                if ((draw.primitive == GL_TRIANGLES ||
+                        draw.primitive == GL_TRIANGLE_FAN) &&
+                        batch->primitive == GL_TRIANGLES &&
+                        batch->vertexSize == draw.vertexSize &&
+                        batch->texCoordsSize == draw.texCoordsSize &&
+                        batch->binding == draw.binding &&
+                        batch->state.isEquivalent(draw.state)) {
+                    rank = 3;
+                }
+            }
+            if (rank > bestRank) {
+                best = i;
+                bestRank = rank;
+            }
+        }
+        LOG_ALWAYS_FATAL_IF(best == count, "no draw can be scheduled");
+
+        mScheduled[best] = true;
+        addToBatch(mDraws[first + best], bestRank == 3);
+        for (size_t i = best + 1; i < count; i++) {
+            if (!mScheduled[i] &&
+                    mustFollow(mDraws[first + best], mDraws[first + i])) {
+                mBlockers[i]--;
+            }
+        }
+    }
+}
+
+void GLES20RenderEngine::addToBatch(const Draw& draw, bool merge) {
+    if (!merge) {
+        if (mBatchCount == mBatches.size()) {
+            mBatches.push_back(Batch());
+        }
+        Batch& batch(mBatches[mBatchCount++]);
+        batch.binding = draw.binding;
+        batch.state = draw.state;
+        batch.key = draw.key;
+        batch.primitive = draw.primitive == GL_TRIANGLE_FAN ?
+                GLenum(GL_TRIANGLES) : draw.primitive;
+        batch.vertexSize = draw.vertexSize;
+        batch.texCoordsSize = draw.texCoordsSize;
+        batch.vertexCount = 0;
+        batch.vertices.clear();
+    }
+    Batch& batch(mBatches[mBatchCount - 1]);
+
+    const size_t stride = size_t(draw.vertexSize + draw.texCoordsSize);
+    const float* vertices = mVertexData.data() + draw.offset;
+    std::vector<float>& out(batch.vertices);
+    if (draw.primitive == GL_TRIANGLE_FAN) {
+        for (GLsizei i = 1; i + 1 < draw.vertexCount; i++) {
+            out.insert(out.end(), vertices, vertices + stride);
+            out.insert(out.end(), vertices + size_t(i) * stride,
+                    vertices + size_t(i + 2) * stride);
+            batch.vertexCount += 3;
+        }
+    } else {
+        out.insert(out.end(), vertices,
+                vertices + size_t(draw.vertexCount) * stride);
+        batch.vertexCount += draw.vertexCount;
+    }
+}
+
+void GLES20RenderEngine::batchDraw(const Mesh& mesh) {
+    const float* vertices = mesh.getPositions();
+    const GLsizei vertexCount = GLsizei(mesh.getVertexCount());
+    const GLint vertexSize = GLint(mesh.getVertexSize());
+    const GLint texCoordsSize = GLint(mesh.getTexCoordsSize());
+    const size_t stride = size_t(vertexSize + texCoordsSize);
+
+    Draw draw;
+    draw.binding = mBinding;
+    draw.state = mState;
+    draw.key = ProgramCache::computeKey(mState);
+    draw.primitive = mesh.getPrimitive();
+    draw.vertexSize = vertexSize;
+    draw.texCoordsSize = texCoordsSize;
+    draw.vertexCount = vertexCount;
+    draw.offset = mVertexData.size();
+    draw.bounded = vertexSize == 2 && vertexCount > 0;
+    draw.minX = draw.minY = draw.maxX = draw.maxY = 0;
+    if (draw.bounded) {
+        draw.minX = draw.maxX = vertices[0];
+        draw.minY = draw.maxY = vertices[1];
+        for (GLsizei i = 1; i < vertexCount; i++) {
+            const float* position = vertices + size_t(i) * stride;
+            draw.minX = fminf(draw.minX, position[0]);
+            draw.maxX = fmaxf(draw.maxX, position[0]);
+            draw.minY = fminf(draw.minY, position[1]);
+            draw.maxY = fmaxf(draw.maxY, position[1]);
+        }
+    }
+    mDraws.push_back(draw);
+
+    // the mesh is usually reused by the caller, keep a copy of its vertices
+    mVertexData.insert(mVertexData.end(), vertices,
+            vertices + size_t(vertexCount) * stride);
+}
+
+void GLES20RenderEngine::applyBinding(const Binding& binding,
+        Binding& current, bool force) {
+    if (binding.blendSrc != NO_BINDING && (force ||
+            binding.blend != current.blend ||
+            binding.blendSrc != current.blendSrc)) {
+        setBlending(binding.blend, binding.blendSrc);
+    }
+    if (binding.name != NO_BINDING && (force ||
+            binding.target != current.target || binding.name != current.name ||
+            binding.filter != current.filter)) {
+        setTexture(false, binding.target, binding.name, binding.filter);
+    }
+    if (binding.maskName != NO_BINDING && (force ||
+            binding.maskTarget != current.maskTarget ||
+            binding.maskName != current.maskName ||
+            binding.maskFilter != current.maskFilter)) {
+        setTexture(true, binding.maskTarget, binding.maskName,
+                binding.maskFilter);
+    }
+    current = binding;
+}
+
 void GLES20RenderEngine::dump(String8& result) {
     RenderEngine::dump(result);
+    result.appendFormat("Batched draws: %zu in %zu batches, %zu program "
+            "switches in the last flush\n",
+            mLastFlushDraws, mLastFlushBatches, mLastFlushPrograms);
 }
 
 void GLES20RenderEngine::setupLayerMasking(const Texture& maskTexture, float alphaThreshold) {
-    glActiveTexture(GL_TEXTURE0 + 1);
-    GLuint target = maskTexture.getTextureTarget();
-    glBindTexture(target, maskTexture.getTextureName());
-    GLenum filter = GL_NEAREST;
-    if (maskTexture.getFiltering()) {
-        filter = GL_LINEAR;
-    }
-    glTexParameteri(target, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
-    glTexParameteri(target, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
-    glTexParameteri(target, GL_TEXTURE_MAG_FILTER, filter);
-    glTexParameteri(target, GL_TEXTURE_MIN_FILTER, filter);
+    setTexture(true, maskTexture);
 
     if (alphaThreshold < 0) alphaThreshold = 0;
     if (alphaThreshold > 1.0f) alphaThreshold = 1.0f;
 
     mState.setMasking(maskTexture, alphaThreshold);
-    glActiveTexture(GL_TEXTURE0);
 }
 
 void GLES20RenderEngine::disableLayerMasking() {
@@ -21,6 +21,8 @@
 #include <stdint.h>
 #include <sys/types.h>
 
+#include <vector>
+
 #include <GLES2/gl2.h>
 #include <Transform.h>
 
@@ -57,6 +59,85 @@ class GLES20RenderEngine : public RenderEngine {
     Description mState;
     Vector<Group> mGroupStack;
 
+    // While batching, see RenderEngine::setBatching(), the texturing and
+    // blending set-up is only tracked in mBinding, and drawMesh() adds the
+    // mesh to a batch drawn by flushBatches().
+    bool mBatching;
+
+    // The texture and blending set-up a batched draw depends on. A name of
+    // NO_BINDING means it was not set since the last flush, a filter of 0
+    // that the texture parameters are left alone.
+    enum { NO_BINDING = 0xFFFFFFFF };
+    struct Binding {
+        bool blend;
+        GLenum blendSrc;
+        GLenum target;
+        GLuint name;
+        GLenum filter;
+        GLenum maskTarget;
+        GLuint maskName;
+        GLenum maskFilter;
+        bool operator==(const Binding& rhs) const;
+    };
+    Binding mBinding;
+
+    // A draw made while batching. Its vertices are copied to mVertexData,
+    // starting at offset.
+    struct Draw {
+        Binding binding;
+        Description state;
+        ProgramCache::Key key;
+        GLenum primitive;
+        GLint vertexSize;
+        GLint texCoordsSize;
+        GLsizei vertexCount;
+        size_t offset;
+        // bounds of the positions, only valid for 2D vertices
+        bool bounded;
+        float minX, minY, maxX, maxY;
+    };
+    std::vector<Draw> mDraws;
+    std::vector<float> mVertexData;
+
+    // flushBatches() reorders the draws so that the ones using the same
+    // program and texture follow each other, as far as the draws they
+    // overlap allow, see scheduleDraws(). Consecutive draws with the same
+    // state and binding are merged into one batch; triangle fans are turned
+    // into triangle lists so they can be.
+    struct Batch {
+        Binding binding;
+        Description state;
+        ProgramCache::Key key;
+        GLenum primitive;
+        GLint vertexSize;
+        GLint texCoordsSize;
+        GLsizei vertexCount;
+        std::vector<float> vertices;
+    };
+    // reused across flushes, mBatchCount are in use
+    std::vector<Batch> mBatches;
+    size_t mBatchCount;
+    // scratch space of scheduleDraws()
+    std::vector<size_t> mBlockers;
+    std::vector<bool> mScheduled;
+    // for dump()
+    size_t mLastFlushDraws;
+    size_t mLastFlushBatches;
+    size_t mLastFlushPrograms;
+
+    static Binding unsetBinding();
+    void setBlending(bool enabled, GLenum srcFactor);
+    void setTexture(bool mask, GLenum target, GLuint name, GLenum filter);
+    void setTexture(bool mask, const Texture& texture);
+    void batchDraw(const Mesh& mesh);
+    static bool mustFollow(const Draw& earlier, const Draw& later);
+    void scheduleDraws(size_t first, size_t last);
+    void addToBatch(const Draw& draw, bool merge);
+    void applyBinding(const Binding& binding, Binding& current, bool force);
+    void drawVertices(const Description& state, GLenum primitive,
+            GLsizei vertexCount, GLint vertexSize, GLint texCoordsSize,
+            const float* vertices, bool programInUse = false);
+
     virtual void bindImageAsFramebuffer(EGLImageKHR image,
             uint32_t* texName, uint32_t* fbName, uint32_t* status,
             bool useReadPixels, int reqWidth, int reqHeight);
@@ -94,6 +175,10 @@ protected:
 
     virtual void drawMesh(const Mesh& mesh);
 
+    virtual void setBatching(bool enabled);
+    virtual bool isBatching() const { return mBatching; }
+    virtual void flushBatches();
+
     virtual size_t getMaxTextureSize() const;
     virtual size_t getMaxViewportDims() const;
     virtual bool getProjectionYSwap() { return mProjectionYSwap; }
@@ -16,6 +16,8 @@
 
 #include <stdint.h>
 
+#include <GLES2/gl2ext.h>
+
 #include <log/log.h>
 
 #include "Program.h"
@@ -53,28 +55,51 @@ Program::Program(const ProgramCache::Key& /*needs*/, const char* vertex, const c
         glDeleteShader(fragmentId);
         glDeleteProgram(programId);
     } else {
-        mProgram = programId;
         mVertexShader = vertexId;
         mFragmentShader = fragmentId;
-        mInitialized = true;
-
-        mColorMatrixLoc = glGetUniformLocation(programId, "colorMatrix");
-        mProjectionMatrixLoc = glGetUniformLocation(programId, "projection");
-        mTextureMatrixLoc = glGetUniformLocation(programId, "texture");
-        mSamplerLoc = glGetUniformLocation(programId, "sampler");
-        mColorLoc = glGetUniformLocation(programId, "color");
-        mAlphaPlaneLoc = glGetUniformLocation(programId, "alphaPlane");
-        mSamplerMaskLoc = glGetUniformLocation(programId, "samplerMask");
-        mMaskAlphaThresholdLoc = glGetUniformLocation(programId, "maskAlphaThreshold");
-
-        // set-up the default values for our uniforms
-        glUseProgram(programId);
-        const GLfloat m[16] = {1,0,0,0, 0,1,0,0, 0,0,1,0, 0,0,0,1 };
-        glUniformMatrix4fv(mProjectionMatrixLoc, 1, GL_FALSE, m);
-        glEnableVertexAttribArray(0);
+        initialize(programId);
+    }
+}
+
+Program::Program(const ProgramCache::Key& /*needs*/, GLenum binaryFormat,
+        const void* binary, GLsizei length)
+        : mInitialized(false), mVertexShader(0), mFragmentShader(0) {
+    GLuint programId = glCreateProgram();
+    glProgramBinaryOES(programId, binaryFormat, binary, length);
+
+    // the driver rejects binaries it can't use anymore, the caller then
+    // builds the program from source
+    GLint status;
+    glGetProgramiv(programId, GL_LINK_STATUS, &status);
+    if (status != GL_TRUE) {
+        ALOGW("Program binary rejected (format 0x%x, %d bytes)",
+                binaryFormat, length);
+        glDeleteProgram(programId);
+    } else {
+        initialize(programId);
     }
 }
 
+void Program::initialize(GLuint programId) {
+    mProgram = programId;
+    mInitialized = true;
+
+    mColorMatrixLoc = glGetUniformLocation(programId, "colorMatrix");
+    mProjectionMatrixLoc = glGetUniformLocation(programId, "projection");
+    mTextureMatrixLoc = glGetUniformLocation(programId, "texture");
+    mSamplerLoc = glGetUniformLocation(programId, "sampler");
+    mColorLoc = glGetUniformLocation(programId, "color");
+    mAlphaPlaneLoc = glGetUniformLocation(programId, "alphaPlane");
+    mSamplerMaskLoc = glGetUniformLocation(programId, "samplerMask");
+    mMaskAlphaThresholdLoc = glGetUniformLocation(programId, "maskAlphaThreshold");
+
+    // set-up the default values for our uniforms
+    glUseProgram(programId);
+    const GLfloat m[16] = {1,0,0,0, 0,1,0,0, 0,0,1,0, 0,0,0,1 };
+    glUniformMatrix4fv(mProjectionMatrixLoc, 1, GL_FALSE, m);
+    glEnableVertexAttribArray(0);
+}
+
 Program::~Program() {
 }
 
@@ -153,4 +178,16 @@ void Program::setUniforms(const Description& desc) {
     }
 }
 
+bool Program::getBinary(GLenum* binaryFormat, std::vector<uint8_t>* binary) const {
+    GLint length = 0;
+    glGetProgramiv(mProgram, GL_PROGRAM_BINARY_LENGTH_OES, &length);
+    if (!mInitialized || length <= 0) {
+        return false;
+    }
+    binary->resize(size_t(length));
+    glGetProgramBinaryOES(mProgram, length, &length, binaryFormat, binary->data());
+    binary->resize(size_t(length));
+    return length > 0;
+}
+
 } /* namespace android */
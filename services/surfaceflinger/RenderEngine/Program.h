@@ -19,6 +19,8 @@
 
 #include <stdint.h>
 
+#include <vector>
+
 #include <GLES2/gl2.h>
 
 #include "Description.h"
@@ -37,6 +39,9 @@ public:
     enum { position=0, texCoords=1 };
 
     Program(const ProgramCache::Key& needs, const char* vertex, const char* fragment);
+    /* loads a program binary returned by getBinary(), see isValid() */
+    Program(const ProgramCache::Key& needs, GLenum binaryFormat,
+            const void* binary, GLsizei length);
     ~Program();
 
     /* whether this object is usable */
@@ -54,9 +59,13 @@ public:
     /* set-up uniforms from the description */
     void setUniforms(const Description& desc);
 
+    /* retrieves the driver binary of this program, false if not supported */
+    bool getBinary(GLenum* binaryFormat, std::vector<uint8_t>* binary) const;
+
 
 private:
     GLuint buildShader(const char* source, GLenum type);
+    void initialize(GLuint programId);
     String8& dumpShader(String8& result, GLenum type);
 
     // whether the initialization succeeded
@@ -16,14 +16,23 @@
 
 //#define LOG_NDEBUG 0
 
+#include <errno.h>
+#include <stdio.h>
+#include <string.h>
+#include <unistd.h>
+
 #include <GLES2/gl2.h>
 #include <GLES2/gl2ext.h>
 
+#include <cutils/properties.h>
+
+#include <utils/JenkinsHash.h>
 #include <utils/String8.h>
 
 #include "ProgramCache.h"
 #include "Program.h"
 #include "Description.h"
+#include "GLExtensions.h"
 
 namespace android {
 // -----------------------------------------------------------------------------------------------
@@ -77,15 +86,63 @@ Formatter& dedent(Formatter& f) {
 
 // -----------------------------------------------------------------------------------------------
 
+// Program binaries saved by ProgramCache::save()
+static const char* const PROGRAM_BINARY_FILE = "/data/misc/surfaceflinger/programs.bin";
+static const uint32_t PROGRAM_BINARY_MAGIC = 0x53465042; // 'SFPB'
+static const uint32_t PROGRAM_BINARY_VERSION = 2;
+// a larger file is corrupted
+static const size_t MAX_PROGRAM_BINARY_FILE_SIZE = 4 * 1024 * 1024;
+
+static void appendBytes(std::vector<uint8_t>& out, const void* data, size_t size) {
+    const uint8_t* bytes = static_cast<const uint8_t*>(data);
+    out.insert(out.end(), bytes, bytes + size);
+}
+
+static bool readBytes(const uint8_t*& data, size_t& remaining, void* out, size_t size) {
+    if (size > remaining) {
+        return false;
+    }
+    memcpy(out, data, size);
+    data += size;
+    remaining -= size;
+    return true;
+}
+
 ANDROID_SINGLETON_STATIC_INSTANCE(ProgramCache)
 
-ProgramCache::ProgramCache() {
-    // Until surfaceflinger has a dependable blob cache on the filesystem,
-    // generate shaders on initialization so as to avoid jank.
-    primeCache();
+ProgramCache::ProgramCache()
+    : mBinarySupported(false), mBinariesDirty(false), mSaveInBackground(false),
+      mSaveRequested(false), mSaveThreadExit(false) {
+    const GLExtensions& extensions(GLExtensions::getInstance());
+    if (extensions.hasExtension("GL_OES_get_program_binary")) {
+        GLint formatCount = 0;
+        glGetIntegerv(GL_NUM_PROGRAM_BINARY_FORMATS_OES, &formatCount);
+        mBinarySupported = formatCount > 0;
+    }
+    // An OTA can update the driver without changing the strings it reports
+    char fingerprint[PROPERTY_VALUE_MAX];
+    property_get("ro.build.fingerprint", fingerprint, "");
+    mDriverId.appendFormat("%s\n%s\n%s\n%s", fingerprint,
+            extensions.getVendor(), extensions.getRenderer(),
+            extensions.getVersion());
+
+    // Use the programs saved by the previous runs. Without them (first boot,
+    // /data not mounted yet, new driver), generate the common shaders on
+    // initialization so as to avoid jank.
+    if (!load()) {
+        primeCache();
+    }
 }
 
 ProgramCache::~ProgramCache() {
+    {
+        Mutex::Autolock _l(mBinaryLock);
+        mSaveThreadExit = true;
+        mSaveCondition.signal();
+    }
+    if (mSaveThread.joinable()) {
+        mSaveThread.join();
+    }
 }
 
 void ProgramCache::primeCache() {
@@ -135,6 +192,191 @@ void ProgramCache::primeCache() {
     ALOGD("SF. shader cache generated - %u shaders in %f ms\n", shaderCount, compileTimeMs);
 }
 
+bool ProgramCache::load() {
+    if (!mBinarySupported) {
+        return false;
+    }
+    FILE* file = fopen(PROGRAM_BINARY_FILE, "rb");
+    if (file == NULL) {
+        return false;
+    }
+    nsecs_t timeBefore = systemTime();
+    std::vector<uint8_t> contents;
+    uint8_t chunk[4096];
+    size_t size;
+    while ((size = fread(chunk, 1, sizeof(chunk), file)) > 0 &&
+            contents.size() <= MAX_PROGRAM_BINARY_FILE_SIZE) {
+        appendBytes(contents, chunk, size);
+    }
+    fclose(file);
+
+    const uint8_t* data = contents.data();
+    size_t remaining = contents.size();
+    uint32_t magic = 0, version = 0, driverIdLength = 0, count = 0;
+    if (contents.size() > MAX_PROGRAM_BINARY_FILE_SIZE ||
+            !readBytes(data, remaining, &magic, sizeof(magic)) ||
+            !readBytes(data, remaining, &version, sizeof(version)) ||
+            !readBytes(data, remaining, &driverIdLength, sizeof(driverIdLength)) ||
+            magic != PROGRAM_BINARY_MAGIC || version != PROGRAM_BINARY_VERSION ||
+            driverIdLength != mDriverId.length() || driverIdLength > remaining ||
+            memcmp(data, mDriverId.string(), driverIdLength) != 0) {
+        ALOGW("Ignoring program binaries from another driver or version");
+        return false;
+    }
+    data += driverIdLength;
+    remaining -= driverIdLength;
+    if (!readBytes(data, remaining, &count, sizeof(count))) {
+        return false;
+    }
+
+    uint32_t rebuiltCount = 0;
+    for (uint32_t i = 0; i < count; i++) {
+        Key key;
+        uint32_t sourceHash = 0, format = 0, length = 0;
+        if (!readBytes(data, remaining, &key.mKey, sizeof(key.mKey)) ||
+                !readBytes(data, remaining, &sourceHash, sizeof(sourceHash)) ||
+                !readBytes(data, remaining, &format, sizeof(format)) ||
+                !readBytes(data, remaining, &length, sizeof(length)) ||
+                length > remaining) {
+            ALOGW("Truncated program binary file");
+            break;
+        }
+        if (mCache.indexOfKey(key) >= 0) {
+            data += length;
+            remaining -= length;
+            continue;
+        }
+        // a binary built from other shaders can link, but it is stale
+        Program* program = NULL;
+        if (sourceHash == hashShaderSource(key)) {
+            program = new Program(key, format, data, GLsizei(length));
+        }
+        if (program != NULL && program->isValid()) {
+            Binary binary;
+            binary.sourceHash = sourceHash;
+            binary.format = format;
+            binary.data.assign(data, data + length);
+            Mutex::Autolock _l(mBinaryLock);
+            mBinaries.add(key, binary);
+            mRecordedKeys.add(key);
+        } else {
+            // still used, recordBinaries() will save the new binary
+            delete program;
+            program = generateProgram(key);
+            rebuiltCount++;
+        }
+        mCache.add(key, program);
+        data += length;
+        remaining -= length;
+    }
+
+    nsecs_t timeAfter = systemTime();
+    float loadTimeMs = static_cast<float>(timeAfter - timeBefore) / 1.0E6;
+    ALOGD("SF. shader cache loaded - %zu programs (%u rebuilt) in %f ms\n",
+            mCache.size(), rebuiltCount, loadTimeMs);
+    return mCache.size() > 0;
+}
+
+void ProgramCache::recordBinaries() {
+    if (mPendingKeys.isEmpty()) {
+        return;
+    }
+    size_t recorded = 0;
+    for (size_t i = 0; i < mPendingKeys.size(); i++) {
+        const Key& key(mPendingKeys.itemAt(i));
+        const Program* program = mCache.valueFor(key);
+        Binary binary;
+        if (program == NULL || !program->isValid() ||
+                !program->getBinary(&binary.format, &binary.data)) {
+            continue;
+        }
+        binary.sourceHash = hashShaderSource(key);
+        Mutex::Autolock _l(mBinaryLock);
+        mBinaries.add(key, binary);
+        recorded++;
+    }
+    mPendingKeys.clear();
+    if (recorded == 0) {
+        return;
+    }
+    Mutex::Autolock _l(mBinaryLock);
+    mBinariesDirty = true;
+    if (mSaveInBackground) {
+        // keep the file system off the main thread
+        if (!mSaveThread.joinable()) {
+            mSaveThread = std::thread(&ProgramCache::saveThreadLoop, this);
+        }
+        mSaveRequested = true;
+        mSaveCondition.signal();
+    }
+}
+
+void ProgramCache::saveThreadLoop() {
+    while (true) {
+        {
+            Mutex::Autolock _l(mBinaryLock);
+            while (!mSaveRequested && !mSaveThreadExit) {
+                mSaveCondition.wait(mBinaryLock);
+            }
+            if (!mSaveRequested) {
+                return;
+            }
+            mSaveRequested = false;
+        }
+        save();
+    }
+}
+
+void ProgramCache::save() {
+    Mutex::Autolock _s(mSaveLock);
+    std::vector<uint8_t> contents;
+    {
+        Mutex::Autolock _l(mBinaryLock);
+        if (!mBinariesDirty) {
+            mSaveInBackground = mBinarySupported;
+            return;
+        }
+        const uint32_t driverIdLength = uint32_t(mDriverId.length());
+        const uint32_t count = uint32_t(mBinaries.size());
+        appendBytes(contents, &PROGRAM_BINARY_MAGIC, sizeof(PROGRAM_BINARY_MAGIC));
+        appendBytes(contents, &PROGRAM_BINARY_VERSION, sizeof(PROGRAM_BINARY_VERSION));
+        appendBytes(contents, &driverIdLength, sizeof(driverIdLength));
+        appendBytes(contents, mDriverId.string(), driverIdLength);
+        appendBytes(contents, &count, sizeof(count));
+        for (size_t i = 0; i < mBinaries.size(); i++) {
+            const Binary& binary(mBinaries.valueAt(i));
+            const uint32_t format = binary.format;
+            const uint32_t length = uint32_t(binary.data.size());
+            appendBytes(contents, &mBinaries.keyAt(i).mKey, sizeof(Key::key_t));
+            appendBytes(contents, &binary.sourceHash, sizeof(binary.sourceHash));
+            appendBytes(contents, &format, sizeof(format));
+            appendBytes(contents, &length, sizeof(length));
+            appendBytes(contents, binary.data.data(), length);
+        }
+        mBinariesDirty = false;
+    }
+
+    // write a new file and swap it in, a partial file is never loaded
+    String8 tmpName(PROGRAM_BINARY_FILE);
+    tmpName.append(".tmp");
+    FILE* file = fopen(tmpName.string(), "wb");
+    bool written = file != NULL &&
+            fwrite(contents.data(), 1, contents.size(), file) == contents.size();
+    if (file != NULL) {
+        written = (fclose(file) == 0) && written;
+    }
+    written = written && rename(tmpName.string(), PROGRAM_BINARY_FILE) == 0;
+    if (!written) {
+        ALOGW("Can't save program binaries to %s (%s)",
+                PROGRAM_BINARY_FILE, strerror(errno));
+        unlink(tmpName.string());
+    }
+
+    Mutex::Autolock _l(mBinaryLock);
+    mBinariesDirty = mBinariesDirty || !written;
+    mSaveInBackground = written;
+}
+
 ProgramCache::Key ProgramCache::computeKey(const Description& description) {
     Key needs;
     needs.set(Key::TEXTURE_MASK,
@@ -249,6 +491,16 @@ String8 ProgramCache::generateFragmentShader(const Key& needs) {
     return fs.getString();
 }
 
+uint32_t ProgramCache::hashShaderSource(const Key& needs) {
+    String8 vs = generateVertexShader(needs);
+    String8 fs = generateFragmentShader(needs);
+    uint32_t hash = JenkinsHashMixBytes(0,
+            reinterpret_cast<const uint8_t*>(vs.string()), vs.length() + 1);
+    hash = JenkinsHashMixBytes(hash,
+            reinterpret_cast<const uint8_t*>(fs.string()), fs.length() + 1);
+    return JenkinsHashWhiten(hash);
+}
+
 Program* ProgramCache::generateProgram(const Key& needs) {
     // vertex shader
     String8 vs = generateVertexShader(needs);
@@ -260,7 +512,7 @@ Program* ProgramCache::generateProgram(const Key& needs) {
     return program;
 }
 
-void ProgramCache::useProgram(const Description& description) {
+void ProgramCache::useProgram(const Description& description, bool inUse) {
 
     // generate the key for the shader based on the description
     Key needs(computeKey(description));
@@ -275,9 +527,18 @@ void ProgramCache::useProgram(const Description& description) {
         time += systemTime();
     }
 
+    if (mBinarySupported && mRecordedKeys.indexOf(needs) < 0) {
+        // reading the binary back stalls on the driver, it's done by
+        // recordBinaries() once the frame is composed
+        mRecordedKeys.add(needs);
+        mPendingKeys.add(needs);
+    }
+
     // here we have a suitable program for this description
     if (program->isValid()) {
-        program->use();
+        if (!inUse) {
+            program->use();
+        }
         program->setUniforms(description);
     }
 }
@@ -17,10 +17,19 @@
 #ifndef SF_RENDER_ENGINE_PROGRAMCACHE_H
 #define SF_RENDER_ENGINE_PROGRAMCACHE_H
 
+#include <stdint.h>
+
+#include <thread>
+#include <vector>
+
 #include <GLES2/gl2.h>
 
+#include <utils/Condition.h>
 #include <utils/Singleton.h>
 #include <utils/KeyedVector.h>
+#include <utils/Mutex.h>
+#include <utils/SortedVector.h>
+#include <utils/String8.h>
 #include <utils/TypeHelpers.h>
 
 #include "Description.h"
@@ -29,13 +38,18 @@ namespace android {
 
 class Description;
 class Program;
-class String8;
 
 /*
  * This class generates GLSL programs suitable to handle a given
  * Description. It's responsible for figuring out what to
  * generate from a Description.
  * It also maintains a cache of these Programs.
+ *
+ * The driver binaries of the programs used are saved to disk
+ * (GL_OES_get_program_binary). At initialization the programs used by the
+ * previous runs are loaded from there, and only those are primed. The file
+ * is only used by the same build on the same GL driver, and a binary is only
+ * used if the shader source of its key is unchanged.
  */
 class ProgramCache : public Singleton<ProgramCache> {
 public:
@@ -109,6 +123,10 @@ public:
             return (mKey & TEXTURE_MASKING_MASK);
         }
 
+        inline bool operator==(const Key& rhs) const {
+            return mKey == rhs.mKey;
+        }
+
         // this is the definition of a friend function -- not a method of class Needs
         friend inline int strictly_order_type(const Key& lhs, const Key& rhs) {
             return  (lhs.mKey < rhs.mKey) ? 1 : 0;
@@ -119,24 +137,68 @@ public:
     ~ProgramCache();
 
     // useProgram lookup a suitable program in the cache or generates one
-    // if none can be found.
-    void useProgram(const Description& description);
+    // if none can be found. inUse skips glUseProgram() when the caller knows
+    // the previous draw was made with the same program.
+    void useProgram(const Description& description, bool inUse = false);
+
+    // Writes the binaries of the programs used so far to disk, if they
+    // changed since the last call. Can be called from any thread; once it
+    // succeeded, programs first used later are saved by mSaveThread.
+    void save();
+
+    // Reads back the binaries of the programs first used since the last
+    // call. Must be called on the main thread, between frames.
+    void recordBinaries();
+
+    // compute a cache Key from a Description
+    static Key computeKey(const Description& description);
 
 private:
+    struct Binary {
+        uint32_t sourceHash;
+        GLenum format;
+        std::vector<uint8_t> data;
+    };
+
     // Generate shaders to populate the cache
     void primeCache();
-    // compute a cache Key from a Description
-    static Key computeKey(const Description& description);
+    // Loads the programs saved by save(), returns false if there are none
+    bool load();
     // generates a program from the Key
     static Program* generateProgram(const Key& needs);
     // generates the vertex shader from the Key
     static String8 generateVertexShader(const Key& needs);
     // generates the fragment shader from the Key
     static String8 generateFragmentShader(const Key& needs);
+    // hashes the shaders generated for the Key
+    static uint32_t hashShaderSource(const Key& needs);
+    // saves the binaries when asked to by recordBinaries()
+    void saveThreadLoop();
 
     // Key/Value map used for caching Programs. Currently the cache
     // is never shrunk.
     DefaultKeyedVector<Key, Program*> mCache;
+
+    // Keys in mBinaries or mPendingKeys, main thread only
+    SortedVector<Key> mRecordedKeys;
+    // Keys used this run whose binaries weren't read back yet, main thread only
+    SortedVector<Key> mPendingKeys;
+    bool mBinarySupported;
+    // Identifies the build and the GL driver the binaries were built by
+    String8 mDriverId;
+
+    // Serializes save()
+    Mutex mSaveLock;
+    Mutex mBinaryLock;
+    // Binaries of the programs used by this run and the ones before
+    KeyedVector<Key, Binary> mBinaries;
+    bool mBinariesDirty;
+    bool mSaveInBackground;
+    // Started by the first background save, joined by the destructor
+    std::thread mSaveThread;
+    Condition mSaveCondition;
+    bool mSaveRequested;
+    bool mSaveThreadExit;
 };
 
 
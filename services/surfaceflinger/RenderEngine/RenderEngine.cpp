@@ -24,6 +24,7 @@
 #include "GLES20RenderEngine.h"
 #include "GLExtensions.h"
 #include "Mesh.h"
+#include "Texture.h"
 
 EGLAPI const char* eglQueryStringImplementationANDROID(EGLDisplay dpy, EGLint name);
 
@@ -219,21 +220,25 @@ void RenderEngine::fillRegionWithColor(const Region& region, uint32_t height,
 }
 
 void RenderEngine::flush() {
+    flushBatches();
     glFlush();
 }
 
 void RenderEngine::clearWithColor(float red, float green, float blue, float alpha) {
+    flushBatches();
     glClearColor(red, green, blue, alpha);
     glClear(GL_COLOR_BUFFER_BIT);
 }
 
 void RenderEngine::setScissor(
         uint32_t left, uint32_t bottom, uint32_t right, uint32_t top) {
+    flushBatches();
     glScissor(left, bottom, right, top);
     glEnable(GL_SCISSOR_TEST);
 }
 
 void RenderEngine::disableScissor() {
+    flushBatches();
     glDisable(GL_SCISSOR_TEST);
 }
 
@@ -242,13 +247,75 @@ void RenderEngine::genTextures(size_t count, uint32_t* names) {
 }
 
 void RenderEngine::deleteTextures(size_t count, uint32_t const* names) {
+    flushBatches();
     glDeleteTextures(count, names);
 }
 
 void RenderEngine::readPixels(size_t l, size_t b, size_t w, size_t h, uint32_t* pixels) {
+    flushBatches();
     glReadPixels(l, b, w, h, GL_RGBA, GL_UNSIGNED_BYTE, pixels);
 }
 
+void RenderEngine::copyFramebufferToTexture(uint32_t texName,
+        const Rect& bounds, uint32_t height) {
+    flushBatches();
+    // the internal format can't have more components than the framebuffer
+    GLint alphaBits = 0;
+    glGetIntegerv(GL_ALPHA_BITS, &alphaBits);
+    glBindTexture(GL_TEXTURE_2D, texName);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_NEAREST);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_NEAREST);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
+    glCopyTexImage2D(GL_TEXTURE_2D, 0, alphaBits ? GL_RGBA : GL_RGB,
+            bounds.left, height - bounds.bottom,
+            bounds.getWidth(), bounds.getHeight(), 0);
+}
+
+void RenderEngine::drawFramebufferTexture(uint32_t texName,
+        const Region& region, uint32_t height) {
+    // the snapshot holds the bounds of region, flipped like the framebuffer
+    const Rect bounds(region.getBounds());
+    const float left = bounds.left;
+    const float bottom = height - bounds.bottom;
+    const float texWidth = bounds.getWidth();
+    const float texHeight = bounds.getHeight();
+    size_t c;
+    Rect const* r = region.getArray(&c);
+    Mesh mesh(Mesh::TRIANGLES, c*6, 2, 2);
+    Mesh::VertexArray<vec2> position(mesh.getPositionArray<vec2>());
+    Mesh::VertexArray<vec2> texCoords(mesh.getTexCoordArray<vec2>());
+    for (size_t i=0 ; i<c ; i++, r++) {
+        position[i*6 + 0] = vec2(r->left, height - r->top);
+        position[i*6 + 1] = vec2(r->left, height - r->bottom);
+        position[i*6 + 2] = vec2(r->right, height - r->bottom);
+        position[i*6 + 3] = vec2(r->left, height - r->top);
+        position[i*6 + 4] = vec2(r->right, height - r->bottom);
+        position[i*6 + 5] = vec2(r->right, height - r->top);
+        for (size_t j=0 ; j<6 ; j++) {
+            texCoords[i*6 + j] = vec2(
+                    (position[i*6 + j].x - left) / texWidth,
+                    (position[i*6 + j].y - bottom) / texHeight);
+        }
+    }
+
+    Texture texture(Texture::TEXTURE_2D, texName);
+    texture.setDimensions(bounds.getWidth(), bounds.getHeight());
+
+    // the color transform, if any, is already applied to the snapshot
+    const mat4 oldColorMatrix = setupColorTransform(mat4());
+#ifdef USE_HWC2
+    setupLayerBlending(true, false, 1.0f);
+#else
+    setupLayerBlending(true, false, 0xFF);
+#endif
+    disableBlending();
+    setupLayerTexturing(texture);
+    drawMesh(mesh);
+    disableTexturing();
+    setupColorTransform(oldColorMatrix);
+}
+
 void RenderEngine::dump(String8& result) {
     const GLExtensions& extensions(GLExtensions::getInstance());
     result.appendFormat("GLES: %s, %s, %s\n",
@@ -264,6 +331,7 @@ RenderEngine::BindImageAsFramebuffer::BindImageAsFramebuffer(
         RenderEngine& engine, EGLImageKHR image, bool useReadPixels,
         int reqWidth, int reqHeight) : mEngine(engine), mUseReadPixels(useReadPixels)
 {
+    mEngine.flushBatches();
     mEngine.bindImageAsFramebuffer(image, &mTexName, &mFbName, &mStatus,
             useReadPixels, reqWidth, reqHeight);
 
@@ -282,6 +350,18 @@ status_t RenderEngine::BindImageAsFramebuffer::getStatus() const {
 
 // ---------------------------------------------------------------------------
 
+RenderEngine::SuspendBatching::SuspendBatching(RenderEngine& engine)
+    : mEngine(engine), mWasBatching(engine.isBatching())
+{
+    mEngine.setBatching(false);
+}
+
+RenderEngine::SuspendBatching::~SuspendBatching() {
+    mEngine.setBatching(mWasBatching);
+}
+
+// ---------------------------------------------------------------------------
+
 static status_t selectConfigForAttribute(EGLDisplay dpy, EGLint const* attrs,
         EGLint attribute, EGLint wanted, EGLConfig* outConfig) {
     EGLint numConfigs = -1, n = 0;
@@ -444,6 +524,14 @@ void RenderEngine::primeCache() const {
     ProgramCache::getInstance();
 }
 
+void RenderEngine::saveProgramCache() const {
+    ProgramCache::getInstance().save();
+}
+
+void RenderEngine::recordProgramBinaries() const {
+    ProgramCache::getInstance().recordBinaries();
+}
+
 // ---------------------------------------------------------------------------
 }; // namespace android
 // ---------------------------------------------------------------------------
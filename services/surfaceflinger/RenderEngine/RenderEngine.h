@@ -67,6 +67,10 @@ public:
     static EGLConfig chooseEglConfig(EGLDisplay display, int format);
 
     void primeCache() const;
+    // saves the shader programs used so far for the next runs
+    void saveProgramCache() const;
+    // records the shader programs first used by the last frame
+    void recordProgramBinaries() const;
 
     // dump the extension strings. always call the base class.
     virtual void dump(String8& result);
@@ -84,6 +88,14 @@ public:
     void deleteTextures(size_t count, uint32_t const* names);
     void readPixels(size_t l, size_t b, size_t w, size_t h, uint32_t* pixels);
 
+    // snapshot of the framebuffer, used to cache client composition:
+    // copyFramebufferToTexture() copies bounds of the current framebuffer
+    // into texName and drawFramebufferTexture() draws region back from it,
+    // unblended. bounds must be the bounds of region, both are in display
+    // coordinates, like fillRegionWithColor().
+    void copyFramebufferToTexture(uint32_t texName, const Rect& bounds, uint32_t height);
+    void drawFramebufferTexture(uint32_t texName, const Region& region, uint32_t height);
+
     class BindImageAsFramebuffer {
         RenderEngine& mEngine;
         uint32_t mTexName, mFbName;
@@ -96,6 +108,24 @@ public:
         int getStatus() const;
     };
 
+    // Draw batching. While batching is enabled, drawMesh() and the
+    // texturing and blending set-up are not issued to GL right away: the
+    // draws are collected into batches, merging the ones that can share a
+    // draw call, and drawn by flushBatches(). Every other method touching GL
+    // flushes the batches first; code issuing GL calls directly must use
+    // SuspendBatching.
+    virtual void setBatching(bool /* enabled */) {}
+    virtual bool isBatching() const { return false; }
+    virtual void flushBatches() {}
+
+    class SuspendBatching {
+        RenderEngine& mEngine;
+        bool mWasBatching;
+    public:
+        SuspendBatching(RenderEngine& engine);
+        ~SuspendBatching();
+    };
+
     // set-up
     virtual void checkErrors() const;
     virtual void setViewportAndProjection(size_t vpw, size_t vph,
@@ -25,6 +25,8 @@
 #include <inttypes.h>
 #include <stdatomic.h>
 
+#include <algorithm>
+
 #include <EGL/egl.h>
 
 #include <cutils/iosched_policy.h>
@@ -77,7 +79,6 @@
 #include "DisplayHardware/HWComposer.h"
 #include "DisplayHardware/VirtualDisplaySurface.h"
 
-#include "Effects/Daltonizer.h"
 
 #include "RenderEngine/RenderEngine.h"
 #include <cutils/compiler.h>
@@ -159,15 +160,32 @@ SurfaceFlinger::SurfaceFlinger()
         mLastTransactionTime(0),
         mBootFinished(false),
         mForceFullDamage(false),
+        mFenceTracker(mFenceTimeline),
         mPrimaryDispSync("PrimaryDispSync"),
         mPrimaryHWVsyncEnabled(false),
         mHWVsyncAvailable(false),
-        mHasColorMatrix(false),
-        mHasSecondaryColorMatrix(false),
         mHasPoweredOff(false),
         mFrameBuckets(),
         mTotalTime(0),
         mLastSwapTime(0),
+        mSkipUnchangedFrames(true),
+        mUnchangedFramesSkipped(0),
+        mLatchedUnchangedFrames(false),
+        mLastFrameRegionAllocations(0),
+        mTotalRegionAllocations(0),
+        mRegionAllocationFrames(0),
+        mIncrementalVisibleRegions(true),
+        mPresentPrimaryFirst(true),
+        mBatchComposition(false),
+        mCacheClientComposition(true),
+        mClientCompositionCacheHits(0),
+        mClientCompositionCacheCaptures(0),
+        mClientCompositionCacheMisses(0),
+        mQueueTransactions(true),
+        mVisibleRegionLayersComputed(0),
+        mVisibleRegionLayersReused(0),
+        mCullScreenshotLayers(true),
+        mScreenshotLayersDrawn(0),
         mActiveFrameSequence(0)
 {
     ALOGI("SurfaceFlinger is starting");
@@ -183,6 +201,30 @@ SurfaceFlinger::SurfaceFlinger()
 
     property_get("debug.sf.ddms", value, "0");
     mDebugDDMS = atoi(value);
+
+    property_get("debug.sf.incremental_visreg", value, "1");
+    mIncrementalVisibleRegions = atoi(value);
+
+    property_get("debug.sf.batch_composition", value, "0");
+    mBatchComposition = atoi(value);
+
+    property_get("debug.sf.client_comp_cache", value, "1");
+    mCacheClientComposition = atoi(value);
+
+    property_get("debug.sf.transaction_queue", value, "1");
+    mQueueTransactions = atoi(value);
+
+    property_get("debug.sf.screenshot_cull", value, "1");
+    mCullScreenshotLayers = atoi(value);
+
+    property_get("debug.sf.skip_unchanged_frames", value, "1");
+    mSkipUnchangedFrames = atoi(value);
+
+    property_get("debug.sf.present_primary_first", value, "1");
+    mPresentPrimaryFirst = atoi(value);
+
+    property_get("debug.sf.plane_prediction", value, "1");
+    mPlanePredictor.setEnabled(atoi(value));
     if (mDebugDDMS) {
         if (!startDdmConnection()) {
             // start failed, and DDMS debugging not enabled
@@ -324,6 +366,10 @@ void SurfaceFlinger::bootFinished()
     // can choose where to stop the animation.
     property_set("service.bootanim.exit", "1");
 
+    // /data is available by now, keep the shader programs used during boot
+    // so that the next boot doesn't have to compile them
+    mRenderEngine->saveProgramCache();
+
 #ifdef USES_HWC_SERVICES
     sp<IServiceManager> sm = defaultServiceManager();
     sp<android::IExynosHWCService> hwc =
@@ -433,6 +479,10 @@ public:
         }
     }
 
+    virtual nsecs_t computeNextRefresh() const {
+        return mDispSync->computeNextRefresh(0);
+    }
+
 private:
     virtual void onDispSyncEvent(nsecs_t when) {
         sp<VSyncSource::Callback> callback;
@@ -853,6 +903,7 @@ status_t SurfaceFlinger::clearAnimationFrameStats() {
 
 status_t SurfaceFlinger::getAnimationFrameStats(FrameStats* outStats) const {
     Mutex::Autolock _l(mStateLock);
+    mFenceTimeline.updateSignalTimes();
     mAnimFrameTracker.getStats(outStats);
     return NO_ERROR;
 }
@@ -1072,6 +1123,8 @@ void SurfaceFlinger::onMessageReceived(int32_t what) {
                 // a new buffer was latched, or if HWC has requested a full
                 // repaint
                 signalRefresh();
+            } else if (mLatchedUnchangedFrames) {
+                mUnchangedFramesSkipped++;
             }
             break;
         }
@@ -1100,6 +1153,7 @@ void SurfaceFlinger::handleMessageRefresh() {
     ATRACE_CALL();
 
     nsecs_t refreshStartTime = systemTime(SYSTEM_TIME_MONOTONIC);
+    const uint32_t regionAllocationsStart = Region::getStorageAllocationCount();
 
     preComposition();
     rebuildLayerStacks();
@@ -1107,6 +1161,13 @@ void SurfaceFlinger::handleMessageRefresh() {
     doDebugFlashRegions();
     doComposition();
     postComposition(refreshStartTime);
+    // the frame is out, read back the shader programs it compiled
+    mRenderEngine->recordProgramBinaries();
+
+    mLastFrameRegionAllocations =
+            Region::getStorageAllocationCount() - regionAllocationsStart;
+    mTotalRegionAllocations += mLastFrameRegionAllocations;
+    mRegionAllocationFrames++;
 #ifdef USES_HWC_SERVICES
     notifyPSRExit = true;
 #endif
@@ -1194,18 +1255,22 @@ void SurfaceFlinger::postComposition(nsecs_t refreshStartTime)
     ATRACE_CALL();
     ALOGV("postComposition");
 
+    // Look at all the fences the trackers wait for at once
+    mFenceTimeline.updateSignalTimes();
+
+    sp<Fence> presentFence = mHwc->getRetireFence(HWC_DISPLAY_PRIMARY);
+    sp<FenceTime> presentFenceTime = mFenceTimeline.track(presentFence);
+
     const LayerVector& layers(mDrawingState.layersSortedByZ);
     const size_t count = layers.size();
     for (size_t i=0 ; i<count ; i++) {
-        bool frameLatched = layers[i]->onPostComposition();
+        bool frameLatched = layers[i]->onPostComposition(presentFenceTime);
         if (frameLatched) {
             recordBufferingStats(layers[i]->getName().string(),
                     layers[i]->getOccupancyHistory(false));
         }
     }
 
-    sp<Fence> presentFence = mHwc->getRetireFence(HWC_DISPLAY_PRIMARY);
-
     if (presentFence->isValid()) {
         if (mPrimaryDispSync.addPresentFence(presentFence)) {
             enableHardwareVsync();
@@ -1221,14 +1286,15 @@ void SurfaceFlinger::postComposition(nsecs_t refreshStartTime)
         }
     }
 
-    mFenceTracker.addFrame(refreshStartTime, presentFence,
-            hw->getVisibleLayersSortedByZ(), hw->getClientTargetAcquireFence());
+    mFenceTracker.addFrame(refreshStartTime, presentFenceTime,
+            hw->getVisibleLayersSortedByZ(),
+            mFenceTimeline.track(hw->getClientTargetAcquireFence()));
 
     if (mAnimCompositionPending) {
         mAnimCompositionPending = false;
 
         if (presentFence->isValid()) {
-            mAnimFrameTracker.setActualPresentFence(presentFence);
+            mAnimFrameTracker.setActualPresentFence(presentFenceTime);
         } else {
             // The HWC doesn't support present fences, so use the refresh
             // timestamp instead.
@@ -1269,6 +1335,8 @@ void SurfaceFlinger::rebuildLayerStacks() {
         ATRACE_CALL();
         mVisibleRegionsDirty = false;
         invalidateHwcGeometry();
+        mVisibleRegionLayersComputed = 0;
+        mVisibleRegionLayersReused = 0;
 
         const LayerVector& layers(mDrawingState.layersSortedByZ);
         for (size_t dpy=0 ; dpy<mDisplays.size() ; dpy++) {
@@ -1376,7 +1444,7 @@ void SurfaceFlinger::setUpHWComposer() {
     }
 
 
-    mat4 colorMatrix = mColorMatrix * mDaltonizer();
+    const mat4& colorMatrix = mColorPipeline.getColorTransform();
 
     // Set the per-frame data
     for (size_t displayId = 0; displayId < mDisplays.size(); ++displayId) {
@@ -1389,10 +1457,13 @@ void SurfaceFlinger::setUpHWComposer() {
             status_t result = mHwc->setColorTransform(hwcId, colorMatrix);
             ALOGE_IF(result != NO_ERROR, "Failed to set color transform on "
                     "display %zd: %d", displayId, result);
+            // HWC decides differently with another color transform
+            mPlanePredictor.clear(hwcId);
         }
         for (auto& layer : displayDevice->getVisibleLayersSortedByZ()) {
             layer->setPerFrameData(displayDevice);
         }
+        predictCompositionTypes(displayDevice);
     }
 
     mPreviousColorMatrix = colorMatrix;
@@ -1406,31 +1477,130 @@ void SurfaceFlinger::setUpHWComposer() {
         status_t result = displayDevice->prepareFrame(*mHwc);
         ALOGE_IF(result != NO_ERROR, "prepareFrame for display %zd failed:"
                 " %d (%s)", displayId, result, strerror(-result));
+        if (result == NO_ERROR) {
+            learnCompositionTypes(displayDevice);
+        }
     }
 }
 
+void SurfaceFlinger::predictCompositionTypes(
+        const sp<const DisplayDevice>& hw) {
+    const auto hwcId = hw->getHwcDisplayId();
+    if (!mPlanePredictor.isEnabled() || hwcId < 0) {
+        return;
+    }
+    const Vector<sp<Layer>>& layers(hw->getVisibleLayersSortedByZ());
+    const size_t count = layers.size();
+    std::vector<HWC2::Composition>& types(mPredictedCompositionTypes);
+    types.resize(count);
+    uint64_t configuration = PlanePredictor::combineHash(0, count);
+    for (size_t i = 0; i < count; i++) {
+        const sp<Layer>& layer(layers[i]);
+        const sp<GraphicBuffer>& buffer(layer->getActiveBuffer());
+        types[i] = layer->getCompositionType(hwcId);
+        configuration = PlanePredictor::combineHash(configuration,
+                layer->getHwcGeometryHash(hwcId));
+        configuration = PlanePredictor::combineHash(configuration,
+                uint64_t(types[i]));
+        configuration = PlanePredictor::combineHash(configuration,
+                buffer != NULL ? uint64_t(buffer->getPixelFormat()) : 0);
+        configuration = PlanePredictor::combineHash(configuration,
+                uint64_t(layer->getDataSpace()));
+    }
+    if (mPlanePredictor.predict(hwcId, configuration, &types)) {
+        for (size_t i = 0; i < count; i++) {
+            layers[i]->setCompositionType(hwcId, types[i]);
+        }
+    }
+}
+
+void SurfaceFlinger::learnCompositionTypes(
+        const sp<const DisplayDevice>& hw) {
+    const auto hwcId = hw->getHwcDisplayId();
+    if (!mPlanePredictor.isEnabled() || hwcId < 0) {
+        return;
+    }
+    const Vector<sp<Layer>>& layers(hw->getVisibleLayersSortedByZ());
+    const size_t count = layers.size();
+    std::vector<HWC2::Composition>& types(mPredictedCompositionTypes);
+    types.resize(count);
+    for (size_t i = 0; i < count; i++) {
+        types[i] = layers[i]->getCompositionType(hwcId);
+    }
+    mPlanePredictor.onValidated(hwcId, types);
+}
+
 void SurfaceFlinger::doComposition() {
     ATRACE_CALL();
     ALOGV("doComposition");
 
     const bool repaintEverything = android_atomic_and(0, &mRepaintEverything);
-    for (size_t dpy=0 ; dpy<mDisplays.size() ; dpy++) {
-        const sp<DisplayDevice>& hw(mDisplays[dpy]);
-        if (hw->isDisplayOn()) {
-            // transform the dirty region into this screen's coordinate space
-            const Region dirtyRegion(hw->getDirtyRegion(repaintEverything));
+    const ssize_t primary = mPresentPrimaryFirst ? mDisplays.indexOfKey(
+            mBuiltinDisplays[DisplayDevice::DISPLAY_PRIMARY]) : -1;
+    if (primary < 0) {
+        for (size_t dpy=0 ; dpy<mDisplays.size() ; dpy++) {
+            composeDisplay(mDisplays.editValueAt(dpy), repaintEverything);
+        }
+        postFramebuffer();
+        return;
+    }
 
-            // repaint the framebuffer (if needed)
-            doDisplayComposition(hw, dirtyRegion);
+    // Compose and present the primary display before doing any work for the
+    // other displays, so that virtual displays (screen recording, casting)
+    // don't add their composition time to the primary display's latency.
+    const nsecs_t start = systemTime();
+    mDebugInSwapBuffers = start;
+    const sp<DisplayDevice>& primaryDevice(mDisplays.editValueAt(size_t(primary)));
+    composeDisplay(primaryDevice, repaintEverything);
+    presentDisplay(size_t(primary));
+    nsecs_t swapTime = systemTime() - start;
+    mDebugInSwapBuffers = 0;
 
-            ++mActiveFrameSequence;
+    if (mDisplays.size() > 1) {
+        for (size_t dpy=0 ; dpy<mDisplays.size() ; dpy++) {
+            if (dpy != size_t(primary)) {
+                composeDisplay(mDisplays.editValueAt(dpy), repaintEverything);
+            }
+        }
 
-            hw->dirtyRegion.clear();
-            hw->flip(hw->swapRegion);
-            hw->swapRegion.clear();
+        const nsecs_t now = systemTime();
+        mDebugInSwapBuffers = now;
+        // See presentDisplay(), the virtual displays can't deal with being
+        // current while the release fences are handed to the layers.
+        primaryDevice->makeCurrent(mEGLDisplay, mEGLContext);
+        for (size_t dpy=0 ; dpy<mDisplays.size() ; dpy++) {
+            if (dpy != size_t(primary)) {
+                presentDisplay(dpy);
+            }
         }
+        swapTime += systemTime() - now;
+        mDebugInSwapBuffers = 0;
+    }
+
+    mLastSwapBufferTime = swapTime;
+
+    uint32_t flipCount = primaryDevice->getPageFlipCount();
+    if (flipCount % LOG_FRAME_STATS_PERIOD == 0) {
+        logFrameStats();
+    }
+    ALOGV_IF(mFrameRateHelper.update(), "FPS: %d", mFrameRateHelper.get());
+}
+
+void SurfaceFlinger::composeDisplay(const sp<DisplayDevice>& hw,
+        bool repaintEverything) {
+    if (hw->isDisplayOn()) {
+        // transform the dirty region into this screen's coordinate space
+        const Region dirtyRegion(hw->getDirtyRegion(repaintEverything));
+
+        // repaint the framebuffer (if needed)
+        doDisplayComposition(hw, dirtyRegion);
+
+        ++mActiveFrameSequence;
+
+        hw->dirtyRegion.clear();
+        hw->flip(hw->swapRegion);
+        hw->swapRegion.clear();
     }
-    postFramebuffer();
 }
 
 void SurfaceFlinger::postFramebuffer()
@@ -1442,35 +1612,7 @@ void SurfaceFlinger::postFramebuffer()
     mDebugInSwapBuffers = now;
 
     for (size_t displayId = 0; displayId < mDisplays.size(); ++displayId) {
-        auto& displayDevice = mDisplays[displayId];
-        if (!displayDevice->isDisplayOn()) {
-            continue;
-        }
-        const auto hwcId = displayDevice->getHwcDisplayId();
-        if (hwcId >= 0) {
-            mHwc->commit(hwcId);
-        }
-        displayDevice->onSwapBuffersCompleted();
-        if (displayId == 0) {
-            // Make the default display current because the VirtualDisplayDevice
-            // code cannot deal with dequeueBuffer() being called outside of the
-            // composition loop; however the code below can call glFlush() which
-            // is allowed to (and does in some case) call dequeueBuffer().
-            displayDevice->makeCurrent(mEGLDisplay, mEGLContext);
-        }
-        for (auto& layer : displayDevice->getVisibleLayersSortedByZ()) {
-            sp<Fence> releaseFence = Fence::NO_FENCE;
-            if (layer->getCompositionType(hwcId) == HWC2::Composition::Client) {
-                releaseFence = displayDevice->getClientTargetAcquireFence();
-            } else {
-                auto hwcLayer = layer->getHwcLayer(hwcId);
-                releaseFence = mHwc->getLayerReleaseFence(hwcId, hwcLayer);
-            }
-            layer->onLayerDisplayed(releaseFence);
-        }
-        if (hwcId >= 0) {
-            mHwc->clearReleaseFences(hwcId);
-        }
+        presentDisplay(displayId);
     }
 
     mLastSwapBufferTime = systemTime() - now;
@@ -1483,6 +1625,43 @@ void SurfaceFlinger::postFramebuffer()
     ALOGV_IF(mFrameRateHelper.update(), "FPS: %d", mFrameRateHelper.get());
 }
 
+void SurfaceFlinger::presentDisplay(size_t displayId)
+{
+    ATRACE_CALL();
+
+    auto& displayDevice = mDisplays[displayId];
+    if (!displayDevice->isDisplayOn()) {
+        return;
+    }
+    const auto hwcId = displayDevice->getHwcDisplayId();
+    if (hwcId >= 0) {
+        mHwc->commit(hwcId);
+    }
+    displayDevice->onSwapBuffersCompleted();
+    if (displayDevice->getDisplayType() == DisplayDevice::DISPLAY_PRIMARY) {
+        // Make the default display current because the VirtualDisplayDevice
+        // code cannot deal with dequeueBuffer() being called outside of the
+        // composition loop; however the code below can call glFlush() which
+        // is allowed to (and does in some case) call dequeueBuffer().
+        // doComposition() makes it current itself before presenting the
+        // other displays when the primary display is presented first.
+        displayDevice->makeCurrent(mEGLDisplay, mEGLContext);
+    }
+    for (auto& layer : displayDevice->getVisibleLayersSortedByZ()) {
+        sp<Fence> releaseFence = Fence::NO_FENCE;
+        if (layer->getCompositionType(hwcId) == HWC2::Composition::Client) {
+            releaseFence = displayDevice->getClientTargetAcquireFence();
+        } else {
+            auto hwcLayer = layer->getHwcLayer(hwcId);
+            releaseFence = mHwc->getLayerReleaseFence(hwcId, hwcLayer);
+        }
+        layer->onLayerDisplayed(releaseFence);
+    }
+    if (hwcId >= 0) {
+        mHwc->clearReleaseFences(hwcId);
+    }
+}
+
 void SurfaceFlinger::handleTransaction(uint32_t transactionFlags)
 {
     ATRACE_CALL();
@@ -1492,6 +1671,8 @@ void SurfaceFlinger::handleTransaction(uint32_t transactionFlags)
     // mStateLock so that the side-effects of the State assignment
     // don't happen with mStateLock held (which can cause deadlocks).
     State drawingState(mDrawingState);
+    // same for the transactions applied from the queue
+    std::vector<QueuedTransaction> appliedTransactions;
 
     Mutex::Autolock _l(mStateLock);
     const nsecs_t now = systemTime();
@@ -1501,9 +1682,12 @@ void SurfaceFlinger::handleTransaction(uint32_t transactionFlags)
     // so we can call handleTransactionLocked() unconditionally.
     // We call getTransactionFlags(), which will also clear the flags,
     // with mStateLock held to guarantee that mCurrentState won't change
-    // until the transaction is committed.
+    // until the transaction is committed. The queued transactions are
+    // applied after the flags are cleared, so that a transaction queued
+    // past this point triggers another one.
 
     transactionFlags = getTransactionFlags(eTransactionMask);
+    transactionFlags |= applyQueuedTransactionsLocked(&appliedTransactions);
     handleTransactionLocked(transactionFlags);
 
     mLastTransactionTime = systemTime() - now;
@@ -1569,8 +1753,11 @@ void SurfaceFlinger::handleTransactionLocked(uint32_t transactionFlags)
                         const sp<const DisplayDevice> defaultDisplay(getDefaultDisplayDevice());
                         defaultDisplay->makeCurrent(mEGLDisplay, mEGLContext);
                         sp<DisplayDevice> hw(getDisplayDevice(draw.keyAt(i)));
-                        if (hw != NULL)
+                        if (hw != NULL) {
+                            dropClientCompositionCache(hw->getHwcDisplayId());
+                            mPlanePredictor.removeDisplay(hw->getHwcDisplayId());
                             hw->disconnect(getHwComposer());
+                        }
                         if (draw[i].type < DisplayDevice::NUM_BUILTIN_DISPLAY_TYPES)
                             mEventThread->onHotplugReceived(draw[i].type, false);
                         mDisplays.removeItem(draw.keyAt(i));
@@ -1589,8 +1776,11 @@ void SurfaceFlinger::handleTransactionLocked(uint32_t transactionFlags)
                         // from the drawing state, so that it get re-added
                         // below.
                         sp<DisplayDevice> hw(getDisplayDevice(display));
-                        if (hw != NULL)
+                        if (hw != NULL) {
+                            dropClientCompositionCache(hw->getHwcDisplayId());
+                            mPlanePredictor.removeDisplay(hw->getHwcDisplayId());
                             hw->disconnect(getHwComposer());
+                        }
                         mDisplays.removeItem(display);
                         mDrawingState.displays.removeItemsAt(i);
                         dc--; i--;
@@ -1863,6 +2053,16 @@ void SurfaceFlinger::computeVisibleRegions(size_t /* dpy */,
         if (s.layerStack != layerStack)
             continue;
 
+        if (mIncrementalVisibleRegions &&
+                layer->reuseVisibleRegions(layerStack, aboveOpaqueLayers,
+                        aboveCoveredLayers, outDirtyRegion)) {
+            mVisibleRegionLayersReused++;
+            continue;
+        }
+        mVisibleRegionLayersComputed++;
+        const Region aboveOpaqueBefore(aboveOpaqueLayers);
+        const Region aboveCoveredBefore(aboveCoveredLayers);
+
         /*
          * opaqueRegion: area of a surface that is fully opaque.
          */
@@ -1970,6 +2170,11 @@ void SurfaceFlinger::computeVisibleRegions(size_t /* dpy */,
         layer->setCoveredRegion(coveredRegion);
         layer->setVisibleNonTransparentRegion(
                 visibleRegion.subtract(transparentRegion));
+
+        if (mIncrementalVisibleRegions) {
+            layer->cacheVisibleRegions(layerStack, aboveOpaqueBefore,
+                    aboveCoveredBefore, aboveOpaqueLayers, aboveCoveredLayers);
+        }
     }
 
     outOpaqueRegion = aboveOpaqueLayers;
@@ -2004,6 +2209,11 @@ bool SurfaceFlinger::handlePageFlip()
     // 3.) Layer 1 is latched.
     // Display is now waiting on Layer 1's frame, which is behind layer 0's
     // second frame. But layer 0's second frame could be waiting on display.
+    // Layers may still be in the set from an invalidate whose refresh hasn't
+    // run yet. Only the ones added from here on are latched when unchanged
+    // frames are skipped, as those may be dropped from the set below.
+    const size_t firstLatched = mSkipUnchangedFrames ?
+            mLayersWithQueuedFrames.size() : 0;
     for (size_t i = 0, count = layers.size(); i<count ; i++) {
         const sp<Layer>& layer(layers[i]);
         if (layer->hasQueuedFrame()) {
@@ -2017,24 +2227,44 @@ bool SurfaceFlinger::handlePageFlip()
             layer->useEmptyDamage();
         }
     }
-    for (auto& layer : mLayersWithQueuedFrames) {
+    // A queued frame doesn't necessarily change the screen: the buffer may be
+    // rejected, or held back by a sync point or its fence
+    bool contentChanged = false;
+    for (size_t i = firstLatched; i < mLayersWithQueuedFrames.size(); i++) {
+        const sp<Layer>& layer(mLayersWithQueuedFrames[i]);
+        const uint64_t contentGeneration = layer->getContentGeneration();
         const Region dirty(layer->latchBuffer(visibleRegions));
         layer->useSurfaceDamage();
         const Layer::State& s(layer->getDrawingState());
         invalidateLayerStack(s.layerStack, dirty);
+        contentChanged = contentChanged || !dirty.isEmpty() ||
+                layer->getContentGeneration() != contentGeneration;
     }
+    contentChanged = contentChanged || visibleRegions;
 
     mVisibleRegionsDirty |= visibleRegions;
 
     // If we will need to wake up at some time in the future to deal with a
     // queued frame that shouldn't be displayed during this vsync period, wake
     // up during the next vsync period to check again.
-    if (frameQueued && mLayersWithQueuedFrames.empty()) {
+    if (frameQueued && mLayersWithQueuedFrames.size() == firstLatched) {
         signalLayerUpdate();
     }
 
+    if (!mSkipUnchangedFrames) {
+        mLatchedUnchangedFrames = false;
+        return !mLayersWithQueuedFrames.empty();
+    }
+    mLatchedUnchangedFrames =
+            mLayersWithQueuedFrames.size() > firstLatched && !contentChanged;
+    if (mLatchedUnchangedFrames) {
+        // Nothing was latched, so the layers have no buffer to release: drop
+        // them rather than let them pile up until the next refresh
+        mLayersWithQueuedFrames.resize(firstLatched);
+    }
+
     // Only continue with the refresh if there is actually new work to do
-    return !mLayersWithQueuedFrames.empty();
+    return contentChanged;
 }
 
 void SurfaceFlinger::invalidateHwcGeometry()
@@ -2100,13 +2330,15 @@ bool SurfaceFlinger::doComposeSurfaces(
     const auto hwcId = displayDevice->getHwcDisplayId();
 
     mat4 oldColorMatrix;
-    const bool applyColorMatrix = !mHwc->hasDeviceComposition(hwcId) &&
+    const bool applyColorMatrix = !mColorPipeline.isIdentity() &&
+            !mHwc->hasDeviceComposition(hwcId) &&
             !mHwc->hasCapability(HWC2::Capability::SkipClientColorTransform);
     if (applyColorMatrix) {
-        mat4 colorMatrix = mColorMatrix * mDaltonizer();
-        oldColorMatrix = getRenderEngine().setupColorTransform(colorMatrix);
+        oldColorMatrix = getRenderEngine().setupColorTransform(
+                mColorPipeline.getColorTransform());
     }
 
+    ClientCompositionCache::Result cacheResult = ClientCompositionCache::MISS;
     bool hasClientComposition = mHwc->hasClientComposition(hwcId);
     if (hasClientComposition) {
         ALOGV("hasClientComposition");
@@ -2131,6 +2363,7 @@ bool SurfaceFlinger::doComposeSurfaces(
             // GPUs doing a "clean slate" clear might be more efficient.
             // We'll revisit later if needed.
             mRenderEngine->clearWithColor(0, 0, 0, 0);
+            cacheResult = lookupClientCompositionCache(displayDevice, dirty);
         } else {
             // we start with the whole screen area
             const Region bounds(displayDevice->getBounds());
@@ -2151,6 +2384,8 @@ bool SurfaceFlinger::doComposeSurfaces(
                 // can happen with SurfaceView
                 drawWormhole(displayDevice, region);
             }
+            // all the layers are drawn, there is nothing to cache
+            dropClientCompositionCache(hwcId);
         }
 
         if (displayDevice->getDisplayType() != DisplayDevice::DISPLAY_PRIMARY) {
@@ -2170,6 +2405,8 @@ bool SurfaceFlinger::doComposeSurfaces(
                         scissor.getWidth(), scissor.getHeight());
             }
         }
+    } else {
+        dropClientCompositionCache(hwcId);
     }
 
     /*
@@ -2177,8 +2414,15 @@ bool SurfaceFlinger::doComposeSurfaces(
      */
 
     ALOGV("Rendering client layers");
+    mRenderEngine->setBatching(mBatchComposition);
     const Transform& displayTransform = displayDevice->getTransform();
-    if (hwcId >= 0) {
+    if (cacheResult == ClientCompositionCache::HIT) {
+        // the client layers didn't change since the snapshot was taken
+        ALOGV("Drawing client layers from the cache");
+        const ClientCompositionCache& cache(mClientCompositionCaches[hwcId]);
+        mRenderEngine->drawFramebufferTexture(cache.texName,
+                cache.region, cache.height);
+    } else if (hwcId >= 0) {
         // we're using h/w composer
         bool firstLayer = true;
         for (auto& layer : displayDevice->getVisibleLayersSortedByZ()) {
@@ -2224,6 +2468,13 @@ bool SurfaceFlinger::doComposeSurfaces(
             }
         }
     }
+    mRenderEngine->setBatching(false);
+
+    if (cacheResult == ClientCompositionCache::CAPTURE) {
+        const ClientCompositionCache& cache(mClientCompositionCaches[hwcId]);
+        mRenderEngine->copyFramebufferToTexture(cache.texName,
+                cache.region.getBounds(), cache.height);
+    }
 
     if (applyColorMatrix) {
         getRenderEngine().setupColorTransform(oldColorMatrix);
@@ -2234,6 +2485,124 @@ bool SurfaceFlinger::doComposeSurfaces(
     return true;
 }
 
+static size_t getRegionArea(const Region& region) {
+    size_t area = 0;
+    for (const Rect& rect : region) {
+        area += size_t(rect.getWidth()) * size_t(rect.getHeight());
+    }
+    return area;
+}
+
+SurfaceFlinger::ClientCompositionCache::Result
+SurfaceFlinger::lookupClientCompositionCache(
+        const sp<const DisplayDevice>& hw, const Region& dirty)
+{
+    const auto hwcId = hw->getHwcDisplayId();
+    // a display which only redraws its dirty region never redraws all the
+    // framebuffer the snapshot is taken from
+    if (!mCacheClientComposition || (hw->getFlags() &
+            (DisplayDevice::SWAP_RECTANGLE | DisplayDevice::PARTIAL_UPDATES))) {
+        dropClientCompositionCache(hwcId);
+        return ClientCompositionCache::MISS;
+    }
+
+    ClientCompositionCache& cache(mClientCompositionCaches[hwcId]);
+
+    // the framebuffer was cleared, the snapshot is only complete if all of
+    // it is redrawn
+    const Rect bounds(hw->getBounds());
+    bool cacheable = dirty.isRect() && dirty.getBounds() == bounds;
+
+    // area covered by the client layers, which is what a hit draws, and
+    // number of pixels drawn by the client composition it replaces
+    const Transform& tr(hw->getTransform());
+    Region region;
+    size_t replacedArea = 0;
+
+    std::vector<ClientCompositionCache::Entry> layers;
+    layers.reserve(hw->getVisibleLayersSortedByZ().size());
+    bool firstLayer = true;
+    for (auto& layer : hw->getVisibleLayersSortedByZ()) {
+        const HWC2::Composition type = layer->getCompositionType(hwcId);
+        const Layer::State& state(layer->getDrawingState());
+        ClientCompositionCache::Entry entry;
+        entry.sequence = layer->getSequence();
+        entry.compositionType = static_cast<int32_t>(type);
+        entry.clearsClientTarget = layer->getClearClientTarget(hwcId) &&
+                !firstLayer && layer->isOpaque(state) && state.alpha == 1.0f;
+        if (type == HWC2::Composition::Client) {
+            // a blur layer samples what is below it
+            cacheable = cacheable && !layer->isBlurLayer();
+            entry.generation = layer->getContentGeneration();
+        } else {
+            entry.generation = layer->getGeometryGeneration();
+        }
+        if (type == HWC2::Composition::Client || entry.clearsClientTarget) {
+            const Region clip(tr.transform(
+                    layer->visibleRegion).intersect(bounds));
+            replacedArea += getRegionArea(clip);
+            if (type == HWC2::Composition::Client) {
+                region.orSelf(clip);
+            }
+        }
+        layers.push_back(entry);
+        firstLayer = false;
+    }
+
+    // the snapshot only pays off where the client layers overlap, it
+    // would draw as many pixels as the layers themselves otherwise
+    cacheable = cacheable && !region.isEmpty() &&
+            getRegionArea(region) < replacedArea;
+
+    const bool unchanged = cacheable && layers == cache.layers &&
+            tr[0] == cache.transform[0] && tr[1] == cache.transform[1] &&
+            tr[2] == cache.transform[2] &&
+            uint32_t(hw->getWidth()) == cache.width &&
+            uint32_t(hw->getHeight()) == cache.height;
+
+    cache.layers.swap(layers);
+    cache.transform = tr;
+    cache.width = uint32_t(hw->getWidth());
+    cache.height = uint32_t(hw->getHeight());
+    cache.region = region;
+
+    if (!unchanged) {
+        // don't hold on to a full screen texture which may not be drawn
+        // again, it is allocated again once the layers settle
+        if (cache.texName != 0) {
+            getRenderEngine().deleteTextures(1, &cache.texName);
+            cache.texName = 0;
+        }
+        cache.valid = false;
+        mClientCompositionCacheMisses++;
+        return ClientCompositionCache::MISS;
+    }
+    if (cache.valid) {
+        mClientCompositionCacheHits++;
+        return ClientCompositionCache::HIT;
+    }
+
+    // second frame in a row with the same layers: keep a copy of this one
+    if (cache.texName == 0) {
+        getRenderEngine().genTextures(1, &cache.texName);
+    }
+    cache.valid = true;
+    mClientCompositionCacheCaptures++;
+    return ClientCompositionCache::CAPTURE;
+}
+
+void SurfaceFlinger::dropClientCompositionCache(int32_t hwcId)
+{
+    auto cache = mClientCompositionCaches.find(hwcId);
+    if (cache == mClientCompositionCaches.end()) {
+        return;
+    }
+    if (cache->second.texName != 0) {
+        getRenderEngine().deleteTextures(1, &cache->second.texName);
+    }
+    mClientCompositionCaches.erase(cache);
+}
+
 void SurfaceFlinger::drawWormhole(const sp<const DisplayDevice>& hw, const Region& region) const {
     const int32_t height = hw->getHeight();
     RenderEngine& engine(getRenderEngine());
@@ -2295,13 +2664,53 @@ uint32_t SurfaceFlinger::setTransactionFlags(uint32_t flags) {
     return old;
 }
 
+// Past this many queued transactions (the main thread is stalled, or a
+// client floods us), transactions are applied directly again.
+static const size_t MAX_QUEUED_TRANSACTIONS = 64;
+
+// Here we need to check that the interface we're given is indeed one of our
+// own. A malicious client could give us a NULL IInterface, or one of its own
+// or even one of our own but a different type. All these situations would
+// cause us to crash.
+//
+// NOTE: it would be better to use RTTI as we could directly check that we
+// have a Client*. however, RTTI is disabled in Android.
+static sp<Client> getClient(const ComposerState& s) {
+    if (s.client != NULL) {
+        sp<IBinder> binder = IInterface::asBinder(s.client);
+        if (binder != NULL) {
+            String16 desc(binder->getInterfaceDescriptor());
+            if (desc == ISurfaceComposerClient::descriptor) {
+                return static_cast<Client *>(s.client.get());
+            }
+        }
+    }
+    return NULL;
+}
+
 void SurfaceFlinger::setTransactionState(
         const Vector<ComposerState>& state,
         const Vector<DisplayState>& displays,
         uint32_t flags)
 {
     ATRACE_CALL();
+
+    // Asynchronous transactions that only change layers don't need to wait
+    // for anything, queue them for the main thread rather than contending
+    // with it and the other clients for mStateLock.
+    if (mQueueTransactions && displays.isEmpty() &&
+            !(flags & (eSynchronous | eAnimation))) {
+        if (queueTransaction(state)) {
+            return;
+        }
+    }
+
+    // destroyed after mStateLock is released, see
+    // applyQueuedTransactionsLocked()
+    std::vector<QueuedTransaction> appliedTransactions;
+    const nsecs_t lockStart = systemTime();
     Mutex::Autolock _l(mStateLock);
+    mTransactionLockWait.record(systemTime() - lockStart);
     uint32_t transactionFlags = 0;
 
     if (flags & eAnimation) {
@@ -2320,6 +2729,10 @@ void SurfaceFlinger::setTransactionState(
         }
     }
 
+    // The transactions queued before this one are applied first, which
+    // keeps the transactions of each client in order.
+    transactionFlags |= applyQueuedTransactionsLocked(&appliedTransactions);
+
     size_t count = displays.size();
     for (size_t i=0 ; i<count ; i++) {
         const DisplayState& s(displays[i]);
@@ -2329,22 +2742,9 @@ void SurfaceFlinger::setTransactionState(
     count = state.size();
     for (size_t i=0 ; i<count ; i++) {
         const ComposerState& s(state[i]);
-        // Here we need to check that the interface we're given is indeed
-        // one of our own. A malicious client could give us a NULL
-        // IInterface, or one of its own or even one of our own but a
-        // different type. All these situations would cause us to crash.
-        //
-        // NOTE: it would be better to use RTTI as we could directly check
-        // that we have a Client*. however, RTTI is disabled in Android.
-        if (s.client != NULL) {
-            sp<IBinder> binder = IInterface::asBinder(s.client);
-            if (binder != NULL) {
-                String16 desc(binder->getInterfaceDescriptor());
-                if (desc == ISurfaceComposerClient::descriptor) {
-                    sp<Client> client( static_cast<Client *>(s.client.get()) );
-                    transactionFlags |= setClientStateLocked(client, s.state);
-                }
-            }
+        sp<Client> client(getClient(s));
+        if (client != NULL) {
+            transactionFlags |= setClientStateLocked(client, s.state);
         }
     }
 
@@ -2367,6 +2767,8 @@ void SurfaceFlinger::setTransactionState(
         if (flags & eAnimation) {
             mAnimTransactionPending = true;
         }
+        const bool waitForCommit = mTransactionPending;
+        const nsecs_t commitStart = systemTime();
         while (mTransactionPending) {
             status_t err = mTransactionCV.waitRelative(mStateLock, s2ns(5));
             if (CC_UNLIKELY(err != NO_ERROR)) {
@@ -2377,7 +2779,62 @@ void SurfaceFlinger::setTransactionState(
                 break;
             }
         }
+        if (waitForCommit) {
+            mTransactionCommitWait.record(systemTime() - commitStart);
+        }
+    }
+}
+
+bool SurfaceFlinger::queueTransaction(const Vector<ComposerState>& state)
+{
+    QueuedTransaction transaction;
+    transaction.queueTime = systemTime();
+    transaction.states.reserve(state.size());
+    for (size_t i=0 ; i<state.size() ; i++) {
+        const ComposerState& s(state[i]);
+        sp<Client> client(getClient(s));
+        if (client != NULL) {
+            transaction.states.push_back({client, s.state});
+        }
+    }
+    if (transaction.states.empty()) {
+        return true;
+    }
+
+    {
+        Mutex::Autolock _l(mTransactionQueueLock);
+        if (mTransactionQueue.size() >= MAX_QUEUED_TRANSACTIONS) {
+            return false;
+        }
+        mTransactionQueue.push_back(std::move(transaction));
     }
+    // Set after the transaction is queued so that handleTransaction() either
+    // applies it or runs again.
+    setTransactionFlags(eTransactionNeeded);
+    return true;
+}
+
+uint32_t SurfaceFlinger::applyQueuedTransactionsLocked(
+        std::vector<QueuedTransaction>* outApplied)
+{
+    {
+        Mutex::Autolock _l(mTransactionQueueLock);
+        if (mTransactionQueue.empty()) {
+            return 0;
+        }
+        outApplied->swap(mTransactionQueue);
+    }
+
+    ATRACE_INT("TransactionQueue", static_cast<int32_t>(outApplied->size()));
+    uint32_t transactionFlags = 0;
+    const nsecs_t now = systemTime();
+    for (const auto& transaction : *outApplied) {
+        for (const auto& s : transaction.states) {
+            transactionFlags |= setClientStateLocked(s.client, s.state);
+        }
+        mTransactionQueueLatency.record(now - transaction.queueTime);
+    }
+    return transactionFlags;
 }
 
 uint32_t SurfaceFlinger::setDisplayStateLocked(const DisplayState& s)
@@ -2836,6 +3293,20 @@ status_t SurfaceFlinger::dump(int fd, const Vector<String16>& args)
                 dumpAll = false;
             }
 
+            if ((index < numArgs) &&
+                    (args[index] == String16("--timestats"))) {
+                index++;
+                dumpTimeStatsLocked(args, index, result);
+                dumpAll = false;
+            }
+
+            if ((index < numArgs) &&
+                    (args[index] == String16("--timestats-clear"))) {
+                index++;
+                clearTimeStatsLocked(args, index, result);
+                dumpAll = false;
+            }
+
             if ((index < numArgs) &&
                     (args[index] == String16("--dispsync"))) {
                 index++;
@@ -2890,6 +3361,8 @@ void SurfaceFlinger::dumpStatsLocked(const Vector<String16>& args, size_t& index
         index++;
     }
 
+    mFenceTimeline.updateSignalTimes();
+
     const auto& activeConfig = mHwc->getActiveConfig(HWC_DISPLAY_PRIMARY);
     const nsecs_t period = activeConfig->getVsyncPeriod();
     result.appendFormat("%" PRId64 "\n", period);
@@ -2929,6 +3402,54 @@ void SurfaceFlinger::clearStatsLocked(const Vector<String16>& args, size_t& inde
     mAnimFrameTracker.clearStats();
 }
 
+void SurfaceFlinger::dumpTimeStatsLocked(const Vector<String16>& args,
+        size_t& index, String8& result) const
+{
+    String8 name;
+    if (index < args.size()) {
+        name = String8(args[index]);
+        index++;
+    }
+
+    mFenceTimeline.updateSignalTimes();
+
+    const LayerVector& currentLayers = mCurrentState.layersSortedByZ;
+    const size_t count = currentLayers.size();
+    for (size_t i=0 ; i<count ; i++) {
+        const sp<Layer>& layer(currentLayers[i]);
+        if (name.isEmpty() || (name == layer->getName())) {
+            layer->dumpTimeStats(result);
+        }
+    }
+
+    if (name.isEmpty()) {
+        mAnimFrameTracker.dumpTimeStats(String8("<win-anim>"), result);
+    }
+}
+
+void SurfaceFlinger::clearTimeStatsLocked(const Vector<String16>& args,
+        size_t& index, String8& /* result */)
+{
+    String8 name;
+    if (index < args.size()) {
+        name = String8(args[index]);
+        index++;
+    }
+
+    const LayerVector& currentLayers = mCurrentState.layersSortedByZ;
+    const size_t count = currentLayers.size();
+    for (size_t i=0 ; i<count ; i++) {
+        const sp<Layer>& layer(currentLayers[i]);
+        if (name.isEmpty() || (name == layer->getName())) {
+            layer->clearTimeStats();
+        }
+    }
+
+    if (name.isEmpty()) {
+        mAnimFrameTracker.clearTimeStats();
+    }
+}
+
 // This should only be called from the main thread.  Otherwise it would need
 // the lock and should use mCurrentState rather than mDrawingState.
 void SurfaceFlinger::logFrameStats() {
@@ -2974,6 +3495,49 @@ void SurfaceFlinger::dumpStaticScreenStats(String8& result) const
             static_cast<float>(mFrameBuckets[NUM_BUCKETS - 1]) / mTotalTime;
     result.appendFormat("  %zd+ frames: %.3f s (%.1f%%)\n",
             NUM_BUCKETS - 1, bucketTimeSec, percent);
+    result.appendFormat("  unchanged frames skipped (%s): %" PRIu64 "\n",
+            mSkipUnchangedFrames ? "on" : "off", mUnchangedFramesSkipped);
+}
+
+void SurfaceFlinger::dumpRegionAllocationStats(String8& result) const
+{
+    // The counter is process-wide, so binder threads working on regions
+    // during a refresh are accounted to that frame as well.
+    const double average = mRegionAllocationFrames == 0 ? 0.0 :
+            double(mTotalRegionAllocations) / mRegionAllocationFrames;
+    result.appendFormat("Region allocations: %u last frame, %.1f per frame "
+            "over %" PRIu64 " frames\n", mLastFrameRegionAllocations, average,
+            mRegionAllocationFrames);
+}
+
+void SurfaceFlinger::dumpClientCompositionCacheStats(String8& result) const
+{
+    result.appendFormat("Client composition cache (%s): %" PRIu64 " hits, "
+            "%" PRIu64 " captures, %" PRIu64 " misses\n",
+            mCacheClientComposition ? "on" : "off",
+            mClientCompositionCacheHits, mClientCompositionCacheCaptures,
+            mClientCompositionCacheMisses);
+}
+
+void SurfaceFlinger::dumpTransactionQueueStats(String8& result) const
+{
+    size_t queued;
+    {
+        Mutex::Autolock _l(mTransactionQueueLock);
+        queued = mTransactionQueue.size();
+    }
+    auto dumpWaitStats = [&result](const char* name,
+            const TransactionWaitStats& s) {
+        result.appendFormat("  %-15s: %" PRIu64 " transactions, "
+                "avg %.3f ms, max %.3f ms\n", name, s.count,
+                s.count ? ns2us(s.total / nsecs_t(s.count)) / 1000.0 : 0.0,
+                ns2us(s.max) / 1000.0);
+    };
+    result.appendFormat("Transaction queue (%s): %zu pending\n",
+            mQueueTransactions ? "on" : "off", queued);
+    dumpWaitStats("state lock wait", mTransactionLockWait);
+    dumpWaitStats("commit wait", mTransactionCommitWait);
+    dumpWaitStats("queue latency", mTransactionQueueLatency);
 }
 
 void SurfaceFlinger::recordBufferingStats(const char* layerName,
@@ -3082,6 +3646,20 @@ void SurfaceFlinger::dumpAllLocked(const Vector<String16>& args, size_t& index,
     dumpStaticScreenStats(result);
     result.append("\n");
 
+    dumpRegionAllocationStats(result);
+    dumpClientCompositionCacheStats(result);
+    dumpTransactionQueueStats(result);
+    result.appendFormat("Visible regions: %zu layers recomputed, %zu reused "
+            "in the last pass (incremental %s)\n",
+            mVisibleRegionLayersComputed, mVisibleRegionLayersReused,
+            mIncrementalVisibleRegions ? "on" : "off");
+    result.appendFormat("Screenshots: %zu layers drawn in the last capture "
+            "(culling %s)\n", mScreenshotLayersDrawn,
+            mCullScreenshotLayers ? "on" : "off");
+    mColorPipeline.dump(result);
+    mPlanePredictor.dump(result);
+    result.append("\n");
+
     dumpBufferingStats(result);
 
     /*
@@ -3340,25 +3918,24 @@ status_t SurfaceFlinger::onTransact(
             case 1014: {
                 // daltonize
                 n = data.readInt32();
+                ColorBlindnessType type;
                 switch (n % 10) {
                     case 1:
-                        mDaltonizer.setType(ColorBlindnessType::Protanomaly);
+                        type = ColorBlindnessType::Protanomaly;
                         break;
                     case 2:
-                        mDaltonizer.setType(ColorBlindnessType::Deuteranomaly);
+                        type = ColorBlindnessType::Deuteranomaly;
                         break;
                     case 3:
-                        mDaltonizer.setType(ColorBlindnessType::Tritanomaly);
+                        type = ColorBlindnessType::Tritanomaly;
                         break;
                     default:
-                        mDaltonizer.setType(ColorBlindnessType::None);
+                        type = ColorBlindnessType::None;
                         break;
                 }
-                if (n >= 10) {
-                    mDaltonizer.setMode(ColorBlindnessMode::Correction);
-                } else {
-                    mDaltonizer.setMode(ColorBlindnessMode::Simulation);
-                }
+                mColorPipeline.setDaltonizer(type, n >= 10 ?
+                        ColorBlindnessMode::Correction :
+                        ColorBlindnessMode::Simulation);
                 invalidateHwcGeometry();
                 repaintEverything();
                 return NO_ERROR;
@@ -3366,18 +3943,18 @@ status_t SurfaceFlinger::onTransact(
             case 1015: {
                 // apply a color matrix
                 n = data.readInt32();
+                mat4 matrix;
                 if (n) {
                     // color matrix is sent as mat3 matrix followed by vec3
                     // offset, then packed into a mat4 where the last row is
                     // the offset and extra values are 0
                     for (size_t i = 0 ; i < 4; i++) {
                         for (size_t j = 0; j < 4; j++) {
-                            mColorMatrix[i][j] = data.readFloat();
+                            matrix[i][j] = data.readFloat();
                         }
                     }
-                } else {
-                    mColorMatrix = mat4();
                 }
+                mColorPipeline.setColorMatrix(matrix);
                 invalidateHwcGeometry();
                 repaintEverything();
                 return NO_ERROR;
@@ -3409,6 +3986,35 @@ status_t SurfaceFlinger::onTransact(
                 mUseHwcVirtualDisplays = !n;
                 return NO_ERROR;
             }
+            case 1022: {
+                // set the global saturation, 1 leaves the colors unchanged
+                float saturation = data.readFloat();
+                mColorPipeline.setSaturation(
+                        std::max(0.0f, std::min(saturation, 2.0f)));
+                invalidateHwcGeometry();
+                repaintEverything();
+                return NO_ERROR;
+            }
+            case 1030: {
+                // apply a secondary color matrix
+                // this will be combined with any other transformations
+                n = data.readInt32();
+                mat4 matrix;
+                if (n) {
+                    // color matrix is sent as mat3 matrix followed by vec3
+                    // offset, then packed into a mat4 where the last row is
+                    // the offset and extra values are 0
+                    for (size_t i = 0 ; i < 4; i++) {
+                        for (size_t j = 0; j < 4; j++) {
+                            matrix[i][j] = data.readFloat();
+                        }
+                    }
+                }
+                mColorPipeline.setSecondaryColorMatrix(matrix);
+                invalidateHwcGeometry();
+                repaintEverything();
+                return NO_ERROR;
+            }
         }
     }
     return err;
@@ -3642,6 +4248,46 @@ status_t SurfaceFlinger::captureScreen(const sp<IBinder>& display,
 }
 
 
+// Computes whether the layer appears in sourceCrop when rendered by
+// renderScreenImplLocked(), and whether it covers all of it with opaque
+// pixels. The bounds follow Layer::computeGeometry(); they are conservative
+// for the former, exact for the latter.
+static void getScreenshotCoverage(const sp<const DisplayDevice>& hw,
+        const sp<Layer>& layer, const Rect& sourceCrop,
+        bool useIdentityTransform, bool* outIntersects, bool* outCovers)
+{
+    const Layer::State& s(layer->getDrawingState());
+    const Transform& hwTransform(hw->getTransform());
+    Rect bounds(layer->computeBounds());
+    bool exact = s.activeTransparentRegion.isEmpty() &&
+            hwTransform.preserveRects();
+#ifdef QTI_BSP
+    // computeGeometry() also clips the window to the display viewport, going
+    // through the layer transform and back, which is only exact for a
+    // translation
+    Rect clipped;
+    s.active.transform.transform(bounds).intersect(hw->getViewport(),
+            &clipped);
+    bounds = s.active.transform.inverse().transform(clipped);
+    bounds.intersect(Rect(s.active.w, s.active.h), &bounds);
+    exact = exact && s.active.transform.getType() <= Transform::TRANSLATE;
+#endif
+    if (!useIdentityTransform) {
+        exact = exact && s.active.transform.preserveRects();
+        bounds = s.active.transform.transform(bounds);
+    }
+    // the final crop applies even with the identity transform
+    if (!s.finalCrop.isEmpty()) {
+        bounds.intersect(s.finalCrop, &bounds);
+    }
+    bounds = hwTransform.transform(bounds);
+
+    Rect visible;
+    *outIntersects = bounds.intersect(sourceCrop, &visible);
+    *outCovers = *outIntersects && exact && layer->isOpaque(s) &&
+            s.alpha >= 1.0f && visible == sourceCrop;
+}
+
 void SurfaceFlinger::renderScreenImplLocked(
         const sp<const DisplayDevice>& hw,
         Rect sourceCrop, uint32_t reqWidth, uint32_t reqHeight,
@@ -3678,6 +4324,38 @@ void SurfaceFlinger::renderScreenImplLocked(
         ALOGE("Invalid crop rect: b = %d (> %d)", sourceCrop.bottom, hw_h);
     }
 
+    const bool cullLayers = mCullScreenshotLayers;
+    // Layers outside of the source crop, and the ones below an opaque layer
+    // covering all of it, can't be seen: skip them, which matters for the
+    // small captures of a region or a single window (e.g. thumbnails).
+    const LayerVector& layers( mDrawingState.layersSortedByZ );
+    const size_t count = layers.size();
+    std::vector<bool> drawLayer(count, false);
+    size_t layersDrawn = 0;
+    for (size_t i=count ; i>0 ; --i) {
+        const sp<Layer>& layer(layers[i-1]);
+        const Layer::State& state(layer->getDrawingState());
+        if (state.layerStack != hw->getLayerStack() ||
+                state.z < minLayerZ || state.z > maxLayerZ ||
+                !layer->isVisible()) {
+            continue;
+        }
+        bool intersects = true;
+        bool covers = false;
+        if (cullLayers) {
+            getScreenshotCoverage(hw, layer, sourceCrop,
+                    useIdentityTransform, &intersects, &covers);
+        }
+        if (intersects) {
+            drawLayer[i-1] = true;
+            layersDrawn++;
+        }
+        if (covers) {
+            break;
+        }
+    }
+    mScreenshotLayersDrawn = layersDrawn;
+
     // make sure to clear all GL error flags
     engine.checkErrors();
 
@@ -3689,19 +4367,12 @@ void SurfaceFlinger::renderScreenImplLocked(
     // redraw the screen entirely...
     engine.clearWithColor(0, 0, 0, 1);
 
-    const LayerVector& layers( mDrawingState.layersSortedByZ );
-    const size_t count = layers.size();
     for (size_t i=0 ; i<count ; ++i) {
-        const sp<Layer>& layer(layers[i]);
-        const Layer::State& state(layer->getDrawingState());
-        if (state.layerStack == hw->getLayerStack()) {
-            if (state.z >= minLayerZ && state.z <= maxLayerZ) {
-                if (layer->isVisible()) {
-                    if (filtering) layer->setFiltering(true);
-                    layer->draw(hw, useIdentityTransform);
-                    if (filtering) layer->setFiltering(false);
-                }
-            }
+        if (drawLayer[i]) {
+            const sp<Layer>& layer(layers[i]);
+            if (filtering) layer->setFiltering(true);
+            layer->draw(hw, useIdentityTransform);
+            if (filtering) layer->setFiltering(false);
         }
     }
 
@@ -3709,6 +4380,46 @@ void SurfaceFlinger::renderScreenImplLocked(
 }
 
 
+// Whether a screenshot can be rendered directly in the format. Besides the
+// default RGBA_8888, RGBX_8888 and RGB_565 are used when the GPU can render
+// to them, which is checked once per format by binding a 1x1 buffer as the
+// framebuffer.
+bool SurfaceFlinger::isScreenshotFormat(int format) {
+    switch (format) {
+        case HAL_PIXEL_FORMAT_RGBA_8888:
+            return true;
+        case HAL_PIXEL_FORMAT_RGBX_8888:
+        case HAL_PIXEL_FORMAT_RGB_565:
+            break;
+        default:
+            return false;
+    }
+
+    auto known = mScreenshotFormats.find(format);
+    if (known != mScreenshotFormats.end()) {
+        return known->second;
+    }
+    bool renderable = false;
+    sp<GraphicBuffer> buffer = new GraphicBuffer(1, 1, format,
+            GRALLOC_USAGE_HW_RENDER | GRALLOC_USAGE_HW_TEXTURE);
+    if (buffer->initCheck() == NO_ERROR) {
+        EGLImageKHR image = eglCreateImageKHR(mEGLDisplay, EGL_NO_CONTEXT,
+                EGL_NATIVE_BUFFER_ANDROID, buffer->getNativeBuffer(), NULL);
+        if (image != EGL_NO_IMAGE_KHR) {
+            {
+                RenderEngine::BindImageAsFramebuffer imageBond(
+                        getRenderEngine(), image, false, 1, 1);
+                renderable = imageBond.getStatus() == NO_ERROR;
+            }
+            eglDestroyImageKHR(mEGLDisplay, image);
+        }
+    }
+    ALOGI_IF(!renderable, "screenshots can't be rendered in format %d, "
+            "using RGBA_8888", format);
+    mScreenshotFormats[format] = renderable;
+    return renderable;
+}
+
 status_t SurfaceFlinger::captureScreenImplLocked(
         const sp<const DisplayDevice>& hw,
         const sp<IGraphicBufferProducer>& producer,
@@ -3774,10 +4485,21 @@ status_t SurfaceFlinger::captureScreenImplLocked(
         uint32_t usage = GRALLOC_USAGE_SW_READ_OFTEN | GRALLOC_USAGE_SW_WRITE_OFTEN |
                         GRALLOC_USAGE_HW_RENDER | GRALLOC_USAGE_HW_TEXTURE;
 
+        // Render in the default format of the consumer if the GPU can, e.g.
+        // RGB_565 halves the bandwidth of a thumbnail. glReadPixels() only
+        // reads RGBA_8888.
+        int format = HAL_PIXEL_FORMAT_RGBA_8888;
+        int consumerFormat = 0;
+        if (!useReadPixels && window->query(window, NATIVE_WINDOW_FORMAT,
+                &consumerFormat) == NO_ERROR &&
+                isScreenshotFormat(consumerFormat)) {
+            format = consumerFormat;
+        }
+
         int err = 0;
         err = native_window_set_buffers_dimensions(window, reqWidth, reqHeight);
         err |= native_window_set_scaling_mode(window, NATIVE_WINDOW_SCALING_MODE_SCALE_TO_WINDOW);
-        err |= native_window_set_buffers_format(window, HAL_PIXEL_FORMAT_RGBA_8888);
+        err |= native_window_set_buffers_format(window, format);
         err |= native_window_set_usage(window, usage);
 
         if (err == NO_ERROR) {
@@ -53,17 +53,20 @@
 #include "Barrier.h"
 #include "DisplayDevice.h"
 #include "DispSync.h"
+#include "FenceTimeline.h"
 #include "FenceTracker.h"
 #include "FrameTracker.h"
 #include "MessageQueue.h"
+#include "PlanePredictor.h"
 
 #include "DisplayHardware/HWComposer.h"
-#include "Effects/Daltonizer.h"
+#include "Effects/ColorPipeline.h"
 
 #include "FrameRateHelper.h"
 
 #include <map>
 #include <string>
+#include <vector>
 
 namespace android {
 
@@ -335,7 +338,9 @@ private:
 
     /* handlePageFlip - latch a new buffer if available and compute the dirty
      * region. Returns whether a new buffer has been latched, i.e., whether it
-     * is necessary to perform a refresh during this vsync.
+     * is necessary to perform a refresh during this vsync. Queued frames which
+     * latched nothing that changes the screen don't count, unless
+     * debug.sf.skip_unchanged_frames is 0.
      */
     bool handlePageFlip();
 
@@ -349,6 +354,38 @@ private:
     uint32_t setClientStateLocked(const sp<Client>& client, const layer_state_t& s);
     uint32_t setDisplayStateLocked(const DisplayState& s);
 
+    // Asynchronous transactions that only change layers are queued by
+    // setTransactionState() without taking mStateLock, and applied in the
+    // order they were received at the start of the next transaction.
+    struct QueuedLayerState {
+        sp<Client> client;
+        layer_state_t state;
+    };
+    struct QueuedTransaction {
+        std::vector<QueuedLayerState> states;
+        nsecs_t queueTime;
+    };
+    struct TransactionWaitStats {
+        uint64_t count = 0;
+        nsecs_t total = 0;
+        nsecs_t max = 0;
+        void record(nsecs_t duration) {
+            count++;
+            total += duration;
+            max = duration > max ? duration : max;
+        }
+    };
+    // returns false if the queue is full, in which case the transaction must
+    // be applied directly
+    bool queueTransaction(const Vector<ComposerState>& state);
+    // Applies the queued transactions and returns the transaction flags they
+    // need. The applied transactions are moved to outApplied, which the
+    // caller must only destroy after releasing mStateLock: they may hold the
+    // last references to a Client or a layer handle, whose destruction takes
+    // mStateLock.
+    uint32_t applyQueuedTransactionsLocked(
+            std::vector<QueuedTransaction>* outApplied);
+
     /* ------------------------------------------------------------------------
      * Layer management
      */
@@ -406,6 +443,7 @@ private:
             uint32_t minLayerZ, uint32_t maxLayerZ,
             bool useIdentityTransform, Transform::orientation_flags rotation,
             bool isLocalScreenshot, bool useReadPixels);
+    bool isScreenshotFormat(int format);
 
     /* ------------------------------------------------------------------------
      * EGL
@@ -476,7 +514,59 @@ private:
     // has been destroyed and is no longer valid.
     bool doComposeSurfaces(const sp<const DisplayDevice>& hw, const Region& dirty);
 
+    // Client composition cache. The client composition of a display with
+    // device composition is fully determined by its visible layers, their
+    // composition type and their content, and by the display transform. When
+    // these match the previous frame, the framebuffer is copied to a texture
+    // once, and drawn from it on the next frames instead of redrawing the
+    // client layers. Only the area covered by the client layers is copied
+    // and drawn, and only when the layers overlap enough for this to draw
+    // fewer pixels. The texture is released as soon as the layers change.
+    struct ClientCompositionCache {
+        enum Result { MISS, CAPTURE, HIT };
+        struct Entry {
+            int32_t sequence;
+            int32_t compositionType;
+            bool clearsClientTarget;
+            // Layer::getContentGeneration() for client layers,
+            // Layer::getGeometryGeneration() for the others
+            uint64_t generation;
+            bool operator==(const Entry& rhs) const {
+                return sequence == rhs.sequence &&
+                        compositionType == rhs.compositionType &&
+                        clearsClientTarget == rhs.clearsClientTarget &&
+                        generation == rhs.generation;
+            }
+        };
+        ClientCompositionCache() : width(0), height(0), texName(0), valid(false) {}
+        std::vector<Entry> layers;
+        Transform transform;
+        uint32_t width;
+        uint32_t height;
+        // area covered by the client layers, in display coordinates
+        Region region;
+        uint32_t texName;
+        // texName holds the client composition of the current entries
+        bool valid;
+    };
+    // called by doComposeSurfaces() once the framebuffer is cleared, returns
+    // whether the client layers must be drawn (MISS, CAPTURE) and then copied
+    // to the cache (CAPTURE), or the cache drawn instead (HIT)
+    ClientCompositionCache::Result lookupClientCompositionCache(
+            const sp<const DisplayDevice>& hw, const Region& dirty);
+    void dropClientCompositionCache(int32_t hwcId);
+
     void postFramebuffer();
+#ifdef USE_HWC2
+    // Hand the composition types of the visible layers of a display to
+    // mPlanePredictor, before and after HWC validates them
+    void predictCompositionTypes(const sp<const DisplayDevice>& hw);
+    void learnCompositionTypes(const sp<const DisplayDevice>& hw);
+    // composeDisplay() and presentDisplay() do the per display part of
+    // doComposition() and postFramebuffer()
+    void composeDisplay(const sp<DisplayDevice>& hw, bool repaintEverything);
+    void presentDisplay(size_t displayId);
+#endif
     void drawWormhole(const sp<const DisplayDevice>& hw, const Region& region) const;
 
     /* ------------------------------------------------------------------------
@@ -499,6 +589,10 @@ private:
     void listLayersLocked(const Vector<String16>& args, size_t& index, String8& result) const;
     void dumpStatsLocked(const Vector<String16>& args, size_t& index, String8& result) const;
     void clearStatsLocked(const Vector<String16>& args, size_t& index, String8& result);
+    void dumpTimeStatsLocked(const Vector<String16>& args, size_t& index,
+            String8& result) const;
+    void clearTimeStatsLocked(const Vector<String16>& args, size_t& index,
+            String8& result);
     void dumpAllLocked(const Vector<String16>& args, size_t& index, String8& result) const;
     bool startDdmConnection();
     static void appendSfConfigString(String8& result);
@@ -509,6 +603,9 @@ private:
     void logFrameStats();
 
     void dumpStaticScreenStats(String8& result) const;
+    void dumpRegionAllocationStats(String8& result) const;
+    void dumpClientCompositionCacheStats(String8& result) const;
+    void dumpTransactionQueueStats(String8& result) const;
     virtual void dumpDrawCycle(bool /* prePrepare */ ) { }
 
     void recordBufferingStats(const char* layerName,
@@ -581,6 +678,8 @@ private:
     nsecs_t mLastTransactionTime;
     bool mBootFinished;
     bool mForceFullDamage;
+    // polls the fences of mFenceTracker and of the FrameTrackers, thread safe
+    mutable FenceTimeline mFenceTimeline;
     FenceTracker mFenceTracker;
 #ifdef USE_HWC2
     bool mPropagateBackpressure = true;
@@ -605,17 +704,9 @@ private:
      * Feature prototyping
      */
 
-    Daltonizer mDaltonizer;
-#ifndef USE_HWC2
-    bool mDaltonize;
-#endif
-
+    // Daltonizer, color matrices and saturation fused into one transform
+    ColorPipeline mColorPipeline;
     mat4 mPreviousColorMatrix;
-    mat4 mColorMatrix;
-    bool mHasColorMatrix;
-
-    mat4 mSecondaryColorMatrix;
-    bool mHasSecondaryColorMatrix;
 
     // Static screen stats
     bool mHasPoweredOff;
@@ -623,6 +714,62 @@ private:
     nsecs_t mFrameBuckets[NUM_BUCKETS];
     nsecs_t mTotalTime;
     std::atomic<nsecs_t> mLastSwapTime;
+    // Invalidates which latched nothing that changes the screen, and so didn't
+    // lead to a refresh, see handlePageFlip(). A transaction or a repaint
+    // request still refreshes, those invalidates aren't counted.
+    bool mSkipUnchangedFrames;
+    uint64_t mUnchangedFramesSkipped;
+    // Whether the last handlePageFlip() latched only unchanged frames
+    bool mLatchedUnchangedFrames;
+
+    // Region storage allocations made while composing, see
+    // Region::getStorageAllocationCount()
+    uint32_t mLastFrameRegionAllocations;
+    uint64_t mTotalRegionAllocations;
+    uint64_t mRegionAllocationFrames;
+
+    // Only recompute the visible regions of layers whose geometry or whose
+    // layers above changed, see Layer::reuseVisibleRegions()
+    bool mIncrementalVisibleRegions;
+#ifdef USE_HWC2
+    // Compose and present the primary display before the other displays
+    bool mPresentPrimaryFirst;
+    // Requests client composition up front for the layers HWC rejected the
+    // last time it validated the same configuration, main thread only
+    PlanePredictor mPlanePredictor;
+    std::vector<HWC2::Composition> mPredictedCompositionTypes;
+#endif
+    // Let the RenderEngine batch the draws of doComposeSurfaces(), see
+    // RenderEngine::setBatching(). Off unless debug.sf.batch_composition is
+    // set, until it is measured on device GPUs.
+    bool mBatchComposition;
+    // Reuse the client composition of unchanged layers, see
+    // lookupClientCompositionCache(). Keyed by hwc display id.
+    bool mCacheClientComposition;
+    std::map<int32_t, ClientCompositionCache> mClientCompositionCaches;
+    uint64_t mClientCompositionCacheHits;
+    uint64_t mClientCompositionCacheCaptures;
+    uint64_t mClientCompositionCacheMisses;
+    // Queue asynchronous layer transactions, see queueTransaction()
+    bool mQueueTransactions;
+    // protected by mTransactionQueueLock
+    mutable Mutex mTransactionQueueLock;
+    std::vector<QueuedTransaction> mTransactionQueue;
+    // Time spent by setTransactionState() waiting for mStateLock and for the
+    // commit of synchronous transactions, and time between the queueing and
+    // the application of queued transactions. Protected by mStateLock.
+    TransactionWaitStats mTransactionLockWait;
+    TransactionWaitStats mTransactionCommitWait;
+    TransactionWaitStats mTransactionQueueLatency;
+    // Layers recomputed / reused by the last rebuildLayerStacks()
+    size_t mVisibleRegionLayersComputed;
+    size_t mVisibleRegionLayersReused;
+    // Skip the layers that can't be seen in a screenshot, see
+    // renderScreenImplLocked()
+    bool mCullScreenshotLayers;
+    size_t mScreenshotLayersDrawn;
+    // Whether the GPU renders to the formats tried by isScreenshotFormat()
+    std::map<int, bool> mScreenshotFormats;
 
     FrameRateHelper mFrameRateHelper;
 
@@ -124,6 +124,7 @@ status_t SurfaceFlingerConsumer::acquireBufferLocked(BufferItem* item,
     if (result == NO_ERROR) {
         mTransformToDisplayInverse = item->mTransformToDisplayInverse;
         mSurfaceDamage = item->mSurfaceDamage;
+        mCurrentDataSpace = item->mDataSpace;
     }
     return result;
 }
@@ -133,6 +134,11 @@ bool SurfaceFlingerConsumer::getTransformToDisplayInverse() const {
     return mTransformToDisplayInverse;
 }
 
+android_dataspace SurfaceFlingerConsumer::getCurrentDataSpace() const {
+    Mutex::Autolock lock(mMutex);
+    return mCurrentDataSpace;
+}
+
 const Region& SurfaceFlingerConsumer::getSurfaceDamage() const {
     return mSurfaceDamage;
 }
@@ -40,6 +40,7 @@ public:
             uint32_t tex, const Layer* layer)
         : GLConsumer(consumer, tex, GLConsumer::TEXTURE_EXTERNAL, false, false),
           mTransformToDisplayInverse(false), mSurfaceDamage(),
+          mCurrentDataSpace(HAL_DATASPACE_UNKNOWN),
           mPrevReleaseFence(Fence::NO_FENCE), mLayer(layer)
     {}
 
@@ -68,6 +69,9 @@ public:
 
     bool getTransformToDisplayInverse() const;
 
+    // Dataspace the producer set on the current buffer
+    android_dataspace getCurrentDataSpace() const;
+
     // must be called from SF main thread
     const Region& getSurfaceDamage() const;
 
@@ -101,6 +105,9 @@ private:
     // The portion of this surface that has changed since the previous frame
     Region mSurfaceDamage;
 
+    // The dataspace of the current buffer
+    android_dataspace mCurrentDataSpace;
+
 #ifdef USE_HWC2
     // A release that is pending on the receipt of a new release fence from
     // presentDisplay
@@ -28,6 +28,8 @@
 #include <inttypes.h>
 #include <stdatomic.h>
 
+#include <algorithm>
+
 #include <EGL/egl.h>
 
 #include <cutils/iosched_policy.h>
@@ -85,7 +87,6 @@
 #include "DisplayHardware/HWComposer.h"
 #include "DisplayHardware/VirtualDisplaySurface.h"
 
-#include "Effects/Daltonizer.h"
 
 #include "RenderEngine/RenderEngine.h"
 #include <cutils/compiler.h>
@@ -163,16 +164,31 @@ SurfaceFlinger::SurfaceFlinger()
         mLastTransactionTime(0),
         mBootFinished(false),
         mForceFullDamage(false),
+        mFenceTracker(mFenceTimeline),
         mPrimaryDispSync("PrimaryDispSync"),
         mPrimaryHWVsyncEnabled(false),
         mHWVsyncAvailable(false),
-        mDaltonize(false),
-        mHasColorMatrix(false),
-        mHasSecondaryColorMatrix(false),
         mHasPoweredOff(false),
         mFrameBuckets(),
         mTotalTime(0),
         mLastSwapTime(0),
+        mSkipUnchangedFrames(true),
+        mUnchangedFramesSkipped(0),
+        mLatchedUnchangedFrames(false),
+        mLastFrameRegionAllocations(0),
+        mTotalRegionAllocations(0),
+        mRegionAllocationFrames(0),
+        mIncrementalVisibleRegions(true),
+        mBatchComposition(false),
+        mCacheClientComposition(true),
+        mClientCompositionCacheHits(0),
+        mClientCompositionCacheCaptures(0),
+        mClientCompositionCacheMisses(0),
+        mQueueTransactions(true),
+        mVisibleRegionLayersComputed(0),
+        mVisibleRegionLayersReused(0),
+        mCullScreenshotLayers(true),
+        mScreenshotLayersDrawn(0),
         mActiveFrameSequence(0)
 {
     ALOGI("SurfaceFlinger is starting");
@@ -188,6 +204,24 @@ SurfaceFlinger::SurfaceFlinger()
 
     property_get("debug.sf.ddms", value, "0");
     mDebugDDMS = atoi(value);
+
+    property_get("debug.sf.incremental_visreg", value, "1");
+    mIncrementalVisibleRegions = atoi(value);
+
+    property_get("debug.sf.batch_composition", value, "0");
+    mBatchComposition = atoi(value);
+
+    property_get("debug.sf.client_comp_cache", value, "1");
+    mCacheClientComposition = atoi(value);
+
+    property_get("debug.sf.transaction_queue", value, "1");
+    mQueueTransactions = atoi(value);
+
+    property_get("debug.sf.screenshot_cull", value, "1");
+    mCullScreenshotLayers = atoi(value);
+
+    property_get("debug.sf.skip_unchanged_frames", value, "1");
+    mSkipUnchangedFrames = atoi(value);
     if (mDebugDDMS) {
         if (!startDdmConnection()) {
             // start failed, and DDMS debugging not enabled
@@ -324,6 +358,10 @@ void SurfaceFlinger::bootFinished()
     // can choose where to stop the animation.
     property_set("service.bootanim.exit", "1");
 
+    // /data is available by now, keep the shader programs used during boot
+    // so that the next boot doesn't have to compile them
+    mRenderEngine->saveProgramCache();
+
     const int LOGTAG_SF_STOP_BOOTANIM = 60110;
     LOG_EVENT_LONG(LOGTAG_SF_STOP_BOOTANIM,
                    ns2ms(systemTime(SYSTEM_TIME_MONOTONIC)));
@@ -425,6 +463,10 @@ public:
         }
     }
 
+    virtual nsecs_t computeNextRefresh() const {
+        return mDispSync->computeNextRefresh(0);
+    }
+
 private:
     virtual void onDispSyncEvent(nsecs_t when) {
         sp<VSyncSource::Callback> callback;
@@ -848,6 +890,7 @@ status_t SurfaceFlinger::clearAnimationFrameStats() {
 
 status_t SurfaceFlinger::getAnimationFrameStats(FrameStats* outStats) const {
     Mutex::Autolock _l(mStateLock);
+    mFenceTimeline.updateSignalTimes();
     mAnimFrameTracker.getStats(outStats);
     return NO_ERROR;
 }
@@ -1016,6 +1059,8 @@ void SurfaceFlinger::onMessageReceived(int32_t what) {
                 // a new buffer was latched, or if HWC has requested a full
                 // repaint
                 signalRefresh();
+            } else if (mLatchedUnchangedFrames) {
+                mUnchangedFramesSkipped++;
             }
             break;
         }
@@ -1044,6 +1089,7 @@ void SurfaceFlinger::handleMessageRefresh() {
     ATRACE_CALL();
 
     nsecs_t refreshStartTime = systemTime(SYSTEM_TIME_MONOTONIC);
+    const uint32_t regionAllocationsStart = Region::getStorageAllocationCount();
 
     preComposition();
     rebuildLayerStacks();
@@ -1051,6 +1097,13 @@ void SurfaceFlinger::handleMessageRefresh() {
     doDebugFlashRegions();
     doComposition();
     postComposition(refreshStartTime);
+    // the frame is out, read back the shader programs it compiled
+    mRenderEngine->recordProgramBinaries();
+
+    mLastFrameRegionAllocations =
+            Region::getStorageAllocationCount() - regionAllocationsStart;
+    mTotalRegionAllocations += mLastFrameRegionAllocations;
+    mRegionAllocationFrames++;
 }
 
 void SurfaceFlinger::doDebugFlashRegions()
@@ -1110,19 +1163,23 @@ void SurfaceFlinger::preComposition()
 
 void SurfaceFlinger::postComposition(nsecs_t refreshStartTime)
 {
+    // Look at all the fences the trackers wait for at once
+    mFenceTimeline.updateSignalTimes();
+
+    const HWComposer& hwc = getHwComposer();
+    sp<Fence> presentFence = hwc.getDisplayFence(HWC_DISPLAY_PRIMARY);
+    sp<FenceTime> presentFenceTime = mFenceTimeline.track(presentFence);
+
     const LayerVector& layers(mDrawingState.layersSortedByZ);
     const size_t count = layers.size();
     for (size_t i=0 ; i<count ; i++) {
-        bool frameLatched = layers[i]->onPostComposition();
+        bool frameLatched = layers[i]->onPostComposition(presentFenceTime);
         if (frameLatched) {
             recordBufferingStats(layers[i]->getName().string(),
                     layers[i]->getOccupancyHistory(false));
         }
     }
 
-    const HWComposer& hwc = getHwComposer();
-    sp<Fence> presentFence = hwc.getDisplayFence(HWC_DISPLAY_PRIMARY);
-
     if (presentFence->isValid()) {
         if (mPrimaryDispSync.addPresentFence(presentFence)) {
             enableHardwareVsync();
@@ -1138,14 +1195,15 @@ void SurfaceFlinger::postComposition(nsecs_t refreshStartTime)
         }
     }
 
-    mFenceTracker.addFrame(refreshStartTime, presentFence,
-            hw->getVisibleLayersSortedByZ(), hw->getClientTargetAcquireFence());
+    mFenceTracker.addFrame(refreshStartTime, presentFenceTime,
+            hw->getVisibleLayersSortedByZ(),
+            mFenceTimeline.track(hw->getClientTargetAcquireFence()));
 
     if (mAnimCompositionPending) {
         mAnimCompositionPending = false;
 
         if (presentFence->isValid()) {
-            mAnimFrameTracker.setActualPresentFence(presentFence);
+            mAnimFrameTracker.setActualPresentFence(presentFenceTime);
         } else {
             // The HWC doesn't support present fences, so use the refresh
             // timestamp instead.
@@ -1185,6 +1243,8 @@ void SurfaceFlinger::rebuildLayerStacks() {
         ATRACE_CALL();
         mVisibleRegionsDirty = false;
         invalidateHwcGeometry();
+        mVisibleRegionLayersComputed = 0;
+        mVisibleRegionLayersReused = 0;
 
         const LayerVector& layers(mDrawingState.layersSortedByZ);
         for (size_t dpy=0 ; dpy<mDisplays.size() ; dpy++) {
@@ -1267,8 +1327,9 @@ void SurfaceFlinger::setUpHWComposer() {
                         for (size_t i=0 ; cur!=end && i<count ; ++i, ++cur) {
                             const sp<Layer>& layer(currentLayers[i]);
                             layer->setGeometry(hw, *cur);
-                            if (mDebugDisableHWC || mDebugRegion || mDaltonize || mHasColorMatrix
-                                    || mHasSecondaryColorMatrix) {
+                            // HWC1 has no color transform, apply it ourselves
+                            if (mDebugDisableHWC || mDebugRegion ||
+                                    !mColorPipeline.isIdentity()) {
                                 cur->setSkip(true);
                             }
                         }
@@ -1418,6 +1479,8 @@ void SurfaceFlinger::handleTransaction(uint32_t transactionFlags)
     // mStateLock so that the side-effects of the State assignment
     // don't happen with mStateLock held (which can cause deadlocks).
     State drawingState(mDrawingState);
+    // same for the transactions applied from the queue
+    std::vector<QueuedTransaction> appliedTransactions;
 
     Mutex::Autolock _l(mStateLock);
     const nsecs_t now = systemTime();
@@ -1427,9 +1490,12 @@ void SurfaceFlinger::handleTransaction(uint32_t transactionFlags)
     // so we can call handleTransactionLocked() unconditionally.
     // We call getTransactionFlags(), which will also clear the flags,
     // with mStateLock held to guarantee that mCurrentState won't change
-    // until the transaction is committed.
+    // until the transaction is committed. The queued transactions are
+    // applied after the flags are cleared, so that a transaction queued
+    // past this point triggers another one.
 
     transactionFlags = getTransactionFlags(eTransactionMask);
+    transactionFlags |= applyQueuedTransactionsLocked(&appliedTransactions);
     handleTransactionLocked(transactionFlags);
 
     mLastTransactionTime = systemTime() - now;
@@ -1495,8 +1561,10 @@ void SurfaceFlinger::handleTransactionLocked(uint32_t transactionFlags)
                         const sp<const DisplayDevice> defaultDisplay(getDefaultDisplayDevice());
                         defaultDisplay->makeCurrent(mEGLDisplay, mEGLContext);
                         sp<DisplayDevice> hw(getDisplayDevice(draw.keyAt(i)));
-                        if (hw != NULL)
+                        if (hw != NULL) {
+                            dropClientCompositionCache(hw->getHwcDisplayId());
                             hw->disconnect(getHwComposer());
+                        }
                         if (draw[i].type < DisplayDevice::NUM_BUILTIN_DISPLAY_TYPES)
                             mEventThread->onHotplugReceived(draw[i].type, false);
                         mDisplays.removeItem(draw.keyAt(i));
@@ -1515,8 +1583,10 @@ void SurfaceFlinger::handleTransactionLocked(uint32_t transactionFlags)
                         // from the drawing state, so that it get re-added
                         // below.
                         sp<DisplayDevice> hw(getDisplayDevice(display));
-                        if (hw != NULL)
+                        if (hw != NULL) {
+                            dropClientCompositionCache(hw->getHwcDisplayId());
                             hw->disconnect(getHwComposer());
+                        }
                         mDisplays.removeItem(display);
                         mDrawingState.displays.removeItemsAt(i);
                         dc--; i--;
@@ -1813,6 +1883,16 @@ void SurfaceFlinger::computeVisibleRegions(size_t dpy,
                               layerStack, i))
             continue;
 
+        if (mIncrementalVisibleRegions &&
+                layer->reuseVisibleRegions(layerStack, aboveOpaqueLayers,
+                        aboveCoveredLayers, outDirtyRegion)) {
+            mVisibleRegionLayersReused++;
+            continue;
+        }
+        mVisibleRegionLayersComputed++;
+        const Region aboveOpaqueBefore(aboveOpaqueLayers);
+        const Region aboveCoveredBefore(aboveCoveredLayers);
+
         /*
          * opaqueRegion: area of a surface that is fully opaque.
          */
@@ -1920,6 +2000,11 @@ void SurfaceFlinger::computeVisibleRegions(size_t dpy,
         layer->setCoveredRegion(coveredRegion);
         layer->setVisibleNonTransparentRegion(
                 visibleRegion.subtract(transparentRegion));
+
+        if (mIncrementalVisibleRegions) {
+            layer->cacheVisibleRegions(layerStack, aboveOpaqueBefore,
+                    aboveCoveredBefore, aboveOpaqueLayers, aboveCoveredLayers);
+        }
     }
 
     outOpaqueRegion = aboveOpaqueLayers;
@@ -1966,13 +2051,20 @@ bool SurfaceFlinger::handlePageFlip()
             layer->useEmptyDamage();
         }
     }
+    // A queued frame doesn't necessarily change the screen: the buffer may be
+    // rejected, or held back by a sync point or its fence
+    bool contentChanged = false;
     for (size_t i = 0, count = layersWithQueuedFrames.size() ; i<count ; i++) {
         Layer* layer = layersWithQueuedFrames[i];
+        const uint64_t contentGeneration = layer->getContentGeneration();
         const Region dirty(layer->latchBuffer(visibleRegions));
         layer->useSurfaceDamage();
         const Layer::State& s(layer->getDrawingState());
         invalidateLayerStack(s.layerStack, dirty);
+        contentChanged = contentChanged || !dirty.isEmpty() ||
+                layer->getContentGeneration() != contentGeneration;
     }
+    contentChanged = contentChanged || visibleRegions;
 
     mVisibleRegionsDirty |= visibleRegions;
 
@@ -1983,8 +2075,15 @@ bool SurfaceFlinger::handlePageFlip()
         signalLayerUpdate();
     }
 
+    if (!mSkipUnchangedFrames) {
+        mLatchedUnchangedFrames = false;
+        return !layersWithQueuedFrames.empty();
+    }
+    mLatchedUnchangedFrames =
+            !layersWithQueuedFrames.empty() && !contentChanged;
+
     // Only continue with the refresh if there is actually new work to do
-    return !layersWithQueuedFrames.empty();
+    return contentChanged;
 }
 
 void SurfaceFlinger::invalidateHwcGeometry()
@@ -2030,19 +2129,12 @@ void SurfaceFlinger::doDisplayComposition(const sp<const DisplayDevice>& hw,
         }
     }
 
-    if (CC_LIKELY(!mDaltonize && !mHasColorMatrix && !mHasSecondaryColorMatrix)) {
+    if (CC_LIKELY(mColorPipeline.isIdentity())) {
         if (!doComposeSurfaces(hw, dirtyRegion)) return;
     } else {
         RenderEngine& engine(getRenderEngine());
-        mat4 colorMatrix = mColorMatrix;
-        if (mHasSecondaryColorMatrix) {
-            colorMatrix = mHasColorMatrix
-                    ? (colorMatrix * mSecondaryColorMatrix) : mSecondaryColorMatrix;
-        }
-        if (mDaltonize) {
-            colorMatrix = colorMatrix * mDaltonizer();
-        }
-        mat4 oldMatrix = engine.setupColorTransform(colorMatrix);
+        mat4 oldMatrix = engine.setupColorTransform(
+                mColorPipeline.getColorTransform());
         doComposeSurfaces(hw, dirtyRegion);
         engine.setupColorTransform(oldMatrix);
     }
@@ -2062,6 +2154,7 @@ bool SurfaceFlinger::doComposeSurfaces(const sp<const DisplayDevice>& hw, const
     HWComposer::LayerListIterator cur = hwc.begin(id);
     const HWComposer::LayerListIterator end = hwc.end(id);
 
+    ClientCompositionCache::Result cacheResult = ClientCompositionCache::MISS;
     bool hasGlesComposition = hwc.hasGlesComposition(id);
     if (hasGlesComposition) {
         if (!hw->makeCurrent(mEGLDisplay, mEGLContext)) {
@@ -2084,6 +2177,7 @@ bool SurfaceFlinger::doComposeSurfaces(const sp<const DisplayDevice>& hw, const
             // GPUs doing a "clean slate" clear might be more efficient.
             // We'll revisit later if needed.
             engine.clearWithColor(0, 0, 0, 0);
+            cacheResult = lookupClientCompositionCache(hw, dirty);
         } else {
             // we start with the whole screen area
             const Region bounds(hw->getBounds());
@@ -2104,6 +2198,8 @@ bool SurfaceFlinger::doComposeSurfaces(const sp<const DisplayDevice>& hw, const
                 // can happen with SurfaceView
                 drawWormHoleIfRequired(cur, end, hw, region);
             }
+            // all the layers are drawn, there is nothing to cache
+            dropClientCompositionCache(id);
         }
 
         if (hw->getDisplayType() != DisplayDevice::DISPLAY_PRIMARY) {
@@ -2123,16 +2219,26 @@ bool SurfaceFlinger::doComposeSurfaces(const sp<const DisplayDevice>& hw, const
                         scissor.getWidth(), scissor.getHeight());
             }
         }
+    } else {
+        dropClientCompositionCache(id);
     }
 
     /*
      * and then, render the layers targeted at the framebuffer
      */
 
+    engine.setBatching(mBatchComposition);
     const Vector< sp<Layer> >& layers(hw->getVisibleLayersSortedByZ());
     const size_t count = layers.size();
     const Transform& tr = hw->getTransform();
-    if (cur != end) {
+    if (cacheResult == ClientCompositionCache::HIT) {
+        // the framebuffer layers didn't change since the snapshot was taken
+        const ClientCompositionCache& cache(mClientCompositionCaches[id]);
+        engine.drawFramebufferTexture(cache.texName, cache.region, cache.height);
+        for (size_t i=0 ; i<count && cur!=end ; ++i, ++cur) {
+            layers[i]->setAcquireFence(hw, *cur);
+        }
+    } else if (cur != end) {
         // we're using h/w composer
         for (size_t i=0 ; i<count && cur!=end ; ++i, ++cur) {
             const sp<Layer>& layer(layers[i]);
@@ -2177,12 +2283,141 @@ bool SurfaceFlinger::doComposeSurfaces(const sp<const DisplayDevice>& hw, const
             }
         }
     }
+    engine.setBatching(false);
+
+    if (cacheResult == ClientCompositionCache::CAPTURE) {
+        const ClientCompositionCache& cache(mClientCompositionCaches[id]);
+        engine.copyFramebufferToTexture(cache.texName,
+                cache.region.getBounds(), cache.height);
+    }
 
     // disable scissor at the end of the frame
     engine.disableScissor();
     return true;
 }
 
+static size_t getRegionArea(const Region& region) {
+    size_t area = 0;
+    for (const Rect& rect : region) {
+        area += size_t(rect.getWidth()) * size_t(rect.getHeight());
+    }
+    return area;
+}
+
+SurfaceFlinger::ClientCompositionCache::Result
+SurfaceFlinger::lookupClientCompositionCache(
+        const sp<const DisplayDevice>& hw, const Region& dirty)
+{
+    const int32_t id = hw->getHwcDisplayId();
+    // a display which only redraws its dirty region never redraws all the
+    // framebuffer the snapshot is taken from
+    if (!mCacheClientComposition || (hw->getFlags() &
+            (DisplayDevice::SWAP_RECTANGLE | DisplayDevice::PARTIAL_UPDATES))) {
+        dropClientCompositionCache(id);
+        return ClientCompositionCache::MISS;
+    }
+
+    ClientCompositionCache& cache(mClientCompositionCaches[id]);
+    HWComposer& hwc(getHwComposer());
+    HWComposer::LayerListIterator cur = hwc.begin(id);
+    const HWComposer::LayerListIterator end = hwc.end(id);
+
+    // the framebuffer was cleared, the snapshot is only complete if all of
+    // it is redrawn
+    const Rect bounds(hw->getBounds());
+    bool cacheable = dirty.isRect() && dirty.getBounds() == bounds;
+
+    // area covered by the client layers, which is what a hit draws, and
+    // number of pixels drawn by the client composition it replaces
+    const Transform& tr(hw->getTransform());
+    Region region;
+    size_t replacedArea = 0;
+
+    const Vector< sp<Layer> >& visibleLayers(hw->getVisibleLayersSortedByZ());
+    const size_t count = visibleLayers.size();
+    std::vector<ClientCompositionCache::Entry> layers;
+    layers.reserve(count);
+    for (size_t i=0 ; i<count && cur!=end ; ++i, ++cur) {
+        const sp<Layer>& layer(visibleLayers[i]);
+        const int32_t type = cur->getCompositionType();
+        const Layer::State& state(layer->getDrawingState());
+        ClientCompositionCache::Entry entry;
+        entry.sequence = layer->getSequence();
+        entry.compositionType = type;
+        entry.clearsClientTarget = (cur->getHints() & HWC_HINT_CLEAR_FB) &&
+                i && layer->isOpaque(state) && state.alpha == 0xFF;
+        if (type == HWC_FRAMEBUFFER) {
+            // a blur layer samples what is below it
+            cacheable = cacheable && !layer->isBlurLayer();
+            entry.generation = layer->getContentGeneration();
+        } else {
+            entry.generation = layer->getGeometryGeneration();
+        }
+        if (type == HWC_FRAMEBUFFER || entry.clearsClientTarget) {
+            const Region clip(tr.transform(
+                    layer->visibleRegion).intersect(bounds));
+            replacedArea += getRegionArea(clip);
+            if (type == HWC_FRAMEBUFFER) {
+                region.orSelf(clip);
+            }
+        }
+        layers.push_back(entry);
+    }
+
+    // the snapshot only pays off where the client layers overlap, it
+    // would draw as many pixels as the layers themselves otherwise
+    cacheable = cacheable && !region.isEmpty() &&
+            getRegionArea(region) < replacedArea;
+
+    const bool unchanged = cacheable && layers == cache.layers &&
+            tr[0] == cache.transform[0] && tr[1] == cache.transform[1] &&
+            tr[2] == cache.transform[2] &&
+            uint32_t(hw->getWidth()) == cache.width &&
+            uint32_t(hw->getHeight()) == cache.height;
+
+    cache.layers.swap(layers);
+    cache.transform = tr;
+    cache.width = uint32_t(hw->getWidth());
+    cache.height = uint32_t(hw->getHeight());
+    cache.region = region;
+
+    if (!unchanged) {
+        // don't hold on to a full screen texture which may not be drawn
+        // again, it is allocated again once the layers settle
+        if (cache.texName != 0) {
+            getRenderEngine().deleteTextures(1, &cache.texName);
+            cache.texName = 0;
+        }
+        cache.valid = false;
+        mClientCompositionCacheMisses++;
+        return ClientCompositionCache::MISS;
+    }
+    if (cache.valid) {
+        mClientCompositionCacheHits++;
+        return ClientCompositionCache::HIT;
+    }
+
+    // second frame in a row with the same layers: keep a copy of this one
+    if (cache.texName == 0) {
+        getRenderEngine().genTextures(1, &cache.texName);
+    }
+    cache.valid = true;
+    mClientCompositionCacheCaptures++;
+    return ClientCompositionCache::CAPTURE;
+}
+
+void SurfaceFlinger::dropClientCompositionCache(int32_t hwcId)
+{
+    auto cache = mClientCompositionCaches.find(hwcId);
+    if (cache == mClientCompositionCaches.end()) {
+        return;
+    }
+    if (cache->second.texName != 0) {
+        getRenderEngine().deleteTextures(1, &cache->second.texName);
+    }
+    mClientCompositionCaches.erase(cache);
+}
+
 void SurfaceFlinger::drawWormhole(const sp<const DisplayDevice>& hw, const Region& region) const {
     const int32_t height = hw->getHeight();
     RenderEngine& engine(getRenderEngine());
@@ -2244,6 +2479,30 @@ uint32_t SurfaceFlinger::setTransactionFlags(uint32_t flags) {
     return old;
 }
 
+// Past this many queued transactions (the main thread is stalled, or a
+// client floods us), transactions are applied directly again.
+static const size_t MAX_QUEUED_TRANSACTIONS = 64;
+
+// Here we need to check that the interface we're given is indeed one of our
+// own. A malicious client could give us a NULL IInterface, or one of its own
+// or even one of our own but a different type. All these situations would
+// cause us to crash.
+//
+// NOTE: it would be better to use RTTI as we could directly check that we
+// have a Client*. however, RTTI is disabled in Android.
+static sp<Client> getClient(const ComposerState& s) {
+    if (s.client != NULL) {
+        sp<IBinder> binder = IInterface::asBinder(s.client);
+        if (binder != NULL) {
+            String16 desc(binder->getInterfaceDescriptor());
+            if (desc == ISurfaceComposerClient::descriptor) {
+                return static_cast<Client *>(s.client.get());
+            }
+        }
+    }
+    return NULL;
+}
+
 void SurfaceFlinger::setTransactionState(
         const Vector<ComposerState>& state,
         const Vector<DisplayState>& displays,
@@ -2252,7 +2511,23 @@ void SurfaceFlinger::setTransactionState(
     ATRACE_CALL();
 
     delayDPTransactionIfNeeded(displays);
+
+    // Asynchronous transactions that only change layers don't need to wait
+    // for anything, queue them for the main thread rather than contending
+    // with it and the other clients for mStateLock.
+    if (mQueueTransactions && displays.isEmpty() &&
+            !(flags & (eSynchronous | eAnimation))) {
+        if (queueTransaction(state)) {
+            return;
+        }
+    }
+
+    // destroyed after mStateLock is released, see
+    // applyQueuedTransactionsLocked()
+    std::vector<QueuedTransaction> appliedTransactions;
+    const nsecs_t lockStart = systemTime();
     Mutex::Autolock _l(mStateLock);
+    mTransactionLockWait.record(systemTime() - lockStart);
     uint32_t transactionFlags = 0;
 
     if (flags & eAnimation) {
@@ -2271,6 +2546,10 @@ void SurfaceFlinger::setTransactionState(
         }
     }
 
+    // The transactions queued before this one are applied first, which
+    // keeps the transactions of each client in order.
+    transactionFlags |= applyQueuedTransactionsLocked(&appliedTransactions);
+
     size_t count = displays.size();
     for (size_t i=0 ; i<count ; i++) {
         const DisplayState& s(displays[i]);
@@ -2280,22 +2559,9 @@ void SurfaceFlinger::setTransactionState(
     count = state.size();
     for (size_t i=0 ; i<count ; i++) {
         const ComposerState& s(state[i]);
-        // Here we need to check that the interface we're given is indeed
-        // one of our own. A malicious client could give us a NULL
-        // IInterface, or one of its own or even one of our own but a
-        // different type. All these situations would cause us to crash.
-        //
-        // NOTE: it would be better to use RTTI as we could directly check
-        // that we have a Client*. however, RTTI is disabled in Android.
-        if (s.client != NULL) {
-            sp<IBinder> binder = IInterface::asBinder(s.client);
-            if (binder != NULL) {
-                String16 desc(binder->getInterfaceDescriptor());
-                if (desc == ISurfaceComposerClient::descriptor) {
-                    sp<Client> client( static_cast<Client *>(s.client.get()) );
-                    transactionFlags |= setClientStateLocked(client, s.state);
-                }
-            }
+        sp<Client> client(getClient(s));
+        if (client != NULL) {
+            transactionFlags |= setClientStateLocked(client, s.state);
         }
     }
 
@@ -2318,6 +2584,8 @@ void SurfaceFlinger::setTransactionState(
         if (flags & eAnimation) {
             mAnimTransactionPending = true;
         }
+        const bool waitForCommit = mTransactionPending;
+        const nsecs_t commitStart = systemTime();
         while (mTransactionPending) {
             status_t err = mTransactionCV.waitRelative(mStateLock, s2ns(5));
             if (CC_UNLIKELY(err != NO_ERROR)) {
@@ -2328,9 +2596,64 @@ void SurfaceFlinger::setTransactionState(
                 break;
             }
         }
+        if (waitForCommit) {
+            mTransactionCommitWait.record(systemTime() - commitStart);
+        }
     }
 }
 
+bool SurfaceFlinger::queueTransaction(const Vector<ComposerState>& state)
+{
+    QueuedTransaction transaction;
+    transaction.queueTime = systemTime();
+    transaction.states.reserve(state.size());
+    for (size_t i=0 ; i<state.size() ; i++) {
+        const ComposerState& s(state[i]);
+        sp<Client> client(getClient(s));
+        if (client != NULL) {
+            transaction.states.push_back({client, s.state});
+        }
+    }
+    if (transaction.states.empty()) {
+        return true;
+    }
+
+    {
+        Mutex::Autolock _l(mTransactionQueueLock);
+        if (mTransactionQueue.size() >= MAX_QUEUED_TRANSACTIONS) {
+            return false;
+        }
+        mTransactionQueue.push_back(std::move(transaction));
+    }
+    // Set after the transaction is queued so that handleTransaction() either
+    // applies it or runs again.
+    setTransactionFlags(eTransactionNeeded);
+    return true;
+}
+
+uint32_t SurfaceFlinger::applyQueuedTransactionsLocked(
+        std::vector<QueuedTransaction>* outApplied)
+{
+    {
+        Mutex::Autolock _l(mTransactionQueueLock);
+        if (mTransactionQueue.empty()) {
+            return 0;
+        }
+        outApplied->swap(mTransactionQueue);
+    }
+
+    ATRACE_INT("TransactionQueue", static_cast<int32_t>(outApplied->size()));
+    uint32_t transactionFlags = 0;
+    const nsecs_t now = systemTime();
+    for (const auto& transaction : *outApplied) {
+        for (const auto& s : transaction.states) {
+            transactionFlags |= setClientStateLocked(s.client, s.state);
+        }
+        mTransactionQueueLatency.record(now - transaction.queueTime);
+    }
+    return transactionFlags;
+}
+
 uint32_t SurfaceFlinger::setDisplayStateLocked(const DisplayState& s)
 {
     ssize_t dpyIdx = mCurrentState.displays.indexOfKey(s.token);
@@ -2791,6 +3114,20 @@ status_t SurfaceFlinger::dump(int fd, const Vector<String16>& args)
                 dumpAll = false;
             }
 
+            if ((index < numArgs) &&
+                    (args[index] == String16("--timestats"))) {
+                index++;
+                dumpTimeStatsLocked(args, index, result);
+                dumpAll = false;
+            }
+
+            if ((index < numArgs) &&
+                    (args[index] == String16("--timestats-clear"))) {
+                index++;
+                clearTimeStatsLocked(args, index, result);
+                dumpAll = false;
+            }
+
             if ((index < numArgs) &&
                     (args[index] == String16("--dispsync"))) {
                 index++;
@@ -2845,6 +3182,8 @@ void SurfaceFlinger::dumpStatsLocked(const Vector<String16>& args, size_t& index
         index++;
     }
 
+    mFenceTimeline.updateSignalTimes();
+
     const nsecs_t period =
             getHwComposer().getRefreshPeriod(HWC_DISPLAY_PRIMARY);
     result.appendFormat("%" PRId64 "\n", period);
@@ -2884,6 +3223,54 @@ void SurfaceFlinger::clearStatsLocked(const Vector<String16>& args, size_t& inde
     mAnimFrameTracker.clearStats();
 }
 
+void SurfaceFlinger::dumpTimeStatsLocked(const Vector<String16>& args,
+        size_t& index, String8& result) const
+{
+    String8 name;
+    if (index < args.size()) {
+        name = String8(args[index]);
+        index++;
+    }
+
+    mFenceTimeline.updateSignalTimes();
+
+    const LayerVector& currentLayers = mCurrentState.layersSortedByZ;
+    const size_t count = currentLayers.size();
+    for (size_t i=0 ; i<count ; i++) {
+        const sp<Layer>& layer(currentLayers[i]);
+        if (name.isEmpty() || (name == layer->getName())) {
+            layer->dumpTimeStats(result);
+        }
+    }
+
+    if (name.isEmpty()) {
+        mAnimFrameTracker.dumpTimeStats(String8("<win-anim>"), result);
+    }
+}
+
+void SurfaceFlinger::clearTimeStatsLocked(const Vector<String16>& args,
+        size_t& index, String8& /* result */)
+{
+    String8 name;
+    if (index < args.size()) {
+        name = String8(args[index]);
+        index++;
+    }
+
+    const LayerVector& currentLayers = mCurrentState.layersSortedByZ;
+    const size_t count = currentLayers.size();
+    for (size_t i=0 ; i<count ; i++) {
+        const sp<Layer>& layer(currentLayers[i]);
+        if (name.isEmpty() || (name == layer->getName())) {
+            layer->clearTimeStats();
+        }
+    }
+
+    if (name.isEmpty()) {
+        mAnimFrameTracker.clearTimeStats();
+    }
+}
+
 // This should only be called from the main thread.  Otherwise it would need
 // the lock and should use mCurrentState rather than mDrawingState.
 void SurfaceFlinger::logFrameStats() {
@@ -2929,6 +3316,49 @@ void SurfaceFlinger::dumpStaticScreenStats(String8& result) const
             static_cast<float>(mFrameBuckets[NUM_BUCKETS - 1]) / mTotalTime;
     result.appendFormat("  %zd+ frames: %.3f s (%.1f%%)\n",
             NUM_BUCKETS - 1, bucketTimeSec, percent);
+    result.appendFormat("  unchanged frames skipped (%s): %" PRIu64 "\n",
+            mSkipUnchangedFrames ? "on" : "off", mUnchangedFramesSkipped);
+}
+
+void SurfaceFlinger::dumpRegionAllocationStats(String8& result) const
+{
+    // The counter is process-wide, so binder threads working on regions
+    // during a refresh are accounted to that frame as well.
+    const double average = mRegionAllocationFrames == 0 ? 0.0 :
+            double(mTotalRegionAllocations) / mRegionAllocationFrames;
+    result.appendFormat("Region allocations: %u last frame, %.1f per frame "
+            "over %" PRIu64 " frames\n", mLastFrameRegionAllocations, average,
+            mRegionAllocationFrames);
+}
+
+void SurfaceFlinger::dumpClientCompositionCacheStats(String8& result) const
+{
+    result.appendFormat("Client composition cache (%s): %" PRIu64 " hits, "
+            "%" PRIu64 " captures, %" PRIu64 " misses\n",
+            mCacheClientComposition ? "on" : "off",
+            mClientCompositionCacheHits, mClientCompositionCacheCaptures,
+            mClientCompositionCacheMisses);
+}
+
+void SurfaceFlinger::dumpTransactionQueueStats(String8& result) const
+{
+    size_t queued;
+    {
+        Mutex::Autolock _l(mTransactionQueueLock);
+        queued = mTransactionQueue.size();
+    }
+    auto dumpWaitStats = [&result](const char* name,
+            const TransactionWaitStats& s) {
+        result.appendFormat("  %-15s: %" PRIu64 " transactions, "
+                "avg %.3f ms, max %.3f ms\n", name, s.count,
+                s.count ? ns2us(s.total / nsecs_t(s.count)) / 1000.0 : 0.0,
+                ns2us(s.max) / 1000.0);
+    };
+    result.appendFormat("Transaction queue (%s): %zu pending\n",
+            mQueueTransactions ? "on" : "off", queued);
+    dumpWaitStats("state lock wait", mTransactionLockWait);
+    dumpWaitStats("commit wait", mTransactionCommitWait);
+    dumpWaitStats("queue latency", mTransactionQueueLatency);
 }
 
 void SurfaceFlinger::recordBufferingStats(const char* layerName,
@@ -3034,6 +3464,19 @@ void SurfaceFlinger::dumpAllLocked(const Vector<String16>& args, size_t& index,
     dumpStaticScreenStats(result);
     result.append("\n");
 
+    dumpRegionAllocationStats(result);
+    dumpClientCompositionCacheStats(result);
+    dumpTransactionQueueStats(result);
+    result.appendFormat("Visible regions: %zu layers recomputed, %zu reused "
+            "in the last pass (incremental %s)\n",
+            mVisibleRegionLayersComputed, mVisibleRegionLayersReused,
+            mIncrementalVisibleRegions ? "on" : "off");
+    result.appendFormat("Screenshots: %zu layers drawn in the last capture "
+            "(culling %s)\n", mScreenshotLayersDrawn,
+            mCullScreenshotLayers ? "on" : "off");
+    mColorPipeline.dump(result);
+    result.append("\n");
+
     dumpBufferingStats(result);
 
     /*
@@ -3120,9 +3563,8 @@ void SurfaceFlinger::dumpAllLocked(const Vector<String16>& args, size_t& index,
     colorizer.reset(result);
     result.appendFormat("  h/w composer %s and %s\n",
             hwc.initCheck()==NO_ERROR ? "present" : "not present",
-                    (mDebugDisableHWC || mDebugRegion || mDaltonize
-                            || mHasColorMatrix
-                            || mHasSecondaryColorMatrix) ? "disabled" : "enabled");
+                    (mDebugDisableHWC || mDebugRegion ||
+                            !mColorPipeline.isIdentity()) ? "disabled" : "enabled");
     hwc.dump(result);
 
     /*
@@ -3274,23 +3716,24 @@ status_t SurfaceFlinger::onTransact(
             case 1014: {
                 // daltonize
                 n = data.readInt32();
+                ColorBlindnessType type;
                 switch (n % 10) {
                     case 1:
-                        mDaltonizer.setType(ColorBlindnessType::Protanomaly);
+                        type = ColorBlindnessType::Protanomaly;
                         break;
                     case 2:
-                        mDaltonizer.setType(ColorBlindnessType::Deuteranomaly);
+                        type = ColorBlindnessType::Deuteranomaly;
                         break;
                     case 3:
-                        mDaltonizer.setType(ColorBlindnessType::Tritanomaly);
+                        type = ColorBlindnessType::Tritanomaly;
+                        break;
+                    default:
+                        type = ColorBlindnessType::None;
                         break;
                 }
-                if (n >= 10) {
-                    mDaltonizer.setMode(ColorBlindnessMode::Correction);
-                } else {
-                    mDaltonizer.setMode(ColorBlindnessMode::Simulation);
-                }
-                mDaltonize = n > 0;
+                mColorPipeline.setDaltonizer(type, n >= 10 ?
+                        ColorBlindnessMode::Correction :
+                        ColorBlindnessMode::Simulation);
                 invalidateHwcGeometry();
                 repaintEverything();
                 return NO_ERROR;
@@ -3298,19 +3741,18 @@ status_t SurfaceFlinger::onTransact(
             case 1015: {
                 // apply a color matrix
                 n = data.readInt32();
-                mHasColorMatrix = n ? 1 : 0;
+                mat4 matrix;
                 if (n) {
                     // color matrix is sent as mat3 matrix followed by vec3
                     // offset, then packed into a mat4 where the last row is
                     // the offset and extra values are 0
                     for (size_t i = 0 ; i < 4; i++) {
-                      for (size_t j = 0; j < 4; j++) {
-                          mColorMatrix[i][j] = data.readFloat();
-                      }
+                        for (size_t j = 0; j < 4; j++) {
+                            matrix[i][j] = data.readFloat();
+                        }
                     }
-                } else {
-                    mColorMatrix = mat4();
                 }
+                mColorPipeline.setColorMatrix(matrix);
                 invalidateHwcGeometry();
                 repaintEverything();
                 return NO_ERROR;
@@ -3344,23 +3786,31 @@ status_t SurfaceFlinger::onTransact(
                 mUseHwcVirtualDisplays = !n;
                 return NO_ERROR;
             }
+            case 1022: {
+                // set the global saturation, 1 leaves the colors unchanged
+                float saturation = data.readFloat();
+                mColorPipeline.setSaturation(
+                        std::max(0.0f, std::min(saturation, 2.0f)));
+                invalidateHwcGeometry();
+                repaintEverything();
+                return NO_ERROR;
+            }
             case 1030: {
                 // apply a secondary color matrix
                 // this will be combined with any other transformations
                 n = data.readInt32();
-                mHasSecondaryColorMatrix = n ? 1 : 0;
+                mat4 matrix;
                 if (n) {
                     // color matrix is sent as mat3 matrix followed by vec3
                     // offset, then packed into a mat4 where the last row is
                     // the offset and extra values are 0
                     for (size_t i = 0 ; i < 4; i++) {
                         for (size_t j = 0; j < 4; j++) {
-                            mSecondaryColorMatrix[i][j] = data.readFloat();
+                            matrix[i][j] = data.readFloat();
                         }
                     }
-                } else {
-                    mSecondaryColorMatrix = mat4();
                 }
+                mColorPipeline.setSecondaryColorMatrix(matrix);
                 invalidateHwcGeometry();
                 repaintEverything();
                 return NO_ERROR;
@@ -3597,6 +4047,46 @@ status_t SurfaceFlinger::captureScreen(const sp<IBinder>& display,
 }
 
 
+// Computes whether the layer appears in sourceCrop when rendered by
+// renderScreenImplLocked(), and whether it covers all of it with opaque
+// pixels. The bounds follow Layer::computeGeometry(); they are conservative
+// for the former, exact for the latter.
+static void getScreenshotCoverage(const sp<const DisplayDevice>& hw,
+        const sp<Layer>& layer, const Rect& sourceCrop,
+        bool useIdentityTransform, bool* outIntersects, bool* outCovers)
+{
+    const Layer::State& s(layer->getDrawingState());
+    const Transform& hwTransform(hw->getTransform());
+    Rect bounds(layer->computeBounds());
+    bool exact = s.activeTransparentRegion.isEmpty() &&
+            hwTransform.preserveRects();
+#ifdef QTI_BSP
+    // computeGeometry() also clips the window to the display viewport, going
+    // through the layer transform and back, which is only exact for a
+    // translation
+    Rect clipped;
+    s.active.transform.transform(bounds).intersect(hw->getViewport(),
+            &clipped);
+    bounds = s.active.transform.inverse().transform(clipped);
+    bounds.intersect(Rect(s.active.w, s.active.h), &bounds);
+    exact = exact && s.active.transform.getType() <= Transform::TRANSLATE;
+#endif
+    if (!useIdentityTransform) {
+        exact = exact && s.active.transform.preserveRects();
+        bounds = s.active.transform.transform(bounds);
+    }
+    // the final crop applies even with the identity transform
+    if (!s.finalCrop.isEmpty()) {
+        bounds.intersect(s.finalCrop, &bounds);
+    }
+    bounds = hwTransform.transform(bounds);
+
+    Rect visible;
+    *outIntersects = bounds.intersect(sourceCrop, &visible);
+    *outCovers = *outIntersects && exact && layer->isOpaque(s) &&
+            s.alpha == 0xFF && visible == sourceCrop;
+}
+
 void SurfaceFlinger::renderScreenImplLocked(
         const sp<const DisplayDevice>& hw,
         Rect sourceCrop, uint32_t reqWidth, uint32_t reqHeight,
@@ -3633,6 +4123,40 @@ void SurfaceFlinger::renderScreenImplLocked(
         ALOGE("Invalid crop rect: b = %d (> %d)", sourceCrop.bottom, hw_h);
     }
 
+    // The culling doesn't handle the flip of the panel mount
+    const bool cullLayers = mCullScreenshotLayers &&
+            hw->getPanelMountFlip() == 0;
+    // Layers outside of the source crop, and the ones below an opaque layer
+    // covering all of it, can't be seen: skip them, which matters for the
+    // small captures of a region or a single window (e.g. thumbnails).
+    const LayerVector& layers( mDrawingState.layersSortedByZ );
+    const size_t count = layers.size();
+    std::vector<bool> drawLayer(count, false);
+    size_t layersDrawn = 0;
+    for (size_t i=count ; i>0 ; --i) {
+        const sp<Layer>& layer(layers[i-1]);
+        const Layer::State& state(layer->getDrawingState());
+        if (state.layerStack != hw->getLayerStack() ||
+                state.z < minLayerZ || state.z > maxLayerZ ||
+                !canDrawLayerinScreenShot(hw, layer)) {
+            continue;
+        }
+        bool intersects = true;
+        bool covers = false;
+        if (cullLayers) {
+            getScreenshotCoverage(hw, layer, sourceCrop,
+                    useIdentityTransform, &intersects, &covers);
+        }
+        if (intersects) {
+            drawLayer[i-1] = true;
+            layersDrawn++;
+        }
+        if (covers) {
+            break;
+        }
+    }
+    mScreenshotLayersDrawn = layersDrawn;
+
     // make sure to clear all GL error flags
     engine.checkErrors();
 
@@ -3655,19 +4179,12 @@ void SurfaceFlinger::renderScreenImplLocked(
     // redraw the screen entirely...
     engine.clearWithColor(0, 0, 0, 1);
 
-    const LayerVector& layers( mDrawingState.layersSortedByZ );
-    const size_t count = layers.size();
     for (size_t i=0 ; i<count ; ++i) {
-        const sp<Layer>& layer(layers[i]);
-        const Layer::State& state(layer->getDrawingState());
-        if (state.layerStack == hw->getLayerStack()) {
-            if (state.z >= minLayerZ && state.z <= maxLayerZ) {
-                if (canDrawLayerinScreenShot(hw,layer)) {
-                    if (filtering) layer->setFiltering(true);
-                    layer->draw(hw, useIdentityTransform);
-                    if (filtering) layer->setFiltering(false);
-                }
-            }
+        if (drawLayer[i]) {
+            const sp<Layer>& layer(layers[i]);
+            if (filtering) layer->setFiltering(true);
+            layer->draw(hw, useIdentityTransform);
+            if (filtering) layer->setFiltering(false);
         }
     }
 
@@ -3677,6 +4194,46 @@ void SurfaceFlinger::renderScreenImplLocked(
 }
 
 
+// Whether a screenshot can be rendered directly in the format. Besides the
+// default RGBA_8888, RGBX_8888 and RGB_565 are used when the GPU can render
+// to them, which is checked once per format by binding a 1x1 buffer as the
+// framebuffer.
+bool SurfaceFlinger::isScreenshotFormat(int format) {
+    switch (format) {
+        case HAL_PIXEL_FORMAT_RGBA_8888:
+            return true;
+        case HAL_PIXEL_FORMAT_RGBX_8888:
+        case HAL_PIXEL_FORMAT_RGB_565:
+            break;
+        default:
+            return false;
+    }
+
+    auto known = mScreenshotFormats.find(format);
+    if (known != mScreenshotFormats.end()) {
+        return known->second;
+    }
+    bool renderable = false;
+    sp<GraphicBuffer> buffer = new GraphicBuffer(1, 1, format,
+            GRALLOC_USAGE_HW_RENDER | GRALLOC_USAGE_HW_TEXTURE);
+    if (buffer->initCheck() == NO_ERROR) {
+        EGLImageKHR image = eglCreateImageKHR(mEGLDisplay, EGL_NO_CONTEXT,
+                EGL_NATIVE_BUFFER_ANDROID, buffer->getNativeBuffer(), NULL);
+        if (image != EGL_NO_IMAGE_KHR) {
+            {
+                RenderEngine::BindImageAsFramebuffer imageBond(
+                        getRenderEngine(), image, false, 1, 1);
+                renderable = imageBond.getStatus() == NO_ERROR;
+            }
+            eglDestroyImageKHR(mEGLDisplay, image);
+        }
+    }
+    ALOGI_IF(!renderable, "screenshots can't be rendered in format %d, "
+            "using RGBA_8888", format);
+    mScreenshotFormats[format] = renderable;
+    return renderable;
+}
+
 status_t SurfaceFlinger::captureScreenImplLocked(
         const sp<const DisplayDevice>& hw,
         const sp<IGraphicBufferProducer>& producer,
@@ -3734,10 +4291,21 @@ status_t SurfaceFlinger::captureScreenImplLocked(
         uint32_t usage = GRALLOC_USAGE_SW_READ_OFTEN | GRALLOC_USAGE_SW_WRITE_OFTEN |
                         GRALLOC_USAGE_HW_RENDER | GRALLOC_USAGE_HW_TEXTURE;
 
+        // Render in the default format of the consumer if the GPU can, e.g.
+        // RGB_565 halves the bandwidth of a thumbnail. glReadPixels() only
+        // reads RGBA_8888.
+        int format = HAL_PIXEL_FORMAT_RGBA_8888;
+        int consumerFormat = 0;
+        if (!useReadPixels && window->query(window, NATIVE_WINDOW_FORMAT,
+                &consumerFormat) == NO_ERROR &&
+                isScreenshotFormat(consumerFormat)) {
+            format = consumerFormat;
+        }
+
         int err = 0;
         err = native_window_set_buffers_dimensions(window, reqWidth, reqHeight);
         err |= native_window_set_scaling_mode(window, NATIVE_WINDOW_SCALING_MODE_SCALE_TO_WINDOW);
-        err |= native_window_set_buffers_format(window, HAL_PIXEL_FORMAT_RGBA_8888);
+        err |= native_window_set_buffers_format(window, format);
         err |= native_window_set_usage(window, usage);
 
         if (err == NO_ERROR) {
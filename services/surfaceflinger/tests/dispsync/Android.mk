@@ -0,0 +1,83 @@
+LOCAL_PATH:= $(call my-dir)
+
+# DispSync, DispSyncModel and DispSyncScheduler aren't exported by
+# libsurfaceflinger, build them in
+SF_PATH := ../..
+
+include $(CLEAR_VARS)
+
+LOCAL_SRC_FILES:= \
+	replay.cpp \
+	VsyncTrace.cpp \
+	$(SF_PATH)/DispSyncModel.cpp
+
+LOCAL_C_INCLUDES := \
+	$(LOCAL_PATH)/$(SF_PATH)
+
+LOCAL_SHARED_LIBRARIES := \
+	libutils
+
+LOCAL_MODULE:= test-dispsync-replay
+
+LOCAL_MODULE_TAGS := tests
+
+include $(BUILD_EXECUTABLE)
+
+# The same tool for the host, to replay traces offline
+include $(CLEAR_VARS)
+
+LOCAL_SRC_FILES:= \
+	replay.cpp \
+	VsyncTrace.cpp \
+	$(SF_PATH)/DispSyncModel.cpp
+
+LOCAL_C_INCLUDES := \
+	$(LOCAL_PATH)/$(SF_PATH)
+
+LOCAL_STATIC_LIBRARIES := \
+	libutils
+
+LOCAL_MODULE:= test-dispsync-replay
+
+LOCAL_MODULE_TAGS := tests
+
+include $(BUILD_HOST_EXECUTABLE)
+
+include $(CLEAR_VARS)
+LOCAL_ADDITIONAL_DEPENDENCIES := $(LOCAL_PATH)/Android.mk
+LOCAL_SRC_FILES := \
+	DispSyncModel_test.cpp \
+	$(SF_PATH)/DispSyncModel.cpp
+LOCAL_C_INCLUDES := \
+	$(LOCAL_PATH)/$(SF_PATH)
+LOCAL_SHARED_LIBRARIES := libutils
+LOCAL_MODULE := DispSyncModel_test
+include $(BUILD_NATIVE_TEST)
+
+include $(CLEAR_VARS)
+LOCAL_ADDITIONAL_DEPENDENCIES := $(LOCAL_PATH)/Android.mk
+LOCAL_SRC_FILES := \
+	DispSync_test.cpp \
+	VsyncTrace.cpp \
+	$(SF_PATH)/DispSync.cpp \
+	$(SF_PATH)/DispSyncModel.cpp \
+	$(SF_PATH)/DispSyncScheduler.cpp
+LOCAL_C_INCLUDES := \
+	$(LOCAL_PATH)/$(SF_PATH)
+# Same flags as libsurfaceflinger, but for RUNNING_WITHOUT_SYNC_FRAMEWORK:
+# the tests need the present fences
+ifeq ($(TARGET_HAS_HH_VSYNC_ISSUE),true)
+    LOCAL_CFLAGS += -DHH_VSYNC_ISSUE
+endif
+ifneq ($(PRESENT_TIME_OFFSET_FROM_VSYNC_NS),)
+    LOCAL_CFLAGS += -DPRESENT_TIME_OFFSET_FROM_VSYNC_NS=$(PRESENT_TIME_OFFSET_FROM_VSYNC_NS)
+else
+    LOCAL_CFLAGS += -DPRESENT_TIME_OFFSET_FROM_VSYNC_NS=0
+endif
+LOCAL_SHARED_LIBRARIES := \
+	libcutils \
+	liblog \
+	libui \
+	libutils
+LOCAL_MODULE := DispSync_test
+include $(BUILD_NATIVE_TEST)
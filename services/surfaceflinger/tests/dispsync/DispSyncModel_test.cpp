@@ -0,0 +1,145 @@
+/*
+ * Copyright (C) 2016 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#define LOG_TAG "DispSyncModelTest"
+
+#include <stdlib.h>
+
+#include <gtest/gtest.h>
+
+#include "DispSyncModel.h"
+
+namespace android {
+
+static const nsecs_t kPeriod60Hz = 16666667;
+static const nsecs_t kPeriod90Hz = 11111111;
+static const nsecs_t kStart = 1000000000;
+
+class DispSyncModelTest : public testing::Test {
+protected:
+    DispSyncModelTest() : mModel(DispSyncModel::ESTIMATOR_ROBUST) {}
+
+    // Adds count samples one period apart, each moved by jitter(i) ns,
+    // and returns the timestamp of the next vsync event.
+    nsecs_t addVsyncs(nsecs_t start, nsecs_t period, size_t count,
+            nsecs_t (*jitter)(size_t) = NULL) {
+        for (size_t i = 0; i < count; i++) {
+            mModel.addSample(start + nsecs_t(i) * period +
+                    (jitter != NULL ? jitter(i) : 0));
+        }
+        return start + nsecs_t(count) * period;
+    }
+
+    DispSyncModel mModel;
+};
+
+// +/- 50 usec, the scheduling noise of a hardware vsync callback
+static nsecs_t smallJitter(size_t i) {
+    static const nsecs_t kJitter[] = { 0, 50000, -30000, 20000, -50000, 40000 };
+    return kJitter[i % (sizeof(kJitter) / sizeof(kJitter[0]))];
+}
+
+TEST_F(DispSyncModelTest, NotValidBeforeEnoughSamples) {
+    addVsyncs(kStart, kPeriod60Hz, DispSyncModel::MIN_SAMPLES_FOR_UPDATE - 1);
+    EXPECT_FALSE(mModel.isValid());
+    EXPECT_TRUE(mModel.addSample(
+            kStart + (DispSyncModel::MIN_SAMPLES_FOR_UPDATE - 1) * kPeriod60Hz));
+    EXPECT_TRUE(mModel.isValid());
+}
+
+TEST_F(DispSyncModelTest, EstimatesExactPeriodAndPhase) {
+    addVsyncs(kStart, kPeriod60Hz, 12);
+    ASSERT_TRUE(mModel.isValid());
+    EXPECT_NEAR(kPeriod60Hz, mModel.getPeriod(), 1);
+    EXPECT_NEAR(0, mModel.getPhase(), 1);
+    EXPECT_EQ(0u, mModel.getOutlierCount());
+    EXPECT_FLOAT_EQ(1.0f, mModel.getConfidence());
+}
+
+TEST_F(DispSyncModelTest, EstimatesPeriodWithJitter) {
+    addVsyncs(kStart, kPeriod60Hz, DispSyncModel::MAX_SAMPLES, smallJitter);
+    ASSERT_TRUE(mModel.isValid());
+    EXPECT_NEAR(kPeriod60Hz, mModel.getPeriod(), 5000);
+    EXPECT_NEAR(0, mModel.getPhase(), 50000);
+    EXPECT_EQ(0u, mModel.getOutlierCount());
+    EXPECT_GT(mModel.getConfidence(), 0.5f);
+}
+
+TEST_F(DispSyncModelTest, EstimatesPhaseOfOffsetGrid) {
+    // The reference time is the first sample; the next ones are late by a
+    // constant 3 ms, as when the first timestamp was taken early
+    mModel.addSample(kStart);
+    addVsyncs(kStart + kPeriod60Hz + 3000000, kPeriod60Hz, 15);
+    ASSERT_TRUE(mModel.isValid());
+    EXPECT_NEAR(kPeriod60Hz, mModel.getPeriod(), 1000);
+    EXPECT_NEAR(3000000, mModel.getPhase(), 10000);
+    EXPECT_EQ(1u, mModel.getOutlierCount());
+}
+
+TEST_F(DispSyncModelTest, RejectsOutlier) {
+    addVsyncs(kStart, kPeriod60Hz, 8);
+    // One sample delivered 4 ms late
+    mModel.addSample(kStart + 8 * kPeriod60Hz + 4000000);
+    addVsyncs(kStart + 9 * kPeriod60Hz, kPeriod60Hz, 8);
+    ASSERT_TRUE(mModel.isValid());
+    EXPECT_EQ(1u, mModel.getOutlierCount());
+    EXPECT_NEAR(kPeriod60Hz, mModel.getPeriod(), 1);
+    EXPECT_NEAR(0, mModel.getPhase(), 1);
+    EXPECT_NEAR(0, mModel.getError(kStart + 20 * kPeriod60Hz), 1);
+}
+
+TEST_F(DispSyncModelTest, RejectsOutliersWithJitter) {
+    addVsyncs(kStart, kPeriod60Hz, 10, smallJitter);
+    mModel.addSample(kStart + 10 * kPeriod60Hz + 3000000);
+    addVsyncs(kStart + 11 * kPeriod60Hz, kPeriod60Hz, 10, smallJitter);
+    mModel.addSample(kStart + 21 * kPeriod60Hz - 2500000);
+    addVsyncs(kStart + 22 * kPeriod60Hz, kPeriod60Hz, 10, smallJitter);
+    ASSERT_TRUE(mModel.isValid());
+    EXPECT_EQ(2u, mModel.getOutlierCount());
+    EXPECT_NEAR(kPeriod60Hz, mModel.getPeriod(), 5000);
+    EXPECT_NEAR(0, mModel.getPhase(), 50000);
+}
+
+TEST_F(DispSyncModelTest, IgnoresMissingSamples) {
+    addVsyncs(kStart, kPeriod60Hz, 8);
+    // Two vsync events without a sample
+    addVsyncs(kStart + 10 * kPeriod60Hz, kPeriod60Hz, 8);
+    ASSERT_TRUE(mModel.isValid());
+    EXPECT_NEAR(kPeriod60Hz, mModel.getPeriod(), 1);
+    EXPECT_NEAR(0, mModel.getPhase(), 1);
+    EXPECT_EQ(0u, mModel.getOutlierCount());
+}
+
+TEST_F(DispSyncModelTest, FollowsRefreshRateChange) {
+    const nsecs_t next = addVsyncs(kStart, kPeriod60Hz, 16);
+    ASSERT_NEAR(kPeriod60Hz, mModel.getPeriod(), 1);
+    addVsyncs(next - kPeriod60Hz + kPeriod90Hz, kPeriod90Hz, 8);
+    ASSERT_TRUE(mModel.isValid());
+    EXPECT_EQ(1u, mModel.getRateChangeCount());
+    EXPECT_NEAR(kPeriod90Hz, mModel.getPeriod(), 1);
+    EXPECT_LT(mModel.getSampleCount(), size_t(DispSyncModel::MAX_SAMPLES));
+}
+
+TEST_F(DispSyncModelTest, ClearSamplesKeepsPeriod) {
+    addVsyncs(kStart, kPeriod60Hz, 12);
+    ASSERT_TRUE(mModel.isValid());
+    mModel.clearSamples();
+    EXPECT_FALSE(mModel.isValid());
+    EXPECT_EQ(0u, mModel.getSampleCount());
+    EXPECT_NEAR(kPeriod60Hz, mModel.getPeriod(), 1);
+}
+
+} // namespace android
@@ -0,0 +1,351 @@
+/*
+ * Copyright (C) 2016 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#define LOG_TAG "DispSyncTest"
+
+// This is needed for stdint.h to define INT64_MAX in C++
+#define __STDC_LIMIT_MACROS
+
+#include <stdint.h>
+#include <stdlib.h>
+
+#include <algorithm>
+#include <map>
+#include <vector>
+
+#include <gtest/gtest.h>
+
+#include <ui/Fence.h>
+
+#include "DispSync.h"
+#include "VsyncTrace.h"
+
+namespace android {
+
+static const nsecs_t kPeriod60Hz = 16666667;
+static const nsecs_t kStart = 1000000000;
+static const nsecs_t kSfPhase = 1000000;
+static const nsecs_t kWakeupLatency = 100000;
+
+// A simulated clock. The fences it makes signal at a given time of it.
+class FakeClock : public DispSync::Clock {
+public:
+    FakeClock() : mNow(0) {}
+
+    virtual nsecs_t now() const { return mNow; }
+
+    virtual nsecs_t getSignalTime(const sp<Fence>& fence) const {
+        std::map<sp<Fence>, nsecs_t>::const_iterator it =
+                mSignalTimes.find(fence);
+        if (it == mSignalTimes.end() || it->second > mNow) {
+            return INT64_MAX;
+        }
+        return it->second;
+    }
+
+    void setNow(nsecs_t now) { mNow = now; }
+
+    sp<Fence> makeFence(nsecs_t signalTime) {
+        sp<Fence> fence = new Fence();
+        mSignalTimes[fence] = signalTime;
+        return fence;
+    }
+
+private:
+    nsecs_t mNow;
+    std::map<sp<Fence>, nsecs_t> mSignalTimes;
+};
+
+// A DispSync listener recording the event times it is called with, and when
+// it was called on the simulated clock.
+class Listener : public DispSync::Callback {
+public:
+    Listener(const FakeClock& clock) : mClock(clock) {}
+
+    virtual void onDispSyncEvent(nsecs_t when) {
+        mEventTimes.push_back(when);
+        mWakeupTimes.push_back(mClock.now());
+    }
+
+    std::vector<nsecs_t> mEventTimes;
+    std::vector<nsecs_t> mWakeupTimes;
+
+private:
+    const FakeClock& mClock;
+};
+
+class DispSyncTest : public testing::Test {
+protected:
+    DispSyncTest() : mDispSync("DispSyncTest", &mClock) {
+        mDispSync.setPeriod(kPeriod60Hz);
+    }
+
+    // Feeds hardware vsyncs one period apart, from start, until DispSync
+    // doesn't need more of them or count were fed. Returns whether it
+    // stopped asking for them, and sets the time of the next vsync.
+    bool resync(nsecs_t* inOutVsync, nsecs_t period, size_t count) {
+        mDispSync.beginResync();
+        for (size_t i = 0; i < count; i++) {
+            mClock.setNow(*inOutVsync);
+            bool needMore = mDispSync.addResyncSample(*inOutVsync);
+            *inOutVsync += period;
+            if (!needMore) {
+                mDispSync.endResync();
+                return true;
+            }
+        }
+        return false;
+    }
+
+    // Adds a present fence signaled at time, returns whether DispSync asks
+    // for a resync.
+    bool present(nsecs_t time) {
+        if (mClock.now() < time) {
+            mClock.setNow(time);
+        }
+        return mDispSync.addPresentFence(mClock.makeFence(time));
+    }
+
+    // Calls dispatchEvents() at every time it asks for until time end, plus
+    // the wakeup latency of the thread, returns the next one.
+    nsecs_t dispatchUntil(nsecs_t next, nsecs_t end) {
+        while (next <= end) {
+            mClock.setNow(next + kWakeupLatency);
+            next = mDispSync.dispatchEvents();
+        }
+        return next;
+    }
+
+    FakeClock mClock;
+    DispSync mDispSync;
+};
+
+TEST_F(DispSyncTest, PresentFencesAskForResyncUntilModelIsUpdated) {
+    nsecs_t vsync = kStart;
+    EXPECT_FALSE(resync(&vsync, kPeriod60Hz,
+            DispSyncModel::MIN_SAMPLES_FOR_UPDATE - 1));
+    // on time, but there is no model to check them against yet
+    for (size_t i = 0; i < 4; i++) {
+        EXPECT_TRUE(present(vsync - PRESENT_TIME_OFFSET_FROM_VSYNC_NS));
+        vsync += kPeriod60Hz;
+    }
+}
+
+TEST_F(DispSyncTest, LocksOnSteadyVsyncs) {
+    nsecs_t vsync = kStart;
+    ASSERT_TRUE(resync(&vsync, kPeriod60Hz, DispSyncModel::MAX_SAMPLES));
+    EXPECT_NEAR(kPeriod60Hz, mDispSync.getPeriod(), 1);
+    for (size_t i = 0; i < 20; i++) {
+        EXPECT_FALSE(present(vsync - PRESENT_TIME_OFFSET_FROM_VSYNC_NS));
+        vsync += kPeriod60Hz;
+    }
+}
+
+TEST_F(DispSyncTest, DriftingPresentsAskForResync) {
+    nsecs_t vsync = kStart;
+    ASSERT_TRUE(resync(&vsync, kPeriod60Hz, DispSyncModel::MAX_SAMPLES));
+    bool needResync = false;
+    for (size_t i = 0; i < 40 && !needResync; i++) {
+        // the display runs 50 usec per frame slower than the model
+        needResync = present(vsync - PRESENT_TIME_OFFSET_FROM_VSYNC_NS +
+                nsecs_t(i) * 50000);
+        vsync += kPeriod60Hz;
+    }
+    EXPECT_TRUE(needResync);
+}
+
+TEST_F(DispSyncTest, SingleLatePresentDoesntAskForResync) {
+    nsecs_t vsync = kStart;
+    ASSERT_TRUE(resync(&vsync, kPeriod60Hz, DispSyncModel::MAX_SAMPLES));
+    for (size_t i = 0; i < 8; i++) {
+        nsecs_t late = (i == 5) ? 3000000 : 0;
+        EXPECT_FALSE(present(vsync - PRESENT_TIME_OFFSET_FROM_VSYNC_NS +
+                late));
+        vsync += kPeriod60Hz;
+    }
+}
+
+TEST_F(DispSyncTest, IgnoresPresentsBeforeReferenceTime) {
+    nsecs_t vsync = kStart;
+    ASSERT_TRUE(resync(&vsync, kPeriod60Hz, DispSyncModel::MAX_SAMPLES));
+    // A fence from before the resync, half a period off the model: it can't
+    // be checked against the model and must not count.
+    mClock.setNow(vsync);
+    EXPECT_FALSE(mDispSync.addPresentFence(
+            mClock.makeFence(kStart - kPeriod60Hz / 2)));
+    EXPECT_FALSE(present(vsync - PRESENT_TIME_OFFSET_FROM_VSYNC_NS));
+}
+
+TEST_F(DispSyncTest, UnsignaledPresentIsCheckedOnceSignaled) {
+    nsecs_t vsync = kStart;
+    ASSERT_TRUE(resync(&vsync, kPeriod60Hz, DispSyncModel::MAX_SAMPLES));
+    mClock.setNow(vsync - kPeriod60Hz / 2);
+    // half a period off the model, signals later
+    EXPECT_FALSE(mDispSync.addPresentFence(
+            mClock.makeFence(vsync + kPeriod60Hz / 2)));
+    mClock.setNow(vsync + kPeriod60Hz);
+    EXPECT_TRUE(mDispSync.addPresentFence(
+            mClock.makeFence(vsync + kPeriod60Hz / 2)));
+}
+
+TEST_F(DispSyncTest, RefreshSkipCountChecksPresentsOnRefreshPeriod) {
+    nsecs_t vsync = kStart;
+    ASSERT_TRUE(resync(&vsync, kPeriod60Hz, DispSyncModel::MAX_SAMPLES));
+    mDispSync.setRefreshSkipCount(1);
+    EXPECT_NEAR(2 * kPeriod60Hz, mDispSync.getPeriod(), 2);
+    // the display still refreshes at 60 Hz, presents can land on any vsync
+    for (size_t i = 0; i < 20; i++) {
+        EXPECT_FALSE(present(vsync - PRESENT_TIME_OFFSET_FROM_VSYNC_NS));
+        vsync += kPeriod60Hz;
+    }
+}
+
+TEST_F(DispSyncTest, CallsListenersAtTheirPhase) {
+    nsecs_t vsync = kStart;
+    ASSERT_TRUE(resync(&vsync, kPeriod60Hz, DispSyncModel::MAX_SAMPLES));
+    sp<Listener> sf = new Listener(mClock);
+    ASSERT_EQ(NO_ERROR, mDispSync.addEventListener("sf", kSfPhase, sf));
+    nsecs_t start = mClock.now();
+    nsecs_t next = dispatchUntil(start, start + 60 * kPeriod60Hz);
+
+    // The events are scheduled earlier by the wakeup latency DispSync has
+    // measured, so that the wakeups get closer to vsync + phase.
+    ASSERT_GE(sf->mEventTimes.size(), 59u);
+    EXPECT_LE(sf->mEventTimes.size(), 61u);
+    nsecs_t firstLateness = 0;
+    nsecs_t lastLateness = 0;
+    for (size_t i = 0; i < sf->mEventTimes.size(); i++) {
+        nsecs_t t = sf->mEventTimes[i] - kSfPhase - kStart;
+        nsecs_t target = (t + kPeriod60Hz / 2) / kPeriod60Hz * kPeriod60Hz +
+                kSfPhase + kStart;
+        EXPECT_LE(sf->mEventTimes[i], target + 10) << "event " << i;
+        EXPECT_GE(sf->mEventTimes[i], target - kWakeupLatency) << "event " << i;
+        lastLateness = sf->mWakeupTimes[i] - target;
+        EXPECT_GE(lastLateness, -10) << "event " << i;
+        EXPECT_LE(lastLateness, kWakeupLatency + 10) << "event " << i;
+        if (i == 0) {
+            firstLateness = lastLateness;
+        }
+    }
+    EXPECT_LT(lastLateness, firstLateness / 2);
+
+    ASSERT_EQ(NO_ERROR, mDispSync.removeEventListener(sf));
+    size_t count = sf->mEventTimes.size();
+    dispatchUntil(next, next + 10 * kPeriod60Hz);
+    EXPECT_EQ(count, sf->mEventTimes.size());
+}
+
+TEST_F(DispSyncTest, RemovingUnknownListenerFails) {
+    sp<Listener> sf = new Listener(mClock);
+    EXPECT_EQ(BAD_VALUE, mDispSync.removeEventListener(sf));
+}
+
+// Runs the synthetic trace of VsyncTrace.h through DispSync the way
+// SurfaceFlinger drives it: hardware vsync is turned on when a present fence
+// asks for a resync and off once the model is locked.
+TEST_F(DispSyncTest, FollowsSyntheticTrace) {
+    std::vector<VsyncTraceEvent> events;
+    makeSyntheticVsyncTrace(&events);
+
+    sp<Listener> sf = new Listener(mClock);
+    ASSERT_EQ(NO_ERROR, mDispSync.addEventListener("sf", kSfPhase, sf));
+
+    bool hwVsyncEnabled = false;
+    size_t resyncs = 0;
+    size_t vsyncs = 0;
+    size_t vsyncsEnabled = 0;
+    nsecs_t next = INT64_MAX;
+    for (size_t i = 0; i < events.size(); i++) {
+        const VsyncTraceEvent& event(events[i]);
+        if (event.type == VsyncTraceEvent::VSYNC ||
+                event.type == VsyncTraceEvent::PRESENT) {
+            next = dispatchUntil(next, event.time);
+            mClock.setNow(std::max(mClock.now(), event.time));
+        }
+        switch (event.type) {
+            case VsyncTraceEvent::PERIOD:
+                mDispSync.setPeriod(event.time);
+                break;
+            case VsyncTraceEvent::RESYNC:
+                mDispSync.beginResync();
+                hwVsyncEnabled = true;
+                break;
+            case VsyncTraceEvent::VSYNC:
+                vsyncs++;
+                if (hwVsyncEnabled) {
+                    vsyncsEnabled++;
+                    if (!mDispSync.addResyncSample(event.time)) {
+                        mDispSync.endResync();
+                        hwVsyncEnabled = false;
+                    }
+                }
+                break;
+            case VsyncTraceEvent::PRESENT:
+                // the trace has the vsync times of the presents
+                if (mDispSync.addPresentFence(mClock.makeFence(event.time -
+                        PRESENT_TIME_OFFSET_FROM_VSYNC_NS)) &&
+                        !hwVsyncEnabled) {
+                    mDispSync.beginResync();
+                    hwVsyncEnabled = true;
+                    resyncs++;
+                }
+                break;
+        }
+        // the model may have changed, which wakes up the thread
+        next = mDispSync.dispatchEvents();
+    }
+
+    // Hardware vsync stays off most of the time, and a resync happens
+    // when the refresh rate changes.
+    EXPECT_GE(resyncs, 1u);
+    EXPECT_LT(vsyncsEnabled * 5, vsyncs);
+
+    // The sf events follow the hardware vsyncs: one per refresh, each at
+    // the phase offset from a vsync, give or take the jitter of the trace
+    // and the frames around a rate change.
+    size_t onTime = 0;
+    size_t j = 0;
+    nsecs_t firstVsync = INT64_MAX;
+    for (size_t i = 0; i < events.size(); i++) {
+        if (events[i].type != VsyncTraceEvent::VSYNC) {
+            continue;
+        }
+        firstVsync = std::min(firstVsync, events[i].time);
+        nsecs_t target = events[i].time + kSfPhase;
+        while (j < sf->mEventTimes.size() &&
+                sf->mEventTimes[j] < target - 1000000) {
+            j++;
+        }
+        if (j < sf->mEventTimes.size() &&
+                sf->mEventTimes[j] <= target + 1000000) {
+            onTime++;
+        }
+    }
+    EXPECT_GT(onTime * 100, vsyncs * 95);
+
+    // before the first vsync, the events follow the period DispSync was
+    // primed with
+    size_t traceEvents = 0;
+    for (size_t i = 0; i < sf->mEventTimes.size(); i++) {
+        if (sf->mEventTimes[i] >= firstVsync) {
+            traceEvents++;
+        }
+    }
+    EXPECT_LE(traceEvents, vsyncs);
+    EXPECT_GT(traceEvents * 100, vsyncs * 99);
+}
+
+}
@@ -0,0 +1,96 @@
+/*
+ * Copyright (C) 2016 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include <errno.h>
+#include <inttypes.h>
+#include <stdio.h>
+#include <string.h>
+
+#include <random>
+
+#include "VsyncTrace.h"
+
+namespace android {
+
+bool readVsyncTrace(const char* path, std::vector<VsyncTraceEvent>* outEvents) {
+    FILE* file = fopen(path, "r");
+    if (file == NULL) {
+        fprintf(stderr, "can't open %s: %s\n", path, strerror(errno));
+        return false;
+    }
+    char line[256];
+    size_t lineNumber = 0;
+    while (fgets(line, sizeof(line), file) != NULL) {
+        lineNumber++;
+        char name[16];
+        int64_t time = 0;
+        if (line[0] == '#' || sscanf(line, "%15s", name) != 1) {
+            continue;
+        }
+        VsyncTraceEvent event;
+        if (!strcmp(name, "resync")) {
+            event.type = VsyncTraceEvent::RESYNC;
+        } else if (sscanf(line, "%15s %" SCNd64, name, &time) != 2) {
+            fprintf(stderr, "%s:%zu: missing timestamp\n", path, lineNumber);
+            fclose(file);
+            return false;
+        } else if (!strcmp(name, "period")) {
+            event.type = VsyncTraceEvent::PERIOD;
+        } else if (!strcmp(name, "vsync")) {
+            event.type = VsyncTraceEvent::VSYNC;
+        } else if (!strcmp(name, "present")) {
+            event.type = VsyncTraceEvent::PRESENT;
+        } else {
+            fprintf(stderr, "%s:%zu: unknown event '%s'\n", path, lineNumber, name);
+            fclose(file);
+            return false;
+        }
+        event.time = time;
+        outEvents->push_back(event);
+    }
+    fclose(file);
+    return true;
+}
+
+void makeSyntheticVsyncTrace(std::vector<VsyncTraceEvent>* outEvents) {
+    std::mt19937 random(1);
+    std::normal_distribution<double> jitter(0, 50000);
+    std::uniform_real_distribution<double> uniform(0, 1);
+
+    const nsecs_t periods[] = { 16666667, 11111111 };
+    const size_t vsyncsPerPeriod = 600;
+    nsecs_t vsync = 1000000000;
+    outEvents->push_back({ VsyncTraceEvent::PERIOD, periods[0] });
+    outEvents->push_back({ VsyncTraceEvent::RESYNC, 0 });
+    for (nsecs_t period : periods) {
+        for (size_t i = 0; i < vsyncsPerPeriod; i++) {
+            vsync += period;
+            nsecs_t sample = vsync + nsecs_t(jitter(random));
+            if (uniform(random) < 0.02) {
+                // a late vsync interrupt
+                sample += nsecs_t(uniform(random) * 3000000);
+            }
+            outEvents->push_back({ VsyncTraceEvent::VSYNC, sample });
+            // present every other frame
+            if (i % 2) {
+                outEvents->push_back({ VsyncTraceEvent::PRESENT,
+                        vsync + nsecs_t(jitter(random) / 5) });
+            }
+        }
+    }
+}
+
+}
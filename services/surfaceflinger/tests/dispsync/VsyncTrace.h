@@ -0,0 +1,50 @@
+/*
+ * Copyright (C) 2016 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef ANDROID_VSYNC_TRACE_H
+#define ANDROID_VSYNC_TRACE_H
+
+#include <vector>
+
+#include <utils/Timers.h>
+
+namespace android {
+
+/*
+ * A vsync trace has one event per line, timestamps are in nanoseconds:
+ *   period <ns>    DispSync::setPeriod()
+ *   resync         DispSync::beginResync()
+ *   vsync <ns>     hardware vsync event (DispSync::addResyncSample())
+ *   present <ns>   present fence signal time
+ * Lines starting with '#' are ignored. The hardware vsync timestamps can be
+ * taken from the mResyncSamples of 'dumpsys SurfaceFlinger --dispsync', or
+ * from the HW_VSYNC events of a systrace.
+ */
+struct VsyncTraceEvent {
+    enum Type { PERIOD, RESYNC, VSYNC, PRESENT };
+    Type type;
+    nsecs_t time;
+};
+
+bool readVsyncTrace(const char* path, std::vector<VsyncTraceEvent>* outEvents);
+
+// 60 Hz with 50 usec of jitter and 2% of late samples, switching to 90 Hz
+// half way, with a present fence every other frame.
+void makeSyntheticVsyncTrace(std::vector<VsyncTraceEvent>* outEvents);
+
+}
+
+#endif // ANDROID_VSYNC_TRACE_H
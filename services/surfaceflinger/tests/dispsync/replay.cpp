@@ -0,0 +1,146 @@
+/*
+ * Copyright (C) 2016 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+/*
+ * Replays a vsync trace through each DispSyncModel estimator and compares
+ * how well they predict the hardware vsync events and the present fences.
+ *
+ * usage: test-dispsync-replay [trace]
+ *
+ * See VsyncTrace.h for the trace format.
+ *
+ * Without a trace, a synthetic one is replayed: 60 Hz with 50 usec of jitter
+ * and 2% of late samples, switching to 90 Hz half way.
+ */
+
+#include <inttypes.h>
+#include <math.h>
+#include <stdio.h>
+#include <stdlib.h>
+
+#include <algorithm>
+#include <vector>
+
+#include "DispSyncModel.h"
+#include "VsyncTrace.h"
+
+using namespace android;
+
+// Same as DispSync: mean squared error of the last NUM_PRESENT_SAMPLES
+// present times against the model, above which a resync is needed.
+static const size_t NUM_PRESENT_SAMPLES = 8;
+static const nsecs_t kErrorThreshold = 160000000000;    // 400 usec squared
+
+struct Stats {
+    Stats() : samples(0), updates(0), outliers(0), resyncRequests(0),
+            confidenceSum(0) {}
+    size_t samples;
+    size_t updates;
+    std::vector<nsecs_t> predictionErrors;
+    size_t outliers;
+    size_t resyncRequests;
+    double confidenceSum;
+};
+
+static void replay(const std::vector<VsyncTraceEvent>& events,
+        DispSyncModel::Estimator estimator) {
+    DispSyncModel model(estimator);
+    Stats stats;
+    nsecs_t presentTimes[NUM_PRESENT_SAMPLES] = {};
+    size_t presentOffset = 0;
+    size_t presentCount = 0;
+
+    for (const VsyncTraceEvent& event : events) {
+        switch (event.type) {
+            case VsyncTraceEvent::PERIOD:
+                model.setPeriod(event.time);
+                break;
+            case VsyncTraceEvent::RESYNC:
+                model.clearSamples();
+                break;
+            case VsyncTraceEvent::VSYNC:
+                // How far the event is from the model before it sees it
+                if (model.isValid()) {
+                    stats.predictionErrors.push_back(
+                            llabs(model.getError(event.time)));
+                }
+                stats.samples++;
+                if (model.addSample(event.time)) {
+                    stats.updates++;
+                    stats.outliers += model.getOutlierCount();
+                    stats.confidenceSum += model.getConfidence();
+                }
+                break;
+            case VsyncTraceEvent::PRESENT: {
+                presentTimes[presentOffset] = event.time;
+                presentOffset = (presentOffset + 1) % NUM_PRESENT_SAMPLES;
+                presentCount = std::min(presentCount + 1, NUM_PRESENT_SAMPLES);
+                if (!model.isValid()) {
+                    break;
+                }
+                nsecs_t sqErrSum = 0;
+                for (size_t i = 0; i < presentCount; i++) {
+                    nsecs_t error = model.getError(presentTimes[i]);
+                    sqErrSum += error * error;
+                }
+                if (sqErrSum / nsecs_t(presentCount) > kErrorThreshold) {
+                    stats.resyncRequests++;
+                }
+                break;
+            }
+        }
+    }
+
+    std::vector<nsecs_t>& errors(stats.predictionErrors);
+    std::sort(errors.begin(), errors.end());
+    double meanError = 0;
+    for (nsecs_t error : errors) {
+        meanError += double(error);
+    }
+    meanError = errors.empty() ? 0 : meanError / errors.size();
+    nsecs_t p95 = errors.empty() ? 0 : errors[errors.size() * 95 / 100];
+    nsecs_t maxError = errors.empty() ? 0 : errors.back();
+
+    printf("%s estimator\n", DispSyncModel::getEstimatorName(estimator));
+    printf("  vsync samples        : %zu (%zu model updates)\n",
+            stats.samples, stats.updates);
+    printf("  prediction error     : mean %.1f us, p95 %.1f us, max %.1f us\n",
+            meanError / 1000.0, p95 / 1000.0, maxError / 1000.0);
+    printf("  present error > thr  : %zu times\n", stats.resyncRequests);
+    printf("  outliers rejected    : %zu (summed over the updates)\n",
+            stats.outliers);
+    printf("  rate changes         : %u\n", model.getRateChangeCount());
+    printf("  mean confidence      : %.2f\n", stats.updates ?
+            stats.confidenceSum / stats.updates : 0.0);
+    printf("  final period         : %" PRId64 " ns (%.3f Hz)\n",
+            model.getPeriod(), model.getPeriod() ?
+            1000000000.0 / model.getPeriod() : 0.0);
+}
+
+int main(int argc, char** argv) {
+    std::vector<VsyncTraceEvent> events;
+    if (argc > 1) {
+        if (!readVsyncTrace(argv[1], &events)) {
+            return 1;
+        }
+    } else {
+        makeSyntheticVsyncTrace(&events);
+    }
+
+    replay(events, DispSyncModel::ESTIMATOR_AVERAGE);
+    replay(events, DispSyncModel::ESTIMATOR_ROBUST);
+    return 0;
+}
@@ -0,0 +1,21 @@
+LOCAL_PATH:= $(call my-dir)
+
+# PlanePredictor is only built with HWC2, and isn't exported by
+# libsurfaceflinger, build it in
+ifeq ($(TARGET_USES_HWC2),true)
+SF_PATH := ../..
+
+include $(CLEAR_VARS)
+LOCAL_ADDITIONAL_DEPENDENCIES := $(LOCAL_PATH)/Android.mk
+LOCAL_SRC_FILES := \
+	PlanePredictor_test.cpp \
+	$(SF_PATH)/PlanePredictor.cpp
+LOCAL_C_INCLUDES := \
+	$(LOCAL_PATH)/$(SF_PATH)
+LOCAL_CFLAGS := -DUSE_HWC2
+LOCAL_SHARED_LIBRARIES := \
+	libcutils \
+	libutils
+LOCAL_MODULE := PlanePredictor_test
+include $(BUILD_NATIVE_TEST)
+endif
@@ -0,0 +1,160 @@
+/*
+ * Copyright 2016 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#define LOG_TAG "PlanePredictorTest"
+
+#include <vector>
+
+#include <gtest/gtest.h>
+
+#include "PlanePredictor.h"
+
+namespace android {
+
+using HWC2::Composition;
+
+static const int32_t kPrimary = 0;
+static const int32_t kVirtual = 2;
+static const uint64_t kConfiguration = 0x1234;
+
+class PlanePredictorTest : public testing::Test {
+protected:
+    PlanePredictorTest() : mRequested({ Composition::Device,
+            Composition::Device, Composition::Device, Composition::Client }) {}
+
+    // One frame of the configuration on the display: SurfaceFlinger asks for
+    // mRequested, and HWC moves the layers in hwcRejects to client
+    // composition. Returns the types predict() sent to HWC.
+    std::vector<Composition> frame(int32_t hwcId, uint64_t configuration,
+            const std::vector<size_t>& hwcRejects) {
+        std::vector<Composition> types(mRequested);
+        mPredictor.predict(hwcId, configuration, &types);
+        std::vector<Composition> sent(types);
+        for (size_t i : hwcRejects) {
+            types[i] = Composition::Client;
+        }
+        mPredictor.onValidated(hwcId, types);
+        return sent;
+    }
+
+    PlanePredictor mPredictor;
+    std::vector<Composition> mRequested;
+};
+
+TEST_F(PlanePredictorTest, NoPredictionForNewConfiguration) {
+    std::vector<Composition> types(mRequested);
+    EXPECT_FALSE(mPredictor.predict(kPrimary, kConfiguration, &types));
+    EXPECT_EQ(mRequested, types);
+}
+
+TEST_F(PlanePredictorTest, PredictsRejectedLayers) {
+    frame(kPrimary, kConfiguration, { 1 });
+
+    std::vector<Composition> types(mRequested);
+    EXPECT_TRUE(mPredictor.predict(kPrimary, kConfiguration, &types));
+    EXPECT_EQ(Composition::Device, types[0]);
+    EXPECT_EQ(Composition::Client, types[1]);
+    EXPECT_EQ(Composition::Device, types[2]);
+    EXPECT_EQ(Composition::Client, types[3]);
+}
+
+TEST_F(PlanePredictorTest, NoPredictionWhenHwcTakesAllLayers) {
+    frame(kPrimary, kConfiguration, {});
+
+    std::vector<Composition> types(mRequested);
+    EXPECT_FALSE(mPredictor.predict(kPrimary, kConfiguration, &types));
+    EXPECT_EQ(mRequested, types);
+}
+
+TEST_F(PlanePredictorTest, PredictionsArePerConfiguration) {
+    frame(kPrimary, kConfiguration, { 0 });
+
+    std::vector<Composition> types(mRequested);
+    EXPECT_FALSE(mPredictor.predict(kPrimary, kConfiguration + 1, &types));
+    EXPECT_EQ(mRequested, types);
+}
+
+TEST_F(PlanePredictorTest, PredictionsArePerDisplay) {
+    frame(kPrimary, kConfiguration, { 0 });
+
+    std::vector<Composition> types(mRequested);
+    EXPECT_FALSE(mPredictor.predict(kVirtual, kConfiguration, &types));
+    EXPECT_EQ(mRequested, types);
+}
+
+TEST_F(PlanePredictorTest, RechecksPredictions) {
+    frame(kPrimary, kConfiguration, { 2 });
+    for (size_t i = 1; i < PlanePredictor::RECHECK_INTERVAL; i++) {
+        EXPECT_EQ(Composition::Client, frame(kPrimary, kConfiguration, {})[2]);
+    }
+
+    // HWC gets to see the layer again, and takes it
+    EXPECT_EQ(Composition::Device, frame(kPrimary, kConfiguration, {})[2]);
+    std::vector<Composition> types(mRequested);
+    EXPECT_FALSE(mPredictor.predict(kPrimary, kConfiguration, &types));
+}
+
+TEST_F(PlanePredictorTest, ClearForgetsPredictions) {
+    frame(kPrimary, kConfiguration, { 0 });
+    frame(kVirtual, kConfiguration, { 0 });
+    mPredictor.clear(kPrimary);
+
+    std::vector<Composition> types(mRequested);
+    EXPECT_FALSE(mPredictor.predict(kPrimary, kConfiguration, &types));
+    types = mRequested;
+    EXPECT_TRUE(mPredictor.predict(kVirtual, kConfiguration, &types));
+}
+
+TEST_F(PlanePredictorTest, RemovedDisplayIdStartsOver) {
+    frame(kVirtual, kConfiguration, { 0 });
+    mPredictor.removeDisplay(kVirtual);
+
+    // The next virtual display reuses the hwc id
+    std::vector<Composition> types(mRequested);
+    EXPECT_FALSE(mPredictor.predict(kVirtual, kConfiguration, &types));
+    EXPECT_EQ(mRequested, types);
+    mPredictor.onValidated(kVirtual, types);
+}
+
+TEST_F(PlanePredictorTest, ValidateWithoutPredictIsIgnored) {
+    mPredictor.onValidated(kPrimary, mRequested);
+
+    std::vector<Composition> types(mRequested);
+    EXPECT_FALSE(mPredictor.predict(kPrimary, kConfiguration, &types));
+}
+
+TEST_F(PlanePredictorTest, EvictsLeastRecentlyUsed) {
+    for (uint64_t c = 0; c <= PlanePredictor::MAX_PREDICTIONS; c++) {
+        frame(kPrimary, kConfiguration + c, { 0 });
+    }
+
+    std::vector<Composition> types(mRequested);
+    EXPECT_FALSE(mPredictor.predict(kPrimary, kConfiguration, &types));
+    types = mRequested;
+    EXPECT_TRUE(mPredictor.predict(kPrimary,
+            kConfiguration + PlanePredictor::MAX_PREDICTIONS, &types));
+}
+
+TEST_F(PlanePredictorTest, DisabledPredictsNothing) {
+    frame(kPrimary, kConfiguration, { 0 });
+    mPredictor.setEnabled(false);
+
+    std::vector<Composition> types(mRequested);
+    EXPECT_FALSE(mPredictor.predict(kPrimary, kConfiguration, &types));
+    EXPECT_EQ(mRequested, types);
+}
+
+} // namespace android
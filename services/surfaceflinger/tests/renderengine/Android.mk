@@ -0,0 +1,44 @@
+LOCAL_PATH:= $(call my-dir)
+include $(CLEAR_VARS)
+
+# RenderEngine isn't exported by libsurfaceflinger, build it in
+SF_PATH := ../..
+
+LOCAL_SRC_FILES:= \
+	batching.cpp \
+	$(SF_PATH)/Transform.cpp \
+	$(SF_PATH)/RenderEngine/Description.cpp \
+	$(SF_PATH)/RenderEngine/Mesh.cpp \
+	$(SF_PATH)/RenderEngine/Program.cpp \
+	$(SF_PATH)/RenderEngine/ProgramCache.cpp \
+	$(SF_PATH)/RenderEngine/GLExtensions.cpp \
+	$(SF_PATH)/RenderEngine/RenderEngine.cpp \
+	$(SF_PATH)/RenderEngine/Texture.cpp \
+	$(SF_PATH)/RenderEngine/GLES10RenderEngine.cpp \
+	$(SF_PATH)/RenderEngine/GLES11RenderEngine.cpp \
+	$(SF_PATH)/RenderEngine/GLES20RenderEngine.cpp
+
+LOCAL_C_INCLUDES := \
+	$(LOCAL_PATH)/$(SF_PATH)
+
+LOCAL_CFLAGS := -DLOG_TAG=\"RenderEngineBatching\"
+LOCAL_CFLAGS += -DGL_GLEXT_PROTOTYPES -DEGL_EGLEXT_PROTOTYPES
+
+ifeq ($(TARGET_USES_HWC2),true)
+    LOCAL_CFLAGS += -DUSE_HWC2
+endif
+
+LOCAL_SHARED_LIBRARIES := \
+	libcutils \
+	liblog \
+	libutils \
+	libui \
+	libEGL \
+	libGLESv1_CM \
+	libGLESv2
+
+LOCAL_MODULE:= test-renderengine-batching
+
+LOCAL_MODULE_TAGS := tests
+
+include $(BUILD_EXECUTABLE)
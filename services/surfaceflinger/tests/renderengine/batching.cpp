@@ -0,0 +1,162 @@
+/*
+ * Copyright (C) 2016 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+/*
+ * Composition micro-benchmark: draws a grid of textured layers the way
+ * SurfaceFlinger composes client layers, once issuing every draw directly
+ * and once with GLES20RenderEngine batching them. Every layer has its own
+ * texture, and opaque and translucent layers alternate so that the two
+ * programs used are interleaved.
+ *
+ * usage: test-renderengine-batching [layers [frames]]
+ */
+
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+
+#include <EGL/egl.h>
+#include <GLES2/gl2.h>
+
+#include <system/graphics.h>
+#include <ui/Rect.h>
+#include <utils/String8.h>
+#include <utils/Timers.h>
+
+#include "RenderEngine/RenderEngine.h"
+#include "RenderEngine/Mesh.h"
+#include "RenderEngine/Texture.h"
+
+using namespace android;
+
+static const uint32_t WIDTH = 1024;
+static const uint32_t HEIGHT = 1024;
+
+static void drawFrame(RenderEngine& engine, const uint32_t* textures,
+        size_t layerCount, bool batch) {
+    size_t columns = 1;
+    while (columns * columns < layerCount) {
+        columns++;
+    }
+    const float size = float(WIDTH) / columns;
+
+    engine.clearWithColor(0, 0, 0, 0);
+    engine.setBatching(batch);
+    Mesh mesh(Mesh::TRIANGLE_FAN, 4, 2, 2);
+    Mesh::VertexArray<vec2> position(mesh.getPositionArray<vec2>());
+    Mesh::VertexArray<vec2> texCoords(mesh.getTexCoordArray<vec2>());
+    texCoords[0] = vec2(0, 0);
+    texCoords[1] = vec2(0, 1);
+    texCoords[2] = vec2(1, 1);
+    texCoords[3] = vec2(1, 0);
+    for (size_t i = 0; i < layerCount; i++) {
+        const float left = (i % columns) * size;
+        const float top = (i / columns) * size;
+        position[0] = vec2(left, top);
+        position[1] = vec2(left, top + size);
+        position[2] = vec2(left + size, top + size);
+        position[3] = vec2(left + size, top);
+
+        Texture texture(Texture::TEXTURE_2D, textures[i]);
+        texture.setDimensions(16, 16);
+        const bool opaque = i % 2 == 0;
+#ifdef USE_HWC2
+        engine.setupLayerBlending(true, opaque, opaque ? 1.0f : 0.5f);
+#else
+        engine.setupLayerBlending(true, opaque, opaque ? 0xFF : 0x80);
+#endif
+        engine.setupLayerTexturing(texture);
+        engine.drawMesh(mesh);
+    }
+    engine.disableTexturing();
+    engine.disableBlending();
+    engine.setBatching(false);
+
+    // wait for the GPU
+    uint32_t pixel;
+    engine.readPixels(0, 0, 1, 1, &pixel);
+}
+
+static double runFrames(RenderEngine& engine, const uint32_t* textures,
+        size_t layerCount, size_t frameCount, bool batch) {
+    // warm-up: shaders and texture uploads
+    drawFrame(engine, textures, layerCount, batch);
+    const nsecs_t start = systemTime();
+    for (size_t i = 0; i < frameCount; i++) {
+        drawFrame(engine, textures, layerCount, batch);
+    }
+    return double(systemTime() - start) / frameCount / 1000000.0;
+}
+
+int main(int argc, char** argv) {
+    const size_t layerCount = argc > 1 ? size_t(atoi(argv[1])) : 64;
+    const size_t frameCount = argc > 2 ? size_t(atoi(argv[2])) : 500;
+    if (layerCount == 0 || frameCount == 0) {
+        fprintf(stderr, "usage: %s [layers [frames]]\n", argv[0]);
+        return 1;
+    }
+
+    EGLDisplay display = eglGetDisplay(EGL_DEFAULT_DISPLAY);
+    eglInitialize(display, NULL, NULL);
+    RenderEngine* engine = RenderEngine::create(display,
+            HAL_PIXEL_FORMAT_RGBA_8888);
+    EGLConfig config = engine->getEGLConfig();
+    if (config == EGL_NO_CONFIG) {
+        config = RenderEngine::chooseEglConfig(display,
+                HAL_PIXEL_FORMAT_RGBA_8888);
+    }
+    const EGLint attribs[] = {
+            EGL_WIDTH, EGLint(WIDTH), EGL_HEIGHT, EGLint(HEIGHT), EGL_NONE };
+    EGLSurface surface = eglCreatePbufferSurface(display, config, attribs);
+    if (surface == EGL_NO_SURFACE ||
+            !eglMakeCurrent(display, surface, surface, engine->getEGLContext())) {
+        fprintf(stderr, "can't make a %ux%u pbuffer current\n", WIDTH, HEIGHT);
+        return 1;
+    }
+    engine->setViewportAndProjection(WIDTH, HEIGHT, Rect(WIDTH, HEIGHT),
+            HEIGHT, false, Transform::ROT_0);
+
+    uint32_t* textures = new uint32_t[layerCount];
+    engine->genTextures(layerCount, textures);
+    uint32_t pixels[16 * 16];
+    for (size_t i = 0; i < layerCount; i++) {
+        for (size_t p = 0; p < 16 * 16; p++) {
+            pixels[p] = 0xFF000000 | uint32_t(i * 0x3F1F0F);
+        }
+        glBindTexture(GL_TEXTURE_2D, textures[i]);
+        glTexImage2D(GL_TEXTURE_2D, 0, GL_RGBA, 16, 16, 0, GL_RGBA,
+                GL_UNSIGNED_BYTE, pixels);
+    }
+
+    const double direct = runFrames(*engine, textures, layerCount,
+            frameCount, false);
+    const double batched = runFrames(*engine, textures, layerCount,
+            frameCount, true);
+
+    String8 stats;
+    engine->dump(stats);
+    printf("%zu layers, %zu frames\n", layerCount, frameCount);
+    printf("direct : %.3f ms/frame\n", direct);
+    printf("batched: %.3f ms/frame\n", batched);
+    printf("%s", stats.string());
+
+    engine->deleteTextures(layerCount, textures);
+    delete [] textures;
+    eglMakeCurrent(display, EGL_NO_SURFACE, EGL_NO_SURFACE, EGL_NO_CONTEXT);
+    eglDestroySurface(display, surface);
+    eglTerminate(display);
+    return 0;
+}
@@ -32,7 +32,8 @@ int receiver(int fd, int events, void* data)
     while ((n = q->getEvents(buffer, 1)) > 0) {
         for (int i=0 ; i<n ; i++) {
             if (buffer[i].header.type == DisplayEventReceiver::DISPLAY_EVENT_VSYNC) {
-                printf("event vsync: count=%d\t", buffer[i].vsync.count);
+                printf("event vsync: count=%d missed=%d\t",
+                        buffer[i].vsync.count, buffer[i].vsync.missed);
             }
             if (oldTimeStamp) {
                 float t = float(buffer[i].header.timestamp - oldTimeStamp) / s2ns(1);
@@ -57,6 +58,7 @@ int main(int argc, char** argv)
             &myDisplayEvent);
 
     myDisplayEvent.setVsyncRate(1);
+    myDisplayEvent.setVsyncCoalescing(argc > 1 && !strcmp(argv[1], "-c"));
 
     do {
         //printf("about to poll...\n");